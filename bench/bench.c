@@ -0,0 +1,603 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../sanitize.h"
+#include "../quizdb.h"
+#include "../cfg.h"
+#include "../outq.h"
+#include "../metrics.h"
+#include "../ircmsg.h"
+#ifdef IRC_NATIVE
+#include "../ircnative.h"
+#endif
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+/*
+   Microbenchmarks for the hot paths of the bots.
+
+   Every input is generated from a fixed seed, so two runs on the same
+   machine measure the same work. Each benchmark is timed BENCH_REPEATS
+   times and the fastest run is reported, as "name ns_per_op ops" lines.
+
+   With -c <baseline> the results are compared against a previous run's
+   output instead, and the exit status is 1 if anything got slower by more
+   than the tolerance (-t, in percent).
+*/
+
+#define BENCH_REPEATS		10
+#define DEFAULT_TOLERANCE	20.0
+
+#define NUM_LINES		4096
+#define NUM_QUESTIONS		50000
+#define NUM_CATEGORIES		50
+#define NUM_WORDS		4000
+#define NUM_SESSIONS		12
+#define NUM_PACKED		3
+
+struct bench {
+	const char *name;
+	unsigned long ops;
+	void (*run) (unsigned long ops);
+};
+
+struct result {
+	char name[64];
+	double ns;
+};
+
+static uint64_t rng_state = 42;
+
+//xorshift64*, so the inputs don't depend on the libc's rand
+static uint32_t rng (void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (uint32_t) ((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+static char *lines[NUM_LINES];
+static size_t line_lens[NUM_LINES];
+static char *raw_lines[NUM_LINES];
+static size_t raw_lens[NUM_LINES];
+static char *words[NUM_WORDS];
+static char *questions[NUM_QUESTIONS];
+static char *exact_queries[NUM_LINES];
+static char *fuzzy_queries[NUM_LINES];
+static struct quizdb *db;
+//The same questions packed with 16, 64 and 256 answers per block
+static const unsigned int pack_blocks[NUM_PACKED] = { 16, 64, 256 };
+static struct quizdb *packed[NUM_PACKED];
+static long packed_size[NUM_PACKED + 1];	//The plain compiled file last
+static char cfg_path[64];
+static volatile size_t sink;
+
+static unsigned long long now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void make_words (void)
+{
+	static const char *syllables[] = {
+		"ka", "lo", "mi", "ne", "ru", "sa", "to", "vi", "el", "an", "or", "is",
+		"ber", "con", "dra", "fen", "gal", "hom", "jin", "pol", "ster", "tri", "wen", "zor"
+	};
+	char buf[32];
+	int n;
+	int i;
+	int k;
+
+	for (i = 0; i < NUM_WORDS; i++)
+	{
+		buf[0] = '\0';
+		n = 1 + rng () % 4;
+		for (k = 0; k < n; k++)
+			strcat (buf, syllables[rng () % (sizeof(syllables) / sizeof(syllables[0]))]);
+		words[i] = strdup (buf);
+	}
+}
+
+//Word frequencies are skewed, like in real questions
+static const char *pick_word (void)
+{
+	uint32_t r = rng () % NUM_WORDS;
+
+	return words[(r * (uint64_t) r) / NUM_WORDS];
+}
+
+//Channel lines as the sanitizer sees them, a quarter with colour codes and UTF-8
+static void make_lines (void)
+{
+	static const char *extras[] = {
+		"\x02" "bold" "\x02", "\x03" "04,01red" "\x03", "caf\xc3\xa9", "no\xc2\xa0" "break",
+		"\xe2\x80\x9cquoted\xe2\x80\x9d", "\x1funder\x1f"
+	};
+	char buf[512];
+	size_t len;
+	int i;
+
+	for (i = 0; i < NUM_LINES; i++)
+	{
+		len = 0;
+		while (len < 60 + (size_t) (rng () % 300) && len < sizeof(buf) - 64)
+		{
+			if (i % 4 == 0 && rng () % 4 == 0)
+				len += snprintf (buf + len, sizeof(buf) - len, "%s ", extras[rng () % 6]);
+			else
+				len += snprintf (buf + len, sizeof(buf) - len, "%s ", pick_word ());
+		}
+		lines[i] = strdup (buf);
+		line_lens[i] = len;
+	}
+}
+
+//The same lines as the server sends them, every eighth with IRCv3 tags
+static void make_raw_lines (void)
+{
+	char buf[1024];
+	int len;
+	int i;
+
+	for (i = 0; i < NUM_LINES; i++)
+	{
+		if (i % 8 == 0)
+			len = snprintf (buf, sizeof(buf), "@time=2024-03-01T19:%02u:%02u.000Z;account=%s :%s!~user@host/%u PRIVMSG #quiz :%s",
+					rng () % 60, rng () % 60, pick_word (), pick_word (), rng () % 1000, lines[i]);
+		else
+			len = snprintf (buf, sizeof(buf), ":%s!~user@host/%u PRIVMSG #quiz :%s", pick_word (), rng () % 1000, lines[i]);
+		raw_lines[i] = strdup (buf);
+		raw_lens[i] = len < (int) sizeof(buf) ? (size_t) len : sizeof(buf) - 1;
+	}
+}
+
+//Compiles db to a temporary file, packed if block isn't 0, and loads it back
+static struct quizdb *compile_db (unsigned int block, long *size)
+{
+	char path[] = "/tmp/bench_qdb.XXXXXX";
+	struct quizdb *compiled = NULL;
+	FILE *in;
+	int fd;
+
+	fd = mkstemp (path);
+	if (fd < 0)
+		return NULL;
+	close (fd);
+	if ((block > 0 ? quizdb_pack (db, path, block) : quizdb_compile (db, path)) == 0 &&
+			(in = fopen (path, "rb")) != NULL)
+	{
+		fseek (in, 0, SEEK_END);
+		*size = ftell (in);
+		fclose (in);
+		compiled = quizdb_load (path);
+	}
+	unlink (path);
+	return compiled;
+}
+
+//Writes a question database to a temporary file and loads it
+static int make_db (void)
+{
+	struct quizdb *compiled;
+	char path[] = "/tmp/bench_qdb.XXXXXX";
+	char buf[512];
+	size_t len;
+	FILE *out;
+	int fd;
+	int n;
+	int i;
+	int k;
+
+	fd = mkstemp (path);
+	if (fd < 0 || (out = fdopen (fd, "w")) == NULL)
+		return 1;
+
+	for (i = 0; i < NUM_QUESTIONS; i++)
+	{
+		len = 0;
+		n = 6 + rng () % 9;
+		for (k = 0; k < n; k++)
+			len += snprintf (buf + len, sizeof(buf) - len, k ? " %s" : "%s", pick_word ());
+		questions[i] = strdup (buf);
+		fprintf (out, "Category: Category %d\nQuestion: %s?\nAnswer: %s\n\n",
+				i % NUM_CATEGORIES, buf, pick_word ());
+	}
+	fclose (out);
+
+	db = quizdb_load (path);
+	unlink (path);
+	if (db == NULL)
+		return 1;
+	for (i = 0; i < NUM_PACKED; i++)
+	{
+		if ((packed[i] = compile_db (pack_blocks[i], &packed_size[i])) == NULL)
+			return 1;
+	}
+	if ((compiled = compile_db (0, &packed_size[NUM_PACKED])) == NULL)
+		return 1;
+	quizdb_free (compiled);
+
+	//Exact repeats of a question, and ones with a word dropped and another misspelt
+	for (i = 0; i < NUM_LINES; i++)
+	{
+		k = rng () % NUM_QUESTIONS;
+		snprintf (buf, sizeof(buf), "(Category %d) %s?", k % NUM_CATEGORIES, questions[k]);
+		exact_queries[i] = strdup (buf);
+
+		snprintf (buf, sizeof(buf), "(Category %d) %s", k % NUM_CATEGORIES, strchr (questions[k], ' ') + 1);
+		len = strlen (buf);
+		buf[len - 2] = buf[len - 2] == 'a' ? 'e' : 'a';
+		fuzzy_queries[i] = strdup (buf);
+	}
+	return 0;
+}
+
+static int make_cfg (void)
+{
+	FILE *out;
+	int fd;
+	int i;
+
+	strcpy (cfg_path, "/tmp/bench_cfg.XXXXXX");
+	fd = mkstemp (cfg_path);
+	if (fd < 0 || (out = fdopen (fd, "w")) == NULL)
+		return 1;
+
+	fprintf (out, "nick=qircbot\nusername=qircbot\nrealname=qircbot\nquestion_db=questions.qdb\n\n");
+	for (i = 0; i < NUM_SESSIONS; i++)
+	{
+		fprintf (out, "[network%d]\nserver=irc.network%d.example.org\nport=6667\nchannel=#quiz%d\n", i, i, i);
+		fprintf (out, "server_connect_msg=identify secretpassword\nserver_connect_nick=NickServ\nserver_connect_delay=2\n\n");
+	}
+	fclose (out);
+	return 0;
+}
+
+//outq sends through libircclient, which formats the line the same way
+int irc_send_raw (irc_session_t *session, const char *format, ...)
+{
+	char buf[512];
+	va_list ap;
+
+	va_start (ap, format);
+	sink += vsnprintf (buf, sizeof(buf), format, ap);
+	va_end (ap);
+	return 0;
+}
+
+#ifdef IRC_NATIVE
+//The native backend hands outq's pieces to writev instead, which gathers them the same way
+int irc_send_iov (irc_session_t *session, const struct iovec *iov, int count)
+{
+	char buf[512];
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < count && len + iov[i].iov_len <= sizeof(buf); i++)
+	{
+		memcpy (buf + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	sink += len + (len > 0 ? buf[len - 1] : 0);
+	return 0;
+}
+#endif
+
+static void bench_sanitize (unsigned long ops)
+{
+	char out[512];
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		sink += irc_sanitize (lines[i % NUM_LINES], line_lens[i % NUM_LINES], out, sizeof(out));
+}
+
+static void bench_normalize (unsigned long ops)
+{
+	char out[1024];
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		sink += quizdb_normalize (exact_queries[i % NUM_LINES], out, sizeof(out));
+}
+
+static void bench_lookup_exact (unsigned long ops)
+{
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		sink += quizdb_lookup (db, exact_queries[i % NUM_LINES], NULL) != NULL;
+}
+
+static void bench_lookup_miss (unsigned long ops)
+{
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		sink += quizdb_lookup (db, fuzzy_queries[i % NUM_LINES], NULL) != NULL;
+}
+
+static void bench_match_fuzzy (unsigned long ops)
+{
+	struct quizdb_match best[3];
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		sink += quizdb_match (db, fuzzy_queries[i % NUM_LINES], 0.5, best, 3);
+}
+
+static void lookup_packed (const struct quizdb *p, unsigned long ops)
+{
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		sink += quizdb_lookup (p, exact_queries[i % NUM_LINES], NULL) != NULL;
+}
+
+static void bench_lookup_packed16 (unsigned long ops)
+{
+	lookup_packed (packed[0], ops);
+}
+
+static void bench_lookup_packed64 (unsigned long ops)
+{
+	lookup_packed (packed[1], ops);
+}
+
+static void bench_lookup_packed256 (unsigned long ops)
+{
+	lookup_packed (packed[2], ops);
+}
+
+static void bench_match_packed64 (unsigned long ops)
+{
+	struct quizdb_match best[3];
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+		sink += quizdb_match (packed[1], fuzzy_queries[i % NUM_LINES], 0.5, best, 3);
+}
+
+static void bench_cfg_read (unsigned long ops)
+{
+	struct cfg defaults;
+	struct cfg *cfgs;
+	unsigned long i;
+	int count;
+
+	memset (&defaults, 0, sizeof(defaults));
+	for (i = 0; i < ops; i++)
+	{
+		if (cfg_read (cfg_path, &defaults, &cfgs, &count) == 0)
+		{
+			sink += count;
+			free (cfgs);
+		}
+	}
+}
+
+static void bench_outq_msg (unsigned long ops)
+{
+	static struct outq q;
+	unsigned long i;
+
+	outq_init (&q, NULL);
+	for (i = 0; i < ops; i++)
+	{
+		//Keep the bucket full, only the formatting and queueing are being measured
+		q.credit = OUTQ_BURST * OUTQ_INTERVAL_MS;
+		outq_msg (&q, OUTQ_URGENT, "#quiz", questions[i % NUM_QUESTIONS]);
+	}
+}
+
+static void bench_irc_parse (unsigned long ops)
+{
+	struct irc_msg msg;
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+	{
+		ircmsg_parse (raw_lines[i % NUM_LINES], raw_lens[i % NUM_LINES], &msg);
+		sink += msg.count + msg.nick.len;
+	}
+}
+
+//An answer from the index going out after its cached prefix
+static void bench_outq_wire (unsigned long ops)
+{
+	static struct outq q;
+	static const char prefix[] = "PRIVMSG #quiz :";
+	unsigned long i;
+
+	outq_init (&q, NULL);
+	for (i = 0; i < ops; i++)
+	{
+		q.credit = OUTQ_BURST * OUTQ_INTERVAL_MS;
+		outq_wire (&q, OUTQ_URGENT, prefix, sizeof(prefix) - 1, questions[i % NUM_QUESTIONS], strlen (questions[i % NUM_QUESTIONS]));
+	}
+}
+
+//What a handled question costs in instrumentation: a counter and a histogram
+static void bench_metrics_record (unsigned long ops)
+{
+	unsigned long i;
+
+	for (i = 0; i < ops; i++)
+	{
+		metric_inc (METRIC_LOOKUP_EXACT);
+		metric_time (METRIC_LOOKUP_US, line_lens[i % NUM_LINES] * 7);
+	}
+}
+
+static const struct bench benches[] = {
+	{ "sanitize", 1000000, bench_sanitize },
+	{ "normalize", 1000000, bench_normalize },
+	{ "lookup_exact", 1000000, bench_lookup_exact },
+	{ "lookup_miss", 1000000, bench_lookup_miss },
+	{ "match_fuzzy", 20000, bench_match_fuzzy },
+	{ "lookup_packed16", 1000000, bench_lookup_packed16 },
+	{ "lookup_packed64", 1000000, bench_lookup_packed64 },
+	{ "lookup_packed256", 200000, bench_lookup_packed256 },
+	{ "match_packed64", 20000, bench_match_packed64 },
+	{ "cfg_read", 5000, bench_cfg_read },
+	{ "outq_msg", 1000000, bench_outq_msg },
+	{ "outq_wire", 1000000, bench_outq_wire },
+	{ "metrics_record", 10000000, bench_metrics_record },
+	{ "irc_parse", 1000000, bench_irc_parse },
+};
+
+#define NUM_BENCHES	(sizeof(benches) / sizeof(benches[0]))
+
+static double run (const struct bench *b)
+{
+	unsigned long long start;
+	unsigned long long took;
+	unsigned long long best = 0;
+	int r;
+
+	//One untimed run to warm the caches
+	b->run (b->ops / 10 + 1);
+	for (r = 0; r < BENCH_REPEATS; r++)
+	{
+		start = now_ns ();
+		b->run (b->ops);
+		took = now_ns () - start;
+		if (best == 0 || took < best)
+			best = took;
+	}
+	return (double) best / b->ops;
+}
+
+static int load_baseline (const char *path, struct result *base, int max)
+{
+	FILE *in;
+	char line[256];
+	int n = 0;
+
+	in = fopen (path, "r");
+	if (in == NULL)
+		return -1;
+	while (n < max && fgets (line, sizeof(line), in) != NULL)
+	{
+		if (line[0] == '#')
+			continue;
+		if (sscanf (line, "%63s %lf", base[n].name, &base[n].ns) == 2)
+			n++;
+	}
+	fclose (in);
+	return n;
+}
+
+static void print_usage (void)
+{
+	fprintf (stdout, "bench [options] [benchmark ...]\n");
+	fprintf (stdout, "Options:\n");
+	fprintf (stdout, "-c		Compare against a baseline written by an earlier run\n");
+	fprintf (stdout, "-t		Slowdown in percent that counts as a regression, default %.0f\n", DEFAULT_TOLERANCE);
+	fprintf (stdout, "-l		List the benchmarks\n");
+	fprintf (stdout, "-h		This help text\n");
+}
+
+int main (int argc, char **argv)
+{
+	struct result base[NUM_BENCHES * 2];
+	const char *baseline = NULL;
+	double tolerance = DEFAULT_TOLERANCE;
+	double ns;
+	double delta;
+	int nbase = 0;
+	int regressions = 0;
+	int selected;
+	int c;
+	int i;
+	int j;
+	size_t k;
+
+	while ((c = getopt (argc, argv, "c:t:lh")) != -1)
+	{
+		switch (c)
+		{
+			case 'c':
+				baseline = optarg;
+				break;
+			case 't':
+				tolerance = atof (optarg);
+				break;
+			case 'l':
+				for (k = 0; k < NUM_BENCHES; k++)
+					fprintf (stdout, "%s\n", benches[k].name);
+				return 0;
+			default:
+				print_usage ();
+				return 1;
+		}
+	}
+
+	if (baseline != NULL && (nbase = load_baseline (baseline, base, NUM_BENCHES * 2)) < 0)
+	{
+		fprintf (stderr, "Error reading baseline %s\n", baseline);
+		return 1;
+	}
+
+	make_words ();
+	make_lines ();
+	make_raw_lines ();
+	if (make_db () || make_cfg ())
+	{
+		fprintf (stderr, "Error setting up the benchmarks\n");
+		return 1;
+	}
+
+	//What the packed files save, to weigh against their lookup times
+	fprintf (stdout, "# size compiled %ld\n", packed_size[NUM_PACKED]);
+	for (k = 0; k < NUM_PACKED; k++)
+		fprintf (stdout, "# size packed%u %ld\n", pack_blocks[k], packed_size[k]);
+	if (baseline != NULL)
+		fprintf (stdout, "# name ns_per_op baseline change_percent\n");
+	else
+		fprintf (stdout, "# name ns_per_op ops\n");
+
+	for (k = 0; k < NUM_BENCHES; k++)
+	{
+		//Only the ones named on the command line, if any were
+		selected = optind == argc;
+		for (i = optind; i < argc; i++)
+			selected |= strcmp (argv[i], benches[k].name) == 0;
+		if (!selected)
+			continue;
+
+		ns = run (&benches[k]);
+		if (baseline == NULL)
+		{
+			fprintf (stdout, "%s %.2f %lu\n", benches[k].name, ns, benches[k].ops);
+			continue;
+		}
+
+		for (j = 0; j < nbase && strcmp (base[j].name, benches[k].name) != 0; j++)
+			;
+		if (j == nbase)
+		{
+			fprintf (stdout, "%s %.2f - -\n", benches[k].name, ns);
+			continue;
+		}
+		delta = 100.0 * (ns - base[j].ns) / base[j].ns;
+		fprintf (stdout, "%s %.2f %.2f %+.1f%s\n", benches[k].name, ns, base[j].ns, delta,
+				delta > tolerance ? " REGRESSION" : "");
+		regressions += delta > tolerance;
+	}
+
+	unlink (cfg_path);
+	for (k = 0; k < NUM_PACKED; k++)
+		quizdb_free (packed[k]);
+	quizdb_free (db);
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,244 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "libircclient/libircclient.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+/*
+   Throughput of the IRC backend's read path, parsing through to the
+   callbacks.
+
+   The same source is linked once against libircclient (bench/bench_irc)
+   and once against ircnative.c (bench/bench_irc_native). It plays a
+   recorded session (bench/traffic.irc, '#' lines are comments) over and
+   over from a thread on 127.0.0.1 until -n lines have been sent, closes,
+   and times the client from connecting to seeing the close. Results are
+   "name value" lines, event counts included so the backends can be checked
+   against each other.
+*/
+
+#define DEFAULT_TRAFFIC		"bench/traffic.irc"
+#define DEFAULT_LINES		2000000
+
+static char *traffic;
+static size_t traffic_len;
+static unsigned long traffic_lines;
+static unsigned long repeats;
+static int listen_fd = -1;
+
+enum { CONNECT, NUMERIC, CHANNEL, PRIVMSG, NOTICE, ACTION, OTHER, COUNTS };
+static unsigned long counts[COUNTS];
+
+static void event_count (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	counts[OTHER]++;
+}
+
+static void event_connect (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	counts[CONNECT]++;
+}
+
+static void event_channel (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	//Touch what the bots would, so both backends pay for it
+	if (origin != NULL && count == 2 && params[1][0] != '\0')
+		counts[CHANNEL]++;
+}
+
+static void event_privmsg (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	counts[PRIVMSG]++;
+}
+
+static void event_notice (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	counts[NOTICE]++;
+}
+
+static void event_action (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	counts[ACTION]++;
+}
+
+static void event_numeric (irc_session_t *session, unsigned int event, const char *origin, const char **params, unsigned int count)
+{
+	counts[NUMERIC]++;
+}
+
+static double now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Lines with CR LF, without the comments
+static int load_traffic (const char *path)
+{
+	char line[1024];
+	size_t len;
+	FILE *in;
+
+	in = fopen (path, "r");
+	if (in == NULL)
+		return 1;
+	traffic = malloc (1);
+	while (fgets (line, sizeof(line), in) != NULL)
+	{
+		len = strcspn (line, "\r\n");
+		if (len == 0 || line[0] == '#')
+			continue;
+		traffic = realloc (traffic, traffic_len + len + 2);
+		memcpy (traffic + traffic_len, line, len);
+		memcpy (traffic + traffic_len + len, "\r\n", 2);
+		traffic_len += len + 2;
+		traffic_lines++;
+	}
+	fclose (in);
+	return traffic_lines == 0;
+}
+
+static void *serve (void *arg)
+{
+	char discard[4096];
+	unsigned long i;
+	size_t off;
+	ssize_t n;
+	int fd;
+
+	fd = accept (listen_fd, NULL, NULL);
+	if (fd < 0)
+		return NULL;
+	for (i = 0; i < repeats; i++)
+	{
+		for (off = 0; off < traffic_len; off += n)
+		{
+			n = write (fd, traffic + off, traffic_len - off);
+			if (n < 0)
+			{
+				close (fd);
+				return NULL;
+			}
+		}
+	}
+	//Let the client's registration and PONGs drain before closing
+	shutdown (fd, SHUT_WR);
+	while (read (fd, discard, sizeof(discard)) > 0)
+		;
+	close (fd);
+	return NULL;
+}
+
+int main (int argc, char **argv)
+{
+	const char *path = DEFAULT_TRAFFIC;
+	unsigned long lines = DEFAULT_LINES;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	irc_callbacks_t callbacks;
+	irc_session_t *session;
+	pthread_t server;
+	fd_set in_set;
+	fd_set out_set;
+	double start;
+	double took;
+	int maxfd;
+	int c;
+
+	while ((c = getopt (argc, argv, "f:n:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'f':
+				path = optarg;
+				break;
+			case 'n':
+				lines = strtoul (optarg, NULL, 10);
+				break;
+			default:
+				fprintf (stdout, "bench_irc [-f traffic] [-n lines]\n");
+				return c != 'h';
+		}
+	}
+
+	if (load_traffic (path))
+	{
+		fprintf (stderr, "Error reading %s\n", path);
+		return 1;
+	}
+	repeats = (lines + traffic_lines - 1) / traffic_lines;
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	listen_fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0 || bind (listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+			listen (listen_fd, 1) != 0 || getsockname (listen_fd, (struct sockaddr *) &addr, &addrlen) != 0)
+	{
+		fprintf (stderr, "Error listening on 127.0.0.1\n");
+		return 1;
+	}
+	pthread_create (&server, NULL, serve, NULL);
+
+	memset (&callbacks, 0, sizeof(callbacks));
+	callbacks.event_connect = event_connect;
+	callbacks.event_numeric = event_numeric;
+	callbacks.event_channel = event_channel;
+	callbacks.event_privmsg = event_privmsg;
+	callbacks.event_notice = event_notice;
+	callbacks.event_ctcp_action = event_action;
+	callbacks.event_join = event_count;
+	callbacks.event_part = event_count;
+	callbacks.event_quit = event_count;
+	callbacks.event_nick = event_count;
+	callbacks.event_mode = event_count;
+	callbacks.event_umode = event_count;
+	callbacks.event_unknown = event_count;
+
+	session = irc_create_session (&callbacks);
+	if (session == NULL)
+		return 1;
+	irc_option_set (session, LIBIRC_OPTION_STRIPNICKS);
+
+	start = now ();
+	if (irc_connect (session, "127.0.0.1", ntohs (addr.sin_port), NULL, "qircbot", "qircbot", "qircbot"))
+	{
+		fprintf (stderr, "Error connecting: %s\n", irc_strerror (irc_errno (session)));
+		return 1;
+	}
+	while (irc_is_connected (session))
+	{
+		FD_ZERO (&in_set);
+		FD_ZERO (&out_set);
+		maxfd = 0;
+		irc_add_select_descriptors (session, &in_set, &out_set, &maxfd);
+		if (select (maxfd + 1, &in_set, &out_set, NULL, NULL) < 0 && errno != EINTR)
+			break;
+		//Fails once the server closes, which is the end of the run
+		if (irc_process_select_descriptors (session, &in_set, &out_set))
+			irc_disconnect (session);
+	}
+	took = now () - start;
+	pthread_join (server, NULL);
+
+	fprintf (stdout, "lines %lu\n", repeats * traffic_lines);
+	fprintf (stdout, "seconds %.3f\n", took);
+	fprintf (stdout, "ns_per_line %.1f\n", took * 1e9 / (repeats * traffic_lines));
+	fprintf (stdout, "lines_per_sec %.0f\n", repeats * traffic_lines / took);
+	fprintf (stdout, "connect %lu\nnumeric %lu\nchannel %lu\nprivmsg %lu\nnotice %lu\naction %lu\nother %lu\n",
+			counts[CONNECT], counts[NUMERIC], counts[CHANNEL], counts[PRIVMSG], counts[NOTICE], counts[ACTION], counts[OTHER]);
+	irc_destroy_session (session);
+	return 0;
+}
@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../sanitize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+/*
+   Compares irc_sanitize against the byte at a time loop event_channel used
+   to have, on a fixed mix of plain, coloured and UTF-8 channel lines.
+*/
+
+#define NUM_LINES	4096
+#define ROUNDS		200
+
+static char *lines[NUM_LINES];
+static size_t lens[NUM_LINES];
+
+//The old event_channel loop, with a buffer big enough that it can't overflow
+static size_t legacy_sanitize (const char *in, size_t len, char *out, size_t outlen)
+{
+#define UTF8_SPACE 32
+#define UTF8_TILDE 126
+	int ch;
+	int i;
+	int j = 0;
+
+	for (i = 0; i < len; i++)
+	{
+		ch = in[i];
+		if ((ch >= UTF8_SPACE && ch <= UTF8_TILDE) || ch == 160)
+		{
+			if (ch == 160)
+				ch = UTF8_SPACE;
+			out[j] = ch;
+			j++;
+		}
+	}
+	out[j] = '\0';
+	return j;
+}
+
+static void make_lines (void)
+{
+	static const char *words[] = {
+		"Moody", "version", "of", "Herman", "Melville", "sea", "classic,", "with", "Peck",
+		"lending", "a", "deranged", "dignity", "to", "the", "role", "Captain", "Ahab.",
+		"caf\xc3\xa9", "na\xc3\xafve", "\xe2\x80\x9cquoted\xe2\x80\x9d", "\x02" "bold" "\x02",
+		"\x03" "04,01red" "\x03", "no\xc2\xa0" "break", "\x1funder\x1f"
+	};
+	char buf[512];
+	size_t len;
+	int i;
+	int w;
+
+	srand (42);
+	for (i = 0; i < NUM_LINES; i++)
+	{
+		len = 0;
+		//Three in four lines are plain ASCII, like most quiz traffic
+		while (len < 60 + (size_t) (rand () % 300))
+		{
+			w = (i % 4 == 0) ? rand () % 25 : rand () % 18;
+			len += snprintf (buf + len, sizeof(buf) - len, "%s ", words[w]);
+			if (len >= sizeof(buf) - 32)
+				break;
+		}
+		lines[i] = strdup (buf);
+		lens[i] = len;
+	}
+}
+
+static unsigned long long now_ticks (void)
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc ();
+#else
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void run (const char *name, size_t (*func) (const char *, size_t, char *, size_t))
+{
+	char out[4096];
+	unsigned long long start;
+	unsigned long long ticks;
+	unsigned long long bytes = 0;
+	size_t sink = 0;
+	int r;
+	int i;
+
+	start = now_ticks ();
+	for (r = 0; r < ROUNDS; r++)
+	{
+		for (i = 0; i < NUM_LINES; i++)
+		{
+			sink += func (lines[i], lens[i], out, sizeof(out));
+			bytes += lens[i];
+		}
+	}
+	ticks = now_ticks () - start;
+
+#ifdef HAVE_RDTSC
+	fprintf (stdout, "%-10s %8.3f bytes/cycle (%zu)\n", name, (double) bytes / ticks, sink);
+#else
+	fprintf (stdout, "%-10s %8.3f bytes/ns (%zu)\n", name, (double) bytes / ticks, sink);
+#endif
+}
+
+int main (void)
+{
+	make_lines ();
+	run ("legacy", legacy_sanitize);
+	run ("scalar", irc_sanitize_scalar);
+	run ("vector", irc_sanitize);
+	return 0;
+}
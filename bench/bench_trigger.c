@@ -0,0 +1,274 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../trigger.h"
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/*
+   Messages per second through the trigger engine as the number of
+   triggers grows, against trying every trigger on every message in turn
+   the way a list of strcasestr and regexec calls would.
+
+   Triggers are one or two word keywords from the first half of a
+   generated vocabulary, with one in ten a regex for a !command or a word
+   followed by digits. Messages are chatter from the other half, with
+   some of the first ten triggers mixed in, so about as many messages
+   fire something whatever the number of triggers. Everything comes from
+   a fixed seed, and as many of the first CHECK_LINES messages have to
+   fire a trigger both ways.
+*/
+
+#define VOCABULARY	20000
+#define NUM_LINES	4096
+//Triggers every set has, and that messages mention
+#define COMMON		10
+//Messages both ways have to agree on, trying every trigger is too slow for all of them
+#define CHECK_LINES	512
+//Each way is run over the messages for at least this long
+#define RUN_NS		300000000ULL
+
+struct naive {
+	char *pattern;
+	int regex;
+	regex_t re;
+};
+
+static char *words[VOCABULARY];
+static char *lines[NUM_LINES];
+static size_t lens[NUM_LINES];
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+//xorshift64*, so the inputs don't depend on the libc's rand
+static uint32_t rng (void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (uint32_t) ((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+static unsigned long long now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t hash_word (const char *w)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *w != '\0'; w++)
+		h = (h ^ (unsigned char) *w) * 16777619u;
+	return h;
+}
+
+//Every word different, so chatter never says a trigger word, only ones that start or end the same
+static void make_words (void)
+{
+	static const char *syllables[] = {
+		"ka", "lo", "mi", "ne", "ru", "sta", "ben", "dor", "fi", "gal", "hu", "jo", "ter", "vi", "zan", "qua"
+	};
+	static const char *seen[VOCABULARY * 4];
+	char buf[32];
+	size_t len;
+	uint32_t h;
+	int i;
+	int n;
+
+	for (i = 0; i < VOCABULARY; )
+	{
+		len = 0;
+		for (n = 3 + rng () % 3; n > 0; n--)
+			len += snprintf (buf + len, sizeof(buf) - len, "%s", syllables[rng () % 16]);
+		for (h = hash_word (buf) % (VOCABULARY * 4); seen[h] != NULL && strcmp (seen[h], buf) != 0; h = (h + 1) % (VOCABULARY * 4))
+			;
+		if (seen[h] != NULL)
+			continue;
+		words[i] = strdup (buf);
+		seen[h] = words[i++];
+	}
+}
+
+static void make_lines (void)
+{
+	char buf[512];
+	size_t len;
+	int i;
+	int n;
+
+	for (i = 0; i < NUM_LINES; i++)
+	{
+		len = 0;
+		if (i % 10 == 0)
+			len += snprintf (buf, sizeof(buf), "!cmd%u ", rng () % (COMMON * 2));
+		for (n = 6 + rng () % 15; n > 0; n--)
+		{
+			len += snprintf (buf + len, sizeof(buf) - len, "%s%s", words[VOCABULARY / 2 + rng () % (VOCABULARY / 2)],
+					rng () % 8 == 0 ? ", " : " ");
+			if (n == 3 && i % 8 == 0)
+				len += snprintf (buf + len, sizeof(buf) - len, "%s ", words[rng () % COMMON]);
+			if (len >= sizeof(buf) - 64)
+				break;
+		}
+		if (i % 16 == 0)
+			len += snprintf (buf + len, sizeof(buf) - len, "%s%u", words[rng () % COMMON], rng () % 100);
+		lines[i] = strdup (buf);
+		lens[i] = len;
+	}
+}
+
+//Trigger i is the same in every set
+static void make_pattern (char *buf, size_t size, int i, int *regex)
+{
+	*regex = i % 10 == 9;
+	if (*regex && i % 20 == 9)
+		snprintf (buf, size, "^!cmd%d( |$)", i / 10);
+	else if (*regex)
+		snprintf (buf, size, "%s[0-9]+", words[i / 10]);
+	else if (i % 3 == 2)
+		snprintf (buf, size, "%s %s", words[i], words[VOCABULARY / 2 - 1 - i]);
+	else
+		snprintf (buf, size, "%s", words[i]);
+}
+
+static int is_word (unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+//What a trigger engine without an automaton would do for a keyword
+static int naive_keyword (const char *pattern, size_t plen, const char *text, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + plen <= len; i++)
+	{
+		if (strncasecmp (text + i, pattern, plen) != 0)
+			continue;
+		if (i > 0 && is_word (text[i]) && is_word (text[i - 1]))
+			continue;
+		if (i + plen < len && is_word (text[i + plen - 1]) && is_word (text[i + plen]))
+			continue;
+		return 1;
+	}
+	return 0;
+}
+
+static int naive_match (struct naive *list, int count, const char *text, size_t len)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (list[i].regex ? regexec (&list[i].re, text, 0, NULL, 0) == 0 :
+				naive_keyword (list[i].pattern, strlen (list[i].pattern), text, len))
+			return 1;
+	}
+	return 0;
+}
+
+static double run_engine (struct triggers *t, unsigned long *matched)
+{
+	unsigned int hits[TRIGGER_MAX_HITS];
+	unsigned long long start = now_ns ();
+	unsigned long long elapsed;
+	unsigned long msgs = 0;
+	int i;
+
+	*matched = 0;
+	do
+	{
+		for (i = 0; i < NUM_LINES; i++)
+		{
+			if (trigger_match (t, lines[i], lens[i], hits, TRIGGER_MAX_HITS) > 0 && msgs < CHECK_LINES)
+				(*matched)++;
+			msgs++;
+		}
+		elapsed = now_ns () - start;
+	} while (elapsed < RUN_NS);
+	return msgs * 1e9 / elapsed;
+}
+
+static double run_naive (struct naive *list, int count, unsigned long *matched)
+{
+	unsigned long long start = now_ns ();
+	unsigned long long elapsed;
+	unsigned long msgs = 0;
+
+	*matched = 0;
+	do
+	{
+		if (naive_match (list, count, lines[msgs % NUM_LINES], lens[msgs % NUM_LINES]) && msgs < CHECK_LINES)
+			(*matched)++;
+		msgs++;
+		elapsed = now_ns () - start;
+	} while (elapsed < RUN_NS || msgs < CHECK_LINES);
+	return msgs * 1e9 / elapsed;
+}
+
+int main (void)
+{
+	static const int counts[] = { 10, 100, 1000, 10000 };
+	char pattern[128];
+	struct triggers *t;
+	struct naive *list;
+	unsigned long engine_matched;
+	unsigned long naive_matched;
+	double engine;
+	double naive;
+	int failed = 0;
+	int regex;
+	int c;
+	int i;
+
+	make_words ();
+	make_lines ();
+
+	fprintf (stdout, "%8s %8s %14s %14s %8s\n", "triggers", "states", "engine msgs/s", "naive msgs/s", "matched");
+	for (c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++)
+	{
+		t = trigger_new ();
+		list = calloc (counts[c], sizeof(*list));
+		if (t == NULL || list == NULL)
+			return 1;
+		for (i = 0; i < counts[c]; i++)
+		{
+			make_pattern (pattern, sizeof(pattern), i, &regex);
+			list[i].pattern = strdup (pattern);
+			list[i].regex = regex;
+			if (regex)
+				regcomp (&list[i].re, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+			if (trigger_add (t, pattern, regex, "reply"))
+				return 1;
+		}
+		if (trigger_compile (t))
+			return 1;
+
+		engine = run_engine (t, &engine_matched);
+		naive = run_naive (list, counts[c], &naive_matched);
+		fprintf (stdout, "%8d %8u %14.0f %14.0f %8lu\n", counts[c], trigger_states (t), engine, naive, engine_matched);
+		if (engine_matched != naive_matched)
+		{
+			fprintf (stderr, "%d triggers: the engine fired on %lu messages, trying each one on %lu\n",
+					counts[c], engine_matched, naive_matched);
+			failed = 1;
+		}
+
+		for (i = 0; i < counts[c]; i++)
+		{
+			if (list[i].regex)
+				regfree (&list[i].re);
+			free (list[i].pattern);
+		}
+		free (list);
+		trigger_free (t);
+	}
+	return failed;
+}
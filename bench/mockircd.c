@@ -0,0 +1,533 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/*
+   Mock IRC server that replays a recorded quiz against quizbot, offline.
+
+   It listens on 127.0.0.1, takes a single client, answers its
+   registration and JOIN and then plays the log back into the channel it
+   joined. Log lines are
+
+	<delay ms> <nick> <text>	sent as a PRIVMSG from nick to the channel
+	= <answer>			the answer expected for the last question
+	# ...				a comment
+
+   where \xHH in the text stands for that byte, for colour codes and UTF-8.
+   As with MoxQuizz, the line after a "{MoxQuizz} The question" prompt is
+   the question.
+
+   The first PRIVMSG the client sends to the channel after a question is
+   timed from the moment the question was written to the socket and
+   checked against the expected answer. The results are printed as
+   "name value" lines on stdout.
+
+   With -d the client is disconnected before every so many questions and
+   the replay waits for it to come back, timing how long it takes from
+   the connection being closed to the client joining the channel again.
+*/
+
+#define DEFAULT_PORT		16667
+#define DEFAULT_WAIT_MS		2000
+#define ACCEPT_TIMEOUT_MS	10000
+#define QUIZ_PROMPT		"{MoxQuizz} The question"
+#define LINE_MAX		1024
+
+struct event {
+	unsigned long delay;	//ms since the previous line
+	char nick[32];
+	char *text;
+	char *expect;		//Questions only, NULL if nobody should know the answer
+	int question;
+};
+
+static struct event *events;
+static int nevents;
+
+static unsigned long *latencies;
+static int nlatencies;
+
+static unsigned long *rejoins;
+static int nrejoins;
+static unsigned long dropped_at;	//0 unless waiting for the client to come back
+
+static int client = -1;
+static char channel[64];
+static char nick[64];
+
+//The question currently open
+static struct event *open_question;
+static unsigned long asked_at;
+static int replied;
+
+static struct {
+	unsigned long questions;
+	unsigned long known;		//Questions with an expected answer
+	unsigned long correct;
+	unsigned long wrong;
+	unsigned long missed;		//Known but not answered
+	unsigned long stray;		//Channel messages while no question was open
+} results;
+
+static unsigned long now_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static char *unescape (const char *in)
+{
+	char *out = malloc (strlen (in) + 1);
+	char hex[3] = { 0, 0, 0 };
+	size_t j = 0;
+
+	if (out == NULL)
+		return NULL;
+	while (*in != '\0')
+	{
+		if (in[0] == '\\' && in[1] == 'x' && in[2] != '\0' && in[3] != '\0')
+		{
+			hex[0] = in[2];
+			hex[1] = in[3];
+			out[j++] = (char) strtol (hex, NULL, 16);
+			in += 4;
+		}
+		else
+			out[j++] = *in++;
+	}
+	out[j] = '\0';
+	return out;
+}
+
+static int load_log (const char *path)
+{
+	FILE *in;
+	char line[LINE_MAX];
+	struct event *ev;
+	char *text;
+	char *end;
+	int after_prompt = 0;
+
+	in = fopen (path, "r");
+	if (in == NULL)
+		return 1;
+
+	while (fgets (line, sizeof(line), in) != NULL)
+	{
+		line[strcspn (line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		if (line[0] == '=')
+		{
+			if (nevents > 0 && events[nevents - 1].question)
+				events[nevents - 1].expect = strdup (line + 2);
+			continue;
+		}
+
+		ev = realloc (events, (nevents + 1) * sizeof(*events));
+		if (ev == NULL)
+			return 1;
+		events = ev;
+		ev = &events[nevents];
+		memset (ev, 0, sizeof(*ev));
+
+		ev->delay = strtoul (line, &end, 10);
+		text = strchr (end + 1, ' ');
+		if (end == line || *end != ' ' || text == NULL || text - end - 1 >= (long) sizeof(ev->nick))
+		{
+			fprintf (stderr, "Bad log line %s\n", line);
+			return 1;
+		}
+		memcpy (ev->nick, end + 1, text - end - 1);
+		ev->text = unescape (text + 1);
+		if (ev->text == NULL)
+			return 1;
+
+		ev->question = after_prompt;
+		after_prompt = strncmp (ev->text, QUIZ_PROMPT, strlen (QUIZ_PROMPT)) == 0;
+		nevents++;
+	}
+	fclose (in);
+	return 0;
+}
+
+static void send_line (const char *fmt, ...)
+{
+	char buf[LINE_MAX + 128];
+	va_list ap;
+	size_t len;
+	ssize_t n;
+	size_t off = 0;
+
+	va_start (ap, fmt);
+	vsnprintf (buf, sizeof(buf) - 2, fmt, ap);
+	va_end (ap);
+	len = strlen (buf);
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+
+	//The client is local and reading, a blocking write won't be held up for long
+	while (off < len && client >= 0)
+	{
+		n = write (client, buf + off, len - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			close (client);
+			client = -1;
+			return;
+		}
+		off += n;
+	}
+}
+
+static void close_question (void)
+{
+	if (open_question != NULL && !replied && open_question->expect != NULL)
+		results.missed++;
+	open_question = NULL;
+}
+
+static void play_line (struct event *ev)
+{
+	if (ev->question)
+	{
+		close_question ();
+		results.questions++;
+		if (ev->expect != NULL)
+			results.known++;
+	}
+	else if (strncmp (ev->text, QUIZ_PROMPT, strlen (QUIZ_PROMPT)) == 0)
+		close_question ();
+
+	send_line (":%s!%s@mock PRIVMSG %s :%s", ev->nick, ev->nick, channel, ev->text);
+	if (ev->question)
+	{
+		open_question = ev;
+		asked_at = now_us ();
+		replied = 0;
+	}
+}
+
+//Compares ignoring case and surrounding spaces
+static int same_answer (const char *a, const char *b)
+{
+	size_t alen;
+	size_t blen;
+
+	while (*a == ' ')
+		a++;
+	while (*b == ' ')
+		b++;
+	alen = strlen (a);
+	blen = strlen (b);
+	while (alen > 0 && a[alen - 1] == ' ')
+		alen--;
+	while (blen > 0 && b[blen - 1] == ' ')
+		blen--;
+	return alen == blen && strncasecmp (a, b, alen) == 0;
+}
+
+static void client_privmsg (const char *target, const char *text, unsigned long now)
+{
+	if (strcasecmp (target, channel) != 0)
+		return;
+	if (open_question == NULL || replied)
+	{
+		results.stray++;
+		return;
+	}
+
+	replied = 1;
+	latencies[nlatencies++] = now - asked_at;
+	if (open_question->expect != NULL && same_answer (text, open_question->expect))
+		results.correct++;
+	else
+		results.wrong++;
+}
+
+//Returns 1 once the client has joined and the replay can start
+static int client_line (char *line, unsigned long now)
+{
+	char *arg;
+	char *text;
+
+	arg = strchr (line, ' ');
+	if (arg != NULL)
+		*arg++ = '\0';
+	else
+		arg = line + strlen (line);
+
+	if (strcmp (line, "NICK") == 0)
+		snprintf (nick, sizeof(nick), "%s", arg);
+	else if (strcmp (line, "USER") == 0)
+	{
+		send_line (":mock 001 %s :Welcome to the replay", nick);
+		send_line (":mock 376 %s :End of MOTD", nick);
+	}
+	else if (strcmp (line, "PING") == 0)
+		send_line ("PONG %s", arg);
+	else if (strcmp (line, "JOIN") == 0 && channel[0] == '\0')
+	{
+		snprintf (channel, sizeof(channel), "%s", arg[0] == ':' ? arg + 1 : arg);
+		channel[strcspn (channel, " ,")] = '\0';
+		send_line (":%s!%s@mock JOIN :%s", nick, nick, channel);
+		send_line (":mock 353 %s = %s :%s", nick, channel, nick);
+		send_line (":mock 366 %s %s :End of /NAMES list.", nick, channel);
+		if (dropped_at != 0)
+		{
+			rejoins[nrejoins++] = now - dropped_at;
+			dropped_at = 0;
+		}
+		return 1;
+	}
+	else if (strcmp (line, "PRIVMSG") == 0 && (text = strstr (arg, " :")) != NULL)
+	{
+		*text = '\0';
+		client_privmsg (arg, text + 2, now);
+	}
+	return 0;
+}
+
+static int cmp_ulong (const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *) a;
+	unsigned long y = *(const unsigned long *) b;
+
+	return (x > y) - (x < y);
+}
+
+static unsigned long percentile (const unsigned long *sorted, int count, double p)
+{
+	int i;
+
+	if (count == 0)
+		return 0;
+	i = (int) (p * count);
+	if (i >= count)
+		i = count - 1;
+	return sorted[i];
+}
+
+static void report (void)
+{
+	qsort (latencies, nlatencies, sizeof(*latencies), cmp_ulong);
+	qsort (rejoins, nrejoins, sizeof(*rejoins), cmp_ulong);
+
+	fprintf (stdout, "questions %lu\n", results.questions);
+	fprintf (stdout, "known %lu\n", results.known);
+	fprintf (stdout, "correct %lu\n", results.correct);
+	fprintf (stdout, "wrong %lu\n", results.wrong);
+	fprintf (stdout, "missed %lu\n", results.missed);
+	fprintf (stdout, "stray %lu\n", results.stray);
+	fprintf (stdout, "hit_rate %.3f\n", results.known ? (double) results.correct / results.known : 0.0);
+	fprintf (stdout, "latency_p50_us %lu\n", percentile (latencies, nlatencies, 0.5));
+	fprintf (stdout, "latency_p99_us %lu\n", percentile (latencies, nlatencies, 0.99));
+	fprintf (stdout, "latency_max_us %lu\n", nlatencies ? latencies[nlatencies - 1] : 0);
+	if (nrejoins == 0)
+		return;
+	fprintf (stdout, "rejoins %d\n", nrejoins);
+	fprintf (stdout, "rejoin_p50_ms %lu\n", percentile (rejoins, nrejoins, 0.5) / 1000);
+	fprintf (stdout, "rejoin_max_ms %lu\n", rejoins[nrejoins - 1] / 1000);
+}
+
+//Closes the client's connection, the replay carries on once it has joined again
+static void drop_client (unsigned long now)
+{
+	close_question ();
+	if (client >= 0)
+		close (client);
+	client = -1;
+	channel[0] = '\0';
+	dropped_at = now;
+}
+
+static void print_usage (void)
+{
+	fprintf (stdout, "mockircd [options] <replay.log>\n");
+	fprintf (stdout, "Options:\n");
+	fprintf (stdout, "-p		Port to listen on, default %d\n", DEFAULT_PORT);
+	fprintf (stdout, "-s		Play the log this many times faster, default 1\n");
+	fprintf (stdout, "-n		Play the log this many times over, default 1\n");
+	fprintf (stdout, "-w		Milliseconds to wait for answers after the last line, default %d\n", DEFAULT_WAIT_MS);
+	fprintf (stdout, "-d		Disconnect the client before every this many questions\n");
+	fprintf (stdout, "-h		This help text\n");
+}
+
+int main (int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	struct pollfd pfd;
+	char buf[4096];
+	size_t buf_len = 0;
+	char *eol;
+	double speed = 1.0;
+	unsigned long wait_ms = DEFAULT_WAIT_MS;
+	unsigned long next_at = 0;
+	unsigned long now;
+	long timeout;
+	int port = DEFAULT_PORT;
+	int rounds = 1;
+	int drop_every = 0;
+	int asked = 0;			//Questions since the client last connected
+	int playing = 0;
+	int next = 0;
+	int listener;
+	int one = 1;
+	int c;
+	ssize_t n;
+
+	while ((c = getopt (argc, argv, "p:s:n:w:d:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'p':
+				port = atoi (optarg);
+				break;
+			case 's':
+				speed = atof (optarg);
+				break;
+			case 'n':
+				rounds = atoi (optarg);
+				break;
+			case 'w':
+				wait_ms = strtoul (optarg, NULL, 10);
+				break;
+			case 'd':
+				drop_every = atoi (optarg);
+				break;
+			default:
+				print_usage ();
+				return 1;
+		}
+	}
+	if (optind >= argc || speed <= 0 || rounds <= 0)
+	{
+		print_usage ();
+		return 1;
+	}
+
+	if (load_log (argv[optind]) || nevents == 0)
+	{
+		fprintf (stderr, "Error reading replay log %s\n", argv[optind]);
+		return 1;
+	}
+	latencies = calloc (nevents * rounds, sizeof(*latencies));
+	rejoins = calloc (nevents * rounds, sizeof(*rejoins));
+	if (latencies == NULL || rejoins == NULL)
+		return 1;
+
+	listener = socket (AF_INET, SOCK_STREAM, 0);
+	setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset (&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (port);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	if (listener < 0 || bind (listener, (struct sockaddr *) &addr, sizeof(addr)) || listen (listener, 1))
+	{
+		fprintf (stderr, "Error listening on port %d: %s\n", port, strerror (errno));
+		return 1;
+	}
+
+	for (;;)
+	{
+		if (client < 0)
+		{
+			pfd.fd = listener;
+			pfd.events = POLLIN;
+			if (poll (&pfd, 1, ACCEPT_TIMEOUT_MS) != 1 || (client = accept (listener, NULL, NULL)) < 0)
+			{
+				fprintf (stderr, "Nobody connected\n");
+				return 1;
+			}
+			buf_len = 0;
+			channel[0] = '\0';
+			playing = 0;
+			asked = 0;
+		}
+
+		now = now_us ();
+		if (playing && now >= next_at)
+		{
+			if (next == nevents * rounds)
+				break;
+			if (drop_every > 0 && events[next % nevents].question && ++asked > drop_every)
+			{
+				//Right before the question, with its prompt already out
+				drop_client (now);
+				continue;
+			}
+			play_line (&events[next % nevents]);
+			next++;
+			//Wait for late answers after the last line
+			if (next == nevents * rounds)
+				next_at += wait_ms * 1000;
+			else
+				next_at += events[next % nevents].delay * 1000 / speed;
+			continue;
+		}
+
+		timeout = playing ? (long) ((next_at - now + 999) / 1000) : -1;
+		pfd.fd = client;
+		pfd.events = POLLIN;
+		if (poll (&pfd, 1, timeout) < 0 && errno != EINTR)
+			break;
+		if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+			continue;
+
+		n = read (client, buf + buf_len, sizeof(buf) - buf_len - 1);
+		if (n <= 0 && drop_every > 0)
+		{
+			drop_client (now_us ());
+			continue;
+		}
+		if (n <= 0)
+			break;
+		now = now_us ();
+		buf_len += n;
+		buf[buf_len] = '\0';
+
+		while ((eol = strchr (buf, '\n')) != NULL)
+		{
+			*eol = '\0';
+			if (eol > buf && eol[-1] == '\r')
+				eol[-1] = '\0';
+			if (client_line (buf, now) && !playing)
+			{
+				playing = 1;
+				next_at = now + events[next % nevents].delay * 1000 / speed;
+			}
+			buf_len -= eol + 1 - buf;
+			memmove (buf, eol + 1, buf_len + 1);
+		}
+		//A line longer than the buffer, drop it
+		if (buf_len == sizeof(buf) - 1)
+			buf_len = 0;
+	}
+
+	close_question ();
+	close (listener);
+	if (client >= 0)
+	{
+		send_line ("ERROR :Closing link (replay finished)");
+		close (client);
+	}
+	report ();
+	return 0;
+}
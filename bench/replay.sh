@@ -0,0 +1,41 @@
+#!/bin/sh
+# Plays bench/replay.log to quizbot through bench/mockircd, all on localhost.
+# Usage: bench/replay.sh [speed] [rounds] [drop_every]
+#
+# The log is played speed times faster than recorded; keep questions at
+# least 2 seconds apart so the outbound flood control isn't what's measured.
+# With drop_every, quizbot is disconnected before every so many questions
+# and the time it takes to rejoin is reported too.
+
+SPEED=${1:-15}
+ROUNDS=${2:-1}
+DROP=${3:-0}
+PORT=${REPLAY_PORT:-16667}
+DIR=$(dirname "$0")
+CFG=$(mktemp /tmp/replay.cfg.XXXXXX)
+
+cat > "$CFG" <<CFG
+server=127.0.0.1
+port=$PORT
+channel=#quiz
+nick=quizbot
+quizbot_nick=juicer
+question_db=$DIR/replay.db
+# Nothing learned, so no replay.db.learned is left in the tree
+reveal_prompt=
+CFG
+
+"$DIR/mockircd" -p "$PORT" -s "$SPEED" -n "$ROUNDS" -d "$DROP" "$DIR/replay.log" &
+SERVER=$!
+# Give it a moment to start listening
+sleep 0.2
+
+"$DIR/../quizbot" -c "$CFG" > /dev/null &
+BOT=$!
+
+wait $SERVER
+STATUS=$?
+kill $BOT 2> /dev/null
+wait $BOT 2> /dev/null
+rm -f "$CFG"
+exit $STATUS
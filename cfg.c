@@ -0,0 +1,239 @@
+#include "cfg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#define CFG_LINE_MAX	1024
+
+#define CFG_OPTION(field)	{ #field, offsetof (struct cfg, field), sizeof(((struct cfg *) 0)->field), 0 }
+//For an option that's off when empty
+#define CFG_OPTION_OFF(field)	{ #field, offsetof (struct cfg, field), sizeof(((struct cfg *) 0)->field), 1 }
+
+static const struct {
+	const char *name;
+	size_t offset;
+	size_t size;
+	int empty_ok;
+} cfg_options[] = {
+	CFG_OPTION (server), CFG_OPTION (port), CFG_OPTION (channel), CFG_OPTION (nick),
+	CFG_OPTION (username), CFG_OPTION (realname),
+	CFG_OPTION_OFF (server_connect_msg), CFG_OPTION_OFF (server_connect_nick), CFG_OPTION (server_connect_delay),
+	CFG_OPTION_OFF (channel_connect_msg), CFG_OPTION_OFF (channel_connect_nick), CFG_OPTION (channel_connect_delay),
+	CFG_OPTION_OFF (admins),
+	CFG_OPTION (quizbot_nick), CFG_OPTION (question_db), CFG_OPTION (match_threshold),
+	CFG_OPTION_OFF (reveal_prompt), CFG_OPTION_OFF (plugins)
+};
+
+#define NUM_CFG_OPTS	(sizeof(cfg_options) / sizeof(cfg_options[0]))
+
+//The "name=value" string for name in extra, or the empty one at its end
+static char *find_extra (const struct cfg *cfg, const char *name, size_t name_len)
+{
+	const char *e;
+
+	for (e = cfg->extra; *e != '\0'; e += strlen (e) + 1)
+	{
+		if (strncmp (e, name, name_len) == 0 && e[name_len] == '=')
+			break;
+	}
+	return (char *) e;
+}
+
+//Replaces any earlier value, a section's copy of the defaults included
+static void set_extra (struct cfg *cfg, const char *name, size_t name_len, const char *value)
+{
+	char *end = cfg->extra + sizeof(cfg->extra);
+	char *e = find_extra (cfg, name, name_len);
+	char *last;
+	size_t len;
+
+	if (*e != '\0')
+	{
+		len = strlen (e) + 1;
+		last = find_extra (cfg, "", 0);
+		memmove (e, e + len, last + 1 - (e + len));
+	}
+	e = find_extra (cfg, "", 0);
+	len = name_len + 1 + strlen (value) + 1;
+	//The empty string ending the list takes the last byte
+	if (len >= (size_t) (end - e))
+	{
+		fprintf (stderr, "IRC: No room for cfg option %.*s, ignoring it\n", (int) name_len, name);
+		return;
+	}
+	sprintf (e, "%.*s=%s", (int) name_len, name, value);
+	e[len] = '\0';
+}
+
+static int set_option (struct cfg *cfg, const char *name, size_t name_len, const char *value)
+{
+	char *var;
+	size_t i;
+
+	//Cycle through the different options
+	for (i = 0; i < NUM_CFG_OPTS; i++)
+	{
+		if (strlen (cfg_options[i].name) != name_len || strncmp (name, cfg_options[i].name, name_len) != 0)
+			continue;
+
+		if (*value == '\0' && !cfg_options[i].empty_ok)
+		{
+			fprintf (stderr, "IRC: Empty cfg option %s\n", cfg_options[i].name);
+			return 1;
+		}
+		if (strlen (value) >= cfg_options[i].size)
+			fprintf (stderr, "IRC: cfg option %s too long, truncating it\n", cfg_options[i].name);
+
+		var = (char *) cfg + cfg_options[i].offset;
+		strncpy (var, value, cfg_options[i].size - 1);
+		var[cfg_options[i].size - 1] = '\0';
+		return 0;
+	}
+	//Anything we don't know about is kept for the plugins
+	if (name_len > 0)
+		set_extra (cfg, name, name_len, value);
+	return 0;
+}
+
+int cfg_read (const char *path, const struct cfg *defaults, struct cfg **cfgs, int *count)
+{
+	FILE *in_file;
+	char line[CFG_LINE_MAX];
+	struct cfg base = *defaults;
+	struct cfg *list = NULL;
+	struct cfg *cur = &base;
+	struct cfg *grown;
+	char *eq;
+	char *end;
+	int n = 0;
+
+	in_file = fopen (path, "r");
+
+	while (in_file != NULL && fgets (line, sizeof(line), in_file) != NULL)
+	{
+		line[strcspn (line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		//Start of a new session
+		if (line[0] == '[')
+		{
+			end = strchr (line, ']');
+			if (end == NULL || end == line + 1)
+			{
+				fprintf (stderr, "IRC: Bad cfg section %s\n", line);
+				goto fail;
+			}
+			*end = '\0';
+
+			grown = realloc (list, (n + 1) * sizeof(*list));
+			if (grown == NULL)
+				goto fail;
+			list = grown;
+			cur = &list[n++];
+			*cur = base;
+			strncpy (cur->name, line + 1, sizeof(cur->name) - 1);
+			cur->name[sizeof(cur->name) - 1] = '\0';
+			continue;
+		}
+
+		//Make sure there's a = after the option
+		eq = strchr (line, '=');
+		if (eq == NULL)
+			continue;
+		if (set_option (cur, line, eq - line, eq + 1))
+			goto fail;
+	}
+	if (in_file != NULL)
+		fclose (in_file);
+
+	//No sections, the defaults are the only session
+	if (n == 0)
+	{
+		list = malloc (sizeof(*list));
+		if (list == NULL)
+			return 2;
+		list[0] = base;
+		n = 1;
+	}
+	*cfgs = list;
+	*count = n;
+	return in_file == NULL ? 1 : 0;
+
+fail:
+	fclose (in_file);
+	free (list);
+	return 2;
+}
+
+const char *cfg_get (const struct cfg *cfg, const char *name)
+{
+	const char *e;
+	size_t len = strlen (name);
+	size_t i;
+
+	for (i = 0; i < NUM_CFG_OPTS; i++)
+	{
+		if (strcmp (name, cfg_options[i].name) == 0)
+			return (const char *) cfg + cfg_options[i].offset;
+	}
+	e = find_extra (cfg, name, len);
+	return *e != '\0' ? e + len + 1 : NULL;
+}
+
+struct cfg *cfg_find (struct cfg *cfgs, int count, const char *name)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (strcmp (cfgs[i].name, name) == 0)
+			return &cfgs[i];
+	}
+	return NULL;
+}
+
+static int list_has (const char *list, const char *item, size_t len)
+{
+	const char *next;
+
+	for (; *list != '\0'; list = next + (*next == ','))
+	{
+		next = strchr (list, ',');
+		if (next == NULL)
+			next = list + strlen (list);
+		if ((size_t) (next - list) == len && strncasecmp (list, item, len) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+int cfg_list_has (const char *list, const char *item)
+{
+	return list_has (list, item, strlen (item));
+}
+
+void cfg_list_minus (const char *list, const char *other, char *out, size_t size)
+{
+	const char *next;
+	size_t used = 0;
+	size_t len;
+
+	out[0] = '\0';
+	for (; *list != '\0'; list = next + (*next == ','))
+	{
+		next = strchr (list, ',');
+		if (next == NULL)
+			next = list + strlen (list);
+		len = next - list;
+		if (len == 0 || list_has (other, list, len) || used + len + 2 > size)
+			continue;
+		if (used > 0)
+			out[used++] = ',';
+		memcpy (out + used, list, len);
+		used += len;
+		out[used] = '\0';
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stddef.h>
+
+/*
+   Config file shared by both bots.
+
+   Options are "name=value" lines. Those before the first "[name]" line
+   are defaults, and every "[name]" line after that starts a session of
+   its own which begins as a copy of the defaults. A file without any
+   sections describes a single session.
+
+   Options neither bot knows are kept as they are in extra, for ircbot's
+   plugins to read through cfg_get.
+*/
+
+//Room for the options kept in extra, names and values together
+#define CFG_EXTRA_MAX	2048
+
+struct cfg {
+	char name[64];		//Section name, empty for a file without sections
+	char server[255];
+	char port[16];
+	char channel[255];		//Channels to join, separated by commas
+	char nick[64];
+	char username[16];
+	char realname[16];
+	char server_connect_msg[255];
+	char server_connect_nick[16];
+	char server_connect_delay[6];
+	char channel_connect_msg[255];
+	char channel_connect_nick[16];
+	char channel_connect_delay[6];
+	char admins[255];		//Nicks allowed to run admin commands, see cmd.h
+	//Only used by quizbot and the quiz plugin
+	char quizbot_nick[255];		//Quizbots to listen to, separated by commas
+	char question_db[255];
+	char match_threshold[8];
+	char reveal_prompt[64];		//Comes before the answer when the quiz gives it away
+	//Only used by ircbot
+	char plugins[255];		//Shared objects to load, see plugin.h
+	//"name=value" strings one after the other, up to an empty one
+	char extra[CFG_EXTRA_MAX];
+};
+
+//Fills in *cfgs (to be freed by the caller) with *count sessions. Returns 0 on
+//success, 1 if the file can't be opened so the defaults are the only session,
+//and 2 if it's malformed
+int cfg_read (const char *path, const struct cfg *defaults, struct cfg **cfgs, int *count);
+
+//The value of option name, known or in extra, NULL if it isn't set
+const char *cfg_get (const struct cfg *cfg, const char *name);
+
+//The session called name in cfgs, NULL if there isn't one
+struct cfg *cfg_find (struct cfg *cfgs, int count, const char *name);
+
+//Writes to out the items of the comma separated list that aren't in other, compared without
+//case as IRC does for channels and nicks
+void cfg_list_minus (const char *list, const char *other, char *out, size_t size);
+//1 if item is in the comma separated list, compared without case
+int cfg_list_has (const char *list, const char *item);
+
+#endif
@@ -0,0 +1,86 @@
+#include "cmd.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+const struct cmd *cmd_find (const struct cmd_table *t, const char *name, size_t len)
+{
+	const struct cmd *c;
+	unsigned int slot;
+
+	slot = t->slots[cmd_slot (t, cmd_hash (t->seed, name, len))];
+	if (slot == 0)
+		return NULL;
+	//Whatever hashes here, the only command it can be is this one
+	c = &t->commands[slot - 1];
+	if (c->len != len || strncasecmp (c->name, name, len) != 0)
+		return NULL;
+	return c;
+}
+
+void cmd_describe (const struct cmd_table *t, const struct cmd_call *call, char *out, size_t size)
+{
+	const struct cmd *c;
+	size_t used;
+	unsigned int i;
+
+	if (call->nargs > 0)
+	{
+		//"!help !stats" as well as "!help stats"
+		c = call->args[0].len > 0 && call->args[0].p[0] == CMD_PREFIX ?
+				cmd_find (t, call->args[0].p + 1, call->args[0].len - 1) : cmd_find (t, call->args[0].p, call->args[0].len);
+		if (c != NULL)
+			snprintf (out, size, "%c%s %s%s", CMD_PREFIX, c->name, c->usage, c->flags & CMD_ADMIN ? " (admins only)" : "");
+		else
+			snprintf (out, size, "No such command %.*s", (int) call->args[0].len, call->args[0].p);
+		return;
+	}
+
+	used = snprintf (out, size, "Commands:");
+	for (i = 0; i < t->count && used < size; i++)
+		used += snprintf (out + used, size - used, " %c%s", CMD_PREFIX, t->commands[i].name);
+}
+
+//Splits what follows the command into words, on spaces as IRC does
+static void split_args (const char *text, struct cmd_call *call)
+{
+	const char *end;
+
+	text += strspn (text, " ");
+	end = text + strlen (text);
+	while (end > text && end[-1] == ' ')
+		end--;
+	call->rest.p = end > text ? text : NULL;
+	call->rest.len = end - text;
+
+	call->nargs = 0;
+	while (text < end && call->nargs < CMD_MAX_ARGS)
+	{
+		call->args[call->nargs].p = text;
+		text += strcspn (text, " ");
+		call->args[call->nargs].len = text - call->args[call->nargs].p;
+		call->nargs++;
+		text += strspn (text, " ");
+	}
+}
+
+enum cmd_result cmd_dispatch (const struct cmd_table *t, void *ctx, const char *origin, const char *text,
+		int admin, struct cmd_call *call)
+{
+	size_t len;
+
+	if (text[0] != CMD_PREFIX)
+		return CMD_NONE;
+	text++;
+	len = strcspn (text, " ");
+	call->cmd = cmd_find (t, text, len);
+	if (call->cmd == NULL)
+		return CMD_UNKNOWN;
+	if ((call->cmd->flags & CMD_ADMIN) && !admin)
+		return CMD_DENIED;
+
+	call->origin = origin;
+	split_args (text + len, call);
+	call->cmd->func (ctx, call);
+	return CMD_RUN;
+}
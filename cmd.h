@@ -0,0 +1,109 @@
+#ifndef CMD_H
+#define CMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ircmsg.h"
+
+/*
+   Commands sent to a bot in a private message, like "!lookup question".
+
+   Each bot lists its commands in a .cmds file, one per line:
+
+	#name	handler		flags	usage
+	stats	cmd_stats	-	Uptime and counters
+	reload	cmd_reload	admin	Read the config file again
+
+   and cmdgen turns that into a C file at build time: the handler
+   prototypes, the commands in file order, and a perfect hash over
+   them. The hash of a name picks a bucket, and the displacement cmdgen
+   worked out for that bucket moves it to a slot no other command has,
+   so finding a command is one hash, two table reads and one compare
+   against the only command it can be, however many there are. To add
+   one, write the handler and a line in the .cmds file.
+
+   A handler gets the words after the command as irc_str slices of the
+   message, which are only good until it returns and aren't NUL
+   terminated.
+*/
+
+#define CMD_PREFIX	'!'
+//Words split out of a command, any more are only in rest
+#define CMD_MAX_ARGS	8
+//Commands a table can hold, slots are a byte
+#define CMD_MAX		255
+
+//Only run for nicks in the admins option
+#define CMD_ADMIN	0x1
+
+struct cmd;
+
+struct cmd_call {
+	const struct cmd *cmd;
+	const char *origin;
+	struct irc_str args[CMD_MAX_ARGS];
+	int nargs;
+	struct irc_str rest;	//Everything after the command, without the spaces around it
+};
+
+typedef void (*cmd_func) (void *ctx, const struct cmd_call *call);
+
+struct cmd {
+	const char *name;
+	size_t len;
+	cmd_func func;
+	unsigned int flags;
+	const char *usage;
+};
+
+struct cmd_table {
+	uint32_t seed;
+	unsigned int buckets_mask;	//Buckets less one, a power of two
+	const uint16_t *displace;	//Added to the slot of every command in the bucket
+	unsigned int slots_mask;
+	const unsigned char *slots;	//Index into commands plus one, 0 for an empty slot
+	const struct cmd *commands;	//As they are in the .cmds file
+	unsigned int count;
+};
+
+enum cmd_result {
+	CMD_NONE,	//Not a command, just a message
+	CMD_RUN,
+	CMD_UNKNOWN,
+	CMD_DENIED	//An admin command from someone else
+};
+
+//FNV-1a over the name folded to lower case, shared by cmdgen and cmd_find. The low
+//bits pick the bucket and the high ones the slot before displacing it
+static inline uint32_t cmd_hash (uint32_t seed, const char *name, size_t len)
+{
+	uint32_t h = 2166136261u ^ seed;
+	unsigned char c;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		c = name[i];
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h = (h ^ c) * 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+static inline unsigned int cmd_slot (const struct cmd_table *t, uint32_t h)
+{
+	return ((h >> 16) + t->displace[h & t->buckets_mask]) & t->slots_mask;
+}
+
+//Runs the command text starts with, if it's one, filling in call for the handler
+enum cmd_result cmd_dispatch (const struct cmd_table *t, void *ctx, const char *origin, const char *text,
+		int admin, struct cmd_call *call);
+
+//NULL if there's no such command
+const struct cmd *cmd_find (const struct cmd_table *t, const char *name, size_t len);
+
+//What !help replies: every command, or the usage of the one named in the call's first argument
+void cmd_describe (const struct cmd_table *t, const struct cmd_call *call, char *out, size_t size);
+
+#endif
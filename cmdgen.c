@@ -0,0 +1,303 @@
+#include "cmd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+   Build time generator for a bot's command table, see cmd.h.
+
+   Reads a .cmds file and writes the C file with its perfect hash. The
+   table is named after the file, so ircbot.cmds gives ircbot_commands.
+*/
+
+#define CMDGEN_LINE_MAX		512
+//Seeds tried before giving up, a few usually do
+#define CMDGEN_SEEDS		100000
+
+struct entry {
+	char name[64];
+	char handler[64];
+	unsigned int flags;
+	char usage[256];
+};
+
+static struct entry entries[CMD_MAX];
+static unsigned int count;
+
+//The table being built, in the shape cmd_slot reads
+static uint16_t displace[CMD_MAX];
+static unsigned char slots[CMD_MAX * 2 + 2];
+static struct cmd_table hash = { 0, 0, displace, 0, slots, NULL, 0 };
+static uint32_t hashes[CMD_MAX];
+
+static void print_usage (const char *name)
+{
+	fprintf (stderr, "Usage: %s <commands.cmds> <commands.c>\n", name);
+}
+
+static int is_ident (const char *s, int allow_dash)
+{
+	if (*s == '\0' || isdigit ((unsigned char) *s))
+		return 0;
+	for (; *s != '\0'; s++)
+	{
+		if (!isalnum ((unsigned char) *s) && *s != '_' && !(allow_dash && *s == '-'))
+			return 0;
+	}
+	return 1;
+}
+
+static int read_cmds (const char *path)
+{
+	char line[CMDGEN_LINE_MAX];
+	char flags[32];
+	struct entry *e;
+	FILE *in;
+	char *usage;
+	char *p;
+	int line_no = 0;
+	int n;
+	unsigned int i;
+
+	in = fopen (path, "r");
+	if (in == NULL)
+	{
+		fprintf (stderr, "Can't open %s\n", path);
+		return 1;
+	}
+	while (fgets (line, sizeof(line), in) != NULL)
+	{
+		line_no++;
+		line[strcspn (line, "\r\n")] = '\0';
+		p = line + strspn (line, " \t");
+		if (*p == '\0' || *p == '#')
+			continue;
+		if (count == CMD_MAX)
+		{
+			fprintf (stderr, "More than %d commands in %s\n", CMD_MAX, path);
+			goto fail;
+		}
+
+		e = &entries[count];
+		n = 0;
+		if (sscanf (p, "%63s %63s %31s %n", e->name, e->handler, flags, &n) < 3 || n == 0)
+			goto bad;
+		usage = p + n;
+		snprintf (e->usage, sizeof(e->usage), "%s", usage);
+
+		for (p = e->name; *p != '\0'; p++)
+			*p = tolower ((unsigned char) *p);
+		if (!is_ident (e->name, 1) || !is_ident (e->handler, 0))
+			goto bad;
+		if (strcmp (flags, "admin") == 0)
+			e->flags = CMD_ADMIN;
+		else if (strcmp (flags, "-") == 0)
+			e->flags = 0;
+		else
+			goto bad;
+
+		for (i = 0; i < count; i++)
+		{
+			if (strcmp (entries[i].name, e->name) == 0)
+			{
+				fprintf (stderr, "%s is listed twice in %s, on line %d\n", e->name, path, line_no);
+				goto fail;
+			}
+		}
+		count++;
+	}
+	fclose (in);
+	if (count == 0)
+	{
+		fprintf (stderr, "No commands in %s\n", path);
+		return 1;
+	}
+	return 0;
+
+bad:
+	fprintf (stderr, "Bad command on line %d of %s, expected name, handler, admin or - and the usage\n", line_no, path);
+fail:
+	fclose (in);
+	return 1;
+}
+
+//Buckets are filled from the fullest down, each with the first displacement that lands all of
+//its commands on free slots. Commands a seed puts in one bucket and one slot never separate
+static int try_seed (uint32_t seed)
+{
+	unsigned int members[CMD_MAX];
+	unsigned int fill[CMD_MAX];
+	unsigned int n;
+	unsigned int b;
+	unsigned int d;
+	unsigned int i;
+	unsigned int j;
+
+	hash.seed = seed;
+	memset (fill, 0, sizeof(fill));
+	for (i = 0; i < count; i++)
+	{
+		hashes[i] = cmd_hash (seed, entries[i].name, strlen (entries[i].name));
+		fill[hashes[i] & hash.buckets_mask]++;
+	}
+	memset (slots, 0, sizeof(slots));
+	memset (displace, 0, sizeof(displace));
+
+	for (n = count; n > 0; n--)
+	{
+		for (b = 0; b <= hash.buckets_mask; b++)
+		{
+			if (fill[b] != n)
+				continue;
+			for (i = 0, j = 0; i < count; i++)
+			{
+				if ((hashes[i] & hash.buckets_mask) == b)
+					members[j++] = i;
+			}
+			for (d = 0; d <= hash.slots_mask; d++)
+			{
+				displace[b] = d;
+				for (j = 0; j < n && slots[cmd_slot (&hash, hashes[members[j]])] == 0; j++)
+					slots[cmd_slot (&hash, hashes[members[j]])] = members[j] + 1;
+				if (j == n)
+					break;
+				while (j-- > 0)
+					slots[cmd_slot (&hash, hashes[members[j]])] = 0;
+			}
+			if (d > hash.slots_mask)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+//Half as many buckets as commands and twice as many slots leaves plenty of seeds that work
+static int build_hash (void)
+{
+	unsigned int size;
+	uint32_t seed;
+
+	for (size = 1; size < count / 2; size *= 2)
+		;
+	hash.buckets_mask = size - 1;
+	for (size = 1; size < count * 2; size *= 2)
+		;
+	hash.slots_mask = size - 1;
+
+	for (seed = 0; seed < CMDGEN_SEEDS; seed++)
+	{
+		if (try_seed (seed) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+static void write_string (FILE *out, const char *s)
+{
+	fputc ('"', out);
+	for (; *s != '\0'; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fputc ('\\', out);
+		fputc (*s, out);
+	}
+	fputc ('"', out);
+}
+
+static void write_array (FILE *out, const char *type, const char *name, unsigned int size, const unsigned int *values)
+{
+	unsigned int i;
+
+	fprintf (out, "static const %s %s[%u] = {", type, name, size);
+	for (i = 0; i < size; i++)
+		fprintf (out, "%s%u", i == 0 ? "\n\t" : i % 16 == 0 ? ",\n\t" : ", ", values[i]);
+	fprintf (out, "\n};\n\n");
+}
+
+static void write_table (FILE *out, const char *source, const char *table)
+{
+	unsigned int values[CMD_MAX * 2 + 2];
+	unsigned int i;
+	unsigned int j;
+
+	fprintf (out, "//Generated by cmdgen from %s, edit that instead\n", source);
+	fprintf (out, "#include \"cmd.h\"\n\n");
+
+	for (i = 0; i < count; i++)
+	{
+		//Two commands can share a handler
+		for (j = 0; j < i && strcmp (entries[j].handler, entries[i].handler) != 0; j++)
+			;
+		if (j == i)
+			fprintf (out, "void %s (void *ctx, const struct cmd_call *call);\n", entries[i].handler);
+	}
+
+	fprintf (out, "\nstatic const struct cmd commands[%u] = {\n", count);
+	for (i = 0; i < count; i++)
+	{
+		fprintf (out, "\t{ \"%s\", %zu, %s, %s, ", entries[i].name, strlen (entries[i].name), entries[i].handler,
+				entries[i].flags & CMD_ADMIN ? "CMD_ADMIN" : "0");
+		write_string (out, entries[i].usage);
+		fprintf (out, " },\n");
+	}
+	fprintf (out, "};\n\n");
+
+	for (i = 0; i <= hash.buckets_mask; i++)
+		values[i] = displace[i];
+	write_array (out, "uint16_t", "displace", hash.buckets_mask + 1, values);
+	for (i = 0; i <= hash.slots_mask; i++)
+		values[i] = slots[i];
+	write_array (out, "unsigned char", "slots", hash.slots_mask + 1, values);
+
+	fprintf (out, "const struct cmd_table %s = { %uu, %u, displace, %u, slots, commands, %u };\n",
+			table, hash.seed, hash.buckets_mask, hash.slots_mask, count);
+}
+
+int main (int argc, char **argv)
+{
+	char table[128];
+	const char *base;
+	FILE *out;
+	size_t len;
+
+	if (argc != 3)
+	{
+		print_usage (argv[0]);
+		return 1;
+	}
+
+	//ircbot.cmds becomes ircbot_commands
+	base = strrchr (argv[1], '/');
+	base = base != NULL ? base + 1 : argv[1];
+	len = strcspn (base, ".");
+	snprintf (table, sizeof(table), "%.*s_commands", (int) len, base);
+	if (!is_ident (table, 0))
+	{
+		fprintf (stderr, "%s doesn't make a C name for the table\n", argv[1]);
+		return 1;
+	}
+
+	if (read_cmds (argv[1]))
+		return 1;
+	if (build_hash ())
+	{
+		fprintf (stderr, "No perfect hash found for the commands in %s\n", argv[1]);
+		return 1;
+	}
+
+	out = fopen (argv[2], "w");
+	if (out == NULL)
+	{
+		fprintf (stderr, "Can't write %s\n", argv[2]);
+		return 1;
+	}
+	write_table (out, argv[1], table);
+	if (fclose (out) != 0)
+	{
+		fprintf (stderr, "Error writing %s\n", argv[2]);
+		remove (argv[2]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include "epoch.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+//Each on its own cache line, readers only ever write their own
+struct epoch_slot {
+	unsigned long active;	//Epoch seen on entering, 0 when outside
+} __attribute__ ((aligned (64)));
+
+struct retired {
+	struct retired *next;
+	unsigned long epoch;
+	void (*func) (void *ptr);
+	void *ptr;
+};
+
+static struct epoch_slot slots[EPOCH_MAX_THREADS];
+static int nslots;
+static unsigned long global_epoch = 1;
+
+static __thread struct epoch_slot *mine;
+
+//Loop thread only
+static struct retired *retired;
+
+static struct epoch_slot *slot (void)
+{
+	int n;
+
+	if (mine != NULL)
+		return mine;
+	n = __atomic_fetch_add (&nslots, 1, __ATOMIC_SEQ_CST);
+	if (n >= EPOCH_MAX_THREADS)
+	{
+		//Reading without a slot could see memory being freed, better to stop here
+		fprintf (stderr, "IRC: More than %d threads reading shared data\n", EPOCH_MAX_THREADS);
+		abort ();
+	}
+	mine = &slots[n];
+	return mine;
+}
+
+void epoch_enter (void)
+{
+	struct epoch_slot *s = slot ();
+
+	//Sequentially consistent, so the load of whatever is being protected can't move above this
+	__atomic_store_n (&s->active, __atomic_load_n (&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+void epoch_exit (void)
+{
+	__atomic_store_n (&mine->active, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_retire (void (*func) (void *ptr), void *ptr)
+{
+	struct retired *r;
+
+	r = malloc (sizeof(*r));
+	if (r == NULL)
+	{
+		//Leaking it is the only safe option
+		fprintf (stderr, "IRC: Out of memory retiring old data, it won't be freed\n");
+		return;
+	}
+	r->func = func;
+	r->ptr = ptr;
+	//Anyone who entered at this epoch or before may still have the old pointer,
+	//anyone entering after the increment is guaranteed to see the new one
+	r->epoch = __atomic_fetch_add (&global_epoch, 1, __ATOMIC_SEQ_CST);
+	r->next = retired;
+	retired = r;
+	epoch_reclaim ();
+}
+
+int epoch_reclaim (void)
+{
+	struct retired **pr = &retired;
+	struct retired *r;
+	unsigned long oldest = 0;
+	unsigned long active;
+	int count;
+	int left = 0;
+	int i;
+
+	count = __atomic_load_n (&nslots, __ATOMIC_SEQ_CST);
+	if (count > EPOCH_MAX_THREADS)
+		count = EPOCH_MAX_THREADS;
+	for (i = 0; i < count; i++)
+	{
+		active = __atomic_load_n (&slots[i].active, __ATOMIC_SEQ_CST);
+		if (active != 0 && (oldest == 0 || active < oldest))
+			oldest = active;
+	}
+
+	while ((r = *pr) != NULL)
+	{
+		if (oldest != 0 && r->epoch >= oldest)
+		{
+			pr = &r->next;
+			left++;
+			continue;
+		}
+		*pr = r->next;
+		r->func (r->ptr);
+		free (r);
+	}
+	return left;
+}
@@ -0,0 +1,28 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+   Epoch based reclamation, for data the loop thread replaces while other
+   threads may still be reading the old copy.
+
+   A reader brackets its use of the shared pointer with epoch_enter and
+   epoch_exit, which are a couple of stores and never wait. The loop
+   thread publishes the replacement, then hands the old copy to
+   epoch_retire, and it is freed by a later epoch_reclaim once every
+   reader that could have seen it has left.
+
+   Readers mustn't nest epoch_enter. epoch_retire and epoch_reclaim are
+   only to be called from the loop thread.
+*/
+
+//Threads that can ever enter, the loop thread and the workers
+#define EPOCH_MAX_THREADS	64
+
+void epoch_enter (void);
+void epoch_exit (void);
+
+void epoch_retire (void (*func) (void *ptr), void *ptr);
+//Frees what no reader can still see, returns how many are left waiting
+int epoch_reclaim (void);
+
+#endif
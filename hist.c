@@ -0,0 +1,77 @@
+#include "hist.h"
+
+int hist_bucket (unsigned long us)
+{
+	int e;
+
+	if (us < HIST_SUB_BUCKETS)
+		return us;
+	if (us >> HIST_MAGNITUDES)
+		return HIST_BUCKETS - 1;
+
+	//Top bit picks the power of two, the HIST_SUB_BITS under it the bucket within it
+	e = 63 - __builtin_clzl (us);
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + ((us >> (e - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+}
+
+unsigned long hist_bucket_max (int n)
+{
+	int shift;
+
+	if (n < HIST_SUB_BUCKETS)
+		return n;
+	shift = n / HIST_SUB_BUCKETS - 1;
+	return ((unsigned long) (n % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+void hist_add (struct hist *h, unsigned long us)
+{
+	h->bucket[hist_bucket (us)]++;
+	h->count++;
+	h->sum += us;
+	if (us > h->max)
+		h->max = us;
+}
+
+void hist_merge (struct hist *into, const struct hist *h)
+{
+	int n;
+
+	for (n = 0; n < HIST_BUCKETS; n++)
+		into->bucket[n] += h->bucket[n];
+	into->count += h->count;
+	into->sum += h->sum;
+	if (h->max > into->max)
+		into->max = h->max;
+}
+
+unsigned long hist_percentile (const struct hist *h, double p)
+{
+	unsigned long want = (unsigned long) (h->count * p);
+	unsigned long seen = 0;
+	int n;
+
+	if (h->count == 0)
+		return 0;
+	for (n = 0; n < HIST_BUCKETS; n++)
+	{
+		seen += h->bucket[n];
+		if (seen > want)
+			break;
+	}
+	if (n >= HIST_BUCKETS)
+		return h->max;
+	//Never claim more than was actually seen
+	return hist_bucket_max (n) < h->max ? hist_bucket_max (n) : h->max;
+}
+
+void hist_dump_header (FILE *out)
+{
+	fprintf (out, "%-16s %8s %10s %10s %10s %10s\n", "Latency (us)", "Count", "Avg", "p50", "p99", "Max");
+}
+
+void hist_dump (const struct hist *h, const char *name, FILE *out)
+{
+	fprintf (out, "%-16s %8lu %10lu %10lu %10lu %10lu\n", name, h->count,
+			h->count ? h->sum / h->count : 0, hist_percentile (h, 0.5), hist_percentile (h, 0.99), h->max);
+}
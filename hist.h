@@ -0,0 +1,41 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdio.h>
+
+/*
+   Latency histogram in microseconds, HDR style: values below
+   HIST_SUB_BUCKETS get a bucket each, and every power of two above that is
+   split into HIST_SUB_BUCKETS linear buckets. Percentiles are reported as
+   the upper bound of the bucket they fall in, so they are accurate to
+   within 1/HIST_SUB_BUCKETS (12.5%) at any scale. Anything over 2^40us
+   (about 12 days) lands in the last bucket.
+
+   A histogram isn't locked, each one should only be added to by one
+   thread; merge them afterwards.
+*/
+
+#define HIST_SUB_BITS		3
+#define HIST_SUB_BUCKETS	(1 << HIST_SUB_BITS)
+#define HIST_MAGNITUDES		40
+#define HIST_BUCKETS		((HIST_MAGNITUDES - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct hist {
+	unsigned long count;
+	unsigned long sum;
+	unsigned long max;
+	unsigned long bucket[HIST_BUCKETS];
+};
+
+//Which bucket us goes in, and the largest value that bucket holds
+int hist_bucket (unsigned long us);
+unsigned long hist_bucket_max (int n);
+
+void hist_add (struct hist *h, unsigned long us);
+void hist_merge (struct hist *into, const struct hist *h);
+unsigned long hist_percentile (const struct hist *h, double p);
+
+void hist_dump_header (FILE *out);
+void hist_dump (const struct hist *h, const char *name, FILE *out);
+
+#endif
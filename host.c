@@ -0,0 +1,585 @@
+#include "host.h"
+#include "libircclient/libirc_rfcnumeric.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <signal.h>
+#include "loop.h"
+#include "metrics.h"
+#include "trace.h"
+
+int verbose = 0;
+
+static const struct host_role *role;
+static char cfg_file[1024];
+static int use_default_cfg = 1;
+static char *metrics_socket = NULL;
+static char *metrics_path = NULL;
+static char *trace_path = NULL;
+
+//The sessions, role->size bytes apart
+static char *bots;
+static int nbots;
+static unsigned long started_ms;
+
+int host_sessions (void)
+{
+	return nbots;
+}
+
+struct host_session *host_session (int i)
+{
+	return (struct host_session *) (bots + i * role->size);
+}
+
+static void to_role (struct host_session *s, enum host_event type, unsigned int numeric,
+		const char *origin, const char *target, const char *text)
+{
+	if (role->event != NULL)
+		role->event (s, type, numeric, origin, target, text);
+}
+
+static void join_channel (struct host_session *s);
+
+//Sent on successful connection to server, useful for NickServ
+static void send_server_connect_msg (void *arg)
+{
+	struct host_session *s = arg;
+
+	if (verbose)
+		fprintf (stdout, "IRC: Sending server_connect_msg\n");
+	outq_msg (&s->out_queue, OUTQ_SERVICE, s->cfg.server_connect_nick, s->cfg.server_connect_msg);
+
+	//Join only now, so the channel sees us identified
+	join_channel (s);
+}
+
+//Sent on successful connection to channel, useful for ChanServ
+static void send_channel_connect_msg (void *arg)
+{
+	struct host_session *s = arg;
+
+	if (verbose)
+		fprintf (stdout, "IRC: Sending channel_connect_msg\n");
+	outq_msg (&s->out_queue, OUTQ_SERVICE, s->cfg.channel_connect_nick, s->cfg.channel_connect_msg);
+}
+
+//Runs the timer's function after delay seconds, or straight away if there's no delay or now is set
+static void run_delayed (struct timer *t, const char *delay, int now)
+{
+	if (atoi (delay) > 0 && !now)
+	{
+		if (verbose)
+			fprintf (stdout, "IRC: Waiting %i seconds before sending command\n", atoi (delay));
+		timer_add (t, atoi (delay) * 1000);
+	}
+	else
+		t->func (t->arg);
+}
+
+static void join_channel (struct host_session *s)
+{
+	char join[OUTQ_LINE_MAX];
+
+	if (verbose)
+		fprintf (stdout, "IRC: Attempting to join %s\n", s->cfg.channel);
+
+	//Queued behind server_connect_msg, so it still goes out first
+	snprintf (join, sizeof(join), "JOIN %s", s->cfg.channel);
+	if (outq_send (&s->out_queue, OUTQ_SERVICE, join))
+	{
+		fprintf (stderr, "IRC: Error joining channel %s\n", s->cfg.channel);
+		return;
+	}
+	s->joined = 1;
+
+	fprintf (stdout, "IRC: Connected to %s\n", s->cfg.channel);
+
+	//Check to see if we have commands to run
+	if (strlen (s->cfg.channel_connect_msg) != 0)
+	{
+		//Make sure a nick was specified
+		if (strlen (s->cfg.channel_connect_nick) == 0)
+		{
+			fprintf (stderr, "IRC: channel_connect_msg specified but not channel_connect_nick\n");
+			return;
+		}
+		run_delayed (&s->channel_connect_timer, s->cfg.channel_connect_delay, s->rejoining);
+	}
+}
+
+//Called when successfully connected to a server
+static void event_connect (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	struct host_session *s = irc_get_ctx (session);
+
+	metric_inc (METRIC_EVENT_CONNECT);
+	s->rejoining = reconnect_connected (&s->reconnect);
+	if (s->rejoining)
+		metric_inc (METRIC_RECONNECT);
+	fprintf (stdout, "IRC: Successfully connected to server %s\n", s->cfg.server);
+	to_role (s, HOST_CONNECT, 0, NULL, NULL, NULL);
+
+	//Check to see if we have commands to run
+	if (strlen (s->cfg.server_connect_msg) != 0)
+	{
+		//Make sure a nick was specified
+		if (strlen (s->cfg.server_connect_nick) != 0)
+		{
+			run_delayed (&s->server_connect_timer, s->cfg.server_connect_delay, s->rejoining);
+			return;
+		}
+		fprintf (stderr, "IRC: server_connect_msg specified but not server_connect_nick\n");
+	}
+	join_channel (s);
+}
+
+static void event_privmsg (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	struct host_session *s = irc_get_ctx (session);
+	struct cmd_call call;
+	enum cmd_result result = CMD_NONE;
+
+	metric_inc (METRIC_EVENT_PRIVMSG);
+	if (count < 2)
+		return;
+	if (origin != NULL)
+		result = cmd_dispatch (role->commands, s, origin, params[1], cfg_list_has (s->cfg.admins, origin), &call);
+
+	switch (result)
+	{
+		case CMD_NONE:
+			printf ("'%s' said to me (%s): %s\n", origin ? origin : "someone", params[0], params[1] );
+			to_role (s, HOST_PRIVMSG, 0, origin, params[0], params[1]);
+			break;
+		case CMD_RUN:
+			metric_inc (METRIC_COMMAND);
+			if (verbose)
+				fprintf (stdout, "IRC: %s ran %c%s\n", origin, CMD_PREFIX, call.cmd->name);
+			break;
+		case CMD_UNKNOWN:
+			metric_inc (METRIC_COMMAND_UNKNOWN);
+			outq_msg (&s->out_queue, OUTQ_CHATTER, origin, "Unknown command, try !help");
+			break;
+		case CMD_DENIED:
+			metric_inc (METRIC_COMMAND_DENIED);
+			outq_msg (&s->out_queue, OUTQ_CHATTER, origin, "Only admins can do that");
+			break;
+	}
+}
+
+static void event_numeric (irc_session_t *session, unsigned int event, const char *origin, const char **params, unsigned int count)
+{
+	struct host_session *s = irc_get_ctx (session);
+
+	metric_numeric (event);
+	reconnect_numeric (&s->reconnect, event);
+	if (count > 0)
+		to_role (s, HOST_NUMERIC, event, NULL, params[0], params[count - 1]);
+	if (!verbose)
+		return;
+
+	switch (event)
+	{
+		case LIBIRC_RFC_RPL_NAMREPLY:
+		      fprintf (stdout, "IRC: User list: %s\n", params[3]);
+		      break;
+		case LIBIRC_RFC_RPL_WELCOME:
+		      fprintf (stdout, "IRC: %s\n", params[1]);
+		      break;
+		case LIBIRC_RFC_RPL_YOURHOST:
+		      fprintf (stdout, "IRC: %s\n", params[1]);
+		case LIBIRC_RFC_RPL_ENDOFNAMES:
+		      fprintf (stdout, "IRC: End of user list\n");
+		      break;
+		case LIBIRC_RFC_RPL_MOTD:
+		      fprintf (stdout, "%s\n", params[1]);
+		      break;
+		default:
+		      fprintf (stdout, "IRC: event_numeric %u\n", event);
+		      break;
+	}
+}
+
+//From the loop, the session is connected again after a backoff with everything else kept as it was
+static int session_lost (irc_session_t *session)
+{
+	struct host_session *s = irc_get_ctx (session);
+
+	//Nothing queued for the old connection makes sense on the new one
+	outq_clear (&s->out_queue);
+	s->joined = 0;
+	timer_cancel (&s->server_connect_timer);
+	timer_cancel (&s->channel_connect_timer);
+	reconnect_lost (&s->reconnect);
+	to_role (s, HOST_DISCONNECT, 0, NULL, NULL, NULL);
+	return 1;
+}
+
+static unsigned long queue_depth (void *arg)
+{
+	struct host_session *s = arg;
+
+	return outq_depth (&s->out_queue);
+}
+
+//Applies what changed in a session's options. The connection itself is left alone, so
+//server, port, nick, username and realname only change the next time it connects
+static void apply_cfg (struct host_session *s, const struct cfg *cfg)
+{
+	char join[sizeof(cfg->channel)];
+	char part[sizeof(cfg->channel)];
+	char line[OUTQ_LINE_MAX];
+	struct cfg *old = &s->cfg;
+
+	cfg_list_minus (cfg->channel, old->channel, join, sizeof(join));
+	cfg_list_minus (old->channel, cfg->channel, part, sizeof(part));
+	//Until the JOIN goes out it will be for the new list anyway
+	if (s->joined && part[0] != '\0')
+	{
+		fprintf (stdout, "IRC: Leaving %s\n", part);
+		snprintf (line, sizeof(line), "PART %s", part);
+		outq_send (&s->out_queue, OUTQ_SERVICE, line);
+	}
+	if (s->joined && join[0] != '\0')
+	{
+		fprintf (stdout, "IRC: Attempting to join %s\n", join);
+		snprintf (line, sizeof(line), "JOIN %s", join);
+		outq_send (&s->out_queue, OUTQ_SERVICE, line);
+	}
+
+	if (strcmp (cfg->server, old->server) != 0 || strcmp (cfg->port, old->port) != 0 ||
+			strcmp (cfg->nick, old->nick) != 0 || strcmp (cfg->username, old->username) != 0 ||
+			strcmp (cfg->realname, old->realname) != 0)
+		fprintf (stdout, "IRC: New connection options for %s are used from the next reconnect\n", old->server);
+	if (role->apply != NULL)
+		role->apply (s, cfg);
+
+	*old = *cfg;
+}
+
+int host_reload_cfg (void)
+{
+	struct host_session *s;
+	struct cfg *cfgs;
+	struct cfg *cfg;
+	int count;
+	int ret;
+	int i;
+	int j;
+
+	fprintf (stdout, "IRC: Reloading config file %s\n", cfg_file);
+	ret = cfg_read (cfg_file, role->defaults, &cfgs, &count);
+	if (ret == 1)
+		free (cfgs);
+	if (ret != 0)
+	{
+		metric_inc (METRIC_CFG_RELOAD_FAILED);
+		fprintf (stderr, "Error reading configuration file %s, keeping the old one\n", cfg_file);
+		return 1;
+	}
+
+	if (role->reloading != NULL)
+		role->reloading ();
+	for (i = 0; i < nbots; i++)
+	{
+		s = host_session (i);
+		cfg = cfg_find (cfgs, count, s->cfg.name);
+		if (cfg != NULL)
+			apply_cfg (s, cfg);
+		else
+			fprintf (stderr, "IRC: Session [%s] is no longer configured, it stays until a restart\n", s->cfg.name);
+	}
+	if (role->reloaded != NULL)
+		role->reloaded ();
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < nbots && strcmp (host_session (j)->cfg.name, cfgs[i].name) != 0; j++)
+			;
+		if (j == nbots)
+			fprintf (stderr, "IRC: Session [%s] is new, it starts on a restart\n", cfgs[i].name);
+	}
+	free (cfgs);
+	metric_inc (METRIC_CFG_RELOAD);
+	return 0;
+}
+
+//SIGHUP, from the loop thread
+static void reload_cfg (void *arg)
+{
+	host_reload_cfg ();
+}
+
+//The session is the ctx
+void cmd_help (void *ctx, const struct cmd_call *call)
+{
+	struct host_session *s = ctx;
+	char text[OUTQ_LINE_MAX];
+
+	cmd_describe (role->commands, call, text, sizeof(text));
+	outq_msg (&s->out_queue, OUTQ_CHATTER, call->origin, text);
+}
+
+void cmd_stats (void *ctx, const struct cmd_call *call)
+{
+	struct host_session *s = ctx;
+	char text[OUTQ_LINE_MAX];
+	unsigned long up = (timer_now_ms () - started_ms) / 1000;
+	int len;
+
+	len = snprintf (text, sizeof(text), "Up %lud %02lu:%02lu:%02lu, %lu reconnects, %lu commands, %lu config reloads, %u lines waiting",
+			up / 86400, up / 3600 % 24, up / 60 % 60, up % 60, metric_count (METRIC_RECONNECT),
+			metric_count (METRIC_COMMAND), metric_count (METRIC_CFG_RELOAD), outq_depth (&s->out_queue));
+	if (role->stats != NULL && len > 0 && (size_t) len + 2 < sizeof(text))
+	{
+		strcpy (text + len, ", ");
+		role->stats (text + len + 2, sizeof(text) - len - 2);
+	}
+	outq_msg (&s->out_queue, OUTQ_CHATTER, call->origin, text);
+}
+
+void cmd_reload (void *ctx, const struct cmd_call *call)
+{
+	struct host_session *s = ctx;
+
+	outq_msg (&s->out_queue, OUTQ_CHATTER, call->origin,
+			host_reload_cfg () == 0 ? role->reload_text : "Couldn't read the config file, kept the old one");
+}
+
+static void print_usage (void)
+{
+	fprintf (stdout, "%s\n", role->name);
+	fprintf (stdout, "Options:\n");
+	fprintf (stdout, "-c		Specify config file location, default %s\n", role->cfg_file);
+	fprintf (stdout, "-v		Verbose output and statistics on exit\n");
+	fprintf (stdout, "-m		Serve metrics on a Unix socket at this path\n");
+	fprintf (stdout, "-M		Write metrics to this file every %d seconds\n", METRICS_FILE_INTERVAL_MS / 1000);
+	role->usage ();
+	fprintf (stdout, "-h		This help text\n");
+}
+
+static int cfg_load (void)
+{
+	char path[1024];
+	struct cfg *cfgs;
+	int ret;
+	int i;
+
+	//If no config file was specified on the command line, look in the users home directory for one
+	if (use_default_cfg)
+	{
+		snprintf (path, sizeof(path), "%s%s", getenv("HOME"), cfg_file);
+		strcpy (cfg_file, path);
+	}
+
+	if (verbose)
+	{
+		fprintf (stdout, "IRC: Attempting to Load config file %s\n", cfg_file);
+	}
+
+	ret = cfg_read (cfg_file, role->defaults, &cfgs, &nbots);
+	if (ret == 1 && !use_default_cfg)
+		return 2;
+	if (ret == 2)
+		return 2;
+
+	bots = calloc (nbots, role->size);
+	if (bots == NULL)
+	{
+		free (cfgs);
+		return 2;
+	}
+	for (i = 0; i < nbots; i++)
+		host_session (i)->cfg = cfgs[i];
+	free (cfgs);
+	return ret;
+}
+
+static void print_cfg (const struct cfg *cfg)
+{
+	if (strlen (cfg->name) != 0)
+		fprintf (stdout, "Configuration options for %s:\n", cfg->name);
+	else
+		fprintf (stdout, "Configuration options:\n");
+	fprintf (stdout, "server = %s\n", cfg->server);
+	fprintf (stdout, "port = %s\n", cfg->port);
+	fprintf (stdout, "channel = %s\n", cfg->channel);
+	fprintf (stdout, "nick = %s\n", cfg->nick);
+	fprintf (stdout, "username = %s\n", cfg->username);
+	fprintf (stdout, "realname = %s\n", cfg->realname);
+	fprintf (stdout, "server_connect_msg = %s\n", cfg->server_connect_msg);
+	fprintf (stdout, "server_connect_nick = %s\n", cfg->server_connect_nick);
+	fprintf (stdout, "server_connect_delay = %s\n", cfg->server_connect_delay);
+	fprintf (stdout, "channel_connect_msg = %s\n", cfg->channel_connect_msg);
+	fprintf (stdout, "channel_connect_nick = %s\n", cfg->channel_connect_nick);
+	fprintf (stdout, "channel_connect_delay = %s\n", cfg->channel_connect_delay);
+	fprintf (stdout, "admins = %s\n", cfg->admins);
+	if (role->print_cfg != NULL)
+		role->print_cfg (cfg);
+	fprintf (stdout, "\n");
+}
+
+int host_main (const struct host_role *r, int argc, char **argv)
+{
+	irc_callbacks_t callbacks;
+	irc_session_t **sessions;
+	char options[64];
+	char labels[128];
+	const char *arg;
+	int trace_fd;
+	int c;
+	int ret;
+	int i;
+
+	role = r;
+	snprintf (cfg_file, sizeof(cfg_file), "%s", role->cfg_file);
+	snprintf (options, sizeof(options), "c:m:M:t:vh%s", role->options != NULL ? role->options : "");
+
+	// Read command line options
+	while ((c = getopt (argc, argv, options)) != -1)
+	{
+		switch (c)
+		{
+			case 'h':
+				print_usage ();
+				return 0;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'c':
+				strcpy (cfg_file, optarg);
+				use_default_cfg = 0;
+				break;
+			case 'm':
+				metrics_socket = optarg;
+				break;
+			case 'M':
+				metrics_path = optarg;
+				break;
+			case 't':
+				trace_path = optarg;
+				break;
+			case '?':
+				arg = strchr (options, optopt);
+				if (arg != NULL && arg[1] == ':')
+					fprintf (stderr, "Option -%c requires an argument\n", optopt);
+				else
+					fprintf (stderr, "Unrecognised option %c\n", optopt);
+				fprintf (stderr, "Error reading commmand line options\n");
+				return 1;
+				break;
+			default:
+				//One of the role's own
+				if (role->option != NULL)
+					role->option (c, optarg);
+				break;
+		}
+	}
+
+	ret = cfg_load ();
+	if (ret > 1)
+	{
+		fprintf (stderr, "Error reading configuration file %s\n", cfg_file);
+		return 1;
+	}
+	else if (ret == 1)
+	{
+		fprintf (stdout, "No configuration file found, using defaults\n");
+	}
+
+	for (i = 0; i < nbots && verbose; i++)
+		print_cfg (&host_session (i)->cfg);
+
+	//Before any thread is started, so none of them can take SIGHUP the default way and exit
+	if (loop_signal (SIGHUP, reload_cfg, NULL))
+		fprintf (stderr, "IRC: Error setting up config reloads on SIGHUP\n");
+
+	//Likewise for SIGUSR1, every thread the role starts has to inherit it blocked
+	if (trace_path != NULL)
+	{
+		trace_fd = trace_start (trace_path, SIGUSR1);
+		if (trace_fd < 0 || loop_watch (trace_fd, trace_signalled, NULL))
+			fprintf (stderr, "IRC: Error setting up tracing to %s\n", trace_path);
+		trace_thread ("loop");
+	}
+
+	fprintf (stdout, "IRC: Bot initilising\n");
+	started_ms = timer_now_ms ();
+
+	if (role->start != NULL && role->start ())
+		return 1;
+
+	memset (&callbacks, 0, sizeof(callbacks));
+
+	callbacks.event_connect = event_connect;
+	callbacks.event_numeric = event_numeric;
+	callbacks.event_privmsg = event_privmsg;
+	callbacks.event_channel = role->event_channel;
+
+	sessions = calloc (nbots, sizeof(*sessions));
+	if (sessions == NULL)
+		return 1;
+
+	for (i = 0; i < nbots; i++)
+	{
+		struct host_session *s = host_session (i);
+
+		s->session = irc_create_session(&callbacks);
+		if (!s->session)
+		{
+			fprintf (stderr, "IRC: Error setting up session\n");
+			return 1;
+		}
+		sessions[i] = s->session;
+
+		irc_set_ctx (s->session, s);
+		irc_option_set(s->session, LIBIRC_OPTION_STRIPNICKS);
+		outq_init (&s->out_queue, s->session);
+		if (role->start_session != NULL && role->start_session (s))
+		{
+			fprintf (stderr, "IRC: Error setting up session\n");
+			return 1;
+		}
+		timer_init (&s->server_connect_timer, send_server_connect_msg, s);
+		timer_init (&s->channel_connect_timer, send_channel_connect_msg, s);
+		snprintf (labels, sizeof(labels), "session=\"%s\"", s->cfg.name);
+		metrics_gauge ("ircbot_outq_depth", "Lines waiting in the outbound queue", labels, queue_depth, s);
+
+		if (verbose)
+		{
+			fprintf (stdout, "IRC: Attempting to connect to server %s:%i channel %s with nick %s\n",
+					s->cfg.server, atoi(s->cfg.port), s->cfg.channel, s->cfg.nick);
+		}
+
+		reconnect_init (&s->reconnect, s->session, &s->cfg);
+		reconnect_start (&s->reconnect);
+	}
+	loop_on_disconnect (session_lost);
+
+	if (metrics_socket != NULL && metrics_listen (metrics_socket))
+		fprintf (stderr, "IRC: Error serving metrics on %s\n", metrics_socket);
+	if (metrics_path != NULL && metrics_file (metrics_path, METRICS_FILE_INTERVAL_MS))
+		fprintf (stderr, "IRC: Error writing metrics to %s\n", metrics_path);
+
+	//Enter main loop, sessions are reconnected whenever they drop so it only returns on error
+	ret = loop_run (sessions, nbots);
+	if (ret)
+		fprintf (stderr, "IRC: ERROR in main loop\n");
+	if (role->stop != NULL)
+		role->stop ();
+	metrics_close ();
+	trace_dump ();
+
+	if (verbose)
+		loop_dump_stats (stdout);
+	for (i = 0; i < nbots && verbose; i++)
+	{
+		if (strlen (host_session (i)->cfg.name) != 0)
+			fprintf (stdout, "Outbound queue for %s:\n", host_session (i)->cfg.name);
+		outq_dump_stats (&host_session (i)->out_queue, stdout);
+	}
+	return ret ? 1 : 0;
+}
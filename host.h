@@ -0,0 +1,95 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stddef.h>
+#include "libircclient/libircclient.h"
+#include "cfg.h"
+#include "cmd.h"
+#include "outq.h"
+#include "timer.h"
+#include "reconnect.h"
+
+/*
+   What ircbot and quizbot have in common as IRC clients: the command
+   line and config file, connecting, joining and the connect messages,
+   reconnecting, reloads, numerics and the commands both have.
+
+   A bot describes itself with a struct host_role and hands it to
+   host_main. Each of its sessions starts with a struct host_session,
+   followed by whatever the bot keeps of its own, and is the ctx of the
+   IRC session and of the commands. The role's hooks are called for
+   anything that isn't the same for both bots.
+
+   Everything here is only to be used from the loop thread.
+*/
+
+struct host_session {
+	struct cfg cfg;
+	irc_session_t *session;
+	struct outq out_queue;
+	struct timer server_connect_timer;
+	struct timer channel_connect_timer;
+	struct reconnect reconnect;
+	int rejoining;		//Connected again after losing the connection, so nothing waits on the delays
+	int joined;		//The JOIN has gone out on this connection, channels added later are joined on their own
+};
+
+//What a session heard that the role may want, for its event hook
+enum host_event {
+	HOST_CONNECT,
+	HOST_DISCONNECT,
+	HOST_NUMERIC,
+	HOST_PRIVMSG		//One that wasn't a command
+};
+
+struct host_role {
+	const char *name;
+	const char *cfg_file;		//Looked for in $HOME unless -c is given
+	const struct cfg *defaults;
+	const struct cmd_table *commands;
+	size_t size;			//Of one of the bot's sessions
+	const char *options;		//getopt letters of the bot's own, on top of c:m:M:t:vh
+	const char *reload_text;	//!reload's answer when the file was read
+
+	//Prints the -h lines for the bot's own options and for -t
+	void (*usage) (void);
+	//Any of these can be NULL
+	void (*option) (int c, const char *arg);
+	void (*print_cfg) (const struct cfg *cfg);
+	//Once the config is read, before any session is made. Returning non-zero exits
+	int (*start) (void);
+	int (*start_session) (struct host_session *s);
+	//Once the loop has returned
+	void (*stop) (void);
+	irc_event_callback_t event_channel;
+	void (*event) (struct host_session *s, enum host_event type, unsigned int numeric,
+			const char *origin, const char *target, const char *text);
+	//A reload starts with reloading, then apply is called for each session still in the
+	//file with its new options before they're copied over s->cfg
+	void (*reloading) (void);
+	void (*apply) (struct host_session *s, const struct cfg *cfg);
+	void (*reloaded) (void);
+	//Added to !stats after the counters every bot has
+	void (*stats) (char *out, size_t size);
+};
+
+extern int verbose;
+
+//Everything main does, returns its exit status
+int host_main (const struct host_role *role, int argc, char **argv);
+
+//The sessions from the config file
+int host_sessions (void);
+struct host_session *host_session (int i);
+
+//Reads the config file again and applies it to the sessions, matched up by section name. Sessions
+//can't be added or removed without a restart. Returns 0 if the file was read, even if some sessions
+//in it couldn't be applied
+int host_reload_cfg (void);
+
+//The commands every bot has, in its .cmds file
+void cmd_help (void *ctx, const struct cmd_call *call);
+void cmd_stats (void *ctx, const struct cmd_call *call);
+void cmd_reload (void *ctx, const struct cmd_call *call);
+
+#endif
@@ -0,0 +1,108 @@
+#include "ircmsg.h"
+#include <string.h>
+
+static const char *skip_spaces (const char *p, const char *end)
+{
+	while (p < end && *p == ' ')
+		p++;
+	return p;
+}
+
+//Up to the next space, or the end of the line
+static const char *token (const char *p, const char *end, struct irc_str *s)
+{
+	const char *space;
+
+	space = memchr (p, ' ', end - p);
+	if (space == NULL)
+		space = end;
+	s->p = p;
+	s->len = space - p;
+	return space;
+}
+
+int ircmsg_parse (const char *line, size_t len, struct irc_msg *msg)
+{
+	const char *end = line + len;
+	const char *p = line;
+	const char *bang;
+	size_t i;
+
+	memset (msg, 0, sizeof(*msg));
+
+	//Tolerate a CR left on the end
+	if (p < end && end[-1] == '\r')
+		end--;
+
+	if (p < end && *p == '@')
+	{
+		p = token (p + 1, end, &msg->tags);
+		p = skip_spaces (p, end);
+	}
+
+	if (p < end && *p == ':')
+	{
+		p = token (p + 1, end, &msg->prefix);
+		msg->nick = msg->prefix;
+		bang = memchr (msg->prefix.p, '!', msg->prefix.len);
+		if (bang == NULL)
+			bang = memchr (msg->prefix.p, '@', msg->prefix.len);
+		if (bang != NULL)
+			msg->nick.len = bang - msg->prefix.p;
+		p = skip_spaces (p, end);
+	}
+
+	p = token (p, end, &msg->command);
+	if (msg->command.len == 0)
+		return 1;
+	if (msg->command.len == 3)
+	{
+		for (i = 0; i < 3 && msg->command.p[i] >= '0' && msg->command.p[i] <= '9'; i++)
+			msg->numeric = msg->numeric * 10 + msg->command.p[i] - '0';
+		if (i < 3)
+			msg->numeric = 0;
+	}
+
+	while (msg->count < IRCMSG_MAX_PARAMS)
+	{
+		p = skip_spaces (p, end);
+		if (p == end)
+			break;
+		//The trailing parameter runs to the end of the line, and so does the 15th
+		if (*p == ':' || msg->count == IRCMSG_MAX_PARAMS - 1)
+		{
+			if (*p == ':')
+				p++;
+			msg->params[msg->count].p = p;
+			msg->params[msg->count].len = end - p;
+			msg->count++;
+			break;
+		}
+		p = token (p, end, &msg->params[msg->count]);
+		msg->count++;
+	}
+	return 0;
+}
+
+int ircmsg_tag (const struct irc_msg *msg, const char *key, struct irc_str *value)
+{
+	size_t klen = strlen (key);
+	const char *p = msg->tags.p;
+	const char *end = p + msg->tags.len;
+	const char *next;
+
+	for (; p != NULL && p < end; p = next + 1)
+	{
+		next = memchr (p, ';', end - p);
+		if (next == NULL)
+			next = end;
+		if ((size_t) (next - p) >= klen && memcmp (p, key, klen) == 0 &&
+				(p + klen == next || p[klen] == '='))
+		{
+			value->p = p + klen + (p + klen < next);
+			value->len = next - value->p;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef IRCMSG_H
+#define IRCMSG_H
+
+#include <stddef.h>
+
+/*
+   IRC line parser that never allocates or copies.
+
+   ircmsg_parse splits one line (without its CR LF) into IRCv3 tags,
+   prefix, command and parameters, each an irc_str pointing back into the
+   line. Nothing is terminated, so the line can sit in a read buffer that
+   isn't writable past it; ircmsg_term writes the NUL after a token for
+   the callers that need C strings and own the buffer.
+
+   Tag values are left escaped as they came, ircmsg_tag finds one by key.
+*/
+
+//RFC 1459, 14 middle parameters and a trailing one
+#define IRCMSG_MAX_PARAMS	15
+
+struct irc_str {
+	const char *p;
+	size_t len;		//p is NULL and len 0 for a part the line didn't have
+};
+
+struct irc_msg {
+	struct irc_str tags;	//Without the leading @
+	struct irc_str prefix;	//Without the leading :
+	struct irc_str nick;	//The prefix up to any ! or @
+	struct irc_str command;
+	struct irc_str params[IRCMSG_MAX_PARAMS];
+	unsigned int count;
+	unsigned int numeric;	//0 unless command is three digits
+};
+
+//Returns 0 if line held a command, 1 if it was empty or malformed
+int ircmsg_parse (const char *line, size_t len, struct irc_msg *msg);
+
+//Returns 1 if the message has tag key, its value is empty for a tag without one
+int ircmsg_tag (const struct irc_msg *msg, const char *key, struct irc_str *value);
+
+static inline int ircmsg_is (struct irc_str s, const char *lit, size_t len)
+{
+	size_t i;
+
+	if (s.len != len)
+		return 0;
+	for (i = 0; i < len; i++)
+	{
+		if (s.p[i] != lit[i])
+			return 0;
+	}
+	return 1;
+}
+
+//Terminates s in place, the line must be writable one byte past it
+static inline const char *ircmsg_term (struct irc_str s)
+{
+	if (s.p == NULL)
+		return "";
+	((char *) s.p)[s.len] = '\0';
+	return s.p;
+}
+
+#endif
@@ -0,0 +1,654 @@
+#define _GNU_SOURCE
+
+#include "ircnative.h"
+#include "ircmsg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+/*
+   Native IRC backend, a drop in for the part of libircclient the bots use.
+
+   Each session reads into a ring buffer mapped twice back to back, so the
+   bytes after the end of the ring are the ones at its start and a line
+   that wraps around is still contiguous. Lines are parsed in place with
+   ircmsg_parse and handed to a handler looked up by command in a small
+   hash table; the handler NUL terminates the tokens inside the ring
+   (which is consumed by then) and calls the libircclient style callback
+   with pointers into it. Nothing is allocated or copied per line.
+
+   Built instead of linking libircclient with IRC_BACKEND=native, see the
+   Makefile. The libircclient headers are still used for the callback
+   types and numeric names, so the bots build the same either way.
+*/
+
+//Must be a multiple of the page size
+#define IRCN_RING_SIZE		16384
+#define IRCN_OUT_SIZE		8192
+#define IRCN_DISPATCH_SIZE	32
+
+enum {
+	IRCN_DISCONNECTED,
+	IRCN_CONNECTING,
+	IRCN_CONNECTED
+};
+
+enum {
+	IRCN_ERR_OK,
+	IRCN_ERR_INVAL,
+	IRCN_ERR_RESOLV,
+	IRCN_ERR_SOCKET,
+	IRCN_ERR_CONNECT,
+	IRCN_ERR_CLOSED,
+	IRCN_ERR_NOMEM,
+	IRCN_ERR_READ,
+	IRCN_ERR_WRITE,
+	IRCN_ERR_STATE,
+	IRCN_ERRORS
+};
+
+static const char *errors[IRCN_ERRORS] = {
+	[IRCN_ERR_OK] = "No error",
+	[IRCN_ERR_INVAL] = "Invalid argument",
+	[IRCN_ERR_RESOLV] = "Host not resolved",
+	[IRCN_ERR_SOCKET] = "Socket error",
+	[IRCN_ERR_CONNECT] = "Could not connect",
+	[IRCN_ERR_CLOSED] = "Remote connection closed",
+	[IRCN_ERR_NOMEM] = "Out of memory",
+	[IRCN_ERR_READ] = "Socket read error",
+	[IRCN_ERR_WRITE] = "Socket write error",
+	[IRCN_ERR_STATE] = "Invalid state",
+};
+
+struct irc_session_s {
+	irc_callbacks_t callbacks;
+	void *ctx;
+	unsigned int options;
+	int state;
+	int err;
+	int fd;
+	char nick[64];		//Ours, as the server last told us
+	char username[64];
+	char realname[128];
+	char password[128];
+
+	//Unread bytes are ring[head..tail), both count up forever
+	char *ring;
+	unsigned long head;
+	unsigned long tail;
+	int skipping;		//Dropping a line too long for the ring
+
+	char out[IRCN_OUT_SIZE];
+	size_t outlen;
+};
+
+typedef void (*handler_t) (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+
+static void on_ping (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_privmsg (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_notice (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_nick (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_mode (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_join (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_part (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_quit (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_kick (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_topic (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_invite (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+static void on_error (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params);
+
+static const struct {
+	const char *command;
+	handler_t func;
+} handlers[] = {
+	{ "PING", on_ping },
+	{ "PRIVMSG", on_privmsg },
+	{ "NOTICE", on_notice },
+	{ "NICK", on_nick },
+	{ "MODE", on_mode },
+	{ "JOIN", on_join },
+	{ "PART", on_part },
+	{ "QUIT", on_quit },
+	{ "KICK", on_kick },
+	{ "TOPIC", on_topic },
+	{ "INVITE", on_invite },
+	{ "ERROR", on_error },
+};
+
+//Slots are indexes into handlers plus one, 0 when empty
+static unsigned char dispatch[IRCN_DISPATCH_SIZE];
+
+static uint32_t hash_command (const char *p, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char) p[i]) * 16777619u;
+	return h;
+}
+
+static void dispatch_init (void)
+{
+	uint32_t i;
+	size_t n;
+
+	if (dispatch[hash_command ("PING", 4) % IRCN_DISPATCH_SIZE] != 0)
+		return;
+	for (n = 0; n < sizeof(handlers) / sizeof(handlers[0]); n++)
+	{
+		for (i = hash_command (handlers[n].command, strlen (handlers[n].command)) % IRCN_DISPATCH_SIZE;
+				dispatch[i] != 0; i = (i + 1) % IRCN_DISPATCH_SIZE)
+			;
+		dispatch[i] = n + 1;
+	}
+}
+
+static handler_t find_handler (struct irc_str command)
+{
+	const char *name;
+	uint32_t i;
+
+	for (i = hash_command (command.p, command.len) % IRCN_DISPATCH_SIZE; dispatch[i] != 0; i = (i + 1) % IRCN_DISPATCH_SIZE)
+	{
+		name = handlers[dispatch[i] - 1].command;
+		if (strlen (name) == command.len && memcmp (name, command.p, command.len) == 0)
+			return handlers[dispatch[i] - 1].func;
+	}
+	return NULL;
+}
+
+static void call (irc_event_callback_t cb, irc_session_t *s, struct irc_msg *m, const char *origin, const char **params, unsigned int count)
+{
+	if (cb != NULL)
+		cb (s, ircmsg_term (m->command), origin, params, count);
+}
+
+static void on_ping (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	irc_send_raw (s, "PONG :%s", m->count > 0 ? params[0] : "");
+}
+
+//CTCP requests and ACTIONs come wrapped in \001
+static int ctcp (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params, int reply)
+{
+	char *text = (char *) params[1];
+	size_t len = strlen (text);
+	const char *ctcp_params[2];
+
+	if (len < 2 || text[0] != '\001')
+		return 0;
+	text[len - (text[len - 1] == '\001')] = '\0';
+	text++;
+
+	if (strncmp (text, "ACTION ", 7) == 0)
+	{
+		ctcp_params[0] = params[0];
+		ctcp_params[1] = text + 7;
+		call (s->callbacks.event_ctcp_action, s, m, origin, ctcp_params, 2);
+	}
+	else
+	{
+		ctcp_params[0] = text;
+		call (reply ? s->callbacks.event_ctcp_rep : s->callbacks.event_ctcp_req, s, m, origin, ctcp_params, 1);
+	}
+	return 1;
+}
+
+static void on_privmsg (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	if (m->count < 2 || ctcp (s, m, origin, params, 0))
+		return;
+	if (strcasecmp (params[0], s->nick) == 0)
+		call (s->callbacks.event_privmsg, s, m, origin, params, m->count);
+	else
+		call (s->callbacks.event_channel, s, m, origin, params, m->count);
+}
+
+static void on_notice (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	if (m->count < 2 || ctcp (s, m, origin, params, 1))
+		return;
+	if (strcasecmp (params[0], s->nick) == 0)
+		call (s->callbacks.event_notice, s, m, origin, params, m->count);
+	else
+		call (s->callbacks.event_channel_notice, s, m, origin, params, m->count);
+}
+
+static void on_nick (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	if (m->count < 1)
+		return;
+	if (m->nick.len == strlen (s->nick) && strncasecmp (m->nick.p, s->nick, m->nick.len) == 0)
+		snprintf (s->nick, sizeof(s->nick), "%s", params[0]);
+	call (s->callbacks.event_nick, s, m, origin, params, m->count);
+}
+
+static void on_mode (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	if (m->count > 0 && strcasecmp (params[0], s->nick) == 0)
+		call (s->callbacks.event_umode, s, m, origin, params + 1, m->count - 1);
+	else
+		call (s->callbacks.event_mode, s, m, origin, params, m->count);
+}
+
+static void on_join (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	call (s->callbacks.event_join, s, m, origin, params, m->count);
+}
+
+static void on_part (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	call (s->callbacks.event_part, s, m, origin, params, m->count);
+}
+
+static void on_quit (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	call (s->callbacks.event_quit, s, m, origin, params, m->count);
+}
+
+static void on_kick (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	call (s->callbacks.event_kick, s, m, origin, params, m->count);
+}
+
+static void on_topic (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	call (s->callbacks.event_topic, s, m, origin, params, m->count);
+}
+
+static void on_invite (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+	call (s->callbacks.event_invite, s, m, origin, params, m->count);
+}
+
+//The server closes the connection straight after, which is reported then
+static void on_error (irc_session_t *s, struct irc_msg *m, const char *origin, const char **params)
+{
+}
+
+static void handle_line (irc_session_t *s, const char *line, size_t len)
+{
+	const char *params[IRCMSG_MAX_PARAMS];
+	const char *origin = NULL;
+	struct irc_msg m;
+	handler_t func;
+	unsigned int i;
+
+	if (ircmsg_parse (line, len, &m))
+		return;
+
+	//Only now that parsing is done can the tokens be terminated
+	for (i = 0; i < m.count; i++)
+		params[i] = ircmsg_term (m.params[i]);
+	if (m.prefix.p != NULL)
+		origin = ircmsg_term ((s->options & LIBIRC_OPTION_STRIPNICKS) ? m.nick : m.prefix);
+
+	if (m.numeric != 0)
+	{
+		//Registration is done, and this is the nick the server gave us
+		if (m.numeric == 1)
+		{
+			if (m.count > 0)
+				snprintf (s->nick, sizeof(s->nick), "%s", params[0]);
+			call (s->callbacks.event_connect, s, &m, origin, params, m.count);
+		}
+		if (s->callbacks.event_numeric != NULL)
+			s->callbacks.event_numeric (s, m.numeric, origin, params, m.count);
+		return;
+	}
+
+	func = find_handler (m.command);
+	if (func != NULL)
+		func (s, &m, origin, params);
+	else
+		call (s->callbacks.event_unknown, s, &m, origin, params, m.count);
+}
+
+//Ring of IRCN_RING_SIZE mapped twice in a row, NULL if that isn't possible
+static char *ring_map (void)
+{
+	char *base;
+	int fd;
+
+	fd = memfd_create ("ircnative", MFD_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate (fd, IRCN_RING_SIZE) != 0)
+	{
+		close (fd);
+		return NULL;
+	}
+	base = mmap (NULL, 2 * IRCN_RING_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base != MAP_FAILED &&
+			(mmap (base, IRCN_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+			 mmap (base + IRCN_RING_SIZE, IRCN_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED))
+	{
+		munmap (base, 2 * IRCN_RING_SIZE);
+		base = MAP_FAILED;
+	}
+	close (fd);
+	return base != MAP_FAILED ? base : NULL;
+}
+
+static int fail (irc_session_t *s, int err)
+{
+	s->err = err;
+	return 1;
+}
+
+//Reads what the socket has and handles every complete line
+static int read_lines (irc_session_t *s)
+{
+	char *start;
+	char *nl;
+	ssize_t n;
+	size_t len;
+
+	for (;;)
+	{
+		//The mirror makes the free space contiguous too
+		n = read (s->fd, s->ring + (s->tail & (IRCN_RING_SIZE - 1)), IRCN_RING_SIZE - (s->tail - s->head));
+		if (n == 0)
+			return fail (s, IRCN_ERR_CLOSED);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return fail (s, IRCN_ERR_READ);
+		}
+		s->tail += n;
+
+		while (s->state == IRCN_CONNECTED && s->head != s->tail)
+		{
+			start = s->ring + (s->head & (IRCN_RING_SIZE - 1));
+			nl = memchr (start, '\n', s->tail - s->head);
+			if (nl == NULL)
+				break;
+			len = nl - start;
+			s->head += len + 1;
+			if (s->skipping)
+				s->skipping = 0;
+			else
+				handle_line (s, start, len);
+		}
+		if (s->state != IRCN_CONNECTED)
+			return 0;
+
+		//A full ring without a line end, drop it up to the next one
+		if (s->tail - s->head == IRCN_RING_SIZE)
+		{
+			s->head = s->tail;
+			s->skipping = 1;
+		}
+	}
+}
+
+static int flush (irc_session_t *s)
+{
+	ssize_t n;
+
+	while (s->outlen > 0)
+	{
+		n = write (s->fd, s->out, s->outlen);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return fail (s, IRCN_ERR_WRITE);
+		}
+		memmove (s->out, s->out + n, s->outlen - n);
+		s->outlen -= n;
+	}
+	return 0;
+}
+
+static int queue (irc_session_t *s, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start (ap, fmt);
+	len = vsnprintf (s->out + s->outlen, sizeof(s->out) - s->outlen, fmt, ap);
+	va_end (ap);
+	if (len < 0 || (size_t) len >= sizeof(s->out) - s->outlen)
+		return fail (s, IRCN_ERR_WRITE);
+	s->outlen += len;
+	return 0;
+}
+
+irc_session_t *irc_create_session (irc_callbacks_t *callbacks)
+{
+	irc_session_t *s;
+
+	s = calloc (1, sizeof(*s));
+	if (s == NULL)
+		return NULL;
+	s->ring = ring_map ();
+	if (s->ring == NULL)
+	{
+		free (s);
+		return NULL;
+	}
+	s->callbacks = *callbacks;
+	s->fd = -1;
+	dispatch_init ();
+	return s;
+}
+
+void irc_destroy_session (irc_session_t *s)
+{
+	irc_disconnect (s);
+	munmap (s->ring, 2 * IRCN_RING_SIZE);
+	free (s);
+}
+
+int irc_connect (irc_session_t *s, const char *server, unsigned short port, const char *server_password,
+		const char *nick, const char *username, const char *realname)
+{
+	struct addrinfo hints;
+	struct addrinfo *res;
+	char service[8];
+	int ret;
+
+	if (server == NULL || nick == NULL)
+		return fail (s, IRCN_ERR_INVAL);
+	if (s->state != IRCN_DISCONNECTED)
+		return fail (s, IRCN_ERR_STATE);
+	snprintf (s->nick, sizeof(s->nick), "%s", nick);
+	snprintf (s->username, sizeof(s->username), "%s", username ? username : nick);
+	snprintf (s->realname, sizeof(s->realname), "%s", realname ? realname : nick);
+	snprintf (s->password, sizeof(s->password), "%s", server_password ? server_password : "");
+
+	memset (&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf (service, sizeof(service), "%u", port);
+	if (getaddrinfo (server, service, &hints, &res) != 0)
+		return fail (s, IRCN_ERR_RESOLV);
+
+	s->fd = socket (res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s->fd < 0)
+	{
+		freeaddrinfo (res);
+		return fail (s, IRCN_ERR_SOCKET);
+	}
+	ret = connect (s->fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo (res);
+	if (ret != 0 && errno != EINPROGRESS)
+	{
+		close (s->fd);
+		s->fd = -1;
+		return fail (s, IRCN_ERR_CONNECT);
+	}
+
+	s->head = 0;
+	s->tail = 0;
+	s->skipping = 0;
+	s->outlen = 0;
+	s->state = IRCN_CONNECTING;
+	s->err = IRCN_ERR_OK;
+	return 0;
+}
+
+void irc_disconnect (irc_session_t *s)
+{
+	if (s->fd >= 0)
+		close (s->fd);
+	s->fd = -1;
+	s->state = IRCN_DISCONNECTED;
+}
+
+int irc_is_connected (irc_session_t *s)
+{
+	return s->state != IRCN_DISCONNECTED;
+}
+
+int irc_add_select_descriptors (irc_session_t *s, fd_set *in_set, fd_set *out_set, int *maxfd)
+{
+	if (s->fd < 0 || s->state == IRCN_DISCONNECTED)
+		return fail (s, IRCN_ERR_STATE);
+	if (s->state == IRCN_CONNECTING || s->outlen > 0)
+		FD_SET (s->fd, out_set);
+	if (s->state == IRCN_CONNECTED)
+		FD_SET (s->fd, in_set);
+	if (s->fd > *maxfd)
+		*maxfd = s->fd;
+	return 0;
+}
+
+int irc_process_select_descriptors (irc_session_t *s, fd_set *in_set, fd_set *out_set)
+{
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if (s->fd < 0 || s->state == IRCN_DISCONNECTED)
+		return fail (s, IRCN_ERR_STATE);
+
+	if (s->state == IRCN_CONNECTING)
+	{
+		if (!FD_ISSET (s->fd, out_set))
+			return 0;
+		if (getsockopt (s->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+			return fail (s, IRCN_ERR_CONNECT);
+		s->state = IRCN_CONNECTED;
+		if (s->password[0] != '\0' && queue (s, "PASS %s\r\n", s->password))
+			return 1;
+		if (queue (s, "NICK %s\r\nUSER %s unknown unknown :%s\r\n", s->nick, s->username, s->realname))
+			return 1;
+	}
+
+	if (FD_ISSET (s->fd, in_set) && read_lines (s))
+		return 1;
+	//A callback may have disconnected it
+	if (s->state == IRCN_CONNECTED && s->outlen > 0)
+		return flush (s);
+	return 0;
+}
+
+int irc_send_iov (irc_session_t *s, const struct iovec *iov, int count)
+{
+	size_t total = 0;
+	size_t off;
+	ssize_t n = 0;
+	int i;
+
+	if (s->state != IRCN_CONNECTED)
+		return fail (s, IRCN_ERR_STATE);
+	for (i = 0; i < count; i++)
+		total += iov[i].iov_len;
+
+	if (s->outlen == 0)
+	{
+		do
+			n = writev (s->fd, iov, count);
+		while (n < 0 && errno == EINTR);
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return fail (s, IRCN_ERR_WRITE);
+		if (n < 0)
+			n = 0;
+		if ((size_t) n == total)
+			return 0;
+	}
+
+	//Whatever didn't fit in the socket waits for it to be writable
+	if (total - n > sizeof(s->out) - s->outlen)
+		return fail (s, IRCN_ERR_WRITE);
+	for (i = 0, off = 0; i < count; off += iov[i].iov_len, i++)
+	{
+		if (off + iov[i].iov_len <= (size_t) n)
+			continue;
+		//Skip the part of this one that was written
+		memcpy (s->out + s->outlen, (const char *) iov[i].iov_base + ((size_t) n > off ? n - off : 0),
+				iov[i].iov_len - ((size_t) n > off ? n - off : 0));
+		s->outlen += iov[i].iov_len - ((size_t) n > off ? n - off : 0);
+	}
+	return 0;
+}
+
+//Written straight away when nothing is waiting, like the answers are
+int irc_send_raw (irc_session_t *s, const char *format, ...)
+{
+	char line[512];
+	va_list ap;
+	int len;
+
+	if (s->state != IRCN_CONNECTED)
+		return fail (s, IRCN_ERR_STATE);
+
+	va_start (ap, format);
+	len = vsnprintf (line, sizeof(line) - 2, format, ap);
+	va_end (ap);
+	if (len < 0)
+		return fail (s, IRCN_ERR_INVAL);
+	if (len > (int) sizeof(line) - 3)
+		len = sizeof(line) - 3;
+	line[len++] = '\r';
+	line[len++] = '\n';
+
+	if ((size_t) len > sizeof(s->out) - s->outlen)
+		return fail (s, IRCN_ERR_WRITE);
+	memcpy (s->out + s->outlen, line, len);
+	s->outlen += len;
+	return flush (s);
+}
+
+void irc_set_ctx (irc_session_t *s, void *ctx)
+{
+	s->ctx = ctx;
+}
+
+void *irc_get_ctx (irc_session_t *s)
+{
+	return s->ctx;
+}
+
+void irc_option_set (irc_session_t *s, unsigned int option)
+{
+	s->options |= option;
+}
+
+int irc_errno (irc_session_t *s)
+{
+	return s->err;
+}
+
+const char *irc_strerror (int ircerrno)
+{
+	if (ircerrno < 0 || ircerrno >= IRCN_ERRORS)
+		return "Unknown error";
+	return errors[ircerrno];
+}
@@ -0,0 +1,16 @@
+#ifndef IRCNATIVE_H
+#define IRCNATIVE_H
+
+#include "libircclient/libircclient.h"
+#include <sys/uio.h>
+
+/*
+   What the native backend (ircnative.c) has on top of libircclient's API.
+   Only there when built with IRC_BACKEND=native, which defines IRC_NATIVE.
+*/
+
+//Sends iov as it is, it must already be whole lines ending in CR LF.
+//Goes out in a single writev when nothing else is waiting to be written
+int irc_send_iov (irc_session_t *session, const struct iovec *iov, int count);
+
+#endif
@@ -0,0 +1,458 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "learn.h"
+#include "epoch.h"
+#include "ring.h"
+#include "quizdb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#define LEARN_TABLE_MIN		64
+//Records waiting for the writer thread
+#define LEARN_QUEUE_SIZE	1024
+
+struct entry {
+	uint32_t hash;
+	const char *question;	//As it was asked, with its "(Category)"
+	const char *answer;
+	char key[];		//Normalized question, the strings above follow it
+};
+
+struct table {
+	uint32_t mask;
+	struct entry *slots[];	//Filled in with release stores, never emptied
+};
+
+struct learned {
+	struct table *table;
+	unsigned int count;	//Loop thread writes, the writer thread reads
+
+	char path[1024];
+	int journal;		//0 if learned answers are only kept in memory
+	int fd;			//Writer thread only once it's running
+	struct spsc_ring queue;
+	int efd;
+	int stopping;
+	pthread_t writer;
+	unsigned long records;	//Writer thread only, records in the journal file
+};
+
+static uint32_t hash_key (const char *key, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char) key[i]) * 16777619u;
+	return h;
+}
+
+static struct table *table_new (uint32_t size)
+{
+	struct table *t;
+
+	t = calloc (1, sizeof(*t) + size * sizeof(t->slots[0]));
+	if (t != NULL)
+		t->mask = size - 1;
+	return t;
+}
+
+//Index of key's slot, or of the empty slot it would go in
+static uint32_t table_find (const struct table *t, const char *key, uint32_t hash)
+{
+	const struct entry *e;
+	uint32_t i;
+
+	for (i = hash & t->mask; (e = __atomic_load_n (&t->slots[i], __ATOMIC_ACQUIRE)) != NULL; i = (i + 1) & t->mask)
+	{
+		if (e->hash == hash && strcmp (e->key, key) == 0)
+			break;
+	}
+	return i;
+}
+
+static struct entry *entry_new (const char *key, size_t len, const char *question, const char *answer)
+{
+	size_t qlen = strlen (question) + 1;
+	size_t alen = strlen (answer) + 1;
+	struct entry *e;
+	char *p;
+
+	e = malloc (sizeof(*e) + len + 1 + qlen + alen);
+	if (e == NULL)
+		return NULL;
+	e->hash = hash_key (key, len);
+	memcpy (e->key, key, len + 1);
+	p = e->key + len + 1;
+	e->question = memcpy (p, question, qlen);
+	e->answer = memcpy (p + qlen, answer, alen);
+	return e;
+}
+
+//Loop thread. Before the table is published (shared == 0) anything replaced is freed straight away
+static int table_put (struct learned *l, struct entry *e, int shared)
+{
+	struct table *t = l->table;
+	struct table *bigger;
+	struct entry *old;
+	uint32_t i;
+
+	i = table_find (t, e->key, e->hash);
+	old = t->slots[i];
+	if (old != NULL)
+	{
+		__atomic_store_n (&t->slots[i], e, __ATOMIC_RELEASE);
+		if (shared)
+			epoch_retire (free, old);
+		else
+			free (old);
+		return 0;
+	}
+
+	//Kept at most half full, readers stop at the first empty slot
+	if ((l->count + 1) * 2 > t->mask + 1)
+	{
+		bigger = table_new ((t->mask + 1) * 2);
+		if (bigger == NULL)
+			return 1;
+		for (i = 0; i <= t->mask; i++)
+		{
+			if (t->slots[i] != NULL)
+				bigger->slots[table_find (bigger, t->slots[i]->key, t->slots[i]->hash)] = t->slots[i];
+		}
+		__atomic_store_n (&l->table, bigger, __ATOMIC_SEQ_CST);
+		if (shared)
+			epoch_retire (free, t);
+		else
+			free (t);
+		t = bigger;
+		i = table_find (t, e->key, e->hash);
+	}
+	__atomic_store_n (&t->slots[i], e, __ATOMIC_RELEASE);
+	__atomic_store_n (&l->count, l->count + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int learn_put (struct learned *l, const char *question, const char *answer, int shared)
+{
+	char key[1024];
+	struct entry *e;
+	size_t len;
+
+	len = quizdb_normalize (question, key, sizeof(key));
+	if (len == 0 || answer[0] == '\0')
+		return 1;
+	e = entry_new (key, len, question, answer);
+	if (e == NULL)
+		return 1;
+	if (table_put (l, e, shared))
+	{
+		free (e);
+		return 1;
+	}
+	return 0;
+}
+
+//Same layout as the question database, "(Category) question" is split back up
+static int write_record (FILE *out, const char *question, const char *answer)
+{
+	const char *end;
+
+	if (question[0] == '(' && (end = strstr (question, ") ")) != NULL)
+		return fprintf (out, "Category: %.*s\nQuestion: %s\nAnswer: %s\n\n",
+				(int) (end - question - 1), question + 1, end + 2, answer) < 0;
+	return fprintf (out, "Question: %s\nAnswer: %s\n\n", question, answer) < 0;
+}
+
+static void load_journal (struct learned *l)
+{
+	char line[1024];
+	char category[1024] = "";
+	char question[1024] = "";
+	char asked[2056];
+	size_t len;
+	FILE *in;
+
+	in = fopen (l->path, "r");
+	if (in == NULL)
+		return;
+	while (fgets (line, sizeof(line), in) != NULL)
+	{
+		len = strlen (line);
+		//A record cut short by a crash is just left out
+		if (len == 0 || line[len - 1] != '\n')
+			break;
+		line[len - 1] = '\0';
+
+		if (strncmp (line, "Category: ", 10) == 0)
+			snprintf (category, sizeof(category), "%s", line + 10);
+		else if (strncmp (line, "Question: ", 10) == 0)
+			snprintf (question, sizeof(question), "%s", line + 10);
+		else if (strncmp (line, "Answer: ", 8) == 0 && question[0] != '\0')
+		{
+			if (category[0] != '\0')
+				snprintf (asked, sizeof(asked), "(%s) %s", category, question);
+			else
+				snprintf (asked, sizeof(asked), "%s", question);
+			learn_put (l, asked, line + 8, 0);
+			l->records++;
+			category[0] = '\0';
+			question[0] = '\0';
+		}
+	}
+	fclose (in);
+}
+
+static int write_all (int fd, const char *buff, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		n = write (fd, buff, len);
+		if (n < 0)
+			return 1;
+		buff += n;
+		len -= n;
+	}
+	return 0;
+}
+
+//Writer thread, rewrites the journal with only what's in the table now
+static void compact (struct learned *l)
+{
+	const struct table *t;
+	const struct entry *e;
+	char tmp[1040];
+	unsigned long kept = 0;
+	uint32_t i;
+	FILE *out;
+	int fd;
+	int ret = 0;
+
+	snprintf (tmp, sizeof(tmp), "%s.tmp", l->path);
+	out = fopen (tmp, "w");
+	if (out == NULL)
+		return;
+
+	//The table is never older than the journal, anything added since is written again after
+	epoch_enter ();
+	t = __atomic_load_n (&l->table, __ATOMIC_SEQ_CST);
+	for (i = 0; i <= t->mask && ret == 0; i++)
+	{
+		e = __atomic_load_n (&t->slots[i], __ATOMIC_ACQUIRE);
+		if (e == NULL)
+			continue;
+		ret = write_record (out, e->question, e->answer);
+		kept++;
+	}
+	epoch_exit ();
+
+	if (ret != 0 || fflush (out) != 0 || fsync (fileno (out)) != 0)
+	{
+		fclose (out);
+		unlink (tmp);
+		return;
+	}
+	fclose (out);
+
+	fd = open (tmp, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd < 0 || rename (tmp, l->path) != 0)
+	{
+		if (fd >= 0)
+			close (fd);
+		unlink (tmp);
+		return;
+	}
+	close (l->fd);
+	l->fd = fd;
+	l->records = kept;
+}
+
+static void *write_journal (void *arg)
+{
+	struct learned *l = arg;
+	char *buff = NULL;
+	size_t size = 0;
+	size_t len;
+	size_t rlen;
+	char *record;
+	char *more;
+	uint64_t count;
+	unsigned long n;
+
+	for (;;)
+	{
+		if (read (l->efd, &count, sizeof(count)) < 0)
+			continue;
+
+		//Everything queued while the last fsync was running goes out together
+		len = 0;
+		n = 0;
+		while ((record = spsc_pop (&l->queue)) != NULL)
+		{
+			rlen = strlen (record);
+			if (len + rlen > size)
+			{
+				more = realloc (buff, (len + rlen) * 2);
+				if (more == NULL)
+				{
+					fprintf (stderr, "IRC: Out of memory, dropping a learned answer from %s\n", l->path);
+					free (record);
+					continue;
+				}
+				buff = more;
+				size = (len + rlen) * 2;
+			}
+			memcpy (buff + len, record, rlen);
+			len += rlen;
+			n++;
+			free (record);
+		}
+
+		if (len > 0)
+		{
+			if (write_all (l->fd, buff, len) || fdatasync (l->fd) != 0)
+				fprintf (stderr, "IRC: Error writing learned answers to %s\n", l->path);
+			l->records += n;
+		}
+
+		if (__atomic_load_n (&l->stopping, __ATOMIC_ACQUIRE))
+			break;
+		if (l->records >= LEARN_COMPACT_MIN && l->records >= 2UL * __atomic_load_n (&l->count, __ATOMIC_RELAXED))
+			compact (l);
+	}
+	free (buff);
+	return NULL;
+}
+
+struct learned *learn_open (const char *question_db)
+{
+	struct learned *l;
+
+	l = calloc (1, sizeof(*l));
+	if (l == NULL)
+		return NULL;
+	l->fd = -1;
+	l->efd = -1;
+	snprintf (l->path, sizeof(l->path), "%s%s", question_db, LEARN_SUFFIX);
+	l->table = table_new (LEARN_TABLE_MIN);
+	if (l->table == NULL)
+	{
+		free (l);
+		return NULL;
+	}
+	load_journal (l);
+
+	//Without a journal answers are still learned, just not kept across restarts
+	if (spsc_init (&l->queue, LEARN_QUEUE_SIZE) == 0)
+	{
+		l->fd = open (l->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		l->efd = eventfd (0, EFD_CLOEXEC);
+		if (l->fd < 0 || l->efd < 0 || pthread_create (&l->writer, NULL, write_journal, l) != 0)
+		{
+			fprintf (stderr, "IRC: Can't write to %s, learned answers won't be saved\n", l->path);
+			if (l->fd >= 0)
+				close (l->fd);
+			l->fd = -1;
+		}
+		else
+			l->journal = 1;
+	}
+	return l;
+}
+
+int learn_add (struct learned *l, const char *question, const char *answer)
+{
+	char key[1024];
+	const struct entry *e;
+	uint64_t one = 1;
+	size_t len;
+	char *record;
+	FILE *out;
+
+	len = quizdb_normalize (question, key, sizeof(key));
+	if (len == 0)
+		return 1;
+	e = l->table->slots[table_find (l->table, key, hash_key (key, len))];
+	if (e != NULL && strcmp (e->answer, answer) == 0)
+		return 1;
+
+	if (learn_put (l, question, answer, 1))
+		return 0;
+	//Frees what earlier answers replaced, this one's goes on the next
+	epoch_reclaim ();
+	if (!l->journal)
+		return 0;
+
+	out = open_memstream (&record, &len);
+	if (out == NULL)
+		return 0;
+	write_record (out, question, answer);
+	fclose (out);
+	if (spsc_push (&l->queue, record))
+	{
+		fprintf (stderr, "IRC: Journal %s is backed up, not saving %s\n", l->path, answer);
+		free (record);
+		return 0;
+	}
+	if (write (l->efd, &one, sizeof(one)) < 0)
+		;
+	return 0;
+}
+
+const char *learn_lookup (const struct learned *l, const char *question)
+{
+	const struct table *t;
+	const struct entry *e;
+	char key[1024];
+	size_t len;
+
+	if (__atomic_load_n (&l->count, __ATOMIC_RELAXED) == 0)
+		return NULL;
+	len = quizdb_normalize (question, key, sizeof(key));
+	if (len == 0)
+		return NULL;
+	t = __atomic_load_n (&l->table, __ATOMIC_SEQ_CST);
+	e = __atomic_load_n (&t->slots[table_find (t, key, hash_key (key, len))], __ATOMIC_ACQUIRE);
+	return e != NULL ? e->answer : NULL;
+}
+
+unsigned int learn_count (const struct learned *l)
+{
+	return __atomic_load_n (&l->count, __ATOMIC_RELAXED);
+}
+
+void learn_close (struct learned *l)
+{
+	uint64_t one = 1;
+	char *record;
+	uint32_t i;
+
+	if (l == NULL)
+		return;
+	if (l->journal)
+	{
+		__atomic_store_n (&l->stopping, 1, __ATOMIC_RELEASE);
+		if (write (l->efd, &one, sizeof(one)) < 0)
+			;
+		pthread_join (l->writer, NULL);
+		close (l->fd);
+	}
+	while ((record = spsc_pop (&l->queue)) != NULL)
+		free (record);
+	spsc_free (&l->queue);
+	if (l->efd >= 0)
+		close (l->efd);
+
+	for (i = 0; i <= l->table->mask; i++)
+		free (l->table->slots[i]);
+	free (l->table);
+	free (l);
+}
@@ -0,0 +1,40 @@
+#ifndef LEARN_H
+#define LEARN_H
+
+/*
+   Answers learned from the quiz, for questions the database got wrong or
+   didn't have.
+
+   Learned answers are kept in a hash table keyed by the normalized
+   question, which lookups can read from any thread without locking: the
+   loop thread only ever fills empty slots or swaps in a new entry, and
+   anything it replaces (an old entry, or the whole table when it grows)
+   is freed through epoch.h. Readers call learn_lookup between
+   epoch_enter and epoch_exit.
+
+   Every answer is also appended to a journal next to the question
+   database (question_db with LEARN_SUFFIX), in the same Category/
+   Question/Answer format, so it can be merged into the database by hand.
+   The journal is written by a thread of its own: whatever was added
+   while the previous write was being synced goes out in one write and
+   one fsync. Once most of the journal is superseded by later records
+   for the same questions, that thread rewrites it with only the latest.
+*/
+
+#define LEARN_SUFFIX		".learned"
+//Don't bother compacting a journal smaller than this many records
+#define LEARN_COMPACT_MIN	256
+
+struct learned;
+
+//Loads the journal for question_db, if there is one, and starts its writer thread
+struct learned *learn_open (const char *question_db);
+void learn_close (struct learned *l);
+
+//question as it came from the channel, after irc_sanitize. Returns 1 if it was already known
+int learn_add (struct learned *l, const char *question, const char *answer);
+
+const char *learn_lookup (const struct learned *l, const char *question);
+unsigned int learn_count (const struct learned *l);
+
+#endif
@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "loop.h"
+#include "timer.h"
+#include "hist.h"
+#include "metrics.h"
+#include "trace.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/signalfd.h>
+
+//Same as irc_run, so libircclient still gets looked at regularly
+#define LOOP_MAX_WAIT_MS	250
+#define LOOP_MAX_EVENTS		64
+#define LOOP_MAX_WATCHES	8
+#define LOOP_MAX_SIGNALS	4
+
+//Either a session, or a plain fd from loop_watch when session is NULL
+struct loop_conn {
+	irc_session_t *session;
+	int fd;			//-1 when not registered with epoll
+	int connected;		//As of the last time round the loop
+	int waiting;		//Disconnected, but going to be reconnected
+	unsigned int events;
+	void (*func) (void *arg);
+	void *arg;
+};
+
+//A signal handled from the loop, its signalfd is one of the watches
+struct loop_sig {
+	int fd;
+	void (*func) (void *arg);
+	void *arg;
+};
+
+static struct loop_conn watches[LOOP_MAX_WATCHES];
+static int nwatches;
+static struct loop_sig sigs[LOOP_MAX_SIGNALS];
+static int nsigs;
+static int loop_epfd = -1;
+static int (*on_disconnect) (irc_session_t *session);
+
+//Time spent handling each wakeup, nothing else runs on the loop thread meanwhile
+static struct hist busy;
+
+void loop_on_disconnect (int (*func) (irc_session_t *session))
+{
+	on_disconnect = func;
+}
+
+int loop_watch (int fd, void (*func) (void *arg), void *arg)
+{
+	struct loop_conn *conn;
+	struct epoll_event ev;
+
+	if (nwatches == LOOP_MAX_WATCHES)
+		return 1;
+	conn = &watches[nwatches];
+	conn->fd = fd;
+	conn->events = EPOLLIN;
+	conn->func = func;
+	conn->arg = arg;
+
+	if (loop_epfd >= 0)
+	{
+		memset (&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		if (epoll_ctl (loop_epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+			return 1;
+	}
+	nwatches++;
+	return 0;
+}
+
+static void signalled (void *arg)
+{
+	struct loop_sig *s = arg;
+	struct signalfd_siginfo info;
+	int n = 0;
+
+	//Several of the same signal before we got round to it only need handling once
+	while (read (s->fd, &info, sizeof(info)) == sizeof(info))
+		n++;
+	if (n > 0)
+		s->func (s->arg);
+}
+
+int loop_signal (int sig, void (*func) (void *arg), void *arg)
+{
+	struct loop_sig *s;
+	sigset_t mask;
+
+	if (nsigs == LOOP_MAX_SIGNALS)
+		return 1;
+	s = &sigs[nsigs];
+	sigemptyset (&mask);
+	sigaddset (&mask, sig);
+	if (pthread_sigmask (SIG_BLOCK, &mask, NULL) != 0)
+		return 1;
+	s->fd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (s->fd < 0)
+		return 1;
+	s->func = func;
+	s->arg = arg;
+	if (loop_watch (s->fd, signalled, s))
+	{
+		close (s->fd);
+		return 1;
+	}
+	nsigs++;
+	return 0;
+}
+
+//Brings the epoll registration in line with what libircclient wants to wait for
+static void watch_session (int epfd, struct loop_conn *conn)
+{
+	struct epoll_event ev;
+	fd_set in_set;
+	fd_set out_set;
+	int fd = 0;
+
+	FD_ZERO (&in_set);
+	FD_ZERO (&out_set);
+	irc_add_select_descriptors (conn->session, &in_set, &out_set, &fd);
+
+	memset (&ev, 0, sizeof(ev));
+	ev.data.ptr = conn;
+	if (FD_ISSET (fd, &in_set))
+		ev.events |= EPOLLIN;
+	if (FD_ISSET (fd, &out_set))
+		ev.events |= EPOLLOUT;
+
+	if (conn->fd != fd && conn->fd >= 0)
+	{
+		//Fails if the old socket was already closed, which removed it anyway
+		epoll_ctl (epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+		conn->fd = -1;
+	}
+	if (ev.events == 0)
+		return;
+
+	if (conn->fd < 0)
+	{
+		if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+		{
+			conn->fd = fd;
+			conn->events = ev.events;
+		}
+	}
+	else if (conn->events != ev.events)
+	{
+		//A reconnect can get the same fd number back after the old one was dropped
+		if (epoll_ctl (epfd, EPOLL_CTL_MOD, fd, &ev) != 0 && errno == ENOENT)
+			epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev);
+		conn->events = ev.events;
+	}
+}
+
+static void process (struct loop_conn *conn, unsigned int events)
+{
+	fd_set in_set;
+	fd_set out_set;
+	unsigned long start;
+
+	if (conn->session == NULL)
+	{
+		conn->func (conn->arg);
+		return;
+	}
+
+	FD_ZERO (&in_set);
+	FD_ZERO (&out_set);
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		FD_SET (conn->fd, &in_set);
+	if (events & EPOLLOUT)
+		FD_SET (conn->fd, &out_set);
+
+	//Everything libircclient does before the first callback counts as parsing that line
+	start = trace_begin ();
+	trace_set_mark (start);
+	if (irc_process_select_descriptors (conn->session, &in_set, &out_set))
+	{
+		fprintf (stderr, "IRC: ERROR %s\n", irc_strerror (irc_errno (conn->session)));
+		irc_disconnect (conn->session);
+	}
+	trace_end ("irc process", start);
+}
+
+int loop_run (irc_session_t **sessions, int count)
+{
+	struct epoll_event events[LOOP_MAX_EVENTS];
+	struct epoll_event ev;
+	struct loop_conn *conns;
+	unsigned long woke;
+	int epfd;
+	int active;
+	int ret = 0;
+	int ms;
+	int n;
+	int i;
+
+	epfd = epoll_create1 (0);
+	if (epfd < 0)
+		return 1;
+	conns = calloc (count, sizeof(*conns));
+	if (conns == NULL)
+	{
+		close (epfd);
+		return 1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		conns[i].session = sessions[i];
+		conns[i].fd = -1;
+		conns[i].waiting = on_disconnect != NULL;
+	}
+	for (i = 0; i < nwatches; i++)
+	{
+		memset (&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = &watches[i];
+		epoll_ctl (epfd, EPOLL_CTL_ADD, watches[i].fd, &ev);
+	}
+	loop_epfd = epfd;
+
+	for (;;)
+	{
+		active = 0;
+		for (i = 0; i < count; i++)
+		{
+			if (irc_is_connected (conns[i].session))
+			{
+				conns[i].connected = 1;
+				conns[i].waiting = 0;
+			}
+			else if (conns[i].connected)
+			{
+				conns[i].connected = 0;
+				metric_inc (METRIC_DISCONNECT);
+				conns[i].waiting = on_disconnect != NULL && on_disconnect (conns[i].session);
+			}
+			if (conns[i].connected || conns[i].waiting)
+				active++;
+			watch_session (epfd, &conns[i]);
+		}
+		if (active == 0)
+			break;
+
+		ms = timer_next_ms ();
+		if (ms < 0 || ms > LOOP_MAX_WAIT_MS)
+			ms = LOOP_MAX_WAIT_MS;
+
+		n = epoll_wait (epfd, events, LOOP_MAX_EVENTS, ms);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ret = 1;
+			break;
+		}
+
+		woke = timer_now_us ();
+		for (i = 0; i < n; i++)
+			process (events[i].data.ptr, events[i].events);
+
+		timer_run ();
+		hist_add (&busy, timer_now_us () - woke);
+	}
+
+	loop_epfd = -1;
+	free (conns);
+	close (epfd);
+	return ret;
+}
+
+void loop_dump_stats (FILE *out)
+{
+	hist_dump_header (out);
+	hist_dump (&busy, "loop busy", out);
+}
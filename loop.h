@@ -0,0 +1,34 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdio.h>
+#include "libircclient/libircclient.h"
+
+/*
+   Our own version of irc_run, for any number of sessions at once.
+
+   Each session's socket is watched with epoll, and only the sessions
+   whose socket is ready are handed to irc_process_select_descriptors.
+   Timers that are due are run in between, and the loop never sleeps past
+   the next one.
+
+   Returns 0 once every session has been disconnected and isn't going to
+   be reconnected, 1 on error.
+*/
+int loop_run (irc_session_t **sessions, int count);
+
+//Called when a session's connection goes, or fails to be made. Returning 1 means it will be
+//reconnected, and the loop waits for that. Every session counts as waiting until its first connect
+void loop_on_disconnect (int (*func) (irc_session_t *session));
+
+//Calls func on the loop thread whenever fd is readable, for eventfds and the like
+int loop_watch (int fd, void (*func) (void *arg), void *arg);
+
+//Calls func on the loop thread whenever sig arrives, through a signalfd. Has to be called before
+//any other thread is started, so they all inherit sig blocked
+int loop_signal (int sig, void (*func) (void *arg), void *arg);
+
+//Prints how long the loop thread was kept busy on each wakeup
+void loop_dump_stats (FILE *out);
+
+#endif
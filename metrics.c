@@ -0,0 +1,264 @@
+#include "metrics.h"
+#include "hist.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct shard {
+	struct shard *next;
+	unsigned long count[METRICS];
+	unsigned long numeric[METRIC_NUMERICS];
+	struct hist hist[METRIC_HISTS];
+};
+
+struct gauge {
+	const char *name;
+	const char *help;
+	const char *type;
+	char labels[128];
+	unsigned long (*read) (void *arg);
+	void *arg;
+};
+
+static const struct {
+	const char *name;
+	const char *labels;
+	const char *help;
+} counters[METRICS] = {
+	[METRIC_EVENT_CONNECT] = { "ircbot_events_total", "type=\"connect\"", "IRC events handled, by type" },
+	[METRIC_EVENT_NUMERIC] = { "ircbot_events_total", "type=\"numeric\"", NULL },
+	[METRIC_EVENT_PRIVMSG] = { "ircbot_events_total", "type=\"privmsg\"", NULL },
+	[METRIC_EVENT_CHANNEL] = { "ircbot_events_total", "type=\"channel\"", NULL },
+	[METRIC_RECONNECT] = { "ircbot_reconnects_total", NULL, "Connections made by a session after its first" },
+	[METRIC_DISCONNECT] = { "ircbot_disconnects_total", NULL, "Sessions that lost their connection" },
+	[METRIC_CFG_RELOAD] = { "ircbot_config_reloads_total", "result=\"ok\"", "Config file reloads on SIGHUP" },
+	[METRIC_CFG_RELOAD_FAILED] = { "ircbot_config_reloads_total", "result=\"failed\"", NULL },
+	[METRIC_COMMAND] = { "ircbot_commands_total", "result=\"ok\"", "Commands sent in a private message, by what became of them" },
+	[METRIC_COMMAND_UNKNOWN] = { "ircbot_commands_total", "result=\"unknown\"", NULL },
+	[METRIC_COMMAND_DENIED] = { "ircbot_commands_total", "result=\"denied\"", NULL },
+	[METRIC_QUESTION] = { "quizbot_questions_total", NULL, "Questions seen from the quizbot" },
+	[METRIC_LOOKUP_EXACT] = { "quizbot_lookups_total", "result=\"exact\"", "Answer lookups, by where the answer came from" },
+	[METRIC_LOOKUP_FUZZY] = { "quizbot_lookups_total", "result=\"fuzzy\"", NULL },
+	[METRIC_LOOKUP_FILE] = { "quizbot_lookups_total", "result=\"file\"", NULL },
+	[METRIC_LOOKUP_LEARNED] = { "quizbot_lookups_total", "result=\"learned\"", NULL },
+	[METRIC_LOOKUP_MISS] = { "quizbot_lookups_total", "result=\"miss\"", NULL },
+	[METRIC_RELOAD] = { "quizbot_reloads_total", "result=\"ok\"", "Question database reloads after the file changed" },
+	[METRIC_RELOAD_FAILED] = { "quizbot_reloads_total", "result=\"failed\"", NULL },
+	[METRIC_LEARNED] = { "quizbot_learned_total", NULL, "Answers learned from the quiz giving them away" },
+	[METRIC_QUIZ_TIMEOUT] = { "quizbot_quiz_timeouts_total", NULL, "Quizzes reset after stopping part way through a round" },
+};
+
+static const struct {
+	const char *name;
+	const char *help;
+} hists[METRIC_HISTS] = {
+	[METRIC_LOOKUP_US] = { "quizbot_lookup_seconds", "Time a worker spent looking up an answer" },
+	[METRIC_ANSWER_US] = { "quizbot_answer_seconds", "Time from a question arriving to its answer being queued" },
+	[METRIC_SEND_US] = { "ircbot_send_seconds", "Time from a line being queued to it being sent" },
+	[METRIC_REJOIN_US] = { "ircbot_rejoin_seconds", "Time from losing the connection to being back in every channel" },
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+static __thread struct shard *mine;
+static struct shard *shards;
+
+static struct gauge gauges[METRICS_MAX_GAUGES];
+static int ngauges;
+
+//Summed by metrics_write, too big for the stack
+static struct shard total;
+
+static struct shard *shard (void)
+{
+	struct shard *s = mine;
+
+	if (s != NULL)
+		return s;
+	s = calloc (1, sizeof(*s));
+	if (s == NULL)
+		return NULL;
+
+	//Never freed, so the exporter can walk the list without a lock
+	s->next = __atomic_load_n (&shards, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n (&shards, &s->next, s, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	mine = s;
+	return s;
+}
+
+//Only the owning thread writes, so this doesn't need to be a locked add
+static inline void bump (unsigned long *c, unsigned long n)
+{
+	__atomic_store_n (c, __atomic_load_n (c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long peek (const unsigned long *c)
+{
+	return __atomic_load_n (c, __ATOMIC_RELAXED);
+}
+
+void metric_inc (enum metric m)
+{
+	struct shard *s = shard ();
+
+	if (s != NULL)
+		bump (&s->count[m], 1);
+}
+
+void metric_numeric (unsigned int code)
+{
+	struct shard *s = shard ();
+
+	if (s == NULL)
+		return;
+	bump (&s->count[METRIC_EVENT_NUMERIC], 1);
+	if (code < METRIC_NUMERICS)
+		bump (&s->numeric[code], 1);
+}
+
+void metric_time (enum metric_hist h, unsigned long us)
+{
+	struct shard *s = shard ();
+	struct hist *hist;
+
+	if (s == NULL)
+		return;
+	hist = &s->hist[h];
+	bump (&hist->bucket[hist_bucket (us)], 1);
+	bump (&hist->count, 1);
+	bump (&hist->sum, us);
+	if (us > peek (&hist->max))
+		__atomic_store_n (&hist->max, us, __ATOMIC_RELAXED);
+}
+
+unsigned long metric_count (enum metric m)
+{
+	unsigned long n = 0;
+	struct shard *s;
+
+	for (s = __atomic_load_n (&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next)
+		n += peek (&s->count[m]);
+	return n;
+}
+
+static int add_gauge (const char *name, const char *help, const char *type, const char *labels,
+		unsigned long (*read) (void *arg), void *arg)
+{
+	struct gauge *g;
+
+	if (ngauges == METRICS_MAX_GAUGES)
+		return 1;
+	g = &gauges[ngauges++];
+	g->name = name;
+	g->help = help;
+	g->type = type;
+	snprintf (g->labels, sizeof(g->labels), "%s", labels ? labels : "");
+	g->read = read;
+	g->arg = arg;
+	return 0;
+}
+
+int metrics_gauge (const char *name, const char *help, const char *labels,
+		unsigned long (*read) (void *arg), void *arg)
+{
+	return add_gauge (name, help, "gauge", labels, read, arg);
+}
+
+int metrics_counter (const char *name, const char *help, const char *labels,
+		unsigned long (*read) (void *arg), void *arg)
+{
+	return add_gauge (name, help, "counter", labels, read, arg);
+}
+
+static void collect (void)
+{
+	struct shard *s;
+	struct hist *into;
+	const struct hist *h;
+	int i;
+	int n;
+
+	memset (&total, 0, sizeof(total));
+	for (s = __atomic_load_n (&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next)
+	{
+		for (i = 0; i < METRICS; i++)
+			total.count[i] += peek (&s->count[i]);
+		for (i = 0; i < METRIC_NUMERICS; i++)
+			total.numeric[i] += peek (&s->numeric[i]);
+		for (i = 0; i < METRIC_HISTS; i++)
+		{
+			into = &total.hist[i];
+			h = &s->hist[i];
+			for (n = 0; n < HIST_BUCKETS; n++)
+				into->bucket[n] += peek (&h->bucket[n]);
+			into->sum += peek (&h->sum);
+			if (peek (&h->max) > into->max)
+				into->max = peek (&h->max);
+		}
+	}
+
+	//Count from the buckets, which can be a record ahead of count while a thread is adding
+	for (i = 0; i < METRIC_HISTS; i++)
+	{
+		for (n = 0; n < HIST_BUCKETS; n++)
+			total.hist[i].count += total.hist[i].bucket[n];
+	}
+}
+
+static void write_header (FILE *out, const char *name, const char *help, const char *type)
+{
+	if (help != NULL)
+		fprintf (out, "# HELP %s %s\n", name, help);
+	fprintf (out, "# TYPE %s %s\n", name, type);
+}
+
+void metrics_write (FILE *out)
+{
+	const struct hist *h;
+	const char *last = NULL;
+	unsigned int code;
+	size_t q;
+	int i;
+
+	collect ();
+
+	for (i = 0; i < METRICS; i++)
+	{
+		if (last == NULL || strcmp (last, counters[i].name) != 0)
+			write_header (out, counters[i].name, counters[i].help, "counter");
+		last = counters[i].name;
+		if (counters[i].labels != NULL)
+			fprintf (out, "%s{%s} %lu\n", counters[i].name, counters[i].labels, total.count[i]);
+		else
+			fprintf (out, "%s %lu\n", counters[i].name, total.count[i]);
+	}
+
+	write_header (out, "ircbot_numerics_total", "Numeric replies from the server, by code", "counter");
+	for (code = 0; code < METRIC_NUMERICS; code++)
+	{
+		if (total.numeric[code] != 0)
+			fprintf (out, "ircbot_numerics_total{code=\"%03u\"} %lu\n", code, total.numeric[code]);
+	}
+
+	for (i = 0; i < METRIC_HISTS; i++)
+	{
+		h = &total.hist[i];
+		write_header (out, hists[i].name, hists[i].help, "summary");
+		for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+			fprintf (out, "%s{quantile=\"%g\"} %.6f\n", hists[i].name, quantiles[q], hist_percentile (h, quantiles[q]) / 1e6);
+		fprintf (out, "%s_sum %.6f\n", hists[i].name, h->sum / 1e6);
+		fprintf (out, "%s_count %lu\n", hists[i].name, h->count);
+	}
+
+	last = NULL;
+	for (i = 0; i < ngauges; i++)
+	{
+		if (last == NULL || strcmp (last, gauges[i].name) != 0)
+			write_header (out, gauges[i].name, gauges[i].help, gauges[i].type);
+		last = gauges[i].name;
+		if (gauges[i].labels[0] != '\0')
+			fprintf (out, "%s{%s} %lu\n", gauges[i].name, gauges[i].labels, gauges[i].read (gauges[i].arg));
+		else
+			fprintf (out, "%s %lu\n", gauges[i].name, gauges[i].read (gauges[i].arg));
+	}
+}
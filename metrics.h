@@ -0,0 +1,83 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+/*
+   Counters and latency histograms that are cheap enough to leave on.
+
+   Every thread records into its own shard, allocated the first time it
+   records anything, so recording is a plain load and store with no locks
+   or atomic read-modify-writes. Only the exporter, on the loop thread,
+   adds the shards up.
+
+   metrics_write prints everything in the Prometheus text format, which
+   metrics_listen serves to anything connecting to a Unix socket and
+   metrics_file rewrites to a file for the node_exporter textfile
+   collector. Gauges aren't recorded but read when exporting, from a
+   function registered with metrics_gauge, as are counters kept outside
+   the enum with metrics_counter.
+*/
+
+//Counters sharing a name are one family, and have to stay next to each other
+enum metric {
+	METRIC_EVENT_CONNECT,
+	METRIC_EVENT_NUMERIC,
+	METRIC_EVENT_PRIVMSG,
+	METRIC_EVENT_CHANNEL,
+	METRIC_RECONNECT,
+	METRIC_DISCONNECT,
+	METRIC_CFG_RELOAD,
+	METRIC_CFG_RELOAD_FAILED,
+	METRIC_COMMAND,
+	METRIC_COMMAND_UNKNOWN,
+	METRIC_COMMAND_DENIED,
+	METRIC_QUESTION,
+	METRIC_LOOKUP_EXACT,
+	METRIC_LOOKUP_FUZZY,
+	METRIC_LOOKUP_FILE,
+	METRIC_LOOKUP_LEARNED,
+	METRIC_LOOKUP_MISS,
+	METRIC_RELOAD,
+	METRIC_RELOAD_FAILED,
+	METRIC_LEARNED,
+	METRIC_QUIZ_TIMEOUT,
+	METRICS
+};
+
+enum metric_hist {
+	METRIC_LOOKUP_US,	//Worker time spent finding an answer
+	METRIC_ANSWER_US,	//Question seen to answer queued
+	METRIC_SEND_US,		//Line queued to written to the socket
+	METRIC_REJOIN_US,	//Connection lost to back in every channel
+	METRIC_HISTS
+};
+
+//Numerics are three digits, anything else is only counted as an event
+#define METRIC_NUMERICS		1000
+#define METRICS_MAX_GAUGES	32
+//How often the bots rewrite the -M file
+#define METRICS_FILE_INTERVAL_MS	15000
+
+void metric_inc (enum metric m);
+void metric_numeric (unsigned int code);
+void metric_time (enum metric_hist h, unsigned long us);
+//A counter added up over every thread, for showing it somewhere other than the exporter
+unsigned long metric_count (enum metric m);
+
+//Loop thread only. labels is the part between the braces, or NULL
+int metrics_gauge (const char *name, const char *help, const char *labels,
+		unsigned long (*read) (void *arg), void *arg);
+//As metrics_gauge, for a count kept somewhere else that only goes up
+int metrics_counter (const char *name, const char *help, const char *labels,
+		unsigned long (*read) (void *arg), void *arg);
+void metrics_write (FILE *out);
+
+//Serves metrics_write to every connection on a Unix socket at path
+int metrics_listen (const char *path);
+//Rewrites path every interval_ms, through a rename so readers never see half of it
+int metrics_file (const char *path, unsigned int interval_ms);
+//Writes the file one last time and removes the socket
+void metrics_close (void);
+
+#endif
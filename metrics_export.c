@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+
+#include "metrics.h"
+#include "loop.h"
+#include "timer.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int listen_fd = -1;
+static char socket_path[108];
+
+static char file_path[1024];
+static unsigned int file_interval_ms;
+static struct timer file_timer;
+
+//Loop thread, one or more clients are waiting to be accepted
+static void serve (void *arg)
+{
+	char *text;
+	size_t len;
+	FILE *out;
+	int fd;
+
+	while ((fd = accept4 (listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		out = open_memstream (&text, &len);
+		if (out != NULL)
+		{
+			metrics_write (out);
+			fclose (out);
+			//A client that can't take it all straight away gets cut short rather than stalling the loop
+			if (write (fd, text, len) != (ssize_t) len)
+				fprintf (stderr, "IRC: Metrics client on %s didn't take the whole reply\n", socket_path);
+			free (text);
+		}
+		close (fd);
+	}
+}
+
+int metrics_listen (const char *path)
+{
+	struct sockaddr_un addr;
+
+	if (strlen (path) >= sizeof(addr.sun_path))
+		return 1;
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+
+	listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+		return 1;
+	//Left behind by a previous run that didn't exit cleanly
+	unlink (path);
+	if (bind (listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen (listen_fd, 8) != 0
+			|| loop_watch (listen_fd, serve, NULL))
+	{
+		close (listen_fd);
+		listen_fd = -1;
+		return 1;
+	}
+	strcpy (socket_path, path);
+	return 0;
+}
+
+static int write_file (void)
+{
+	char tmp[1040];
+	FILE *out;
+	int ret;
+
+	snprintf (tmp, sizeof(tmp), "%s.tmp", file_path);
+	out = fopen (tmp, "w");
+	if (out == NULL)
+		return 1;
+	metrics_write (out);
+	ret = fclose (out);
+	if (ret != 0 || rename (tmp, file_path) != 0)
+	{
+		unlink (tmp);
+		return 1;
+	}
+	return 0;
+}
+
+static void rewrite_file (void *arg)
+{
+	if (write_file ())
+		fprintf (stderr, "IRC: Error writing metrics to %s: %s\n", file_path, strerror (errno));
+	timer_add (&file_timer, file_interval_ms);
+}
+
+int metrics_file (const char *path, unsigned int interval_ms)
+{
+	if (strlen (path) >= sizeof(file_path))
+		return 1;
+	strcpy (file_path, path);
+	file_interval_ms = interval_ms;
+	timer_init (&file_timer, rewrite_file, NULL);
+	if (write_file ())
+		return 1;
+	timer_add (&file_timer, interval_ms);
+	return 0;
+}
+
+void metrics_close (void)
+{
+	if (file_path[0] != '\0')
+	{
+		timer_cancel (&file_timer);
+		write_file ();
+	}
+	if (listen_fd >= 0)
+	{
+		close (listen_fd);
+		unlink (socket_path);
+		listen_fd = -1;
+	}
+}
@@ -0,0 +1,247 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "outq.h"
+#include "metrics.h"
+#include "trace.h"
+#include <string.h>
+#ifdef IRC_NATIVE
+#include "ircnative.h"
+#endif
+
+#define OUTQ_CREDIT_MAX	(OUTQ_BURST * OUTQ_INTERVAL_MS)
+
+static const char *lane_names[OUTQ_LANES] = { "urgent", "service", "chatter" };
+
+static void outq_flush (void *arg);
+
+//One line, already formatted, with the CR LF still to go on the end
+static int send_line (struct outq *q, const char *prefix, size_t prefix_len, const char *text, size_t len)
+{
+#ifdef IRC_NATIVE
+	struct iovec iov[3];
+
+	iov[0].iov_base = (void *) prefix;
+	iov[0].iov_len = prefix_len;
+	iov[1].iov_base = (void *) text;
+	iov[1].iov_len = len;
+	iov[2].iov_base = "\r\n";
+	iov[2].iov_len = 2;
+	return irc_send_iov (q->session, iov, 3);
+#else
+	return irc_send_raw (q->session, "%.*s%.*s", (int) prefix_len, prefix, (int) len, text);
+#endif
+}
+
+void outq_init (struct outq *q, irc_session_t *session)
+{
+	memset (q, 0, sizeof(*q));
+	q->session = session;
+	q->credit = OUTQ_CREDIT_MAX;
+	q->refilled = timer_now_ms ();
+	timer_init (&q->drain, outq_flush, q);
+}
+
+void outq_clear (struct outq *q)
+{
+	int l;
+
+	for (l = 0; l < OUTQ_LANES; l++)
+	{
+		q->head[l] = 0;
+		q->depth[l] = 0;
+	}
+	timer_cancel (&q->drain);
+}
+
+unsigned int outq_depth (const struct outq *q)
+{
+	unsigned int depth = 0;
+	int l;
+
+	for (l = 0; l < OUTQ_LANES; l++)
+		depth += q->depth[l];
+	return depth;
+}
+
+static struct outq_msg *lane_at (struct outq *q, int l, unsigned int i)
+{
+	return &q->lane[l][(q->head[l] + i) % OUTQ_LANE_MAX];
+}
+
+//Takes the i'th line out of a lane, keeping the rest in order
+static void lane_remove (struct outq *q, int l, unsigned int i)
+{
+	for (; i + 1 < q->depth[l]; i++)
+		*lane_at (q, l, i) = *lane_at (q, l, i + 1);
+	q->depth[l]--;
+}
+
+//Everything but the urgent lane has to leave a token behind for it
+static long lane_cost (int l)
+{
+	return l == OUTQ_URGENT ? OUTQ_INTERVAL_MS : 2 * OUTQ_INTERVAL_MS;
+}
+
+static void refill (struct outq *q, unsigned long now)
+{
+	q->credit += now - q->refilled;
+	if (q->credit > OUTQ_CREDIT_MAX)
+		q->credit = OUTQ_CREDIT_MAX;
+	q->refilled = now;
+}
+
+static void outq_flush (void *arg)
+{
+	struct outq *q = arg;
+	struct outq_lane_stats *stats;
+	struct outq_msg *msg;
+	unsigned long now = timer_now_ms ();
+	unsigned long now_us = timer_now_us ();
+	unsigned long wait;
+	unsigned long start;
+	int l;
+
+	refill (q, now);
+
+	for (l = 0; l < OUTQ_LANES; l++)
+	{
+		stats = &q->stats[l];
+		while (q->depth[l] > 0)
+		{
+			//Lower lanes cost more, so nothing further down can go either
+			if (q->credit < lane_cost (l))
+			{
+				timer_add (&q->drain, lane_cost (l) - q->credit);
+				return;
+			}
+
+			msg = lane_at (q, l, 0);
+			trace_set_line (msg->trace);
+			start = trace_begin ();
+			if (send_line (q, msg->line, msg->len, "", 0))
+				fprintf (stderr, "IRC: Error sending %s\n", msg->line);
+			trace_end ("write", start);
+			q->credit -= OUTQ_INTERVAL_MS;
+
+			metric_time (METRIC_SEND_US, now_us - msg->queued);
+			wait = (now_us - msg->queued) / 1000;
+			stats->sent++;
+			stats->wait_total += wait;
+			if (wait > stats->wait_max)
+				stats->wait_max = wait;
+
+			q->head[l] = (q->head[l] + 1) % OUTQ_LANE_MAX;
+			q->depth[l]--;
+		}
+	}
+}
+
+int outq_send (struct outq *q, enum outq_lane lane, const char *line)
+{
+	struct outq_msg *msg;
+	size_t len;
+	unsigned int i;
+	int l;
+
+	//Never let a CR or LF from the text start a second command
+	len = strcspn (line, "\r\n");
+	if (len >= OUTQ_LINE_MAX)
+		len = OUTQ_LINE_MAX - 1;
+
+	for (l = 0; l < OUTQ_LANES; l++)
+	{
+		for (i = 0; i < q->depth[l]; i++)
+		{
+			msg = lane_at (q, l, i);
+			if (strncmp (msg->line, line, len) != 0 || msg->line[len] != '\0')
+				continue;
+			//Already on its way at least as soon
+			if (l <= lane)
+			{
+				q->stats[lane].coalesced++;
+				return 0;
+			}
+			//Waiting further down, move it up to this lane
+			lane_remove (q, l, i);
+			q->stats[lane].coalesced++;
+			break;
+		}
+	}
+
+	if (q->depth[lane] == OUTQ_LANE_MAX)
+	{
+		q->stats[lane].dropped++;
+		fprintf (stderr, "IRC: Outbound %s queue full, dropping %.*s\n", lane_names[lane], (int) len, line);
+		return 1;
+	}
+
+	msg = lane_at (q, lane, q->depth[lane]);
+	memcpy (msg->line, line, len);
+	msg->line[len] = '\0';
+	msg->len = len;
+	msg->queued = timer_now_us ();
+	msg->trace = trace_line ();
+	q->depth[lane]++;
+	if (q->depth[lane] > q->stats[lane].max_depth)
+		q->stats[lane].max_depth = q->depth[lane];
+
+	//Sends it right away if the bucket allows, otherwise flush sets the drain timer
+	//for whichever lane is now at the front
+	timer_cancel (&q->drain);
+	outq_flush (q);
+	return 0;
+}
+
+int outq_msg (struct outq *q, enum outq_lane lane, const char *target, const char *text)
+{
+	char line[OUTQ_LINE_MAX];
+
+	snprintf (line, sizeof(line), "PRIVMSG %s :%s", target, text);
+	return outq_send (q, lane, line);
+}
+
+int outq_wire (struct outq *q, enum outq_lane lane, const char *prefix, size_t prefix_len, const char *text, size_t len)
+{
+	char line[OUTQ_LINE_MAX];
+	unsigned long start;
+
+	if (prefix_len >= OUTQ_LINE_MAX)
+		return 1;
+	if (len >= OUTQ_LINE_MAX - prefix_len)
+		len = OUTQ_LINE_MAX - 1 - prefix_len;
+
+	//Nothing to coalesce with or wait behind, so straight out from the caller's buffers
+	refill (q, timer_now_ms ());
+	if (outq_depth (q) == 0 && q->credit >= lane_cost (lane))
+	{
+		start = trace_begin ();
+		if (send_line (q, prefix, prefix_len, text, len))
+			fprintf (stderr, "IRC: Error sending %.*s%.*s\n", (int) prefix_len, prefix, (int) len, text);
+		trace_end ("write", start);
+		q->credit -= OUTQ_INTERVAL_MS;
+		metric_time (METRIC_SEND_US, 0);
+		q->stats[lane].sent++;
+		return 0;
+	}
+
+	memcpy (line, prefix, prefix_len);
+	memcpy (line + prefix_len, text, len);
+	line[prefix_len + len] = '\0';
+	return outq_send (q, lane, line);
+}
+
+void outq_dump_stats (const struct outq *q, FILE *out)
+{
+	const struct outq_lane_stats *stats;
+	int l;
+
+	fprintf (out, "%-8s %6s %6s %8s %9s %7s %10s %10s\n",
+			"Lane", "Depth", "Max", "Sent", "Coalesced", "Dropped", "Avg wait", "Max wait");
+	for (l = 0; l < OUTQ_LANES; l++)
+	{
+		stats = &q->stats[l];
+		fprintf (out, "%-8s %6u %6u %8lu %9lu %7lu %8lums %8lums\n",
+				lane_names[l], q->depth[l], stats->max_depth, stats->sent, stats->coalesced, stats->dropped,
+				stats->sent ? stats->wait_total / stats->sent : 0, stats->wait_max);
+	}
+}
@@ -0,0 +1,81 @@
+#ifndef OUTQ_H
+#define OUTQ_H
+
+#include <stdio.h>
+#include "libircclient/libircclient.h"
+#include "timer.h"
+
+/*
+   Outbound message queue with flood control.
+
+   Lines are sent through a token bucket sized like the usual ircd flood
+   limits: a burst of OUTQ_BURST lines, then one every OUTQ_INTERVAL_MS.
+   Anything over that waits in one of three lanes, and a lane is only
+   looked at once the ones above it are empty. The last token in the
+   bucket is kept for the urgent lane, so an answer goes out straight
+   away even right after a burst of other traffic.
+
+   A line that is already waiting isn't queued a second time. When the
+   bucket has room and nothing is waiting a line is sent immediately,
+   otherwise the queue drains itself from a timer.
+*/
+
+#define OUTQ_BURST		5
+#define OUTQ_INTERVAL_MS	2000
+#define OUTQ_LANE_MAX		32
+//An IRC line without its CR LF
+#define OUTQ_LINE_MAX		511
+
+enum outq_lane {
+	OUTQ_URGENT,		//Quiz answers
+	OUTQ_SERVICE,		//NickServ/ChanServ, JOIN and the like
+	OUTQ_CHATTER,		//Anything else
+	OUTQ_LANES
+};
+
+struct outq_msg {
+	char line[OUTQ_LINE_MAX];
+	unsigned int len;
+	unsigned long queued;	//timer_now_us when it was queued
+	unsigned int trace;	//Line id it's answering, see trace.h
+};
+
+struct outq_lane_stats {
+	unsigned long sent;
+	unsigned long coalesced;
+	unsigned long dropped;	//Lane was full
+	unsigned int max_depth;
+	unsigned long wait_total;	//ms, for every line sent from this lane
+	unsigned long wait_max;
+};
+
+struct outq {
+	irc_session_t *session;
+	struct outq_msg lane[OUTQ_LANES][OUTQ_LANE_MAX];
+	unsigned int head[OUTQ_LANES];
+	unsigned int depth[OUTQ_LANES];
+	long credit;		//ms worth of tokens, OUTQ_INTERVAL_MS each
+	unsigned long refilled;	//timer_now_ms of the last refill
+	struct timer drain;
+	struct outq_lane_stats stats[OUTQ_LANES];
+};
+
+void outq_init (struct outq *q, irc_session_t *session);
+
+//Drops anything still waiting, for when the connection goes away
+void outq_clear (struct outq *q);
+
+//Queues a raw line, returns 0 if it was sent or queued and 1 if the lane was full
+int outq_send (struct outq *q, enum outq_lane lane, const char *line);
+int outq_msg (struct outq *q, enum outq_lane lane, const char *target, const char *text);
+
+//Sends prefix then text as one line, with nothing to format. Neither may hold a CR or LF.
+//When nothing is waiting it goes out without being queued, in one writev with the native backend
+int outq_wire (struct outq *q, enum outq_lane lane, const char *prefix, size_t prefix_len, const char *text, size_t len);
+
+unsigned int outq_depth (const struct outq *q);
+
+//Prints the depth, wait times and coalesced/dropped counts for each lane
+void outq_dump_stats (const struct outq *q, FILE *out);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <stddef.h>
+
+/*
+   The interface between ircbot and the plugins it loads, everything a
+   plugin needs to include.
+
+   A plugin is a shared object exporting plugin_entry, which returns a
+   struct plugin_info the host checks the ABI of before calling open.
+   The plugin sees the sessions that list it in their plugins option
+   through its event function, and talks back through the struct
+   plugin_host it was opened with. Nothing but those two structs and
+   plugin_event is shared: a plugin never sees the host's own types, so
+   it keeps working with any host of the same PLUGIN_ABI.
+
+   Every string in an event is a view into the line as the IRC backend
+   handed it over, borrowed for the length of the call and never copied.
+   They happen to be NUL terminated at len, but a plugin must not rely
+   on that. Sessions are opaque and stay valid for as long as the
+   plugin is open.
+
+   Everything is called on the host's event loop thread, and a plugin
+   has to be done with anything of its own (threads, timers through
+   wake) by the time close returns: the host can dlclose it straight
+   after, to load it again from a rebuilt file without reconnecting.
+*/
+
+//Bumped for any change that isn't a field added at the end of a struct
+#define PLUGIN_ABI	1
+
+#define PLUGIN_EXPORT	__attribute__ ((visibility ("default")))
+
+struct plugin_str {
+	const char *p;
+	size_t len;
+};
+
+enum plugin_event_type {
+	PLUGIN_ATTACH,		//The session started feeding this plugin, before any other event from it
+	PLUGIN_CONNECT,		//Registered with the server, channels are joined after this
+	PLUGIN_DISCONNECT,
+	PLUGIN_CHANNEL,		//origin said text in target, a channel
+	PLUGIN_PRIVMSG,		//origin said text to us, anything that wasn't a host command
+	PLUGIN_NUMERIC		//numeric from the server, text is its last parameter
+};
+
+struct plugin_event {
+	size_t size;		//sizeof the host's struct, fields past it aren't there
+	enum plugin_event_type type;
+	void *session;
+	struct plugin_str session_name;	//Its [name] in the config, empty without sections
+	unsigned int numeric;
+	struct plugin_str origin;	//The nick only, empty for the server
+	struct plugin_str target;
+	struct plugin_str text;		//As sent, colours and all
+};
+
+enum plugin_lane {
+	PLUGIN_URGENT,		//Goes ahead of everything else, for quiz answers
+	PLUGIN_SERVICE,
+	PLUGIN_CHATTER
+};
+
+struct plugin_host {
+	size_t size;
+	unsigned int abi;
+	int verbose;
+	//Queues a PRIVMSG to target on session, cut at any CR or LF. Returns 0 if it was sent or queued
+	int (*say) (void *session, enum plugin_lane lane, struct plugin_str target, struct plugin_str text);
+	//Option name from the session's config, any name=value line counts whether ircbot knows it or
+	//not. "" if it isn't set, and only valid until the next reload
+	const char *(*option) (void *session, const char *name);
+	//Calls the plugin's tick in ms milliseconds instead of whenever it was going to, or never if ms is negative
+	void (*wake) (void *plugin, int ms);
+	//Adds n to the plugin's counter name, exported as ircbot_plugin_events_total
+	void (*count) (void *plugin, const char *name, unsigned long n);
+};
+
+struct plugin_info {
+	size_t size;
+	unsigned int abi;	//PLUGIN_ABI it was built against
+	const char *name;
+	//plugin is the handle to pass back to wake and count. Returns the plugin's state, NULL if it failed
+	void *(*open) (const struct plugin_host *host, void *plugin);
+	void (*close) (void *state);
+	void (*event) (void *state, const struct plugin_event *ev);
+	//When wake asked for it, can be NULL if it never does
+	void (*tick) (void *state);
+};
+
+PLUGIN_EXPORT const struct plugin_info *plugin_entry (void);
+
+#endif
@@ -0,0 +1,288 @@
+#include "plugins.h"
+#include "timer.h"
+#include "metrics.h"
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct slot {
+	char path[255];			//Empty for a free slot
+	void *dl;
+	const struct plugin_info *info;	//NULL while it's failed to load again after a reload
+	void *state;
+	struct timer wake;
+	//Sessions sent PLUGIN_ATTACH since it was opened
+	void **attached;
+	int nattached;
+	int attached_size;
+};
+
+//Kept by the host rather than the plugin, so they outlive a reload
+struct counter {
+	char labels[96];
+	unsigned long value;
+};
+
+static struct slot slots[PLUGINS_MAX];
+static struct counter counters[PLUGINS_MAX_COUNTERS];
+static int ncounters;
+static struct plugin_host host;
+
+static void woken (void *arg)
+{
+	struct slot *s = arg;
+
+	if (s->info != NULL && s->info->tick != NULL)
+		s->info->tick (s->state);
+}
+
+static void wake (void *plugin, int ms)
+{
+	struct slot *s = plugin;
+
+	if (ms < 0)
+		timer_cancel (&s->wake);
+	else
+		timer_add (&s->wake, ms);
+}
+
+static unsigned long read_counter (void *arg)
+{
+	const struct counter *c = arg;
+
+	return c->value;
+}
+
+//Names go in a label as they are, so only the ones that can't break it are taken
+static int is_name (const char *name)
+{
+	if (*name == '\0')
+		return 0;
+	for (; *name != '\0'; name++)
+	{
+		if (!((*name >= 'a' && *name <= 'z') || (*name >= '0' && *name <= '9') || *name == '_'))
+			return 0;
+	}
+	return 1;
+}
+
+static void count (void *plugin, const char *name, unsigned long n)
+{
+	struct slot *s = plugin;
+	char labels[sizeof(counters[0].labels)];
+	int i;
+
+	if (!is_name (name) || strlen (name) > 32)
+		return;
+	snprintf (labels, sizeof(labels), "plugin=\"%s\",event=\"%s\"", s->info->name, name);
+	for (i = 0; i < ncounters && strcmp (counters[i].labels, labels) != 0; i++)
+		;
+	if (i == ncounters)
+	{
+		if (ncounters == PLUGINS_MAX_COUNTERS || metrics_counter ("ircbot_plugin_events_total",
+				"Events plugins counted, by plugin", labels, read_counter, &counters[i]))
+			return;
+		strcpy (counters[ncounters++].labels, labels);
+	}
+	counters[i].value += n;
+}
+
+void plugins_init (int (*say) (void *session, enum plugin_lane lane, struct plugin_str target, struct plugin_str text),
+		const char *(*option) (void *session, const char *name), int verbose)
+{
+	host.size = sizeof(host);
+	host.abi = PLUGIN_ABI;
+	host.verbose = verbose;
+	host.say = say;
+	host.option = option;
+	host.wake = wake;
+	host.count = count;
+}
+
+static int open_slot (struct slot *s)
+{
+	const struct plugin_info *(*entry) (void);
+
+	s->dl = dlopen (s->path, RTLD_NOW | RTLD_LOCAL);
+	if (s->dl == NULL)
+	{
+		fprintf (stderr, "IRC: Error loading plugin %s: %s\n", s->path, dlerror ());
+		return 1;
+	}
+	//POSIX's way round a void * not converting to a function pointer
+	*(void **) (&entry) = dlsym (s->dl, "plugin_entry");
+	s->info = entry != NULL ? entry () : NULL;
+	if (s->info == NULL || s->info->abi != PLUGIN_ABI || s->info->size < sizeof(*s->info))
+	{
+		fprintf (stderr, "IRC: %s isn't a plugin for ABI %d\n", s->path, PLUGIN_ABI);
+		goto fail;
+	}
+
+	timer_init (&s->wake, woken, s);
+	s->state = s->info->open (&host, s);
+	if (s->state == NULL)
+	{
+		fprintf (stderr, "IRC: Plugin %s failed to start\n", s->path);
+		goto fail;
+	}
+	if (host.verbose)
+		fprintf (stdout, "IRC: Loaded plugin %s from %s\n", s->info->name, s->path);
+	return 0;
+
+fail:
+	s->info = NULL;
+	dlclose (s->dl);
+	s->dl = NULL;
+	return 1;
+}
+
+static void close_slot (struct slot *s)
+{
+	if (s->info == NULL)
+		return;
+	timer_cancel (&s->wake);
+	s->info->close (s->state);
+	s->info = NULL;
+	s->state = NULL;
+	s->nattached = 0;
+	dlclose (s->dl);
+	s->dl = NULL;
+}
+
+unsigned int plugins_use (const char *list)
+{
+	char path[sizeof(slots[0].path)];
+	unsigned int set = 0;
+	const char *next;
+	size_t len;
+	int free_slot;
+	int i;
+
+	for (; *list != '\0'; list = next + (*next == ','))
+	{
+		next = strchr (list, ',');
+		if (next == NULL)
+			next = list + strlen (list);
+		len = next - list;
+		if (len == 0)
+			continue;
+		//dlopen searches the library path for a bare file name
+		snprintf (path, sizeof(path), "%s%.*s", memchr (list, '/', len) == NULL ? "./" : "", (int) len, list);
+
+		free_slot = -1;
+		for (i = 0; i < PLUGINS_MAX && strcmp (slots[i].path, path) != 0; i++)
+		{
+			if (free_slot < 0 && slots[i].path[0] == '\0')
+				free_slot = i;
+		}
+		if (i == PLUGINS_MAX)
+		{
+			if (free_slot < 0)
+			{
+				fprintf (stderr, "IRC: More than %d plugins, not loading %s\n", PLUGINS_MAX, path);
+				continue;
+			}
+			i = free_slot;
+			strcpy (slots[i].path, path);
+			if (open_slot (&slots[i]))
+			{
+				slots[i].path[0] = '\0';
+				continue;
+			}
+		}
+		set |= 1u << i;
+	}
+	return set;
+}
+
+void plugins_reload (void)
+{
+	int i;
+
+	for (i = 0; i < PLUGINS_MAX; i++)
+	{
+		if (slots[i].path[0] == '\0')
+			continue;
+		close_slot (&slots[i]);
+		//Left in its slot, so the next reload tries again
+		open_slot (&slots[i]);
+	}
+}
+
+void plugins_keep (unsigned int set)
+{
+	int i;
+
+	for (i = 0; i < PLUGINS_MAX; i++)
+	{
+		if ((set & (1u << i)) || slots[i].path[0] == '\0')
+			continue;
+		if (host.verbose)
+			fprintf (stdout, "IRC: Unloading plugin %s\n", slots[i].path);
+		close_slot (&slots[i]);
+		free (slots[i].attached);
+		memset (&slots[i], 0, sizeof(slots[i]));
+	}
+}
+
+void plugins_attach (unsigned int set, void *session, const char *name)
+{
+	struct plugin_event ev;
+	struct slot *s;
+	void **attached;
+	int i;
+	int j;
+
+	memset (&ev, 0, sizeof(ev));
+	ev.size = sizeof(ev);
+	ev.type = PLUGIN_ATTACH;
+	ev.session = session;
+	ev.session_name = plugins_str (name);
+
+	for (i = 0; i < PLUGINS_MAX; i++)
+	{
+		s = &slots[i];
+		if (!(set & (1u << i)) || s->info == NULL)
+			continue;
+		for (j = 0; j < s->nattached && s->attached[j] != session; j++)
+			;
+		if (j < s->nattached)
+			continue;
+		if (s->nattached == s->attached_size)
+		{
+			attached = realloc (s->attached, (s->attached_size * 2 + 4) * sizeof(*attached));
+			if (attached == NULL)
+				continue;
+			s->attached = attached;
+			s->attached_size = s->attached_size * 2 + 4;
+		}
+		s->attached[s->nattached++] = session;
+		s->info->event (s->state, &ev);
+	}
+}
+
+void plugins_event (unsigned int set, const struct plugin_event *ev)
+{
+	int i;
+
+	for (i = 0; set != 0 && i < PLUGINS_MAX; i++, set >>= 1)
+	{
+		if ((set & 1) && slots[i].info != NULL)
+			slots[i].info->event (slots[i].state, ev);
+	}
+}
+
+void plugins_describe (unsigned int set, char *out, size_t size)
+{
+	size_t used = 0;
+	int i;
+
+	out[0] = '\0';
+	for (i = 0; i < PLUGINS_MAX && used < size; i++)
+	{
+		if (!(set & (1u << i)) || slots[i].path[0] == '\0')
+			continue;
+		used += snprintf (out + used, size - used, "%s%s (%s)", used > 0 ? ", " : "",
+				slots[i].info != NULL ? slots[i].info->name : "not loaded", slots[i].path);
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef PLUGINS_H
+#define PLUGINS_H
+
+#include <stddef.h>
+#include <string.h>
+#include "plugin.h"
+
+/*
+   ircbot's side of plugin.h: loading plugins, feeding them events and
+   loading them again on a reload.
+
+   A plugin is loaded once however many sessions list it, into a slot it
+   keeps across reloads, so a session only has to remember a set of slot
+   bits. A reload closes and dlcloses every plugin before opening its file
+   again, which picks up a rebuilt plugin without dropping a connection.
+   The new file has to be renamed into place (make does), writing over a
+   file that's mapped would crash the host.
+
+   Everything here is only to be used from the loop thread.
+*/
+
+#define PLUGINS_MAX		16
+//Distinct plugin and counter name pairs, across reloads
+#define PLUGINS_MAX_COUNTERS	16
+
+//The host's side of say and option in the struct plugin_host every plugin is opened with
+void plugins_init (int (*say) (void *session, enum plugin_lane lane, struct plugin_str target, struct plugin_str text),
+		const char *(*option) (void *session, const char *name), int verbose);
+
+//Loads the plugins in the comma separated list that aren't loaded yet, and returns the set of
+//slots the list's plugins are in. One that fails to load is reported and left out of the set
+unsigned int plugins_use (const char *list);
+
+//Opens every loaded plugin again from its file, after which sessions need attaching again
+void plugins_reload (void);
+//Unloads every plugin not in set
+void plugins_keep (unsigned int set);
+
+//Sends a PLUGIN_ATTACH for session to each plugin in set that hasn't had one since it was opened
+void plugins_attach (unsigned int set, void *session, const char *name);
+void plugins_event (unsigned int set, const struct plugin_event *ev);
+
+//"name (path)" for every plugin in set
+void plugins_describe (unsigned int set, char *out, size_t size);
+
+//A view of a C string, empty for NULL
+static inline struct plugin_str plugins_str (const char *s)
+{
+	struct plugin_str str = { s != NULL ? s : "", s != NULL ? strlen (s) : 0 };
+
+	return str;
+}
+
+#endif
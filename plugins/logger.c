@@ -0,0 +1,152 @@
+#include "../plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+   Logs what each session sees to its log_file, ircbot.log if that isn't
+   set, one timestamped line per event. Sessions logging to the same file
+   share it.
+*/
+
+#define DEFAULT_LOG_FILE	"ircbot.log"
+
+struct log {
+	char path[255];
+	FILE *file;
+};
+
+struct session {
+	void *session;
+	int log;		//Into logs, -1 if it couldn't be opened
+};
+
+struct state {
+	const struct plugin_host *host;
+	struct log *logs;
+	int nlogs;
+	struct session *sessions;
+	int nsessions;
+};
+
+static void *logger_open (const struct plugin_host *host, void *plugin)
+{
+	struct state *st = calloc (1, sizeof(*st));
+
+	if (st != NULL)
+		st->host = host;
+	return st;
+}
+
+static void logger_close (void *state)
+{
+	struct state *st = state;
+	int i;
+
+	for (i = 0; i < st->nlogs; i++)
+		fclose (st->logs[i].file);
+	free (st->logs);
+	free (st->sessions);
+	free (st);
+}
+
+static int open_log (struct state *st, const char *path)
+{
+	struct log *log;
+	int i;
+
+	for (i = 0; i < st->nlogs; i++)
+	{
+		if (strcmp (st->logs[i].path, path) == 0)
+			return i;
+	}
+	log = realloc (st->logs, (st->nlogs + 1) * sizeof(*log));
+	if (log == NULL)
+		return -1;
+	st->logs = log;
+	log = &st->logs[st->nlogs];
+	log->file = fopen (path, "a");
+	if (log->file == NULL)
+	{
+		fprintf (stderr, "Error opening log file %s\n", path);
+		return -1;
+	}
+	//A line at a time, so the log is up to date for tail -f
+	setvbuf (log->file, NULL, _IOLBF, 0);
+	snprintf (log->path, sizeof(log->path), "%s", path);
+	return st->nlogs++;
+}
+
+static void attach (struct state *st, const struct plugin_event *ev)
+{
+	const char *path = st->host->option (ev->session, "log_file");
+	struct session *s;
+
+	s = realloc (st->sessions, (st->nsessions + 1) * sizeof(*s));
+	if (s == NULL)
+		return;
+	st->sessions = s;
+	s = &st->sessions[st->nsessions++];
+	s->session = ev->session;
+	s->log = open_log (st, path[0] != '\0' ? path : DEFAULT_LOG_FILE);
+}
+
+static void logger_event (void *state, const struct plugin_event *ev)
+{
+	struct state *st = state;
+	FILE *log = NULL;
+	char stamp[32];
+	time_t now;
+	int i;
+
+	if (ev->type == PLUGIN_ATTACH)
+	{
+		attach (st, ev);
+		return;
+	}
+	for (i = 0; i < st->nsessions && log == NULL; i++)
+	{
+		if (st->sessions[i].session == ev->session && st->sessions[i].log >= 0)
+			log = st->logs[st->sessions[i].log].file;
+	}
+	if (log == NULL)
+		return;
+
+	now = time (NULL);
+	strftime (stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime (&now));
+	fprintf (log, "%s ", stamp);
+	if (ev->session_name.len > 0)
+		fprintf (log, "[%.*s] ", (int) ev->session_name.len, ev->session_name.p);
+	switch (ev->type)
+	{
+		case PLUGIN_CONNECT:
+			fprintf (log, "Connected\n");
+			break;
+		case PLUGIN_DISCONNECT:
+			fprintf (log, "Disconnected\n");
+			break;
+		case PLUGIN_CHANNEL:
+			fprintf (log, "%.*s <%.*s> %.*s\n", (int) ev->target.len, ev->target.p,
+					(int) ev->origin.len, ev->origin.p, (int) ev->text.len, ev->text.p);
+			break;
+		case PLUGIN_PRIVMSG:
+			fprintf (log, "*%.*s* %.*s\n", (int) ev->origin.len, ev->origin.p, (int) ev->text.len, ev->text.p);
+			break;
+		case PLUGIN_NUMERIC:
+			fprintf (log, "%03u %.*s\n", ev->numeric, (int) ev->text.len, ev->text.p);
+			break;
+		default:
+			fputc ('\n', log);
+			break;
+	}
+}
+
+static const struct plugin_info info = {
+	sizeof(info), PLUGIN_ABI, "logger", logger_open, logger_close, logger_event, NULL
+};
+
+PLUGIN_EXPORT const struct plugin_info *plugin_entry (void)
+{
+	return &info;
+}
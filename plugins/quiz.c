@@ -0,0 +1,226 @@
+#include "../plugin.h"
+#include "../quiz.h"
+#include "../quizdb.h"
+#include "../sanitize.h"
+#include "../timer.h"
+#include "../metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+   quizbot's answering, as a plugin for sessions that do other things too.
+
+   It follows each quiz through quiz_hear as quizbot does (see quiz.h),
+   and answers from the session's question_db through quizdb_answer, the
+   index first and then the closest question. The lookup runs on the host's loop thread,
+   so only a database that answers quickly (compiled, or small) suits
+   it; quizbot itself has the worker threads, learned answers and
+   databases reloaded as they change. Its quiz timeouts run on a timer wheel of its own,
+   driven by the host through wake and tick.
+*/
+
+struct question_db {
+	char path[255];
+	struct quizdb *db;	//NULL if it couldn't be loaded
+};
+
+struct session {
+	void *session;
+	struct quiz_table quizzes;
+	struct quizdb *db;
+	float match_threshold;
+	char quizbot_nick[255];
+	char reveal_prompt[64];
+};
+
+struct state {
+	const struct plugin_host *host;
+	void *plugin;
+	struct question_db *dbs;
+	int ndbs;
+	struct session **sessions;
+	int nsessions;
+};
+
+//For metric_inc, quiz.c has no way to pass it along
+static struct state *current;
+
+//quiz.c counts its timeouts here, as ircbot's metrics aren't ours to use
+void metric_inc (enum metric m)
+{
+	if (m == METRIC_QUIZ_TIMEOUT && current != NULL)
+		current->host->count (current->plugin, "timeouts", 1);
+}
+
+static void *quiz_open (const struct plugin_host *host, void *plugin)
+{
+	struct state *st = calloc (1, sizeof(*st));
+
+	if (st == NULL)
+		return NULL;
+	st->host = host;
+	st->plugin = plugin;
+	current = st;
+	return st;
+}
+
+static void quiz_close (void *state)
+{
+	struct state *st = state;
+	int i;
+
+	//Cancels every quiz timer, so nothing is left on the wheel
+	for (i = 0; i < st->nsessions; i++)
+	{
+		quiz_table_free (&st->sessions[i]->quizzes);
+		free (st->sessions[i]);
+	}
+	for (i = 0; i < st->ndbs; i++)
+		quizdb_free (st->dbs[i].db);
+	free (st->sessions);
+	free (st->dbs);
+	current = NULL;
+	free (st);
+}
+
+static struct quizdb *use_question_db (struct state *st, const char *path)
+{
+	struct question_db *db;
+	int i;
+
+	for (i = 0; i < st->ndbs; i++)
+	{
+		if (strcmp (st->dbs[i].path, path) == 0)
+			return st->dbs[i].db;
+	}
+	db = realloc (st->dbs, (st->ndbs + 1) * sizeof(*db));
+	if (db == NULL)
+		return NULL;
+	st->dbs = db;
+	db = &st->dbs[st->ndbs++];
+	snprintf (db->path, sizeof(db->path), "%s", path);
+	db->db = quizdb_load (path);
+	if (db->db == NULL)
+		fprintf (stderr, "Error loading question database %s\n", path);
+	else if (st->host->verbose)
+		fprintf (stdout, "Loaded %u questions from %s\n", quizdb_count (db->db), path);
+	return db->db;
+}
+
+static const char *option (struct state *st, void *session, const char *name, const char *def)
+{
+	const char *value = st->host->option (session, name);
+
+	return value[0] != '\0' ? value : def;
+}
+
+static void attach (struct state *st, void *session)
+{
+	struct session **sessions;
+	struct session *s;
+
+	sessions = realloc (st->sessions, (st->nsessions + 1) * sizeof(*sessions));
+	if (sessions == NULL)
+		return;
+	st->sessions = sessions;
+	s = calloc (1, sizeof(*s));
+	if (s == NULL || quiz_table_init (&s->quizzes))
+	{
+		free (s);
+		return;
+	}
+	s->session = session;
+	s->db = use_question_db (st, option (st, session, "question_db", QUIZ_DEFAULT_QUESTION_DB));
+	s->match_threshold = atof (option (st, session, "match_threshold", QUIZ_DEFAULT_MATCH_THRESHOLD));
+	snprintf (s->quizbot_nick, sizeof(s->quizbot_nick), "%s", option (st, session, "quizbot_nick", QUIZ_DEFAULT_QUIZBOT_NICK));
+	snprintf (s->reveal_prompt, sizeof(s->reveal_prompt), "%s", option (st, session, "reveal_prompt", QUIZ_DEFAULT_REVEAL_PROMPT));
+	st->sessions[st->nsessions++] = s;
+}
+
+static void answer_question (struct state *st, struct session *s, struct quiz *quiz)
+{
+	struct quizdb_match match;
+	const char *answer = NULL;
+	size_t len = 0;
+	int found;
+
+	st->host->count (st->plugin, "questions", 1);
+	//The same lookup as quizbot's, less its learned answers and the file scan
+	if (s->db != NULL)
+		answer = quizdb_answer (s->db, quiz->question, s->match_threshold, &match, 1, &found, &len);
+	if (answer == NULL)
+	{
+		st->host->count (st->plugin, "misses", 1);
+		if (st->host->verbose)
+			fprintf (stdout, "I Couldn't find an answer :-(\n");
+		return;
+	}
+
+	if (st->host->verbose)
+		fprintf (stdout, "I think the answer is %.*s\n", (int) len, answer);
+	st->host->count (st->plugin, "answers", 1);
+	st->host->say (s->session, PLUGIN_URGENT, (struct plugin_str) { quiz->channel, strlen (quiz->channel) },
+			(struct plugin_str) { answer, len });
+}
+
+static void channel (struct state *st, struct session *s, const struct plugin_event *ev)
+{
+	//Nothing the server sends us will be longer than an IRC line
+	char channel_text[512];
+	char channel[64];
+	char nick[64];
+	const char *reveal;
+	struct quiz *quiz;
+
+	snprintf (channel, sizeof(channel), "%.*s", (int) ev->target.len, ev->target.p);
+	snprintf (nick, sizeof(nick), "%.*s", (int) ev->origin.len, ev->origin.p);
+	//We just saw a message from a quizbot, find the quiz it's running there
+	quiz = quiz_of_quizbot (&s->quizzes, s->quizbot_nick, channel, nick);
+	if (quiz == NULL)
+		return;
+	irc_sanitize (ev->text.p, ev->text.len, channel_text, sizeof(channel_text));
+
+	//Nothing is learned from a reveal, that's left to quizbot
+	if (quiz_hear (quiz, channel_text, s->reveal_prompt, &reveal) == QUIZ_HEARD_QUESTION)
+	{
+		if (st->host->verbose)
+			fprintf (stdout, "Attempting to answer question %s in %s\n", channel_text, quiz->channel);
+		answer_question (st, s, quiz);
+	}
+}
+
+static void quiz_event (void *state, const struct plugin_event *ev)
+{
+	struct state *st = state;
+	int i;
+
+	if (ev->type == PLUGIN_ATTACH)
+		attach (st, ev->session);
+	else if (ev->type == PLUGIN_CHANNEL && ev->origin.len > 0)
+	{
+		for (i = 0; i < st->nsessions && st->sessions[i]->session != ev->session; i++)
+			;
+		if (i < st->nsessions)
+			channel (st, st->sessions[i], ev);
+	}
+	//Anything above can have moved a quiz timeout
+	st->host->wake (st->plugin, timer_next_ms ());
+}
+
+static void quiz_tick (void *state)
+{
+	struct state *st = state;
+
+	timer_run ();
+	st->host->wake (st->plugin, timer_next_ms ());
+}
+
+static const struct plugin_info info = {
+	sizeof(info), PLUGIN_ABI, "quiz", quiz_open, quiz_close, quiz_event, quiz_tick
+};
+
+PLUGIN_EXPORT const struct plugin_info *plugin_entry (void)
+{
+	return &info;
+}
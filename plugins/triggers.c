@@ -0,0 +1,111 @@
+#include "../plugin.h"
+#include "../trigger.h"
+#include "../sanitize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+   Answers channel messages from each session's triggers file (see
+   trigger.h), read when the session attaches and so again on every
+   reload.
+*/
+
+struct session {
+	void *session;
+	struct triggers *triggers;	//NULL without a triggers file
+};
+
+struct state {
+	const struct plugin_host *host;
+	void *plugin;
+	struct session *sessions;
+	int nsessions;
+};
+
+static void *triggers_open (const struct plugin_host *host, void *plugin)
+{
+	struct state *st = calloc (1, sizeof(*st));
+
+	if (st == NULL)
+		return NULL;
+	st->host = host;
+	st->plugin = plugin;
+	return st;
+}
+
+static void triggers_close (void *state)
+{
+	struct state *st = state;
+	int i;
+
+	for (i = 0; i < st->nsessions; i++)
+		trigger_free (st->sessions[i].triggers);
+	free (st->sessions);
+	free (st);
+}
+
+static void attach (struct state *st, void *session)
+{
+	const char *path = st->host->option (session, "triggers");
+	struct session *s;
+
+	s = realloc (st->sessions, (st->nsessions + 1) * sizeof(*s));
+	if (s == NULL)
+		return;
+	st->sessions = s;
+	s = &st->sessions[st->nsessions++];
+	s->session = session;
+	s->triggers = path[0] != '\0' ? trigger_load (path) : NULL;
+	if (s->triggers != NULL && st->host->verbose)
+		fprintf (stdout, "Loaded %u triggers from %s\n", trigger_count (s->triggers), path);
+}
+
+static void channel (struct state *st, const struct plugin_event *ev)
+{
+	//Nothing the server sends us will be longer than an IRC line
+	char channel_text[512];
+	unsigned int hits[TRIGGER_MAX_HITS];
+	struct triggers *t = NULL;
+	const char *reply;
+	size_t len;
+	int n;
+	int i;
+
+	for (i = 0; i < st->nsessions && t == NULL; i++)
+	{
+		if (st->sessions[i].session == ev->session)
+			t = st->sessions[i].triggers;
+	}
+	if (t == NULL)
+		return;
+
+	//Colours and formatting could otherwise split a keyword up
+	len = irc_sanitize (ev->text.p, ev->text.len, channel_text, sizeof(channel_text));
+	n = trigger_match (t, channel_text, len, hits, TRIGGER_MAX_HITS);
+	for (i = 0; i < n; i++)
+	{
+		reply = trigger_reply (t, hits[i]);
+		if (st->host->verbose)
+			fprintf (stdout, "Trigger in %.*s: %s\n", (int) ev->target.len, ev->target.p, reply);
+		st->host->count (st->plugin, "replies", 1);
+		st->host->say (ev->session, PLUGIN_CHATTER, ev->target, (struct plugin_str) { reply, strlen (reply) });
+	}
+}
+
+static void triggers_event (void *state, const struct plugin_event *ev)
+{
+	if (ev->type == PLUGIN_ATTACH)
+		attach (state, ev->session);
+	else if (ev->type == PLUGIN_CHANNEL)
+		channel (state, ev);
+}
+
+static const struct plugin_info info = {
+	sizeof(info), PLUGIN_ABI, "triggers", triggers_open, triggers_close, triggers_event, NULL
+};
+
+PLUGIN_EXPORT const struct plugin_info *plugin_entry (void)
+{
+	return &info;
+}
@@ -0,0 +1,222 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pool.h"
+#include "ring.h"
+#include "hist.h"
+#include "loop.h"
+#include "timer.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define POOL_MAX_WORKERS	16
+//Jobs waiting for each worker
+#define POOL_RING_SIZE		256
+
+struct worker {
+	pthread_t thread;
+	struct spsc_ring jobs;
+	int efd;
+	int sleeping;
+	//Only touched by the worker itself until it has been joined
+	struct hist wait;
+	struct hist run;
+};
+
+static struct worker *workers;
+static int nworkers;
+static int next_worker;
+static int stopping;
+
+static struct mpsc_ring results;
+static int results_efd = -1;
+static int results_pending;
+
+//Loop thread only
+static struct hist hand_back;
+static struct hist total;
+static unsigned long run_inline;
+
+static void wake (int efd)
+{
+	uint64_t one = 1;
+
+	//Can only fail if the counter is about to overflow, which still wakes the reader
+	if (write (efd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static void finish (struct pool_job *job)
+{
+	unsigned long now = timer_now_us ();
+
+	hist_add (&hand_back, now - job->finished);
+	hist_add (&total, now - job->queued);
+	job->done (job);
+}
+
+//Loop thread, the eventfd said results are waiting
+static void drain_results (void *arg)
+{
+	struct pool_job *job;
+	uint64_t count;
+
+	if (read (results_efd, &count, sizeof(count)) < 0)
+		;
+	//Cleared before draining, anything pushed after this point writes the eventfd again
+	__atomic_store_n (&results_pending, 0, __ATOMIC_SEQ_CST);
+
+	while ((job = mpsc_pop (&results)) != NULL)
+		finish (job);
+}
+
+static void *worker_main (void *arg)
+{
+	struct worker *w = arg;
+	struct pool_job *job;
+	uint64_t count;
+
+	trace_thread ("worker");
+	for (;;)
+	{
+		job = spsc_pop (&w->jobs);
+		if (job == NULL)
+		{
+			//Say we're going to sleep, then look once more so a push in between isn't missed
+			__atomic_store_n (&w->sleeping, 1, __ATOMIC_SEQ_CST);
+			job = spsc_pop (&w->jobs);
+			if (job == NULL)
+			{
+				if (__atomic_load_n (&stopping, __ATOMIC_SEQ_CST))
+					break;
+				if (read (w->efd, &count, sizeof(count)) < 0)
+					;
+				__atomic_store_n (&w->sleeping, 0, __ATOMIC_SEQ_CST);
+				continue;
+			}
+			__atomic_store_n (&w->sleeping, 0, __ATOMIC_SEQ_CST);
+		}
+
+		job->started = timer_now_us ();
+		hist_add (&w->wait, job->started - job->queued);
+		job->run (job);
+		job->finished = timer_now_us ();
+		hist_add (&w->run, job->finished - job->started);
+
+		//Big enough for every job in flight, but don't count on it
+		while (mpsc_push (&results, job))
+			sched_yield ();
+		if (__atomic_exchange_n (&results_pending, 1, __ATOMIC_SEQ_CST) == 0)
+			wake (results_efd);
+	}
+	return NULL;
+}
+
+int pool_start (int nthreads)
+{
+	unsigned long size = POOL_RING_SIZE;
+	int i;
+
+	if (nthreads <= 0)
+		return 0;
+	if (nthreads > POOL_MAX_WORKERS)
+		nthreads = POOL_MAX_WORKERS;
+
+	while (size < (unsigned long) nthreads * POOL_RING_SIZE)
+		size <<= 1;
+	if (mpsc_init (&results, size))
+		return 1;
+	results_efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (results_efd < 0 || loop_watch (results_efd, drain_results, NULL))
+		return 1;
+
+	workers = calloc (nthreads, sizeof(*workers));
+	if (workers == NULL)
+		return 1;
+	for (i = 0; i < nthreads; i++)
+	{
+		if (spsc_init (&workers[i].jobs, POOL_RING_SIZE))
+			return 1;
+		workers[i].efd = eventfd (0, EFD_CLOEXEC);
+		if (workers[i].efd < 0)
+			return 1;
+		if (pthread_create (&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+			return 1;
+		nworkers++;
+	}
+	return 0;
+}
+
+void pool_submit (struct pool_job *job)
+{
+	struct worker *w;
+	int i;
+
+	job->queued = timer_now_us ();
+
+	//Round robin, skipping any worker that is backed up
+	for (i = 0; i < nworkers; i++)
+	{
+		w = &workers[(next_worker + i) % nworkers];
+		if (spsc_push (&w->jobs, job) == 0)
+		{
+			next_worker = (next_worker + i + 1) % nworkers;
+			__atomic_thread_fence (__ATOMIC_SEQ_CST);
+			if (__atomic_load_n (&w->sleeping, __ATOMIC_SEQ_CST))
+				wake (w->efd);
+			return;
+		}
+	}
+
+	//No workers, or all of them are full
+	run_inline++;
+	job->started = timer_now_us ();
+	job->run (job);
+	job->finished = timer_now_us ();
+	finish (job);
+}
+
+void pool_stop (void)
+{
+	struct pool_job *job;
+	int i;
+
+	__atomic_store_n (&stopping, 1, __ATOMIC_SEQ_CST);
+	for (i = 0; i < nworkers; i++)
+		wake (workers[i].efd);
+	for (i = 0; i < nworkers; i++)
+		pthread_join (workers[i].thread, NULL);
+
+	if (nworkers > 0)
+	{
+		while ((job = mpsc_pop (&results)) != NULL)
+			finish (job);
+	}
+}
+
+void pool_dump_stats (FILE *out)
+{
+	struct hist wait;
+	struct hist run;
+	int i;
+
+	memset (&wait, 0, sizeof(wait));
+	memset (&run, 0, sizeof(run));
+	for (i = 0; i < nworkers; i++)
+	{
+		hist_merge (&wait, &workers[i].wait);
+		hist_merge (&run, &workers[i].run);
+	}
+
+	fprintf (out, "Worker pool: %d threads, %lu jobs run on the loop thread\n", nworkers, run_inline);
+	hist_dump_header (out);
+	hist_dump (&wait, "queue wait", out);
+	hist_dump (&run, "run", out);
+	hist_dump (&hand_back, "hand back", out);
+	hist_dump (&total, "total", out);
+}
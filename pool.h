@@ -0,0 +1,41 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+
+/*
+   Worker threads for anything too slow to run on the loop thread.
+
+   A job is handed to a worker through that worker's single producer ring
+   and comes back through one multi producer ring, which the loop thread
+   drains when the pool's eventfd wakes it up. job->run is called on the
+   worker and job->done back on the loop thread, so nothing but the loop
+   thread ever touches a session. The rings are lock-free, the eventfds
+   are only written when the other side may be asleep.
+
+   Without any workers (pool_start (0), or not started at all) a job is
+   run straight away on the loop thread instead.
+
+   pool_start, pool_submit and pool_stop are only to be called from the
+   loop thread.
+*/
+
+struct pool_job {
+	void (*run) (struct pool_job *job);
+	void (*done) (struct pool_job *job);
+	//timer_now_us at each step, for the latency histograms
+	unsigned long queued;
+	unsigned long started;
+	unsigned long finished;
+};
+
+int pool_start (int nthreads);
+void pool_submit (struct pool_job *job);
+
+//Waits for the workers to finish what they were given and runs every job's done
+void pool_stop (void);
+
+//Prints queue wait, run time and hand back latencies
+void pool_dump_stats (FILE *out);
+
+#endif
@@ -0,0 +1,246 @@
+#include "quiz.h"
+#include "cfg.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define QUIZ_TABLE_MIN	16
+
+static const char *phase_names[] = {
+	[QUIZ_IDLE] = "idle",
+	[QUIZ_PROMPT] = "prompt",
+	[QUIZ_QUESTION] = "question",
+	[QUIZ_HINT] = "hint",
+};
+
+static const unsigned int phase_timeouts[] = {
+	[QUIZ_IDLE] = QUIZ_IDLE_MS,
+	[QUIZ_PROMPT] = QUIZ_PROMPT_MS,
+	[QUIZ_QUESTION] = QUIZ_ROUND_MS,
+	[QUIZ_HINT] = QUIZ_ROUND_MS,
+};
+
+static uint32_t hash_key (const char *key)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *key != '\0'; key++)
+		h = (h ^ (unsigned char) *key) * 16777619u;
+	return h;
+}
+
+//Builds the lower case key and returns its hash
+static uint32_t make_key (char *key, size_t size, const char *channel, const char *nick)
+{
+	size_t i;
+
+	snprintf (key, size, "%s %s", channel, nick);
+	for (i = 0; key[i] != '\0'; i++)
+		key[i] = tolower ((unsigned char) key[i]);
+	return hash_key (key);
+}
+
+//Index of key's slot, or of the empty slot it would go in
+static uint32_t find_slot (const struct quiz_table *t, const char *key, uint32_t hash)
+{
+	uint32_t i;
+
+	for (i = hash & t->mask; t->slots[i].quiz != NULL; i = (i + 1) & t->mask)
+	{
+		if (t->slots[i].hash == hash && strcmp (t->slots[i].quiz->key, key) == 0)
+			break;
+	}
+	return i;
+}
+
+static int grow (struct quiz_table *t)
+{
+	struct quiz_slot *old = t->slots;
+	uint32_t size = (t->mask + 1) * 2;
+	uint32_t i;
+
+	t->slots = calloc (size, sizeof(*t->slots));
+	if (t->slots == NULL)
+	{
+		t->slots = old;
+		return 1;
+	}
+	t->mask = size - 1;
+	for (i = 0; i < size / 2; i++)
+	{
+		if (old[i].quiz != NULL)
+			t->slots[find_slot (t, old[i].quiz->key, old[i].hash)] = old[i];
+	}
+	free (old);
+	return 0;
+}
+
+//Shifts later entries back into the hole, so probes never need tombstones
+static void remove_slot (struct quiz_table *t, uint32_t i)
+{
+	uint32_t j = i;
+	uint32_t home;
+
+	for (;;)
+	{
+		t->slots[i].quiz = NULL;
+		do
+		{
+			j = (j + 1) & t->mask;
+			if (t->slots[j].quiz == NULL)
+				return;
+			home = t->slots[j].hash & t->mask;
+		}
+		//Leave it if its home is cyclically within (i, j]
+		while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+		t->slots[i] = t->slots[j];
+		i = j;
+	}
+}
+
+static void timed_out (void *arg)
+{
+	struct quiz *q = arg;
+	struct quiz_table *t = q->table;
+
+	if (q->phase != QUIZ_IDLE)
+	{
+		metric_inc (METRIC_QUIZ_TIMEOUT);
+		fprintf (stdout, "IRC: Quiz by %s in %s stopped in the %s phase\n", q->nick, q->channel, phase_names[q->phase]);
+		quiz_set_phase (q, QUIZ_IDLE);
+		return;
+	}
+
+	remove_slot (t, find_slot (t, q->key, hash_key (q->key)));
+	t->count--;
+	free (q);
+}
+
+int quiz_table_init (struct quiz_table *t)
+{
+	t->slots = calloc (QUIZ_TABLE_MIN, sizeof(*t->slots));
+	if (t->slots == NULL)
+		return 1;
+	t->mask = QUIZ_TABLE_MIN - 1;
+	t->count = 0;
+	return 0;
+}
+
+void quiz_table_free (struct quiz_table *t)
+{
+	uint32_t i;
+
+	for (i = 0; t->slots != NULL && i <= t->mask; i++)
+	{
+		if (t->slots[i].quiz != NULL)
+		{
+			timer_cancel (&t->slots[i].quiz->timeout);
+			free (t->slots[i].quiz);
+		}
+	}
+	free (t->slots);
+	t->slots = NULL;
+	t->count = 0;
+}
+
+struct quiz *quiz_find (struct quiz_table *t, const char *channel, const char *nick)
+{
+	char key[sizeof(((struct quiz *) 0)->key)];
+	uint32_t hash;
+
+	hash = make_key (key, sizeof(key), channel, nick);
+	return t->slots[find_slot (t, key, hash)].quiz;
+}
+
+struct quiz *quiz_get (struct quiz_table *t, const char *channel, const char *nick)
+{
+	char key[sizeof(((struct quiz *) 0)->key)];
+	struct quiz *q;
+	uint32_t hash;
+	uint32_t i;
+
+	hash = make_key (key, sizeof(key), channel, nick);
+	i = find_slot (t, key, hash);
+	if (t->slots[i].quiz != NULL)
+		return t->slots[i].quiz;
+
+	//Kept at most half full
+	if ((t->count + 1) * 2 > t->mask + 1)
+	{
+		if (grow (t))
+			return NULL;
+		i = find_slot (t, key, hash);
+	}
+	q = calloc (1, sizeof(*q));
+	if (q == NULL)
+		return NULL;
+	strcpy (q->key, key);
+	snprintf (q->channel, sizeof(q->channel), "%s", channel);
+	snprintf (q->nick, sizeof(q->nick), "%s", nick);
+	q->prefix_len = snprintf (q->prefix, sizeof(q->prefix), "PRIVMSG %s :", q->channel);
+	q->table = t;
+	timer_init (&q->timeout, timed_out, q);
+	timer_add (&q->timeout, QUIZ_IDLE_MS);
+	t->slots[i].hash = hash;
+	t->slots[i].quiz = q;
+	t->count++;
+	return q;
+}
+
+struct quiz *quiz_of_quizbot (struct quiz_table *t, const char *quizbots, const char *channel, const char *nick)
+{
+	if (!cfg_list_has (quizbots, nick))
+		return NULL;
+	return quiz_get (t, channel, nick);
+}
+
+void quiz_set_phase (struct quiz *q, enum quiz_phase phase)
+{
+	q->phase = phase;
+	timer_add (&q->timeout, phase_timeouts[phase]);
+}
+
+enum quiz_heard quiz_hear (struct quiz *q, const char *text, const char *reveal_prompt, const char **answer)
+{
+	const char *reveal;
+
+	//After the prompt the next message should be the question
+	if (q->phase == QUIZ_PROMPT)
+	{
+		q->round++;
+		q->hints = 0;
+		snprintf (q->question, sizeof(q->question), "%s", text);
+		q->guess[0] = '\0';
+		quiz_set_phase (q, QUIZ_QUESTION);
+		return QUIZ_HEARD_QUESTION;
+	}
+	//The message was the start of a new question
+	if (strncmp (text, QUIZ_PROMPT_TEXT, strlen (QUIZ_PROMPT_TEXT) - 1) == 0)
+	{
+		quiz_set_phase (q, QUIZ_PROMPT);
+		return QUIZ_HEARD_PROMPT;
+	}
+	if (q->phase != QUIZ_QUESTION && q->phase != QUIZ_HINT)
+		return QUIZ_HEARD_NOTHING;
+
+	if (reveal_prompt[0] != '\0' && (reveal = strstr (text, reveal_prompt)) != NULL)
+	{
+		*answer = reveal + strlen (reveal_prompt);
+		quiz_set_phase (q, QUIZ_IDLE);
+		return QUIZ_HEARD_REVEAL;
+	}
+	if (strstr (text, QUIZ_HINT_TEXT) != NULL)
+	{
+		q->hints++;
+		quiz_set_phase (q, QUIZ_HINT);
+		return QUIZ_HEARD_HINT;
+	}
+	return QUIZ_HEARD_NOTHING;
+}
+
+const char *quiz_phase_name (enum quiz_phase phase)
+{
+	return phase_names[phase];
+}
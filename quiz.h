@@ -0,0 +1,114 @@
+#ifndef QUIZ_H
+#define QUIZ_H
+
+#include "timer.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+   Where each quiz quizbot is playing has got to, so quizzes in different
+   channels (or run by different quizbots in one channel) don't get in
+   each other's way.
+
+   A quiz goes from QUIZ_PROMPT (the quizbot announced a question) to
+   QUIZ_QUESTION (it asked it, and an answer is being looked up) to
+   QUIZ_HINT (it gave a hint) and back to QUIZ_IDLE once the answer is
+   revealed or the next question is announced. Every phase has a timeout,
+   so a quiz that stops half way is reset, and one left idle for
+   QUIZ_IDLE_MS is forgotten.
+
+   quiz_hear moves a quiz along for each message its quizbot sends, for
+   quizbot and the quiz plugin alike, and says what the message was.
+
+   Quizzes are kept in a per-session table keyed by channel and quizbot
+   nick, compared without case as IRC does. The table is open addressing
+   with linear probing over slots holding just the hash and a pointer, so
+   a probe rarely leaves the first cache line. Everything here is only to
+   be used from the loop thread.
+*/
+
+//The question should follow its prompt straight away
+#define QUIZ_PROMPT_MS		30000
+//Longest a question can go unanswered before the quiz is assumed to have stopped
+#define QUIZ_ROUND_MS		300000
+#define QUIZ_IDLE_MS		3600000
+
+//What MoxQuizz starts a question and a hint with
+#define QUIZ_PROMPT_TEXT	"{MoxQuizz} The question"
+#define QUIZ_HINT_TEXT		"Hint:"
+
+//Option defaults for quizbot and the quiz plugin. Nick to listen to for questions
+#define QUIZ_DEFAULT_QUIZBOT_NICK	"juicer"
+#define QUIZ_DEFAULT_QUESTION_DB	"questions.db"
+//Lowest fuzzy match score we'll answer with
+#define QUIZ_DEFAULT_MATCH_THRESHOLD	"0.5"
+//Quizbot text just before the answer when nobody got it, empty to not learn answers
+#define QUIZ_DEFAULT_REVEAL_PROMPT	"The answer was"
+
+enum quiz_phase {
+	QUIZ_IDLE,
+	QUIZ_PROMPT,
+	QUIZ_QUESTION,
+	QUIZ_HINT
+};
+
+//What a message from a quizbot turned out to be
+enum quiz_heard {
+	QUIZ_HEARD_NOTHING,
+	QUIZ_HEARD_PROMPT,
+	QUIZ_HEARD_QUESTION,	//The quiz's question is to be answered
+	QUIZ_HEARD_HINT,
+	QUIZ_HEARD_REVEAL	//Nobody got it, and the quiz gave the answer away
+};
+
+struct quiz_table;
+
+struct quiz {
+	char key[128];		//"#channel nick" in lower case
+	char channel[64];
+	char nick[64];
+	//"PRIVMSG #channel :", built once so an answer only has to be written after it
+	char prefix[80];
+	size_t prefix_len;
+	enum quiz_phase phase;
+	unsigned int round;	//Bumped for every question, to spot answers that come back too late
+	unsigned int hints;
+	struct timer timeout;
+	struct quiz_table *table;
+	char question[512];
+	char guess[1024];	//What we answered this round
+};
+
+struct quiz_slot {
+	uint32_t hash;
+	struct quiz *quiz;	//NULL if the slot is empty
+};
+
+struct quiz_table {
+	struct quiz_slot *slots;
+	uint32_t mask;
+	unsigned int count;
+};
+
+int quiz_table_init (struct quiz_table *t);
+void quiz_table_free (struct quiz_table *t);
+
+//NULL if nothing has been heard from nick in channel, or it has been forgotten
+struct quiz *quiz_find (struct quiz_table *t, const char *channel, const char *nick);
+//As quiz_find, but starts a new idle quiz if there isn't one. NULL only if out of memory
+struct quiz *quiz_get (struct quiz_table *t, const char *channel, const char *nick);
+
+//The quiz nick is running in channel, started if need be, as long as nick is one of the comma
+//separated quizbots. NULL if it isn't, or if out of memory
+struct quiz *quiz_of_quizbot (struct quiz_table *t, const char *quizbots, const char *channel, const char *nick);
+
+//Moves q to phase and restarts its timeout
+void quiz_set_phase (struct quiz *q, enum quiz_phase phase);
+
+//Moves q along for text, a sanitized message from its quizbot. A question is kept in q->question.
+//For QUIZ_HEARD_REVEAL, *answer is set to what followed reveal_prompt; an empty reveal_prompt never matches
+enum quiz_heard quiz_hear (struct quiz *q, const char *text, const char *reveal_prompt, const char **answer);
+
+const char *quiz_phase_name (enum quiz_phase phase);
+
+#endif
@@ -1,10 +1,23 @@
 #include "libircclient/libircclient.h"
-#include "libircclient/libirc_rfcnumeric.h"
 #include <stdio.h>
-#include <unistd.h>
 #include <string.h>
-#include <getopt.h>
+#include <strings.h>
+#include <stdlib.h>
 #include <iconv.h>
+#include "quizdb.h"
+#include "cfg.h"
+#include "sanitize.h"
+#include "timer.h"
+#include "outq.h"
+#include "metrics.h"
+#include "trace.h"
+#include "reload.h"
+#include "epoch.h"
+#include "learn.h"
+#include "quiz.h"
+#include "pool.h"
+#include "cmd.h"
+#include "host.h"
 
 #define DEFAULT_CFG_FILE  	"/.quizbot.cfg"
 #define DEFAULT_IRC_SERVER  	"irc.squatjuice.org"
@@ -13,10 +26,8 @@
 #define DEFAULT_IRC_NICK	"qircbot"
 #define DEFAULT_IRC_USERNAME 	"qircbot"
 #define DEFAULT_IRC_REALNAME 	"qircbot"
-//Nick to listen to for questions
-#define DEFAULT_QUIZBOT_NICK	"juicer"
-
-#define DEFAULT_QUIZ_PROMPT	"{MoxQuizz} The question"
+//Threads looking up answers, 0 does it on the main thread
+#define DEFAULT_WORKERS		2
 
 /*
    Example output from MozzQuiz:
@@ -30,25 +41,12 @@
    Author: serv
 */
 
-static void answer_question (char *question);
+struct bot;
+static void answer_question (struct bot *bot, struct quiz *quiz, const char *question);
+static void learn_reveal (struct bot *bot, struct quiz *quiz, const char *answer);
 
-struct cfg {
-	char cfg_file[1024];
-	char server[255];
-	char port[16];
-	char channel[64];
-	char nick[64];
-	char username[16];
-	char realname[16];
-	char server_connect_msg[255];
-	char server_connect_nick[16];
-	char server_connect_delay[6];
-	char channel_connect_msg[255];
-	char channel_connect_nick[16];
-	char channel_connect_delay[6];
-	char quizbot_nick[16];
-} irc_cfg = {
-	DEFAULT_CFG_FILE,
+struct cfg irc_defaults = {
+	"",
 	DEFAULT_IRC_SERVER,
 	DEFAULT_IRC_PORT,
 	DEFAULT_IRC_CHANNEL,
@@ -61,231 +59,179 @@ struct cfg {
 	"",
 	"",
 	"",
-	DEFAULT_QUIZBOT_NICK
+	"",
+	QUIZ_DEFAULT_QUIZBOT_NICK,
+	QUIZ_DEFAULT_QUESTION_DB,
+	QUIZ_DEFAULT_MATCH_THRESHOLD,
+	QUIZ_DEFAULT_REVEAL_PROMPT
 };
 
-#define NUM_CFG_OPTS 13
+//One per session, the session's ctx points back at it
+struct bot {
+	struct host_session host;
+	//Every quiz heard on this session, by channel and quizbot
+	struct quiz_table quizzes;
+	//Shared with every other session using the same question_db
+	struct quizdb_live *quiz_db;
+	struct learned *learned;
+};
 
-const char *cfg_options[] = {
-	"server", "port", "channel", "nick", "username", "realname", 
-	"server_connect_msg", "server_connect_nick", "server_connect_delay",
-	"channel_connect_msg", "channel_connect_nick", "channel_connect_delay",
-	"quizbot_nick"
+//A question on its way through the worker pool
+struct answer_job {
+	struct pool_job job;
+	struct bot *bot;
+	struct quizdb_live *quiz_db;
+	struct learned *learned;
+	//Which quiz and round the answer is for, looked up again once it's found. For a
+	//!lookup, channel is the nick to answer
+	char channel[64];
+	char nick[64];
+	unsigned int round;
+	float match_threshold;
+	unsigned int trace;	//Line id the question came in on
+	char question_db[255];
+	char question[512];
+	char answer[1024];	//Empty if nothing was found
+	size_t answer_len;	//Sent as it is after the quiz's prefix, so no CR or LF
 };
 
-char *cfg_vars[] = {
-	irc_cfg.server, irc_cfg.port, irc_cfg.channel, irc_cfg.nick, irc_cfg.username, irc_cfg.realname,
-		irc_cfg.server_connect_msg, irc_cfg.server_connect_nick, irc_cfg.server_connect_delay,
-		irc_cfg.channel_connect_msg, irc_cfg.channel_connect_nick, irc_cfg.channel_connect_delay,
-		irc_cfg.quizbot_nick
+//Every question database opened, each shared by all the sessions using it. One a reload
+//leaves unused is kept until exit, as a worker may still be looking an answer up in it
+struct question_db {
+	char path[255];
+	struct quizdb_live *live;
+	struct learned *learned;
 };
 
-int verbose = 0;
-int use_default_cfg = 1;
-int quizbot_prompt = 0;
+static int workers = DEFAULT_WORKERS;
+static struct question_db *dbs;
+static int ndbs;
 
-irc_session_t *session;
+//Generated from quizbot.cmds by cmdgen, the handlers are the cmd_ functions here and in host.c
+extern const struct cmd_table quizbot_commands;
 
-//Sent on successful connection to server, useful for NickServ
-static void send_server_connect_msg (void)
+static void event_channel (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
 {
-	//Check to see if we have commands to run
-	if (strlen (irc_cfg.server_connect_msg) != 0)
+	//Nothing the server sends us will be longer than an IRC line
+	char channel_text[512];
+	struct bot *bot = irc_get_ctx (session);
+	unsigned long start;
+	const char *reveal;
+	struct quiz *quiz;
+
+	metric_inc (METRIC_EVENT_CHANNEL);
+	trace_new_line ();
+	trace_end ("parse", trace_mark ());
+
+	start = trace_begin ();
+	irc_sanitize (params[1], strlen (params[1]), channel_text, sizeof(channel_text));
+	trace_end ("sanitize", start);
+
+	//We just saw a message from a quizbot, find the quiz it's running there
+	if (origin != NULL && (quiz = quiz_of_quizbot (&bot->quizzes, bot->host.cfg.quizbot_nick, params[0], origin)) != NULL)
 	{
-		//Make sure a nick was specified
-		if (strlen (irc_cfg.server_connect_nick) == 0)
-		{
-			fprintf (stderr, "IRC: server_connect_msg specified but not server_connect_nick\n");
-			return;
-		}
-		if (atoi (irc_cfg.server_connect_delay) > 0)
-		{
-			if (verbose)
-				fprintf (stdout, "IRC: Waiting %i seconds before sending command\n", atoi(irc_cfg.server_connect_delay));
-			sleep (atoi (irc_cfg.server_connect_delay));
-		}
-		if (verbose)
-			fprintf (stdout, "IRC: Sending server_connect_msg\n");
-		irc_cmd_msg (session, irc_cfg.server_connect_nick, irc_cfg.server_connect_msg);
-	}
-}
-
-//Sent on successful connection to channel, useful for ChanServ
-static void send_channel_connect_msg (void)
-{
-	//Check to see if we have commands to run
-	if (strlen (irc_cfg.channel_connect_msg) != 0)
-	{
-		//Make sure a nick was specified
-		if (strlen (irc_cfg.channel_connect_nick) == 0)
-		{
-			fprintf (stderr, "IRC: channel_connect_msg specified but not channel_connect_nick\n");
-			return;
-		}
-		if (atoi (irc_cfg.channel_connect_delay) > 0)
+		switch (quiz_hear (quiz, channel_text, bot->host.cfg.reveal_prompt, &reveal))
 		{
-			if (verbose)
-				fprintf (stdout, "IRC: Waiting %i seconds before sending command\n", atoi(irc_cfg.channel_connect_delay));
-			sleep (atoi (irc_cfg.channel_connect_delay));
+			case QUIZ_HEARD_PROMPT:
+				if (verbose)
+					fprintf (stdout, "Found prompt in %s, ready for question\n", quiz->channel);
+				break;
+			case QUIZ_HEARD_QUESTION:
+				if (verbose)
+					fprintf (stdout, "Attempting to answer question %s in %s\n", channel_text, quiz->channel);
+				metric_inc (METRIC_QUESTION);
+				answer_question (bot, quiz, channel_text);
+				break;
+			case QUIZ_HEARD_REVEAL:
+				//Nobody got it, remember the answer for next time
+				learn_reveal (bot, quiz, reveal);
+				break;
+			default:
+				break;
 		}
-		if (verbose)
-			fprintf (stdout, "IRC: Sending channel_connect_msg\n");
-		irc_cmd_msg (session, irc_cfg.channel_connect_nick, irc_cfg.channel_connect_msg);
 	}
-
+	//Parsing the next line in the same read starts from here
+	trace_set_mark (trace_begin ());
 }
 
-//Called when successfully connected to a server
-void event_connect (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+static void set_answer (struct answer_job *a, const char *answer, size_t len)
 {
-	fprintf (stdout, "IRC: Successfully connected to server %s\n", irc_cfg.server);
-
-	send_server_connect_msg ();
-	
-	if (verbose)
-		fprintf (stdout, "IRC: Attempting to join %s\n", irc_cfg.channel);
-
-	if (irc_cmd_join (session, irc_cfg.channel, NULL))
-	{
-		fprintf (stderr, "IRC: Error joining channel %s\n", irc_cfg.channel);
-		return;
-	}
-	
-	fprintf (stdout, "IRC: Connected to %s\n", irc_cfg.channel);
-
-	send_channel_connect_msg ();
+	if (len >= sizeof(a->answer))
+		len = sizeof(a->answer) - 1;
+	memcpy (a->answer, answer, len);
+	a->answer[len] = '\0';
+	a->answer_len = len;
 }
 
-void event_privmsg (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+//Nothing from quiz_db may be kept once this returns, it can be freed by a reload
+static void lookup_answer (struct answer_job *a, const struct quizdb *quiz_db)
 {
-	printf ("'%s' said to me (%s): %s\n", origin ? origin : "someone", params[0], params[1] );
-}
-
-void event_numeric (irc_session_t *session, unsigned int event, const char *origin, const char **params, unsigned int count)
-{
-	if (!verbose)
-		return;
-
-	switch (event)
-	{
-		case LIBIRC_RFC_RPL_NAMREPLY:
-		      fprintf (stdout, "IRC: User list: %s\n", params[3]);
-		      break;
-		case LIBIRC_RFC_RPL_WELCOME:
-		      fprintf (stdout, "IRC: %s\n", params[1]);
-		      break;
-		case LIBIRC_RFC_RPL_YOURHOST:
-		      fprintf (stdout, "IRC: %s\n", params[1]);
-		case LIBIRC_RFC_RPL_ENDOFNAMES:
-		      fprintf (stdout, "IRC: End of user list\n");
-		      break;
-		case LIBIRC_RFC_RPL_MOTD:
-		      fprintf (stdout, "%s\n", params[1]);
-		      break;
-		default:
-		      fprintf (stdout, "IRC: event_numeric %u\n", event);
-		      break;
-	}
-}
-
-void event_channel (irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
-{
-#define UTF8_SPACE 32
-#define UTF8_TILDE 126
-
-	const char *text_buff;
-	char channel_text[255] = "";
-	int ch;
+	const char *question = a->question;
+	char question_buff[1024];
+	char answer_buff[1024];
+	struct quizdb_match match[3];
+	const char *answer;
+	FILE *q_file;
+	unsigned long start;
 	size_t len;
+	int found_answer = 0;
+	int found;
 	int i;
-	int j = 0;
-
-	//Cast params to text_buff
-	text_buff = params[1];
-	
-	//Get the length
-	len = strlen (text_buff);
 
-	for (i = 0; i < len; i++)
+	//Anything the quiz told us overrides the database, it may have had the wrong answer
+	if (a->learned != NULL && (answer = learn_lookup (a->learned, question)) != NULL)
 	{
-		ch = text_buff[i];
-		//Only put the chars we want into the string
-		if ((ch >= UTF8_SPACE && ch <= UTF8_TILDE) || ch == 160)
-		{
-			if (ch == 160)
-				ch = UTF8_SPACE;
-			channel_text[j] = ch;
-			j++;
-
-		}
+		if (verbose)
+			fprintf (stdout, "I think the answer is %s (learned)\n", answer);
+		metric_inc (METRIC_LOOKUP_LEARNED);
+		set_answer (a, answer, strlen (answer));
+		return;
 	}
 
-	//We just saw a message from the quizbot
-	if (strcmp (origin, irc_cfg.quizbot_nick) == 0)
+	//Then the index, or the closest question in case it was reworded or mangled
+	if (quiz_db != NULL && (answer = quizdb_answer (quiz_db, question, a->match_threshold, match, 3, &found, &len)) != NULL)
 	{
-		if (quizbot_prompt)
-		{	
-			if (verbose)
-				fprintf (stdout, "Attempting to answer question %s\n", channel_text);
-			//This message should contain the question text
-			answer_question (channel_text);
-			quizbot_prompt = 0;
-		}
-		//The message was the start of a new question
-		else if (strncmp (channel_text, DEFAULT_QUIZ_PROMPT, strlen(DEFAULT_QUIZ_PROMPT) - 1) == 0)
+		if (verbose)
 		{
-			if (verbose)
-				fprintf (stdout, "Found prompt, ready for question\n");
-			quizbot_prompt = 1;
+			for (i = 0; i < found; i++)
+				fprintf (stdout, "Candidate %.3f: %s\n", match[i].score, match[i].question);
+			if (found > 0)
+				fprintf (stdout, "I think the answer is %s (score %.3f)\n", answer, match[0].score);
+			else
+				fprintf (stdout, "I think the answer is %s (index)\n", answer);
 		}
+		metric_inc (found > 0 ? METRIC_LOOKUP_FUZZY : METRIC_LOOKUP_EXACT);
+		//Stored ready to send, so this is the only copy on the way out
+		set_answer (a, answer, len);
+		return;
 	}
-}
 
-static void print_usage (void)
-{
-	fprintf (stdout, "quizbot\n");
-	fprintf (stdout, "Options:\n");
-	fprintf (stdout, "-c		Specify config file location, default %s\n", DEFAULT_CFG_FILE);
-	fprintf (stdout, "-h		This help text\n");
-}
+	//The file is searched for the question without its "(Category) " or a trailing .
+	answer = strchr (question, ')');
+	answer = answer != NULL ? answer + 1 : question;
+	answer += strspn (answer, " ");
+	len = strlen (answer);
+	if (len > 0 && answer[len - 1] == '.')
+		len--;
+	snprintf (question_buff, sizeof(question_buff), "%.*s", (int) len, answer);
 
-static void answer_question (char *question)
-{
-	char question_buff[1024];
-	char answer_buff[1024];
-	FILE *q_file;
-	int found_answer = 0;
-	int i;
-
-	//Strip out the category part, if it exists FIXME
-	if (strchr (question, ')') != NULL)
-		strcpy (question_buff, strchr (question, ')') + 2);
-	else
-		strcpy (question_buff, question);
-
-    //Strip off the leading blank spaces
-    for (i = 0; i < strlen (question_buff); i++)
-    {
-        if (strncmp (&question_buff[i], " ", 1) != 0)
-        {
-            strcpy (question_buff, &question_buff[i]);
-            break;
-        }
-    }
-    //FIXME
-    //Strip off the trailing . if the question had one
-    if (strcmp (&question_buff[strlen(question_buff + 1)], ".") == 0)
-    {
-        fprintf (stdout, "Question had a . at the end of it\n");
-        strncpy (question_buff, question_buff, strlen(question_buff - 2));
-    }
-        
 	if (verbose)
 		fprintf (stdout, "Question was: %s\n", question_buff);
 
-	q_file = fopen ("questions.db", "r");
+	//A compiled database can't be scanned as text, and nothing is in every line
+	if (len == 0 || (quiz_db != NULL && quizdb_is_compiled (quiz_db)))
+	{
+		metric_inc (METRIC_LOOKUP_MISS);
+		if (verbose)
+			fprintf (stdout, "I Couldn't find an answer :-\(\n");
+		return;
+	}
+
+	start = trace_begin ();
+	q_file = fopen (a->question_db, "r");
 	if (q_file == NULL)
 	{
+		metric_inc (METRIC_LOOKUP_MISS);
 		fprintf (stderr, "Error reading question database\n");
 		return;
 	}
@@ -298,190 +244,323 @@ static void answer_question (char *question)
 			if (verbose)
 				fprintf (stdout, "Found match %s\n", answer_buff);
 			//We found a match, grab the next line which will be the answer
-			fgets (answer_buff, sizeof(answer_buff), q_file);
-			found_answer = 1;
+			found_answer = fgets (answer_buff, sizeof(answer_buff), q_file) != NULL;
 			break;
 		}
 	}
 	
 	if (found_answer)
 	{
-		//Strip off the answer part
-		strcpy (answer_buff, strchr (answer_buff, ':') + 2);
+		//Strip off the "Answer: " part
+		answer = strchr (answer_buff, ':');
+		answer = answer != NULL ? answer + 1 : answer_buff;
+		answer += strspn (answer, " ");
 		if (verbose)
-			fprintf (stdout, "I think the answer is %s\n", answer_buff);
+			fprintf (stdout, "I think the answer is %s\n", answer);
 
-		irc_cmd_msg (session, irc_cfg.channel, answer_buff);
+		metric_inc (METRIC_LOOKUP_FILE);
+		set_answer (a, answer, strcspn (answer, "\r\n"));
+	}
+	else
+	{
+		metric_inc (METRIC_LOOKUP_MISS);
+		if (verbose)
+			fprintf (stdout, "I Couldn't find an answer :-\(\n");
 	}
-    else if (verbose)
-    {
-        fprintf (stdout, "I Couldn't find an answer :-\(\n");
-    }
 
 	fclose (q_file);
+	trace_end ("file scan", start);
 }
 
-/*
-static int cfg_create (void)
+//Worker thread, everything it needs was copied into the job so it never touches the bot
+static void find_answer (struct pool_job *job)
 {
-    FILE *in_file;
-    
+	struct answer_job *a = (struct answer_job *) job;
+
+	trace_set_line (a->trace);
+	if (trace_enabled)
+		trace_record ("queue wait", job->queued * 1000, job->started * 1000);
+
+	//The database can be swapped by a reload meanwhile, the epoch keeps this copy alive
+	epoch_enter ();
+	lookup_answer (a, a->quiz_db != NULL ? reload_get (a->quiz_db) : NULL);
+	epoch_exit ();
 }
-*/
 
-static int cfg_load (void)
+//Back on the loop thread
+static void send_answer (struct pool_job *job)
 {
-	FILE *in_file;
-	char cfg_buff[64];
-	int i;
-	
+	struct answer_job *a = (struct answer_job *) job;
+	struct quiz *quiz;
+	unsigned long start;
+
+	trace_set_line (a->trace);
+	if (trace_enabled)
+		trace_record ("hand back", job->finished * 1000, trace_clock ());
+
+	metric_time (METRIC_LOOKUP_US, job->finished - job->started);
 
-	//If no config file was specified on the command line, look in the users home directory for one
-	if (use_default_cfg)
+	//The quiz may have moved on to the next question meanwhile, or stopped
+	quiz = quiz_find (&a->bot->quizzes, a->channel, a->nick);
+	if (quiz == NULL || quiz->round != a->round || quiz->phase == QUIZ_IDLE)
 	{
-		strcpy (cfg_buff, getenv("HOME"));
-		strcat (cfg_buff, irc_cfg.cfg_file);
-		strcpy (irc_cfg.cfg_file, cfg_buff);
+		if (verbose)
+			fprintf (stdout, "Too late answering %s in %s\n", a->question, a->channel);
+		free (a);
+		return;
 	}
-	
-	if (verbose)
+	if (a->answer_len > 0 && irc_is_connected (a->bot->host.session))
 	{
-		fprintf (stdout, "IRC: Attempting to Load config file %s\n", irc_cfg.cfg_file);
+		start = trace_begin ();
+		outq_wire (&a->bot->host.out_queue, OUTQ_URGENT, quiz->prefix, quiz->prefix_len, a->answer, a->answer_len);
+		trace_end ("send", start);
+		metric_time (METRIC_ANSWER_US, timer_now_us () - job->queued);
 	}
+	//Kept so a reveal can be checked against it
+	memcpy (quiz->guess, a->answer, a->answer_len + 1);
+	free (a);
+}
 
-	in_file = fopen (irc_cfg.cfg_file, "r");
+//answer is whatever followed reveal_prompt in the quizbot's message
+static void learn_reveal (struct bot *bot, struct quiz *quiz, const char *answer)
+{
+	char buff[1024];
+	size_t len;
 
-	if (in_file == NULL && !use_default_cfg)
-		return 2;
-	else if (in_file == NULL && use_default_cfg)
-		return 1;
+	//"The answer was: Moby Dick." and the like
+	answer += strspn (answer, " :");
+	snprintf (buff, sizeof(buff), "%s", answer);
+	len = strlen (buff);
+	while (len > 0 && (buff[len - 1] == ' ' || buff[len - 1] == '.' || buff[len - 1] == '!'))
+		buff[--len] = '\0';
 
-	//Copy a line from cfg file into cfg_buff
-	while (fgets (cfg_buff, 64, in_file) != NULL)
+	if (len > 0 && bot->learned != NULL && strcasecmp (buff, quiz->guess) != 0)
 	{
-		//Cycle through the different options
-		for (i = 0; i < NUM_CFG_OPTS; i++)
+		if (learn_add (bot->learned, quiz->question, buff) == 0)
 		{
-			//Look for a match and make sure there's a = after it
-			if (strncmp (cfg_buff, cfg_options[i], strlen(cfg_options[i])) == 0 &&
-					strncmp (cfg_buff + strlen (cfg_options[i]), "=", 1) == 0)
-			{
-				//Copy to variable
-				strcpy (cfg_vars[i], cfg_buff + strlen (cfg_options[i]) + 1);
-				//Strip newline
-				strtok (cfg_vars[i], "\n");
-				//Check if empty var
-				if (strcmp (cfg_vars[i], "\n") == 0)
-				{
-					fprintf (stderr, "IRC: Empty cfg option %s\n", cfg_options[i]);
-					fclose (in_file);
-					return 1;
-				}
-			}
+			metric_inc (METRIC_LEARNED);
+			if (verbose)
+				fprintf (stdout, "Learned %s for %s\n", buff, quiz->question);
 		}
 	}
-	fclose (in_file);
-	return 0;
+}
 
+//A job to look question up with the session's databases, for the caller to say where the answer goes
+static struct answer_job *new_answer_job (struct bot *bot, const char *question, size_t len)
+{
+	struct answer_job *a;
+
+	a = malloc (sizeof(*a));
+	if (a == NULL)
+		return NULL;
+	a->job.run = find_answer;
+	a->bot = bot;
+	a->quiz_db = bot->quiz_db;
+	a->learned = bot->learned;
+	a->match_threshold = atof (bot->host.cfg.match_threshold);
+	a->trace = trace_line ();
+	strcpy (a->question_db, bot->host.cfg.question_db);
+	snprintf (a->question, sizeof(a->question), "%.*s", (int) len, question);
+	a->answer[0] = '\0';
+	a->answer_len = 0;
+	return a;
 }
 
-int main (int argc, char **argv)
+//Looking the answer up can take a while, so it's done on a worker
+static void answer_question (struct bot *bot, struct quiz *quiz, const char *question)
 {
-	irc_callbacks_t callbacks;
-	int c;
-	int ret;
+	struct answer_job *a;
 
-	// Read command line options
-	while ((c = getopt (argc, argv, "c:vh")) != -1)
-	{
-		switch (c)
-		{
-			default:
-			case 'h':
-				print_usage ();
-				return 0;
-				break;
-			case 'v':
-				verbose = 1;
-				break;
-			case 'c':
-				strcpy (irc_cfg.cfg_file, optarg);
-				use_default_cfg = 0;
-				break;
-			case '?':
-				if (optopt == 'c')
-					fprintf (stderr, "Option -c requires an argument\n");
-				else
-					fprintf (stderr, "Unrecognised option %c\n", optopt);
-				fprintf (stderr, "Error reading commmand line options\n");
-				return 1;
-				break;
-		}
-	}
-	
-	ret = cfg_load ();
-	if (ret > 1)
+	a = new_answer_job (bot, question, strlen (question));
+	if (a == NULL)
+		return;
+	a->job.done = send_answer;
+	strcpy (a->channel, quiz->channel);
+	strcpy (a->nick, quiz->nick);
+	a->round = quiz->round;
+	pool_submit (&a->job);
+}
+
+//Back on the loop thread with a !lookup, whoever asked is in channel
+static void send_lookup (struct pool_job *job)
+{
+	struct answer_job *a = (struct answer_job *) job;
+	char text[OUTQ_LINE_MAX];
+
+	if (a->answer_len > 0)
+		snprintf (text, sizeof(text), "Answer: %.480s", a->answer);
+	else
+		snprintf (text, sizeof(text), "No answer found");
+	if (irc_is_connected (a->bot->host.session))
+		outq_msg (&a->bot->host.out_queue, OUTQ_CHATTER, a->channel, text);
+	free (a);
+}
+
+//Loads path, or finds it already loaded, and points bot at it. Its learned answers are only
+//opened for a session that learns, so nothing is written next to a database that never does
+static void use_question_db (struct bot *bot, const char *path, int learn)
+{
+	struct question_db *db;
+	int i;
+
+	for (i = 0; i < ndbs && strcmp (dbs[i].path, path) != 0; i++)
+		;
+	if (i == ndbs)
 	{
-		fprintf (stderr, "Error reading configuration file %s\n", irc_cfg.cfg_file);
-		return 1;
+		db = realloc (dbs, (ndbs + 1) * sizeof(*dbs));
+		if (db == NULL)
+			return;
+		dbs = db;
+		db = &dbs[ndbs++];
+		snprintf (db->path, sizeof(db->path), "%s", path);
+
+		//Picks up changes to the file from then on
+		db->live = reload_open (path);
+		if (db->live == NULL || reload_get (db->live) == NULL)
+			fprintf (stderr, "Error loading question database %s\n", path);
+		else if (verbose)
+			fprintf (stdout, "Loaded %u questions from %s\n", quizdb_count (reload_get (db->live)), path);
+		db->learned = NULL;
 	}
-	else if (ret == 1)
+	if (dbs[i].learned == NULL && learn)
 	{
-		fprintf (stdout, "No configuration file found, using defaults\n");
+		dbs[i].learned = learn_open (path);
+		if (dbs[i].learned != NULL && learn_count (dbs[i].learned) > 0 && verbose)
+			fprintf (stdout, "Loaded %u learned answers for %s\n", learn_count (dbs[i].learned), path);
 	}
+	bot->quiz_db = dbs[i].live;
+	bot->learned = dbs[i].learned;
+}
 
-	if (verbose)
+//The role hook for a reload. Answers already being looked up come from the old database
+static void apply_quiz (struct host_session *s, const struct cfg *cfg)
+{
+	struct bot *bot = (struct bot *) s;
+	const struct cfg *old = &s->cfg;
+
+	if (strcmp (cfg->quizbot_nick, old->quizbot_nick) != 0)
+		fprintf (stdout, "IRC: Listening to %s for questions\n", cfg->quizbot_nick);
+	if (strcmp (cfg->question_db, old->question_db) != 0)
+		fprintf (stdout, "Switching to question database %s\n", cfg->question_db);
+	if (strcmp (cfg->question_db, old->question_db) != 0 || strcmp (cfg->reveal_prompt, old->reveal_prompt) != 0)
+		use_question_db (bot, cfg->question_db, cfg->reveal_prompt[0] != '\0');
+}
+
+void cmd_lookup (void *ctx, const struct cmd_call *call)
+{
+	struct bot *bot = ctx;
+	struct answer_job *a;
+
+	if (call->rest.len == 0)
 	{
-		fprintf (stdout, "Configuration options:\n");
-		fprintf (stdout, "server = %s\n", irc_cfg.server);
-		fprintf (stdout, "port = %s\n", irc_cfg.port);
-		fprintf (stdout, "channel = %s\n", irc_cfg.channel);
-		fprintf (stdout, "nick = %s\n", irc_cfg.nick);
-		fprintf (stdout, "username = %s\n", irc_cfg.username);
-		fprintf (stdout, "realname = %s\n", irc_cfg.realname);
-		fprintf (stdout, "server_connect_msg = %s\n", irc_cfg.server_connect_msg);
-		fprintf (stdout, "server_connect_nick = %s\n", irc_cfg.server_connect_nick);
-		fprintf (stdout, "server_connect_delay = %s\n", irc_cfg.server_connect_delay);
-		fprintf (stdout, "channel_connect_msg = %s\n", irc_cfg.channel_connect_msg);
-		fprintf (stdout, "channel_connect_nick = %s\n", irc_cfg.channel_connect_nick);
-		fprintf (stdout, "channel_connect_delay = %s\n", irc_cfg.channel_connect_delay);
-		fprintf (stdout, "quizbot_nick = %s\n", irc_cfg.quizbot_nick);
+		outq_msg (&bot->host.out_queue, OUTQ_CHATTER, call->origin, "Usage: !lookup <question>");
+		return;
 	}
-	fprintf (stdout, "IRC: Bot initilising\n");
+	a = new_answer_job (bot, call->rest.p, call->rest.len);
+	if (a == NULL)
+		return;
+	a->job.done = send_lookup;
+	snprintf (a->channel, sizeof(a->channel), "%s", call->origin);
+	a->nick[0] = '\0';
+	a->round = 0;
+	pool_submit (&a->job);
+}
 
-	memset (&callbacks, 0, sizeof(callbacks));
+static void print_usage (void)
+{
+	fprintf (stdout, "-w		Number of threads looking up answers, default %d\n", DEFAULT_WORKERS);
+	fprintf (stdout, "-t		Trace the answer path, written to this file on SIGUSR1 and at exit\n");
+}
 
-	callbacks.event_connect = event_connect;
-	callbacks.event_numeric = event_numeric;
-	callbacks.event_privmsg = event_privmsg;
-	callbacks.event_channel = event_channel;
-	
-	session = irc_create_session(&callbacks);
+static void option (int c, const char *arg)
+{
+	//-w is the only one
+	workers = atoi (arg);
+}
 
-	if (!session)
-	{
-		fprintf (stderr, "IRC: Error setting up session\n");
-		return 1;
-	}
-	
-	irc_option_set(session, LIBIRC_OPTION_STRIPNICKS);
+static void print_cfg (const struct cfg *cfg)
+{
+	fprintf (stdout, "quizbot_nick = %s\n", cfg->quizbot_nick);
+	fprintf (stdout, "question_db = %s\n", cfg->question_db);
+	fprintf (stdout, "match_threshold = %s\n", cfg->match_threshold);
+	fprintf (stdout, "reveal_prompt = %s\n", cfg->reveal_prompt);
+}
 
-	if (verbose)
-	{
-		fprintf (stdout, "IRC: Attempting to connect to server %s:%i channel %s with nick %s\n", 
-				irc_cfg.server, atoi(irc_cfg.port), irc_cfg.channel, irc_cfg.nick);
-	}
+static int start (void)
+{
+	struct bot *bot;
+	int i;
 
-	if (irc_connect (session, irc_cfg.server, atoi(irc_cfg.port), 0, irc_cfg.nick, irc_cfg.username, irc_cfg.realname ))
+	//Sessions using the same question database share one copy of it
+	for (i = 0; i < host_sessions (); i++)
 	{
-		fprintf (stderr, "IRC: ERROR %s\n", irc_strerror(irc_errno (session)));
+		bot = (struct bot *) host_session (i);
+		use_question_db (bot, bot->host.cfg.question_db, bot->host.cfg.reveal_prompt[0] != '\0');
 	}
 
-	//Enter main loop
-	if (irc_run (session))
+	if (pool_start (workers))
 	{
-		fprintf (stderr, "IRC: ERROR %s\n", irc_strerror(irc_errno (session)));
+		fprintf (stderr, "Error starting worker threads\n");
 		return 1;
 	}
 	return 0;
 }
+
+static int start_session (struct host_session *s)
+{
+	return quiz_table_init (&((struct bot *) s)->quizzes);
+}
+
+static void stop (void)
+{
+	int i;
+
+	pool_stop ();
+	if (verbose)
+		pool_dump_stats (stdout);
+	for (i = 0; i < ndbs && verbose; i++)
+	{
+		if (dbs[i].live != NULL && reload_get (dbs[i].live) != NULL)
+			quizdb_dump_stats (reload_get (dbs[i].live), stdout);
+	}
+	for (i = 0; i < host_sessions (); i++)
+		quiz_table_free (&((struct bot *) host_session (i))->quizzes);
+	for (i = 0; i < ndbs; i++)
+		learn_close (dbs[i].learned);
+	reload_close ();
+}
+
+static void stats (char *out, size_t size)
+{
+	snprintf (out, size, "%lu questions, answers %lu exact, %lu fuzzy, %lu learned, %lu from the file, %lu missed, %lu answers learned",
+			metric_count (METRIC_QUESTION), metric_count (METRIC_LOOKUP_EXACT), metric_count (METRIC_LOOKUP_FUZZY),
+			metric_count (METRIC_LOOKUP_LEARNED), metric_count (METRIC_LOOKUP_FILE), metric_count (METRIC_LOOKUP_MISS),
+			metric_count (METRIC_LEARNED));
+}
+
+static const struct host_role role = {
+	"quizbot",
+	DEFAULT_CFG_FILE,
+	&irc_defaults,
+	&quizbot_commands,
+	sizeof(struct bot),
+	"w:",
+	"Config reloaded",
+	print_usage,
+	option,
+	print_cfg,
+	start,
+	start_session,
+	stop,
+	event_channel,
+	NULL,
+	NULL,
+	apply_quiz,
+	NULL,
+	stats
+};
+
+int main (int argc, char **argv)
+{
+	return host_main (&role, argc, argv);
+}
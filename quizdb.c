@@ -0,0 +1,691 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "quizdb_int.h"
+#include "sanitize.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//FNV-1a
+uint32_t qdb_hash (const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= (unsigned char) s[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+size_t quizdb_normalize (const char *in, char *out, size_t outlen)
+{
+	const unsigned char *p = (const unsigned char *) in;
+	const char *end;
+	int space = 0;
+	size_t j = 0;
+
+	if (outlen == 0)
+		return 0;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	//Strip out the category part, if it exists
+	if (*p == '(' && (end = strchr ((const char *) p, ')')) != NULL)
+		p = (const unsigned char *) end + 1;
+
+	for (; *p != '\0'; p++)
+	{
+		if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		{
+			space = 1;
+			continue;
+		}
+		//Control characters, the input should already be through irc_sanitize
+		if (*p < 32 || *p == 127)
+			continue;
+		if (j + 2 >= outlen)
+			break;
+		if (space && j > 0)
+			out[j++] = ' ';
+		space = 0;
+		out[j++] = (*p >= 'A' && *p <= 'Z') ? *p + ('a' - 'A') : *p;
+	}
+
+	//Strip off any trailing punctuation
+	while (j > 0 && (out[j - 1] == '.' || out[j - 1] == '?' || out[j - 1] == '!' || out[j - 1] == ' '))
+		j--;
+
+	out[j] = '\0';
+	return j;
+}
+
+int qdb_arena_add (struct quizdb *db, const char *s, size_t len, uint32_t *off)
+{
+	char *arena;
+	size_t size;
+
+	if (db->arena_len + len + 1 > db->arena_size)
+	{
+		size = db->arena_size ? db->arena_size * 2 : 1 << 20;
+		while (size < db->arena_len + len + 1)
+			size *= 2;
+		if (size > UINT32_MAX || (arena = realloc (db->arena, size)) == NULL)
+			return 1;
+		db->arena = arena;
+		db->arena_size = size;
+	}
+	memcpy (db->arena + db->arena_len, s, len);
+	db->arena[db->arena_len + len] = '\0';
+	*off = db->arena_len;
+	db->arena_len += len + 1;
+	return 0;
+}
+
+//Grows the arena to hold at least size bytes in all, so it isn't copied as it fills
+int qdb_arena_reserve (struct quizdb *db, size_t size)
+{
+	char *arena;
+
+	if (size <= db->arena_size)
+		return 0;
+	if (size > UINT32_MAX || (arena = realloc (db->arena, size)) == NULL)
+		return 1;
+	db->arena = arena;
+	db->arena_size = size;
+	return 0;
+}
+
+//Case and spacing don't matter in category names
+uint32_t qdb_category_hash (const char *name, size_t len)
+{
+	uint32_t h = 2166136261u;
+	unsigned char c;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		c = name[i];
+		if (c == ' ' || c == '\t')
+			continue;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h ^= c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+//Returns the category named in a "(Category) question" line, or -1 if there isn't a known one
+int qdb_find_category (const struct quizdb *db, const char *question)
+{
+	const char *end;
+	uint32_t hash;
+	uint32_t i;
+
+	while (*question == ' ')
+		question++;
+	if (*question != '(' || (end = strchr (question, ')')) == NULL)
+		return -1;
+
+	//There are rarely more than a few hundred categories
+	hash = qdb_category_hash (question + 1, end - question - 1);
+	for (i = 0; i < db->ncategories; i++)
+	{
+		if (db->categories[i].hash == hash)
+			return i;
+	}
+	return -1;
+}
+
+/*
+   Insert into the table. Within a category the first copy of a question
+   wins like the old file scan, the same question in another category is
+   kept since the answer may well depend on it.
+*/
+static int table_insert (struct quizdb *db, uint32_t hash, uint32_t key, uint32_t answer, uint32_t answer_len, uint32_t first)
+{
+	const struct qdb_doc *doc;
+	uint32_t i;
+
+	for (i = hash & db->mask; db->slots[i].doc != 0; i = (i + 1) & db->mask)
+	{
+		doc = &db->docs[db->slots[i].doc - 1];
+		if (db->slots[i].hash == hash && db->slots[i].doc - 1 >= first &&
+				strcmp (db->arena + doc->key, db->arena + key) == 0)
+			return 0;
+	}
+	db->docs[db->count].key = key;
+	db->docs[db->count].answer = answer;
+	db->docs[db->count].answer_len = answer_len;
+	db->count++;
+	db->slots[i].hash = hash;
+	db->slots[i].doc = db->count;
+	return 1;
+}
+
+char *qdb_strip_field (char *line, const char *field)
+{
+	size_t len = strlen (field);
+	char *end;
+
+	if (strncmp (line, field, len) != 0)
+		return NULL;
+	line += len;
+	while (*line == ' ')
+		line++;
+	end = line + strlen (line);
+	while (end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' '))
+		end--;
+	*end = '\0';
+	return line;
+}
+
+//Returns the index of the named category, adding it if it's new
+int qdb_add_category (struct quizdb *db, const char *name, uint32_t *maxcat)
+{
+	struct qdb_category *cats;
+	uint32_t hash = qdb_category_hash (name, strlen (name));
+	uint32_t i;
+
+	for (i = 0; i < db->ncategories; i++)
+	{
+		if (db->categories[i].hash == hash)
+			return i;
+	}
+	if (db->ncategories == *maxcat)
+	{
+		*maxcat = *maxcat ? *maxcat * 2 : 64;
+		cats = realloc (db->categories, *maxcat * sizeof(struct qdb_category));
+		if (cats == NULL)
+			return -1;
+		db->categories = cats;
+	}
+	memset (&db->categories[i], 0, sizeof(struct qdb_category));
+	db->categories[i].hash = hash;
+	if (qdb_arena_add (db, name, strlen (name), &db->categories[i].name))
+		return -1;
+	db->ncategories++;
+	return i;
+}
+
+/*
+   Builds the table over entries, whose strings are already in the arena.
+   Entries are taken in order, categories must have the number of entries
+   in each counted.
+*/
+int qdb_build (struct quizdb *db, const struct qdb_entry *entries, size_t nentries)
+{
+	struct qdb_entry *sorted;
+	uint32_t size;
+	uint32_t off;
+	uint32_t c;
+	size_t i;
+
+	//Counting sort by category, keeping file order within each one
+	sorted = malloc ((nentries + 1) * sizeof(struct qdb_entry));
+	if (sorted == NULL)
+		return 1;
+	for (c = 0, off = 0; c < db->ncategories; c++)
+	{
+		db->categories[c].first = off;
+		off += db->categories[c].count;
+		db->categories[c].count = 0;
+	}
+	for (i = 0; i < nentries; i++)
+	{
+		c = entries[i].category;
+		sorted[db->categories[c].first + db->categories[c].count++] = entries[i];
+	}
+
+	//Keep the load factor at or below 50%
+	for (size = 16; size < nentries * 2; size *= 2)
+		;
+	db->slots = calloc (size, sizeof(struct qdb_slot));
+	db->docs = calloc (nentries + 1, sizeof(struct qdb_doc));
+	db->stats = calloc (db->ncategories + 1, sizeof(struct qdb_stats));
+	if (db->slots == NULL || db->docs == NULL || db->stats == NULL)
+	{
+		free (sorted);
+		return 1;
+	}
+	db->mask = size - 1;
+
+	//Doc ids are handed out in order, so duplicates shrink the ranges
+	for (c = 0, i = 0; c < db->ncategories; c++)
+	{
+		db->categories[c].first = db->count;
+		for (off = 0; off < db->categories[c].count; off++, i++)
+		{
+			table_insert (db, sorted[i].hash, sorted[i].question, sorted[i].answer, sorted[i].answer_len,
+					db->categories[c].first);
+		}
+		db->categories[c].count = db->count - db->categories[c].first;
+	}
+	free (sorted);
+	return 0;
+}
+
+static struct quizdb *load_text (const char *path)
+{
+	struct quizdb *db;
+	FILE *q_file;
+	char line[QDB_LINE_MAX];
+	char text[QDB_LINE_MAX];
+	char key[QDB_LINE_MAX];
+	struct qdb_entry *entries = NULL;
+	struct qdb_entry *tmp;
+	size_t nentries = 0;
+	size_t maxentries = 0;
+	uint32_t maxcat = 0;
+	uint32_t question = 0;
+	uint32_t hash = 0;
+	uint32_t off;
+	size_t len;
+	char *field;
+	int category;
+
+	q_file = fopen (path, "r");
+	if (q_file == NULL)
+		return NULL;
+
+	db = calloc (1, sizeof (struct quizdb));
+	if (db == NULL)
+	{
+		fclose (q_file);
+		return NULL;
+	}
+
+	//Offset 0 is reserved so an empty slot can be told apart
+	if (qdb_arena_add (db, "", 0, &off))
+		goto fail;
+	//Questions without a Category line go in an unnamed one
+	if ((category = qdb_add_category (db, "", &maxcat)) < 0)
+		goto fail;
+
+	//Collect the entries, then build the table once we know how many there are
+	while (fgets (line, sizeof(line), q_file) != NULL)
+	{
+		if ((field = qdb_strip_field (line, "Category:")) != NULL)
+		{
+			if ((category = qdb_add_category (db, field, &maxcat)) < 0)
+				goto fail;
+		}
+		else if ((field = qdb_strip_field (line, "Question:")) != NULL)
+		{
+			//Clean it up the same way channel text is, so the keys match
+			irc_sanitize (field, strlen (field), text, sizeof(text));
+			len = quizdb_normalize (text, key, sizeof(key));
+			question = 0;
+			if (len > 0 && qdb_arena_add (db, key, len, &question))
+				goto fail;
+			hash = qdb_hash (key, len);
+		}
+		else if ((field = qdb_strip_field (line, "Answer:")) != NULL && question != 0)
+		{
+			if (qdb_arena_add (db, field, strlen (field), &off))
+				goto fail;
+			if (nentries == maxentries)
+			{
+				maxentries = maxentries ? maxentries * 2 : 4096;
+				tmp = realloc (entries, maxentries * sizeof(struct qdb_entry));
+				if (tmp == NULL)
+					goto fail;
+				entries = tmp;
+			}
+			entries[nentries].question = question;
+			entries[nentries].hash = hash;
+			entries[nentries].answer = off;
+			entries[nentries].answer_len = strlen (field);
+			entries[nentries].category = category;
+			db->categories[category].count++;
+			nentries++;
+			question = 0;
+			category = 0;
+		}
+	}
+	fclose (q_file);
+	q_file = NULL;
+
+	if (qdb_build (db, entries, nentries) || qdb_build_terms (db))
+		goto fail;
+	free (entries);
+	return db;
+
+fail:
+	if (q_file != NULL)
+		fclose (q_file);
+	free (entries);
+	quizdb_free (db);
+	return NULL;
+}
+
+//Returns a pointer to section n if it is in bounds and holds at least size bytes
+void *qdb_map_section (void *map, size_t len, const struct qdb_header *hdr, int n, uint64_t size)
+{
+	if (hdr->sec[n].off % 8 != 0 || hdr->sec[n].off > len || hdr->sec[n].len > len - hdr->sec[n].off ||
+			hdr->sec[n].len < size)
+		return NULL;
+	return (char *) map + hdr->sec[n].off;
+}
+
+static struct quizdb *load_compiled (int fd, size_t len)
+{
+	struct quizdb *db;
+	const struct qdb_header *hdr;
+	void *map;
+
+	map = mmap (NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	hdr = map;
+
+	if (hdr->version != QDB_VERSION || hdr->byte_order != QDB_BYTE_ORDER)
+	{
+		fprintf (stderr, "Question database was compiled by an incompatible version, run quizdb-compile again\n");
+		goto fail;
+	}
+
+	db = calloc (1, sizeof(struct quizdb));
+	if (db == NULL)
+		goto fail;
+	db->map = map;
+	db->map_len = len;
+	db->count = hdr->count;
+	db->packed = (hdr->flags & QDB_PACKED) != 0;
+	db->mask = hdr->table_size - 1;
+	db->term_mask = hdr->term_size - 1;
+	db->slots = qdb_map_section (map, len, hdr, QDB_SEC_SLOTS, (uint64_t) hdr->table_size * sizeof(struct qdb_slot));
+	db->arena = qdb_map_section (map, len, hdr, QDB_SEC_ARENA, 1);
+	db->arena_len = hdr->sec[QDB_SEC_ARENA].len;
+	db->docs = qdb_map_section (map, len, hdr, QDB_SEC_DOCS, (uint64_t) hdr->count * sizeof(struct qdb_doc));
+	db->terms = qdb_map_section (map, len, hdr, QDB_SEC_TERMS, (uint64_t) hdr->term_size * sizeof(struct qdb_term));
+	db->postings = qdb_map_section (map, len, hdr, QDB_SEC_POSTINGS, 0);
+	db->npostings = hdr->sec[QDB_SEC_POSTINGS].len / sizeof(uint32_t);
+	db->ncategories = hdr->ncategories;
+	db->categories = qdb_map_section (map, len, hdr, QDB_SEC_CATEGORIES, (uint64_t) hdr->ncategories * sizeof(struct qdb_category));
+	db->stats = calloc (db->ncategories + 1, sizeof(struct qdb_stats));
+
+	if ((!db->packed && (hdr->table_size == 0 || (hdr->table_size & db->mask) != 0 ||
+			db->slots == NULL || db->docs == NULL)) ||
+			(db->packed && qdb_map_packed (db, hdr)) ||
+			hdr->term_size == 0 || (hdr->term_size & db->term_mask) != 0 ||
+			db->arena == NULL || db->terms == NULL || db->postings == NULL || db->categories == NULL ||
+			db->arena[db->arena_len - 1] != '\0')
+	{
+		fprintf (stderr, "Question database is corrupt\n");
+		free (db->stats);
+		free (db);
+		goto fail;
+	}
+	if (db->stats == NULL)
+	{
+		free (db);
+		goto fail;
+	}
+
+	//Lookups land all over the file, don't bother reading ahead
+	posix_madvise (map, len, POSIX_MADV_RANDOM);
+	return db;
+
+fail:
+	munmap (map, len);
+	return NULL;
+}
+
+struct quizdb *quizdb_load (const char *path)
+{
+	struct quizdb *db;
+	struct stat st;
+	char magic[4];
+	int fd;
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	//Compiled files start with the magic, anything else is the text format
+	if (fstat (fd, &st) == 0 && st.st_size >= (off_t) sizeof(struct qdb_header) &&
+			read (fd, magic, sizeof(magic)) == sizeof(magic) && memcmp (magic, QDB_MAGIC, sizeof(magic)) == 0)
+		db = load_compiled (fd, st.st_size);
+	else
+		db = load_text (path);
+
+	close (fd);
+	return db;
+}
+
+//Writes the header and the sections it lists, data[i] holding hdr->sec[i].len bytes
+int qdb_write (const char *path, const struct qdb_header *hdr, const void **data)
+{
+	static const char pad[8];
+	char tmp_path[1024];
+	uint64_t off;
+	FILE *out;
+	int i;
+
+	//Write to a temporary file and rename it, so running bots never map a half written file
+	snprintf (tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	out = fopen (tmp_path, "wb");
+	if (out == NULL)
+		return 1;
+
+	if (fwrite (hdr, sizeof(*hdr), 1, out) != 1)
+		goto fail;
+	off = sizeof(*hdr);
+	for (i = 0; i < QDB_NUM_SECTIONS; i++)
+	{
+		if (fwrite (pad, 1, hdr->sec[i].off - off, out) != hdr->sec[i].off - off ||
+				(hdr->sec[i].len > 0 && fwrite (data[i], 1, hdr->sec[i].len, out) != hdr->sec[i].len))
+			goto fail;
+		off = hdr->sec[i].off + hdr->sec[i].len;
+	}
+	if (fflush (out) != 0 || fsync (fileno (out)) != 0)
+		goto fail;
+	if (fclose (out) != 0 || rename (tmp_path, path) != 0)
+	{
+		unlink (tmp_path);
+		return 1;
+	}
+	return 0;
+
+fail:
+	fclose (out);
+	unlink (tmp_path);
+	return 1;
+}
+
+int quizdb_compile (const struct quizdb *db, const char *path)
+{
+	struct qdb_header hdr;
+	const void *data[QDB_NUM_SECTIONS];
+	uint64_t off;
+	int i;
+
+	//The tables a packed file leaves out can't be put back
+	if (db->packed)
+		return 1;
+
+	memset (&hdr, 0, sizeof(hdr));
+	memset (data, 0, sizeof(data));
+	memcpy (hdr.magic, QDB_MAGIC, sizeof(hdr.magic));
+	hdr.version = QDB_VERSION;
+	hdr.byte_order = QDB_BYTE_ORDER;
+	hdr.count = db->count;
+	hdr.table_size = db->mask + 1;
+	hdr.term_size = db->term_mask + 1;
+	hdr.ncategories = db->ncategories;
+
+	data[QDB_SEC_SLOTS] = db->slots;
+	hdr.sec[QDB_SEC_SLOTS].len = (uint64_t) hdr.table_size * sizeof(struct qdb_slot);
+	data[QDB_SEC_ARENA] = db->arena;
+	hdr.sec[QDB_SEC_ARENA].len = db->arena_len;
+	data[QDB_SEC_DOCS] = db->docs;
+	hdr.sec[QDB_SEC_DOCS].len = (uint64_t) db->count * sizeof(struct qdb_doc);
+	data[QDB_SEC_TERMS] = db->terms;
+	hdr.sec[QDB_SEC_TERMS].len = (uint64_t) hdr.term_size * sizeof(struct qdb_term);
+	data[QDB_SEC_POSTINGS] = db->postings;
+	hdr.sec[QDB_SEC_POSTINGS].len = (uint64_t) db->npostings * sizeof(uint32_t);
+	data[QDB_SEC_CATEGORIES] = db->categories;
+	hdr.sec[QDB_SEC_CATEGORIES].len = (uint64_t) db->ncategories * sizeof(struct qdb_category);
+
+	off = sizeof(hdr);
+	for (i = 0; i < QDB_NUM_SECTIONS; i++)
+	{
+		off = (off + 7) & ~(uint64_t) 7;
+		hdr.sec[i].off = off;
+		off += hdr.sec[i].len;
+	}
+	return qdb_write (path, &hdr, data);
+}
+
+int quizdb_is_compiled (const struct quizdb *db)
+{
+	return db->map != NULL;
+}
+
+void quizdb_free (struct quizdb *db)
+{
+	if (db == NULL)
+		return;
+	if (db->map != NULL)
+	{
+		munmap (db->map, db->map_len);
+	}
+	else
+	{
+		free (db->arena);
+		free (db->slots);
+		free (db->docs);
+		free (db->terms);
+		free (db->postings);
+		free (db->categories);
+	}
+	free (db->stats);
+	free (db);
+}
+
+unsigned int quizdb_count (const struct quizdb *db)
+{
+	return db->count;
+}
+
+//Returns the doc + 1 stored under key, or 0
+static uint32_t probe (const struct quizdb *db, const struct qdb_category *cat, const char *key, uint32_t hash)
+{
+	uint32_t found = 0;
+	uint32_t doc;
+	uint32_t i;
+
+	//Prefer the copy of the question from its own category
+	for (i = hash & db->mask; db->slots[i].doc != 0; i = (i + 1) & db->mask)
+	{
+		doc = db->slots[i].doc - 1;
+		//Offsets come straight from the file when mapped, don't trust them
+		if (doc >= db->count || db->docs[doc].key >= db->arena_len || db->docs[doc].answer >= db->arena_len ||
+				db->docs[doc].answer_len >= db->arena_len - db->docs[doc].answer)
+			return 0;
+		if (db->slots[i].hash != hash || strcmp (db->arena + db->docs[doc].key, key) != 0)
+			continue;
+		if (cat != NULL && doc >= cat->first && doc - cat->first < cat->count)
+			return doc + 1;
+		if (found == 0)
+			found = doc + 1;
+	}
+	return found;
+}
+
+//Answers from a packed file are decompressed into here
+static __thread char unpacked[QDB_LINE_MAX];
+
+const char *quizdb_lookup (const struct quizdb *db, const char *question, size_t *len)
+{
+	const struct qdb_category *cat = NULL;
+	struct qdb_stats *stats;
+	char key[QDB_LINE_MAX];
+	const char *answer;
+	unsigned long start;
+	size_t answer_len;
+	size_t key_len;
+	uint32_t found;
+	int n;
+	int c;
+
+	c = qdb_find_category (db, question);
+	if (c >= 0)
+		cat = &db->categories[c];
+	stats = &db->stats[c >= 0 ? (uint32_t) c : db->ncategories];
+	QDB_COUNT (stats->lookups);
+
+	start = trace_begin ();
+	key_len = quizdb_normalize (question, key, sizeof(key));
+	trace_end ("normalize", start);
+	if (key_len == 0)
+		return NULL;
+
+	start = trace_begin ();
+	if (db->packed)
+		found = qdb_packed_find (db, cat, key, key_len);
+	else
+		found = probe (db, cat, key, qdb_hash (key, key_len));
+	trace_end ("probe", start);
+	if (found == 0)
+		return NULL;
+
+	if (db->packed)
+	{
+		start = trace_begin ();
+		n = qdb_packed_answer (db, found - 1, unpacked, sizeof(unpacked));
+		trace_end ("unpack", start);
+		if (n < 0)
+			return NULL;
+		answer = unpacked;
+		answer_len = n;
+	}
+	else
+	{
+		answer = db->arena + db->docs[found - 1].answer;
+		answer_len = db->docs[found - 1].answer_len;
+	}
+
+	QDB_COUNT (stats->exact);
+	if (cat != NULL && (found - 1 < cat->first || found - 1 - cat->first >= cat->count))
+		QDB_COUNT (stats->global);
+	if (len != NULL)
+		*len = answer_len;
+	return answer;
+}
+
+void quizdb_dump_stats (const struct quizdb *db, FILE *out)
+{
+	const struct qdb_stats *stats;
+	const char *name;
+	unsigned long hits;
+	uint32_t i;
+
+	fprintf (out, "%-32s %8s %8s %8s %8s %6s\n", "Category", "Lookups", "Exact", "Fuzzy", "Global", "Hit%");
+	for (i = 0; i <= db->ncategories; i++)
+	{
+		stats = &db->stats[i];
+		if (stats->lookups == 0)
+			continue;
+		if (i == db->ncategories)
+			name = "(unknown)";
+		else if (db->categories[i].name < db->arena_len && db->arena[db->categories[i].name] != '\0')
+			name = db->arena + db->categories[i].name;
+		else
+			name = "(none)";
+		hits = stats->exact + stats->fuzzy;
+		fprintf (out, "%-32.32s %8lu %8lu %8lu %8lu %5.1f%%\n", name, stats->lookups,
+				stats->exact, stats->fuzzy, stats->global, 100.0 * hits / stats->lookups);
+	}
+}
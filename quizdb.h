@@ -0,0 +1,85 @@
+#ifndef QUIZDB_H
+#define QUIZDB_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+   In-memory question index for quizbot.
+
+   The question database is parsed once at startup and every question is
+   stored under its normalized text (see quizdb_normalize), so looking up
+   an answer is a single hash probe instead of a scan of the file.
+
+   Questions that were reworded or lost characters on the way are found by
+   quizdb_match, which scores candidates from a word inverted index.
+
+   Questions are partitioned by their category. A "(Category) question"
+   is looked for in that category first and in the whole index only if
+   that fails, and hits are counted per category.
+
+   quizdb_compile writes the index out as a binary file which quizdb_load
+   maps read-only instead of parsing, see quizdb-compile. quizdb_pack
+   writes a smaller one for very large databases, with the questions front
+   coded and the answers compressed in blocks; the strings quizdb_lookup
+   and quizdb_match return from one of those are unpacked into a buffer of
+   the calling thread, and only last until its next lookup or match.
+
+   quizdb_import builds one index out of many text databases, reading them
+   on several threads and merging questions that appear more than once.
+
+   Once loaded, quizdb_lookup and quizdb_match can be called from any
+   number of threads at once.
+*/
+
+struct quizdb;
+
+struct quizdb_match {
+	const char *question;	//Normalized text of the matched question
+	const char *answer;
+	size_t answer_len;
+	float score;		//Weighted Jaccard similarity, 0 to 1
+};
+
+struct quizdb_import_stats {
+	unsigned long questions;	//Read from all the files
+	unsigned long duplicates;	//Merged into an earlier copy of the same question
+	unsigned long conflicts;	//Questions whose copies gave different answers
+	unsigned long parse_ms;
+	unsigned long dedupe_ms;
+	unsigned long index_ms;
+};
+
+//Loads either a text or a compiled database
+struct quizdb *quizdb_load (const char *path);
+//Merges text databases on up to threads threads. Conflicting answers and what was kept are written to log unless it's NULL
+struct quizdb *quizdb_import (const char *const *paths, int npaths, int threads, FILE *log, struct quizdb_import_stats *stats);
+void quizdb_free (struct quizdb *db);
+
+int quizdb_compile (const struct quizdb *db, const char *path);
+//Compiles db packed, compressing its answers block answers at a time. Larger blocks compress better and look up slower
+int quizdb_pack (const struct quizdb *db, const char *path, unsigned int block);
+int quizdb_is_compiled (const struct quizdb *db);
+
+unsigned int quizdb_count (const struct quizdb *db);
+
+//Returns the answer for question, or NULL if it isn't in the index. Its length goes in len unless that's NULL
+const char *quizdb_lookup (const struct quizdb *db, const char *question, size_t *len);
+
+//Fills in up to max (at most 8) candidates scoring at least min_score, best first, and returns how many were found
+int quizdb_match (const struct quizdb *db, const char *question, float min_score, struct quizdb_match *best, int max);
+
+//quizbot's answer for question: the index's if it's there, otherwise the closest question scoring at
+//least min_score. Returns NULL if neither has one. The candidates go in best as for quizdb_match and
+//their count in found, 0 for an answer from the index
+const char *quizdb_answer (const struct quizdb *db, const char *question, float min_score,
+		struct quizdb_match *best, int max, int *found, size_t *len);
+
+//Prints the lookup and hit counts for each category seen so far
+void quizdb_dump_stats (const struct quizdb *db, FILE *out);
+
+//Case-fold, collapse whitespace, strip the "(Category)" prefix and trailing punctuation.
+//Expects text that has been through irc_sanitize
+size_t quizdb_normalize (const char *in, char *out, size_t outlen);
+
+#endif
@@ -0,0 +1,95 @@
+#include "quizdb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+static void print_usage (const char *name)
+{
+	fprintf (stderr, "Usage: %s [options] <questions.db>... <questions.qdb>\n", name);
+	fprintf (stderr, "Options:\n");
+	fprintf (stderr, "-j		Threads to read the databases on, default one per core\n");
+	fprintf (stderr, "-l		Log questions with conflicting answers to this file, - for stdout\n");
+	fprintf (stderr, "-z		Pack the output, compressing this many answers per block\n");
+}
+
+//Merges text question databases into the compiled format quizbot maps at startup
+int main (int argc, char **argv)
+{
+	struct quizdb_import_stats stats;
+	struct quizdb *db;
+	const char *log_path = NULL;
+	const char *out_path;
+	FILE *log = NULL;
+	unsigned int block = 0;
+	long threads;
+	int ret;
+	int c;
+
+	threads = sysconf (_SC_NPROCESSORS_ONLN);
+	while ((c = getopt (argc, argv, "j:l:z:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'j':
+				threads = atoi (optarg);
+				break;
+			case 'l':
+				log_path = optarg;
+				break;
+			case 'z':
+				block = strtoul (optarg, NULL, 10);
+				if (block > 0)
+					break;
+				//Fall through
+			default:
+				print_usage (argv[0]);
+				return 1;
+		}
+	}
+	if (argc - optind < 2)
+	{
+		print_usage (argv[0]);
+		return 1;
+	}
+	out_path = argv[argc - 1];
+
+	if (log_path != NULL)
+	{
+		log = strcmp (log_path, "-") == 0 ? stdout : fopen (log_path, "w");
+		if (log == NULL)
+		{
+			fprintf (stderr, "Error opening %s\n", log_path);
+			return 1;
+		}
+	}
+
+	db = quizdb_import ((const char *const *) argv + optind, argc - optind - 1, threads, log, &stats);
+	if (log != NULL && log != stdout)
+		fclose (log);
+	if (db == NULL)
+	{
+		fprintf (stderr, "Error reading question databases\n");
+		return 1;
+	}
+
+	if (block > 0)
+		ret = quizdb_pack (db, out_path, block);
+	else
+		ret = quizdb_compile (db, out_path);
+	if (ret)
+	{
+		fprintf (stderr, "Error writing compiled database %s\n", out_path);
+		quizdb_free (db);
+		return 1;
+	}
+
+	fprintf (stdout, "Read %lu questions from %d files, %lu duplicates, %lu with conflicting answers\n",
+			stats.questions, argc - optind - 1, stats.duplicates, stats.conflicts);
+	fprintf (stdout, "Parsed in %lu ms, merged duplicates in %lu ms, indexed in %lu ms\n",
+			stats.parse_ms, stats.dedupe_ms, stats.index_ms);
+	fprintf (stdout, "Compiled %u questions into %s%s\n", quizdb_count (db), out_path, block > 0 ? ", packed" : "");
+	quizdb_free (db);
+	return 0;
+}
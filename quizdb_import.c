@@ -0,0 +1,855 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "quizdb_int.h"
+#include "sanitize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+   Builds one index out of many question files, on several threads.
+
+   The files are mapped and cut into chunks of about IMPORT_CHUNK bytes,
+   each ending after an Answer line, where the parser forgets the question
+   and category anyway. Where the chunks end only depends on the files, so
+   the result is the same whatever the number of threads.
+
+   1. Chunks are parsed in parallel. Questions are cleaned up and
+      normalized as quizdb_load does, and hashed with their category, and
+      each chunk sorts its questions into IMPORT_SHARDS shards by hash.
+   2. Shards are deduplicated in parallel. The copies of a question in one
+      category become one; if they disagree, the answer given by most of
+      them wins, or the first seen of those tied, and that is logged.
+   3. What is left is indexed in the order the questions were first seen,
+      as if the files had been concatenated. Splitting the questions into
+      words and weighing them is done in parallel over blocks of
+      IMPORT_BLOCK docs, only filling in the table and the word index is
+      left to one thread.
+*/
+
+#define IMPORT_CHUNK		(4 << 20)
+#define IMPORT_SHARDS		64
+#define IMPORT_MAX_THREADS	64
+#define IMPORT_LOG_MAX		2048
+#define IMPORT_BLOCK		16384
+
+struct import_file {
+	const char *path;
+	char *map;
+	size_t len;
+};
+
+struct import_item {
+	uint64_t hash;		//Of the category and the normalized question
+	uint32_t key_hash;	//qdb_hash of the normalized question, for the table
+	uint32_t key;		//Offsets in the chunk's text
+	uint32_t key_len;
+	uint32_t answer;
+	uint32_t answer_len;
+	uint32_t category;
+	uint32_t line;		//Of the answer, within the chunk
+	//Set on the first copy of a question once deduplicated, to the copy whose answer won
+	const struct import_chunk *winner_chunk;
+	const struct import_item *winner;
+};
+
+struct import_chunk {
+	const struct import_file *file;
+	const char *start;
+	const char *end;
+	unsigned long first_line;	//Of start within its file, known once every chunk is parsed
+	unsigned long lines;
+	char *text;
+	size_t text_len;
+	size_t text_size;
+	struct import_item *items;
+	uint32_t nitems;
+	uint32_t shard[IMPORT_SHARDS + 1];	//Shard s is items[shard[s]] up to items[shard[s + 1]]
+	const struct import_item **kept;	//Items that survived deduplication, in file order
+	uint32_t nkept;
+	uint32_t first_entry;	//Where the kept items go in the index's entries and arena
+	size_t arena;
+	int failed;
+};
+
+struct import_ref {
+	uint64_t hash;
+	uint64_t order;		//Chunk and line, so the order the files were read in
+	const struct import_chunk *chunk;
+	struct import_item *item;
+	int done;
+};
+
+struct import_conflict {
+	uint64_t order;
+	char *text;
+};
+
+struct import_shard {
+	struct import_conflict *conflicts;
+	uint32_t nconflicts;
+	unsigned long duplicates;
+	int failed;
+};
+
+struct import {
+	struct import_file *files;
+	int nfiles;
+	struct import_chunk *chunks;
+	uint32_t nchunks;
+	struct import_shard shards[IMPORT_SHARDS];
+	struct quizdb *db;
+	struct qdb_entry *entries;
+	struct qdb_tokens *blocks;
+	uint32_t nblocks;
+	int failed;
+};
+
+static unsigned long now_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/*
+   Running a step on every chunk or shard, each thread taking the next one
+   not yet taken
+*/
+
+struct import_run {
+	struct import *im;
+	void (*step) (struct import *im, uint32_t n);
+	uint32_t count;
+	uint32_t next;
+};
+
+static void *run_worker (void *arg)
+{
+	struct import_run *run = arg;
+	uint32_t n;
+
+	while ((n = __atomic_fetch_add (&run->next, 1, __ATOMIC_RELAXED)) < run->count)
+		run->step (run->im, n);
+	return NULL;
+}
+
+static void run_parallel (struct import *im, int threads, void (*step) (struct import *, uint32_t), uint32_t count)
+{
+	pthread_t tids[IMPORT_MAX_THREADS];
+	struct import_run run = { im, step, count, 0 };
+	int started;
+
+	//The calling thread is one of them
+	for (started = 0; started < threads - 1 && (uint32_t) started + 1 < count; started++)
+	{
+		if (pthread_create (&tids[started], NULL, run_worker, &run) != 0)
+			break;
+	}
+	run_worker (&run);
+	while (started-- > 0)
+		pthread_join (tids[started], NULL);
+}
+
+/*
+   Parsing
+*/
+
+static int text_add (struct import_chunk *chunk, const char *s, size_t len, uint32_t *off)
+{
+	char *text;
+	size_t size;
+
+	if (chunk->text_len + len + 1 > chunk->text_size)
+	{
+		size = chunk->text_size ? chunk->text_size * 2 : 1 << 16;
+		while (size < chunk->text_len + len + 1)
+			size *= 2;
+		if (size > UINT32_MAX || (text = realloc (chunk->text, size)) == NULL)
+			return 1;
+		chunk->text = text;
+		chunk->text_size = size;
+	}
+	memcpy (chunk->text + chunk->text_len, s, len);
+	chunk->text[chunk->text_len + len] = '\0';
+	*off = chunk->text_len;
+	chunk->text_len += len + 1;
+	return 0;
+}
+
+//FNV-1a, 64 bits so that copies can be found by hash alone almost always
+static uint64_t item_hash (uint32_t category, const char *key, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL ^ category;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= (unsigned char) key[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static int item_add (struct import_chunk *chunk, uint32_t *max, const struct import_item *item)
+{
+	struct import_item *items;
+
+	if (chunk->nitems == *max)
+	{
+		*max = *max ? *max * 2 : 1024;
+		if ((items = realloc (chunk->items, *max * sizeof(struct import_item))) == NULL)
+			return 1;
+		chunk->items = items;
+	}
+	chunk->items[chunk->nitems++] = *item;
+	return 0;
+}
+
+//Reads questions the way load_text in quizdb.c does
+static void parse_chunk (struct import *im, uint32_t n)
+{
+	struct import_chunk *chunk = &im->chunks[n];
+	struct import_item item;
+	struct import_item *sorted;
+	char line[QDB_LINE_MAX];
+	char text[QDB_LINE_MAX];
+	char key[QDB_LINE_MAX];
+	const char *p;
+	const char *eol;
+	uint32_t category = 0;
+	uint32_t category_hash = qdb_category_hash ("", 0);
+	uint32_t question = 0;
+	uint32_t key_len = 0;
+	uint32_t max = 0;
+	uint32_t s;
+	uint32_t i;
+	size_t len;
+	char *field;
+
+	//Offset 0 is the unnamed category
+	if (text_add (chunk, "", 0, &category))
+		goto fail;
+
+	for (p = chunk->start; p < chunk->end; p = eol + 1)
+	{
+		eol = memchr (p, '\n', chunk->end - p);
+		if (eol == NULL)
+			eol = chunk->end;
+		len = eol - p < QDB_LINE_MAX - 1 ? (size_t) (eol - p) : QDB_LINE_MAX - 1;
+		memcpy (line, p, len);
+		line[len] = '\0';
+		chunk->lines++;
+
+		if ((field = qdb_strip_field (line, "Category:")) != NULL)
+		{
+			if (text_add (chunk, field, strlen (field), &category))
+				goto fail;
+			category_hash = qdb_category_hash (field, strlen (field));
+		}
+		else if ((field = qdb_strip_field (line, "Question:")) != NULL)
+		{
+			irc_sanitize (field, strlen (field), text, sizeof(text));
+			key_len = quizdb_normalize (text, key, sizeof(key));
+			question = 0;
+			if (key_len > 0 && text_add (chunk, key, key_len, &question))
+				goto fail;
+		}
+		else if ((field = qdb_strip_field (line, "Answer:")) != NULL && question != 0)
+		{
+			item.hash = item_hash (category_hash, key, key_len);
+			item.key_hash = qdb_hash (key, key_len);
+			item.key = question;
+			item.key_len = key_len;
+			item.winner_chunk = NULL;
+			item.winner = NULL;
+			item.category = category;
+			item.answer_len = strlen (field);
+			item.line = chunk->lines - 1;
+			if (text_add (chunk, field, item.answer_len, &item.answer) || item_add (chunk, &max, &item))
+				goto fail;
+			question = 0;
+			category = 0;
+			category_hash = qdb_category_hash ("", 0);
+		}
+	}
+
+	//Counting sort into shards, keeping the order within each
+	memset (chunk->shard, 0, sizeof(chunk->shard));
+	for (i = 0; i < chunk->nitems; i++)
+		chunk->shard[chunk->items[i].hash % IMPORT_SHARDS + 1]++;
+	for (s = 0; s < IMPORT_SHARDS; s++)
+		chunk->shard[s + 1] += chunk->shard[s];
+	if ((sorted = malloc ((chunk->nitems + 1) * sizeof(struct import_item))) == NULL)
+		goto fail;
+	for (i = 0; i < chunk->nitems; i++)
+		sorted[chunk->shard[chunk->items[i].hash % IMPORT_SHARDS]++] = chunk->items[i];
+	for (s = IMPORT_SHARDS; s > 0; s--)
+		chunk->shard[s] = chunk->shard[s - 1];
+	chunk->shard[0] = 0;
+	free (chunk->items);
+	chunk->items = sorted;
+	return;
+
+fail:
+	chunk->failed = 1;
+}
+
+/*
+   Deduplicating
+*/
+
+static int ref_cmp (const void *a, const void *b)
+{
+	const struct import_ref *x = a;
+	const struct import_ref *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static int same_question (const struct import_ref *a, const struct import_ref *b)
+{
+	const char *ca = a->chunk->text + a->item->category;
+	const char *cb = b->chunk->text + b->item->category;
+
+	return strcmp (a->chunk->text + a->item->key, b->chunk->text + b->item->key) == 0 &&
+			qdb_category_hash (ca, strlen (ca)) == qdb_category_hash (cb, strlen (cb));
+}
+
+//Answers that only differ in case or spacing are the same answer
+static int same_answer (const struct import_ref *a, const struct import_ref *b)
+{
+	const unsigned char *p = (const unsigned char *) a->chunk->text + a->item->answer;
+	const unsigned char *q = (const unsigned char *) b->chunk->text + b->item->answer;
+	unsigned char x;
+	unsigned char y;
+
+	for (;;)
+	{
+		while (*p == ' ' && (p[1] == ' ' || p[1] == '\0'))
+			p++;
+		while (*q == ' ' && (q[1] == ' ' || q[1] == '\0'))
+			q++;
+		x = *p >= 'A' && *p <= 'Z' ? *p + ('a' - 'A') : *p;
+		y = *q >= 'A' && *q <= 'Z' ? *q + ('a' - 'A') : *q;
+		if (x != y)
+			return 0;
+		if (x == '\0')
+			return 1;
+		p++;
+		q++;
+	}
+}
+
+static unsigned long ref_line (const struct import_ref *ref)
+{
+	return ref->chunk->first_line + ref->item->line + 1;
+}
+
+/*
+   Logs the copies of a question that disagree, the first copy of each
+   different answer being in copies[answers[i]] with counts[i] copies
+*/
+static int log_conflict (struct import_shard *shard, struct import_ref **copies, uint32_t ncopies, const uint32_t *answers,
+		const uint32_t *counts, uint32_t nanswers, uint32_t winner)
+{
+	struct import_conflict *conflicts;
+	const struct import_ref *first = copies[0];
+	const struct import_ref *ref;
+	const char *category = first->chunk->text + first->item->category;
+	char text[IMPORT_LOG_MAX];
+	size_t len;
+	uint32_t i;
+
+	len = snprintf (text, sizeof(text), "%s:%lu: %s%s%s\"%s\": kept \"%s\" (%u of %u)",
+			first->chunk->file->path, ref_line (first), *category ? "[" : "", category, *category ? "] " : "",
+			first->chunk->text + first->item->key, copies[answers[winner]]->chunk->text + copies[answers[winner]]->item->answer,
+			counts[winner], ncopies);
+	for (i = 0; i < nanswers && len < sizeof(text); i++)
+	{
+		if (i == winner)
+			continue;
+		ref = copies[answers[i]];
+		len += snprintf (text + len, sizeof(text) - len, ", dropped \"%s\" (%u, %s:%lu)",
+				ref->chunk->text + ref->item->answer, counts[i], ref->chunk->file->path, ref_line (ref));
+	}
+
+	if ((shard->nconflicts & (shard->nconflicts - 1)) == 0)
+	{
+		conflicts = realloc (shard->conflicts, (shard->nconflicts ? shard->nconflicts * 2 : 1) * sizeof(struct import_conflict));
+		if (conflicts == NULL)
+			return 1;
+		shard->conflicts = conflicts;
+	}
+	shard->conflicts[shard->nconflicts].order = first->order;
+	if ((shard->conflicts[shard->nconflicts].text = strdup (text)) == NULL)
+		return 1;
+	shard->nconflicts++;
+	return 0;
+}
+
+/*
+   Merges the copies of one question, in the order they were read. The
+   answer given by most wins, the first of them on a tie.
+*/
+static int merge_copies (struct import_shard *shard, struct import_ref **copies, uint32_t ncopies)
+{
+	uint32_t answers[64];
+	uint32_t counts[64];
+	uint32_t nanswers = 0;
+	uint32_t winner = 0;
+	uint32_t i;
+	uint32_t a;
+
+	for (i = 0; i < ncopies; i++)
+	{
+		for (a = 0; a < nanswers && !same_answer (copies[answers[a]], copies[i]); a++)
+			;
+		if (a == nanswers)
+		{
+			//Past that many different answers, the rest only count for the ones already seen
+			if (nanswers == sizeof(answers) / sizeof(answers[0]))
+				continue;
+			answers[nanswers] = i;
+			counts[nanswers++] = 0;
+		}
+		counts[a]++;
+	}
+	//Only once everything is counted, answers[] is in the order they were first seen
+	for (a = 1; a < nanswers; a++)
+	{
+		if (counts[a] > counts[winner])
+			winner = a;
+	}
+
+	copies[0]->item->winner_chunk = copies[answers[winner]]->chunk;
+	copies[0]->item->winner = copies[answers[winner]]->item;
+	shard->duplicates += ncopies - 1;
+	if (nanswers > 1)
+		return log_conflict (shard, copies, ncopies, answers, counts, nanswers, winner);
+	return 0;
+}
+
+static void dedupe_shard (struct import *im, uint32_t s)
+{
+	struct import_shard *shard = &im->shards[s];
+	struct import_ref *refs;
+	struct import_ref **copies = NULL;
+	struct import_chunk *chunk;
+	uint32_t nrefs = 0;
+	uint32_t ncopies;
+	uint32_t c;
+	uint32_t i;
+	uint32_t j;
+	uint32_t k;
+
+	for (c = 0; c < im->nchunks; c++)
+		nrefs += im->chunks[c].shard[s + 1] - im->chunks[c].shard[s];
+	refs = malloc ((nrefs + 1) * sizeof(struct import_ref));
+	copies = malloc ((nrefs + 1) * sizeof(struct import_ref *));
+	if (refs == NULL || copies == NULL)
+		goto fail;
+
+	for (c = 0, nrefs = 0; c < im->nchunks; c++)
+	{
+		chunk = &im->chunks[c];
+		for (i = chunk->shard[s]; i < chunk->shard[s + 1]; i++)
+		{
+			refs[nrefs].hash = chunk->items[i].hash;
+			refs[nrefs].order = (uint64_t) c << 32 | chunk->items[i].line;
+			refs[nrefs].chunk = chunk;
+			refs[nrefs].item = &chunk->items[i];
+			refs[nrefs].done = 0;
+			nrefs++;
+		}
+	}
+	qsort (refs, nrefs, sizeof(struct import_ref), ref_cmp);
+
+	//Runs with the same hash are nearly always copies of one question, but check
+	for (i = 0; i < nrefs; i = j)
+	{
+		for (j = i + 1; j < nrefs && refs[j].hash == refs[i].hash; j++)
+			;
+		for (k = i; k < j; k++)
+		{
+			if (refs[k].done)
+				continue;
+			copies[0] = &refs[k];
+			ncopies = 1;
+			for (c = k + 1; c < j; c++)
+			{
+				if (!refs[c].done && same_question (&refs[k], &refs[c]))
+				{
+					refs[c].done = 1;
+					copies[ncopies++] = &refs[c];
+				}
+			}
+			if (merge_copies (shard, copies, ncopies))
+				goto fail;
+		}
+	}
+	free (refs);
+	free (copies);
+	return;
+
+fail:
+	free (refs);
+	free (copies);
+	shard->failed = 1;
+}
+
+/*
+   Indexing
+*/
+
+static int item_line_cmp (const void *a, const void *b)
+{
+	const struct import_item *x = *(const struct import_item *const *) a;
+	const struct import_item *y = *(const struct import_item *const *) b;
+
+	return x->line < y->line ? -1 : x->line > y->line;
+}
+
+static int conflict_cmp (const void *a, const void *b)
+{
+	const struct import_conflict *x = a;
+	const struct import_conflict *y = b;
+
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void tokenize_block (struct import *im, uint32_t n)
+{
+	if (qdb_tokenize_docs (im->db, &im->blocks[n]))
+		__atomic_store_n (&im->failed, 1, __ATOMIC_RELAXED);
+}
+
+static void weigh_block (struct import *im, uint32_t n)
+{
+	qdb_weigh_docs (im->db, &im->blocks[n]);
+}
+
+static int build_terms (struct import *im, int threads)
+{
+	struct quizdb *db = im->db;
+	uint32_t i;
+
+	im->nblocks = (db->count + IMPORT_BLOCK - 1) / IMPORT_BLOCK;
+	im->blocks = calloc (im->nblocks + 1, sizeof(struct qdb_tokens));
+	if (im->blocks == NULL)
+		return 1;
+	for (i = 0; i < im->nblocks; i++)
+	{
+		im->blocks[i].lo = i * IMPORT_BLOCK;
+		im->blocks[i].hi = db->count - im->blocks[i].lo > IMPORT_BLOCK ? im->blocks[i].lo + IMPORT_BLOCK : db->count;
+	}
+	run_parallel (im, threads, tokenize_block, im->nblocks);
+	if (im->failed || qdb_index_terms (db, im->blocks, im->nblocks))
+		return 1;
+	run_parallel (im, threads, weigh_block, im->nblocks);
+	return 0;
+}
+
+//Gathers what is left of a chunk, each shard's items being in file order already
+static void collect_chunk (struct import *im, uint32_t n)
+{
+	struct import_chunk *chunk = &im->chunks[n];
+	uint32_t i;
+
+	chunk->kept = malloc ((chunk->nitems + 1) * sizeof(struct import_item *));
+	if (chunk->kept == NULL)
+	{
+		chunk->failed = 1;
+		return;
+	}
+	for (i = 0; i < chunk->nitems; i++)
+	{
+		if (chunk->items[i].winner != NULL)
+			chunk->kept[chunk->nkept++] = &chunk->items[i];
+	}
+	qsort (chunk->kept, chunk->nkept, sizeof(struct import_item *), item_line_cmp);
+}
+
+//Copies the strings of a chunk's kept items into the space left for them in the arena
+static void copy_chunk (struct import *im, uint32_t n)
+{
+	const struct import_chunk *chunk = &im->chunks[n];
+	const struct import_item *item;
+	struct qdb_entry *entry;
+	size_t off = chunk->arena;
+	uint32_t i;
+
+	for (i = 0; i < chunk->nkept; i++)
+	{
+		item = chunk->kept[i];
+		entry = &im->entries[chunk->first_entry + i];
+		entry->hash = item->key_hash;
+		entry->question = off;
+		memcpy (im->db->arena + off, chunk->text + item->key, item->key_len + 1);
+		off += item->key_len + 1;
+		entry->answer = off;
+		entry->answer_len = item->winner->answer_len;
+		memcpy (im->db->arena + off, item->winner_chunk->text + item->winner->answer, item->winner->answer_len + 1);
+		off += item->winner->answer_len + 1;
+	}
+}
+
+static struct quizdb *build_index (struct import *im, int threads)
+{
+	struct quizdb *db;
+	struct import_chunk *chunk;
+	const char *name;
+	const char *last = NULL;
+	size_t size = 0;
+	uint32_t maxcat = 0;
+	uint32_t nkept = 0;
+	uint32_t off;
+	uint32_t c;
+	uint32_t i;
+	int category = 0;
+
+	run_parallel (im, threads, collect_chunk, im->nchunks);
+	for (c = 0; c < im->nchunks; c++)
+	{
+		chunk = &im->chunks[c];
+		if (chunk->failed)
+			return NULL;
+		chunk->first_entry = nkept;
+		chunk->arena = size;
+		for (i = 0; i < chunk->nkept; i++)
+			size += chunk->kept[i]->key_len + chunk->kept[i]->winner->answer_len + 2;
+		nkept += chunk->nkept;
+	}
+
+	//The strings go after the empty string at offset 0, the category names after them
+	db = calloc (1, sizeof(struct quizdb));
+	im->entries = malloc ((nkept + 1) * sizeof(struct qdb_entry));
+	if (db == NULL || im->entries == NULL || qdb_arena_reserve (db, size + 1) || qdb_arena_add (db, "", 0, &off))
+		goto fail;
+	for (c = 0; c < im->nchunks; c++)
+		im->chunks[c].arena += db->arena_len;
+	db->arena_len += size;
+	im->db = db;
+	run_parallel (im, threads, copy_chunk, im->nchunks);
+
+	if (qdb_add_category (db, "", &maxcat) < 0)
+		goto fail;
+	for (c = 0; c < im->nchunks; c++)
+	{
+		chunk = &im->chunks[c];
+		for (i = 0; i < chunk->nkept; i++)
+		{
+			//Runs of questions nearly always share a category
+			name = chunk->text + chunk->kept[i]->category;
+			if (last == NULL || strcmp (name, last) != 0)
+			{
+				if ((category = qdb_add_category (db, name, &maxcat)) < 0)
+					goto fail;
+				last = name;
+			}
+			im->entries[chunk->first_entry + i].category = category;
+			db->categories[category].count++;
+		}
+	}
+	if (qdb_build (db, im->entries, nkept) || build_terms (im, threads))
+		goto fail;
+	return db;
+
+fail:
+	quizdb_free (db);
+	return NULL;
+}
+
+/*
+   Cuts every file into chunks, each but the last ending after an Answer
+   line found IMPORT_CHUNK bytes or more into it
+*/
+static int make_chunks (struct import *im)
+{
+	struct import_file *file;
+	struct import_chunk *chunks;
+	uint32_t max = 0;
+	const char *p;
+	const char *end;
+	const char *eol;
+	int f;
+
+	for (f = 0; f < im->nfiles; f++)
+	{
+		file = &im->files[f];
+		for (p = file->map; p < file->map + file->len; p = end)
+		{
+			end = file->map + file->len;
+			if ((size_t) (end - p) > IMPORT_CHUNK)
+			{
+				for (eol = p + IMPORT_CHUNK - 1; (eol = memchr (eol, '\n', file->map + file->len - eol)) != NULL; eol++)
+				{
+					if ((size_t) (file->map + file->len - eol) > 7 && memcmp (eol + 1, "Answer:", 7) == 0)
+					{
+						eol = memchr (eol + 1, '\n', file->map + file->len - eol - 1);
+						if (eol != NULL)
+							end = eol + 1;
+						break;
+					}
+				}
+			}
+
+			if (im->nchunks == max)
+			{
+				max = max ? max * 2 : 64;
+				if ((chunks = realloc (im->chunks, max * sizeof(struct import_chunk))) == NULL)
+					return 1;
+				im->chunks = chunks;
+			}
+			memset (&im->chunks[im->nchunks], 0, sizeof(struct import_chunk));
+			im->chunks[im->nchunks].file = file;
+			im->chunks[im->nchunks].start = p;
+			im->chunks[im->nchunks].end = end;
+			im->nchunks++;
+		}
+	}
+	return 0;
+}
+
+static void import_free (struct import *im)
+{
+	uint32_t i;
+	int f;
+
+	for (f = 0; f < im->nfiles; f++)
+	{
+		if (im->files[f].map != NULL)
+			munmap (im->files[f].map, im->files[f].len);
+	}
+	free (im->files);
+	for (i = 0; i < im->nblocks; i++)
+		qdb_tokens_free (&im->blocks[i]);
+	free (im->blocks);
+	free (im->entries);
+	for (i = 0; i < im->nchunks; i++)
+	{
+		free (im->chunks[i].text);
+		free (im->chunks[i].items);
+		free (im->chunks[i].kept);
+	}
+	free (im->chunks);
+	for (i = 0; i < IMPORT_SHARDS; i++)
+	{
+		while (im->shards[i].nconflicts > 0)
+			free (im->shards[i].conflicts[--im->shards[i].nconflicts].text);
+		free (im->shards[i].conflicts);
+	}
+}
+
+struct quizdb *quizdb_import (const char *const *paths, int npaths, int threads, FILE *log, struct quizdb_import_stats *stats)
+{
+	struct import im;
+	struct import_conflict *conflicts = NULL;
+	struct quizdb *db = NULL;
+	struct stat st;
+	unsigned long start;
+	unsigned long lines = 0;
+	uint32_t nconflicts = 0;
+	uint32_t i;
+	uint32_t s;
+	int fd;
+	int f;
+
+	memset (&im, 0, sizeof(im));
+	memset (stats, 0, sizeof(*stats));
+	if (threads < 1)
+		threads = 1;
+	if (threads > IMPORT_MAX_THREADS)
+		threads = IMPORT_MAX_THREADS;
+
+	start = now_ms ();
+	if ((im.files = calloc (npaths + 1, sizeof(struct import_file))) == NULL)
+		return NULL;
+	for (f = 0; f < npaths; f++, im.nfiles++)
+	{
+		im.files[f].path = paths[f];
+		fd = open (paths[f], O_RDONLY);
+		if (fd < 0 || fstat (fd, &st) != 0)
+		{
+			fprintf (stderr, "Error reading question database %s\n", paths[f]);
+			if (fd >= 0)
+				close (fd);
+			goto out;
+		}
+		im.files[f].len = st.st_size;
+		if (st.st_size > 0)
+		{
+			im.files[f].map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (im.files[f].map == MAP_FAILED)
+			{
+				im.files[f].map = NULL;
+				close (fd);
+				goto out;
+			}
+			//Each chunk is read straight through, once
+			posix_madvise (im.files[f].map, st.st_size, POSIX_MADV_SEQUENTIAL);
+		}
+		close (fd);
+	}
+	if (make_chunks (&im))
+		goto out;
+
+	run_parallel (&im, threads, parse_chunk, im.nchunks);
+	for (i = 0; i < im.nchunks; i++)
+	{
+		if (im.chunks[i].failed)
+			goto out;
+		//Line numbers for the log start again with every file
+		if (i == 0 || im.chunks[i].file != im.chunks[i - 1].file)
+			lines = 0;
+		im.chunks[i].first_line = lines;
+		lines += im.chunks[i].lines;
+		stats->questions += im.chunks[i].nitems;
+	}
+	stats->parse_ms = now_ms () - start;
+
+	start = now_ms ();
+	run_parallel (&im, threads, dedupe_shard, IMPORT_SHARDS);
+	for (s = 0; s < IMPORT_SHARDS; s++)
+	{
+		if (im.shards[s].failed)
+			goto out;
+		stats->duplicates += im.shards[s].duplicates;
+		nconflicts += im.shards[s].nconflicts;
+	}
+	stats->dedupe_ms = now_ms () - start;
+
+	start = now_ms ();
+	db = build_index (&im, threads);
+	stats->index_ms = now_ms () - start;
+	stats->conflicts = nconflicts;
+
+	//Logged in the order the files were read, like everything else
+	if (db != NULL && log != NULL && nconflicts > 0 &&
+			(conflicts = malloc (nconflicts * sizeof(struct import_conflict))) != NULL)
+	{
+		for (s = 0, nconflicts = 0; s < IMPORT_SHARDS; s++)
+		{
+			memcpy (conflicts + nconflicts, im.shards[s].conflicts, im.shards[s].nconflicts * sizeof(struct import_conflict));
+			nconflicts += im.shards[s].nconflicts;
+		}
+		qsort (conflicts, nconflicts, sizeof(struct import_conflict), conflict_cmp);
+		for (i = 0; i < nconflicts; i++)
+			fprintf (log, "%s\n", conflicts[i].text);
+		free (conflicts);
+	}
+
+out:
+	import_free (&im);
+	return db;
+}
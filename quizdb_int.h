@@ -0,0 +1,201 @@
+#ifndef QUIZDB_INT_H
+#define QUIZDB_INT_H
+
+#include "quizdb.h"
+#include <stdint.h>
+
+//Internals shared by the quizdb source files, nothing outside quizdb*.c should need these
+
+#define QDB_LINE_MAX	1024
+
+/*
+   Compiled database layout, all integers in host byte order:
+
+   struct qdb_header
+   sections, each 8 byte aligned, at the offsets listed in the header
+
+   The file is mapped read-only and used in place, so several bots on one
+   host share the same pages. A packed file (QDB_PACKED) has no slots or
+   docs, its questions and answers are compressed, see quizdb_pack.c.
+*/
+#define QDB_MAGIC	"QZDB"
+#define QDB_VERSION	6
+#define QDB_BYTE_ORDER	0x01020304u
+
+#define QDB_PACKED	0x1
+
+enum {
+	QDB_SEC_SLOTS,
+	QDB_SEC_ARENA,
+	QDB_SEC_DOCS,
+	QDB_SEC_TERMS,
+	QDB_SEC_POSTINGS,
+	QDB_SEC_CATEGORIES,
+	//Packed files only
+	QDB_SEC_KEYS,
+	QDB_SEC_KEY_BLOCKS,
+	QDB_SEC_RANKS,
+	QDB_SEC_WEIGHTS,
+	QDB_SEC_ANSWERS,
+	QDB_SEC_ANSWER_BLOCKS,
+	QDB_SEC_DICT,
+	QDB_NUM_SECTIONS
+};
+
+#define QDB_MAX_SECTIONS	16
+
+struct qdb_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t count;
+	uint32_t table_size;
+	uint32_t term_size;
+	uint32_t ncategories;
+	uint32_t flags;
+	uint32_t block;		//Answers per compressed block
+	uint32_t block_max;	//Size of the largest block once decompressed
+	struct {
+		uint64_t off;
+		uint64_t len;
+	} sec[QDB_MAX_SECTIONS];
+};
+
+//Exact match table, open addressed with linear probing
+struct qdb_slot {
+	uint32_t hash;
+	uint32_t doc;		//Doc id + 1, 0 marks an empty slot
+};
+
+//One per unique question, the doc id is the index into quizdb.docs
+struct qdb_doc {
+	uint32_t key;		//Offset of the normalized question in the arena
+	uint32_t answer;	//Offset of the answer in the arena
+	uint32_t answer_len;	//The answer never holds a CR or LF, so these bytes can go out as they are
+	float weight;		//Sum of the idf of the question's words
+};
+
+//Docs are sorted by category, so each category is a contiguous range of doc ids
+struct qdb_category {
+	uint32_t hash;		//See qdb_category_hash
+	uint32_t name;		//Offset of the name as written in the database
+	uint32_t first;
+	uint32_t count;
+};
+
+//Hit counters, one per category plus one for questions without a known category.
+//Lookups can run on several threads, so they're only bumped through QDB_COUNT
+struct qdb_stats {
+	unsigned long lookups;
+	unsigned long exact;
+	unsigned long fuzzy;
+	unsigned long global;	//Hits found only after falling back to the whole index
+};
+
+#define QDB_COUNT(counter)	__atomic_fetch_add (&(counter), 1, __ATOMIC_RELAXED)
+
+//Word in the fuzzy index, its postings are doc ids in ascending order
+struct qdb_term {
+	uint32_t hash;		//0 marks an empty slot
+	uint32_t df;
+	uint32_t post;		//Offset into quizdb.postings
+};
+
+//Questions are front coded in blocks of this many, in sorted order
+#define QDB_KEY_BLOCK	16
+
+//Where the compressed parts of a packed file are, everything points into the map
+struct qdb_pack {
+	const uint8_t *keys;
+	size_t keys_len;
+	const uint32_t *key_blocks;	//Offset in keys of the first question of every block
+	uint32_t nkey_blocks;
+	const uint32_t *ranks;		//Position of each doc's question in sorted order
+	const float *weights;
+	const uint8_t *answers;
+	size_t answers_len;
+	const uint32_t *answer_blocks;	//Offset in answers of every block, and of the end
+	uint32_t nanswer_blocks;
+	uint32_t block;
+	uint32_t block_max;
+	const uint8_t *dict;
+	uint32_t dict_len;
+};
+
+struct quizdb {
+	char *arena;
+	size_t arena_len;
+	size_t arena_size;
+	struct qdb_slot *slots;
+	uint32_t mask;
+	unsigned int count;
+	struct qdb_doc *docs;
+	struct qdb_category *categories;
+	uint32_t ncategories;
+	struct qdb_stats *stats;	//Always on the heap, even for a mapped file
+	struct qdb_term *terms;
+	uint32_t term_mask;
+	uint32_t *postings;
+	size_t npostings;
+	//Set when everything above points into a mapped compiled file
+	void *map;
+	size_t map_len;
+	//A packed file has no slots or docs, and only the category names in the arena
+	int packed;
+	struct qdb_pack pack;
+};
+
+uint32_t qdb_hash (const char *s, size_t len);
+uint32_t qdb_category_hash (const char *name, size_t len);
+int qdb_find_category (const struct quizdb *db, const char *question);
+float qdb_idf (const struct quizdb *db, uint32_t df);
+int qdb_is_stopword (const struct quizdb *db, uint32_t df);
+const struct qdb_term *qdb_find_term (const struct quizdb *db, uint32_t hash);
+int qdb_tokenize (const char *key, uint32_t *hashes, int max);
+
+//A question read from a text database, before it is indexed
+struct qdb_entry {
+	uint32_t question;	//Offsets in the arena
+	uint32_t hash;		//qdb_hash of the question
+	uint32_t answer;
+	uint32_t answer_len;
+	uint32_t category;
+};
+
+//The rest of line if it starts with field, with surrounding spaces and the line ending cut off
+char *qdb_strip_field (char *line, const char *field);
+int qdb_arena_add (struct quizdb *db, const char *s, size_t len, uint32_t *off);
+int qdb_arena_reserve (struct quizdb *db, size_t size);
+int qdb_add_category (struct quizdb *db, const char *name, uint32_t *maxcat);
+//Fills in the table and docs from entries, the word index is built after by qdb_build_terms
+int qdb_build (struct quizdb *db, const struct qdb_entry *entries, size_t nentries);
+int qdb_build_terms (struct quizdb *db);
+
+//The words of docs [lo, hi), so the word index can be built from docs tokenized on several threads
+struct qdb_tokens {
+	uint32_t lo;
+	uint32_t hi;
+	uint32_t *hashes;	//Every word of doc lo, then of lo + 1, and so on
+	size_t nhashes;
+	uint8_t *counts;	//Words in each doc, never more than 128
+};
+
+int qdb_tokenize_docs (const struct quizdb *db, struct qdb_tokens *tokens);
+void qdb_tokens_free (struct qdb_tokens *tokens);
+int qdb_index_terms (struct quizdb *db, const struct qdb_tokens *blocks, uint32_t nblocks);
+void qdb_weigh_docs (struct quizdb *db, const struct qdb_tokens *tokens);
+
+void *qdb_map_section (void *map, size_t len, const struct qdb_header *hdr, int n, uint64_t size);
+int qdb_write (const char *path, const struct qdb_header *hdr, const void **data);
+
+int qdb_map_packed (struct quizdb *db, const struct qdb_header *hdr);
+uint32_t qdb_packed_find (const struct quizdb *db, const struct qdb_category *cat, const char *key, size_t len);
+int qdb_packed_question (const struct quizdb *db, uint32_t doc, char *out, size_t size);
+int qdb_packed_answer (const struct quizdb *db, uint32_t doc, char *out, size_t size);
+
+static inline float qdb_weight (const struct quizdb *db, uint32_t doc)
+{
+	return db->packed ? db->pack.weights[doc] : db->docs[doc].weight;
+}
+
+#endif
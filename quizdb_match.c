@@ -0,0 +1,604 @@
+#include "quizdb_int.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+   Fuzzy matching for questions that don't normalize to an exact key.
+
+   Every question is split into words and each word keeps a postings list
+   of the questions it appears in. A lookup scores the questions sharing
+   words with the query by weighted Jaccard similarity, each word weighted
+   by its idf, so rare words count for much more than common ones.
+
+   A question with a known category is searched for within that category
+   first. Docs are sorted by category, so that is just a slice of every
+   postings list.
+
+   Postings of the rarest query words are walked to find candidates, the
+   common words are then only checked against those candidates that can
+   still reach the caller's minimum score, which keeps a lookup well under
+   a millisecond on large databases.
+*/
+
+#define QDB_MAX_TERMS		128
+//Postings walked to collect candidates before switching to probing them
+#define QDB_CANDIDATE_BUDGET	20000
+//Most candidates one call returns
+#define QDB_MAX_MATCHES		8
+
+struct query_term {
+	const struct qdb_term *term;
+	const uint32_t *post;	//The postings searched, may be a slice of the term's
+	uint32_t df;
+	float weight;
+};
+
+//Per-question scores, indexed by doc id and reset lazily by stamping them.
+//Each thread gets its own, so lookups can run on several threads at once
+struct scratch {
+	float *acc;
+	uint32_t *stamp;
+	uint32_t *touched;
+	uint32_t size;
+	uint32_t epoch;
+	char (*text)[QDB_LINE_MAX];	//Question and answer of each candidate from a packed file
+};
+
+static __thread struct scratch scratch;
+
+float qdb_idf (const struct quizdb *db, uint32_t df)
+{
+	return logf (1.0f + ((float) db->count - df + 0.5f) / (df + 0.5f));
+}
+
+//Words in over a quarter of a decent sized database say nothing about the question
+int qdb_is_stopword (const struct quizdb *db, uint32_t df)
+{
+	return db->count >= 100 && df > db->count / 4;
+}
+
+const struct qdb_term *qdb_find_term (const struct quizdb *db, uint32_t hash)
+{
+	uint32_t i;
+
+	for (i = hash & db->term_mask; db->terms[i].hash != 0; i = (i + 1) & db->term_mask)
+	{
+		if (db->terms[i].hash == hash)
+		{
+			if (db->terms[i].post > db->npostings || db->terms[i].df > db->npostings - db->terms[i].post)
+				return NULL;
+			return &db->terms[i];
+		}
+	}
+	return NULL;
+}
+
+//Splits a normalized question into words, returning the hash of each distinct word
+int qdb_tokenize (const char *key, uint32_t *hashes, int max)
+{
+	const unsigned char *p = (const unsigned char *) key;
+	const unsigned char *start;
+	uint32_t h;
+	int n = 0;
+	int i;
+
+	while (*p != '\0' && n < max)
+	{
+		//Anything that isn't a letter or digit separates words, UTF-8 bytes are part of one
+		while (*p != '\0' && !((*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9') || *p >= 0x80))
+			p++;
+		start = p;
+		while ((*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9') || *p >= 0x80)
+			p++;
+		if (p == start)
+			break;
+
+		h = qdb_hash ((const char *) start, p - start);
+		if (h == 0)
+			h = 1;
+		for (i = 0; i < n && hashes[i] != h; i++)
+			;
+		if (i == n)
+			hashes[n++] = h;
+	}
+	return n;
+}
+
+static struct qdb_term *term_insert (struct qdb_term *terms, uint32_t mask, uint32_t hash, int *added)
+{
+	uint32_t i;
+
+	for (i = hash & mask; terms[i].hash != 0; i = (i + 1) & mask)
+	{
+		if (terms[i].hash == hash)
+			return &terms[i];
+	}
+	terms[i].hash = hash;
+	*added = 1;
+	return &terms[i];
+}
+
+static int terms_grow (struct quizdb *db)
+{
+	struct qdb_term *terms;
+	struct qdb_term *t;
+	uint32_t size = (db->term_mask + 1) * 2;
+	uint32_t i;
+	int added;
+
+	terms = calloc (size, sizeof(struct qdb_term));
+	if (terms == NULL)
+		return 1;
+	for (i = 0; i <= db->term_mask; i++)
+	{
+		if (db->terms[i].hash == 0)
+			continue;
+		t = term_insert (terms, size - 1, db->terms[i].hash, &added);
+		*t = db->terms[i];
+	}
+	free (db->terms);
+	db->terms = terms;
+	db->term_mask = size - 1;
+	return 0;
+}
+
+//Splits docs [tokens->lo, tokens->hi) into words, only reading db, so ranges can be split over threads
+int qdb_tokenize_docs (const struct quizdb *db, struct qdb_tokens *tokens)
+{
+	uint32_t hashes[QDB_MAX_TERMS];
+	uint32_t *tmp;
+	size_t size = 0;
+	uint32_t d;
+	int n;
+
+	tokens->hashes = NULL;
+	tokens->nhashes = 0;
+	tokens->counts = malloc (tokens->hi - tokens->lo + 1);
+	if (tokens->counts == NULL)
+		return 1;
+	for (d = tokens->lo; d < tokens->hi; d++)
+	{
+		n = qdb_tokenize (db->arena + db->docs[d].key, hashes, QDB_MAX_TERMS);
+		if (tokens->nhashes + n > size)
+		{
+			size = size * 2 + QDB_MAX_TERMS;
+			tmp = realloc (tokens->hashes, size * sizeof(uint32_t));
+			if (tmp == NULL)
+				return 1;
+			tokens->hashes = tmp;
+		}
+		memcpy (tokens->hashes + tokens->nhashes, hashes, n * sizeof(uint32_t));
+		tokens->nhashes += n;
+		tokens->counts[d - tokens->lo] = n;
+	}
+	return 0;
+}
+
+void qdb_tokens_free (struct qdb_tokens *tokens)
+{
+	free (tokens->hashes);
+	free (tokens->counts);
+	tokens->hashes = NULL;
+	tokens->counts = NULL;
+}
+
+//Builds the terms and postings from blocks of tokens covering all the docs in order
+int qdb_index_terms (struct quizdb *db, const struct qdb_tokens *blocks, uint32_t nblocks)
+{
+	struct qdb_term *t;
+	uint32_t nterms = 0;
+	size_t post = 0;
+	size_t h;
+	uint32_t b;
+	uint32_t d;
+	uint32_t i;
+	int added;
+	int k;
+
+	db->term_mask = (1 << 16) - 1;
+	db->terms = calloc (db->term_mask + 1, sizeof(struct qdb_term));
+	if (db->terms == NULL)
+		return 1;
+
+	//Count the document frequency of every word
+	for (b = 0; b < nblocks; b++)
+	{
+		for (h = 0; h < blocks[b].nhashes; h++)
+		{
+			added = 0;
+			t = term_insert (db->terms, db->term_mask, blocks[b].hashes[h], &added);
+			t->df++;
+			if (added && ++nterms * 2 > db->term_mask && terms_grow (db))
+				return 1;
+		}
+		post += blocks[b].nhashes;
+	}
+
+	//Lay the postings lists out back to back, df is reused as the fill position
+	db->postings = malloc ((post + 1) * sizeof(uint32_t));
+	if (db->postings == NULL)
+		return 1;
+	db->npostings = post;
+	post = 0;
+	for (i = 0; i <= db->term_mask; i++)
+	{
+		db->terms[i].post = post;
+		post += db->terms[i].df;
+		db->terms[i].df = 0;
+	}
+
+	//Docs are visited in order, so every postings list comes out sorted
+	for (b = 0; b < nblocks; b++)
+	{
+		for (d = blocks[b].lo, h = 0; d < blocks[b].hi; d++)
+		{
+			for (k = 0; k < blocks[b].counts[d - blocks[b].lo]; k++, h++)
+			{
+				t = term_insert (db->terms, db->term_mask, blocks[b].hashes[h], &added);
+				db->postings[t->post + t->df++] = d;
+			}
+		}
+	}
+	return 0;
+}
+
+//Sets the weight of the docs in a block once the terms are built, blocks can be done on several threads
+void qdb_weigh_docs (struct quizdb *db, const struct qdb_tokens *tokens)
+{
+	const struct qdb_term *t;
+	size_t h = 0;
+	uint32_t d;
+	int k;
+
+	for (d = tokens->lo; d < tokens->hi; d++)
+	{
+		db->docs[d].weight = 0;
+		for (k = 0; k < tokens->counts[d - tokens->lo]; k++, h++)
+		{
+			t = qdb_find_term (db, tokens->hashes[h]);
+			if (!qdb_is_stopword (db, t->df))
+				db->docs[d].weight += qdb_idf (db, t->df);
+		}
+	}
+}
+
+//Builds the word index over db->docs, used when loading the text format
+int qdb_build_terms (struct quizdb *db)
+{
+	struct qdb_tokens tokens;
+	int ret;
+
+	tokens.lo = 0;
+	tokens.hi = db->count;
+	ret = qdb_tokenize_docs (db, &tokens) || qdb_index_terms (db, &tokens, 1);
+	if (!ret)
+		qdb_weigh_docs (db, &tokens);
+	qdb_tokens_free (&tokens);
+	return ret;
+}
+
+static int scratch_reserve (uint32_t count)
+{
+	if (count <= scratch.size)
+		return 0;
+
+	free (scratch.acc);
+	free (scratch.stamp);
+	free (scratch.touched);
+	scratch.acc = malloc (count * sizeof(float));
+	scratch.stamp = calloc (count, sizeof(uint32_t));
+	scratch.touched = malloc (count * sizeof(uint32_t));
+	if (scratch.acc == NULL || scratch.stamp == NULL || scratch.touched == NULL)
+	{
+		scratch.size = 0;
+		return 1;
+	}
+	scratch.size = count;
+	scratch.epoch = 0;
+	return 0;
+}
+
+//Index of the first posting >= doc
+static uint32_t postings_lower_bound (const uint32_t *post, uint32_t n, uint32_t doc)
+{
+	uint32_t lo = 0;
+	uint32_t hi = n;
+	uint32_t mid;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (post[mid] < doc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int postings_contain (const uint32_t *post, uint32_t n, uint32_t doc)
+{
+	uint32_t i = postings_lower_bound (post, n, doc);
+
+	return i < n && post[i] == doc;
+}
+
+//Words the index has never seen still count against the score, through weight
+static int parse_query (const struct quizdb *db, const char *key, struct query_term *qterms, float *weight)
+{
+	uint32_t hashes[QDB_MAX_TERMS];
+	const struct qdb_term *t;
+	int nterms = 0;
+	int n;
+	int k;
+
+	*weight = 0;
+	n = qdb_tokenize (key, hashes, QDB_MAX_TERMS);
+	for (k = 0; k < n; k++)
+	{
+		t = qdb_find_term (db, hashes[k]);
+		if (t != NULL && qdb_is_stopword (db, t->df))
+			continue;
+		qterms[nterms].weight = qdb_idf (db, t != NULL ? t->df : 0);
+		*weight += qterms[nterms].weight;
+		if (t == NULL)
+			continue;
+		qterms[nterms].term = t;
+		qterms[nterms].post = db->postings + t->post;
+		qterms[nterms].df = t->df;
+		nterms++;
+	}
+	return nterms;
+}
+
+//Scores the docs in [lo, hi) against the query, the doc of each of best goes in docs
+static int match_range (const struct quizdb *db, const struct query_term *query, int nquery, float query_weight,
+		uint32_t lo, uint32_t hi, float min_score, struct quizdb_match *best, uint32_t *docs, int max)
+{
+	struct query_term qterms[QDB_MAX_TERMS];
+	struct query_term tmp;
+	float *score_acc;
+	uint32_t *score_stamp;
+	uint32_t *touched;
+	uint32_t epoch;
+	const uint32_t *post;
+	uint32_t ntouched = 0;
+	uint32_t walked = 0;
+	uint32_t start;
+	uint32_t doc;
+	uint32_t i;
+	float remaining = 0;
+	float top = 0;
+	float score;
+	int nterms = 0;
+	int found = 0;
+	int k;
+	int j;
+
+	//Narrow every postings list down to the range and sort them rarest first
+	for (k = 0; k < nquery; k++)
+	{
+		tmp = query[k];
+		if (lo > 0 || hi < db->count)
+		{
+			start = postings_lower_bound (tmp.post, tmp.df, lo);
+			tmp.post += start;
+			tmp.df = postings_lower_bound (tmp.post, tmp.df - start, hi);
+		}
+		if (tmp.df == 0)
+		{
+			remaining += tmp.weight;
+			continue;
+		}
+		for (j = nterms; j > 0 && qterms[j - 1].df > tmp.df; j--)
+			qterms[j] = qterms[j - 1];
+		qterms[j] = tmp;
+		nterms++;
+	}
+	if (nterms == 0)
+		return 0;
+
+	if (++scratch.epoch == 0)
+	{
+		memset (scratch.stamp, 0, scratch.size * sizeof(uint32_t));
+		scratch.epoch = 1;
+	}
+	//Local copies, the thread local would be looked up again on every access
+	score_acc = scratch.acc;
+	score_stamp = scratch.stamp;
+	touched = scratch.touched;
+	epoch = scratch.epoch;
+
+	//Rare words pull in candidates
+	for (k = 0; k < nterms; k++)
+	{
+		//A question made only of common words is too vague to guess at
+		if (walked + qterms[k].df > QDB_CANDIDATE_BUDGET)
+			break;
+		walked += qterms[k].df;
+		post = qterms[k].post;
+		for (i = 0; i < qterms[k].df; i++)
+		{
+			doc = post[i];
+			if (doc >= db->count)
+				continue;
+			if (score_stamp[doc] != epoch)
+			{
+				score_stamp[doc] = epoch;
+				score_acc[doc] = 0;
+				touched[ntouched++] = doc;
+			}
+			score_acc[doc] += qterms[k].weight;
+		}
+	}
+	if (ntouched == 0)
+		return 0;
+
+	//Only the front runners are worth probing for the common words. A
+	//question can't score more than (words shared) / (query weight), so
+	//anything that can't reach min_score with every remaining word is dropped
+	remaining = 0;
+	for (j = k; j < nterms; j++)
+		remaining += qterms[j].weight;
+	for (i = 0; i < ntouched; i++)
+	{
+		if (score_acc[touched[i]] > top)
+			top = score_acc[touched[i]];
+	}
+	for (i = 0, j = 0; i < ntouched; i++)
+	{
+		if ((score_acc[touched[i]] + remaining) >= min_score * query_weight &&
+				(k == nterms || score_acc[touched[i]] * 2 >= top))
+			touched[j++] = touched[i];
+	}
+	ntouched = j;
+
+	//Common words only add to the candidates we already have
+	for (; k < nterms; k++)
+	{
+		for (i = 0; i < ntouched; i++)
+		{
+			if (postings_contain (qterms[k].post, qterms[k].df, touched[i]))
+				score_acc[touched[i]] += qterms[k].weight;
+		}
+	}
+
+	for (i = 0; i < ntouched; i++)
+	{
+		doc = touched[i];
+		score = score_acc[doc] / (query_weight + qdb_weight (db, doc) - score_acc[doc]);
+		if (score < min_score || (found == max && score <= best[max - 1].score))
+			continue;
+		if (!db->packed && (db->docs[doc].key >= db->arena_len || db->docs[doc].answer >= db->arena_len ||
+				db->docs[doc].answer_len >= db->arena_len - db->docs[doc].answer))
+			continue;
+
+		if (found < max)
+			found++;
+		for (j = found - 1; j > 0 && best[j - 1].score < score; j--)
+		{
+			best[j] = best[j - 1];
+			docs[j] = docs[j - 1];
+		}
+		best[j].score = score;
+		docs[j] = doc;
+	}
+	return found;
+}
+
+//Points the winners at their text, dropping any a packed file fails to give up
+static int fill_matches (const struct quizdb *db, struct quizdb_match *best, const uint32_t *docs, int found)
+{
+	char *question;
+	char *answer;
+	int len;
+	int i;
+	int j;
+
+	if (db->packed && scratch.text == NULL &&
+			(scratch.text = malloc (QDB_MAX_MATCHES * 2 * sizeof(*scratch.text))) == NULL)
+		return 0;
+
+	for (i = 0, j = 0; i < found; i++)
+	{
+		best[j].score = best[i].score;
+		if (!db->packed)
+		{
+			best[j].question = db->arena + db->docs[docs[i]].key;
+			best[j].answer = db->arena + db->docs[docs[i]].answer;
+			best[j].answer_len = db->docs[docs[i]].answer_len;
+			j++;
+			continue;
+		}
+		question = scratch.text[j * 2];
+		answer = scratch.text[j * 2 + 1];
+		if (qdb_packed_question (db, docs[i], question, QDB_LINE_MAX) < 0 ||
+				(len = qdb_packed_answer (db, docs[i], answer, QDB_LINE_MAX)) < 0)
+			continue;
+		best[j].question = question;
+		best[j].answer = answer;
+		best[j].answer_len = len;
+		j++;
+	}
+	return j;
+}
+
+int quizdb_match (const struct quizdb *db, const char *question, float min_score, struct quizdb_match *best, int max)
+{
+	char key[QDB_LINE_MAX];
+	struct query_term query[QDB_MAX_TERMS];
+	uint32_t docs[QDB_MAX_MATCHES];
+	const struct qdb_category *cat = NULL;
+	struct qdb_stats *stats;
+	unsigned long start;
+	float weight;
+	size_t len;
+	int nquery;
+	int found = 0;
+	int c;
+
+	if (max <= 0 || db->count == 0)
+		return 0;
+	if (max > QDB_MAX_MATCHES)
+		max = QDB_MAX_MATCHES;
+	start = trace_begin ();
+	len = quizdb_normalize (question, key, sizeof(key));
+	trace_end ("normalize", start);
+	if (len == 0)
+		return 0;
+
+	nquery = parse_query (db, key, query, &weight);
+	if (nquery == 0 || scratch_reserve (db->count))
+		return 0;
+
+	c = qdb_find_category (db, question);
+	if (c >= 0)
+		cat = &db->categories[c];
+	stats = &db->stats[c >= 0 ? (uint32_t) c : db->ncategories];
+
+	//Search the question's own category before the whole index
+	if (cat != NULL && cat->first <= db->count && cat->count <= db->count - cat->first)
+	{
+		start = trace_begin ();
+		found = match_range (db, query, nquery, weight, cat->first, cat->first + cat->count, min_score, best, docs, max);
+		trace_end ("score category", start);
+		if (found > 0)
+			found = fill_matches (db, best, docs, found);
+		if (found > 0 || cat->count == db->count)
+		{
+			if (found > 0)
+				QDB_COUNT (stats->fuzzy);
+			return found;
+		}
+	}
+
+	start = trace_begin ();
+	found = match_range (db, query, nquery, weight, 0, db->count, min_score, best, docs, max);
+	trace_end ("score all", start);
+	if (found > 0)
+		found = fill_matches (db, best, docs, found);
+	if (found > 0)
+	{
+		QDB_COUNT (stats->fuzzy);
+		if (cat != NULL)
+			QDB_COUNT (stats->global);
+	}
+	return found;
+}
+
+const char *quizdb_answer (const struct quizdb *db, const char *question, float min_score,
+		struct quizdb_match *best, int max, int *found, size_t *len)
+{
+	const char *answer;
+
+	*found = 0;
+	//A single hash probe, so it's always tried first
+	if ((answer = quizdb_lookup (db, question, len)) != NULL)
+		return answer;
+	if ((*found = quizdb_match (db, question, min_score, best, max)) <= 0)
+		return NULL;
+	*len = best[0].answer_len;
+	return best[0].answer;
+}
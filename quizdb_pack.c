@@ -0,0 +1,846 @@
+#include "quizdb_int.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+   Packed question databases, for dumps too big to keep whole in memory.
+
+   Questions are sorted and front coded in blocks of QDB_KEY_BLOCK: every
+   block starts with a whole question, the rest only store what differs
+   from the one before. An exact lookup binary searches the first question
+   of each block and decodes one or two blocks, so there is no hash table.
+
+   Answers are left in doc order and compressed in blocks of a chosen
+   number of answers, and a lookup decompresses only the block holding its
+   answer. Blocks are small, so most of what repeats in them ("True",
+   years, countries) repeats across blocks instead; every block is
+   compressed against a dictionary of the most common answers and words in
+   the database, trained when it is packed.
+
+   The compression is LZ77 laid out like LZ4: a token byte with the
+   lengths of a run of literals and of the match after it, the literals,
+   then a two byte offset back into the dictionary followed by the block.
+
+   The word index is kept as it is. A fuzzy match only unpacks the
+   questions and answers of the candidates it returns.
+*/
+
+#define DICT_SIZE	32768
+//Answers looked at to train the dictionary, spread over the whole database
+#define TRAIN_SAMPLES	(1 << 20)
+#define MIN_MATCH	4
+#define MAX_OFFSET	65535
+#define HASH_BITS	16
+#define CHAIN_DEPTH	32
+#define COPY_SLACK	16
+
+struct bytes {
+	uint8_t *p;
+	size_t len;
+	size_t size;
+};
+
+static int bytes_add (struct bytes *b, const void *p, size_t len)
+{
+	uint8_t *grown;
+	size_t size;
+
+	if (b->len + len > b->size)
+	{
+		size = b->size ? b->size * 2 : 4096;
+		while (size < b->len + len)
+			size *= 2;
+		if ((grown = realloc (b->p, size)) == NULL)
+			return 1;
+		b->p = grown;
+		b->size = size;
+	}
+	memcpy (b->p + b->len, p, len);
+	b->len += len;
+	return 0;
+}
+
+static int bytes_byte (struct bytes *b, uint8_t c)
+{
+	return bytes_add (b, &c, 1);
+}
+
+static int bytes_varint (struct bytes *b, uint32_t v)
+{
+	uint8_t buf[5];
+	int n = 0;
+
+	while (v >= 0x80)
+	{
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+	return bytes_add (b, buf, n);
+}
+
+//Returns the offset after the varint at off, or 0 if it runs off the end
+static size_t get_varint (const uint8_t *p, size_t len, size_t off, uint32_t *v)
+{
+	uint32_t x = 0;
+	int shift;
+
+	for (shift = 0; shift < 35 && off < len; shift += 7)
+	{
+		x |= (uint32_t) (p[off] & 0x7f) << shift;
+		if ((p[off++] & 0x80) == 0)
+		{
+			*v = x;
+			return off;
+		}
+	}
+	return 0;
+}
+
+/*
+   Questions
+*/
+
+struct key_cursor {
+	const struct qdb_pack *pack;
+	size_t off;
+	uint32_t len;
+	uint32_t doc;
+	char key[QDB_LINE_MAX];
+};
+
+static void key_seek (struct key_cursor *c, const struct qdb_pack *pack, uint32_t block)
+{
+	c->pack = pack;
+	c->off = pack->key_blocks[block];
+	c->len = 0;
+}
+
+//Decodes the next question, returns 1 at the end or on a corrupt entry
+static int key_next (struct key_cursor *c)
+{
+	const struct qdb_pack *pack = c->pack;
+	uint32_t shared;
+	uint32_t suffix;
+	size_t off = c->off;
+
+	if (off >= pack->keys_len ||
+			(off = get_varint (pack->keys, pack->keys_len, off, &shared)) == 0 ||
+			(off = get_varint (pack->keys, pack->keys_len, off, &suffix)) == 0 ||
+			shared > c->len || suffix >= sizeof(c->key) - shared || suffix > pack->keys_len - off)
+		return 1;
+	memcpy (c->key + shared, pack->keys + off, suffix);
+	c->len = shared + suffix;
+	c->key[c->len] = '\0';
+	if ((off = get_varint (pack->keys, pack->keys_len, off + suffix, &c->doc)) == 0)
+		return 1;
+	c->off = off;
+	return 0;
+}
+
+//Orders like strcmp, the keys aren't terminated in the file
+static int key_cmp (const char *a, size_t alen, const char *b, size_t blen)
+{
+	int cmp = memcmp (a, b, alen < blen ? alen : blen);
+
+	if (cmp != 0)
+		return cmp;
+	return alen < blen ? -1 : alen > blen;
+}
+
+uint32_t qdb_packed_find (const struct quizdb *db, const struct qdb_category *cat, const char *key, size_t len)
+{
+	const struct qdb_pack *pack = &db->pack;
+	struct key_cursor c;
+	uint32_t found = 0;
+	uint32_t lo = 0;
+	uint32_t hi = pack->nkey_blocks;
+	uint32_t mid;
+	int cmp;
+
+	//Count the blocks starting before key, it can only be in the last of them or after
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		key_seek (&c, pack, mid);
+		if (key_next (&c))
+			return 0;
+		if (key_cmp (c.key, c.len, key, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (pack->nkey_blocks == 0)
+		return 0;
+
+	//Copies from several categories sit next to each other, by doc id
+	key_seek (&c, pack, lo > 0 ? lo - 1 : 0);
+	while (key_next (&c) == 0)
+	{
+		cmp = key_cmp (c.key, c.len, key, len);
+		if (cmp > 0)
+			break;
+		if (cmp < 0)
+			continue;
+		if (c.doc >= db->count)
+			return 0;
+		if (cat != NULL && c.doc >= cat->first && c.doc - cat->first < cat->count)
+			return c.doc + 1;
+		if (found == 0)
+			found = c.doc + 1;
+	}
+	return found;
+}
+
+int qdb_packed_question (const struct quizdb *db, uint32_t doc, char *out, size_t size)
+{
+	const struct qdb_pack *pack = &db->pack;
+	struct key_cursor c;
+	uint32_t rank;
+	uint32_t i;
+
+	if (doc >= db->count || (rank = pack->ranks[doc]) >= db->count)
+		return -1;
+	key_seek (&c, pack, rank / QDB_KEY_BLOCK);
+	for (i = 0; i <= rank % QDB_KEY_BLOCK; i++)
+	{
+		if (key_next (&c))
+			return -1;
+	}
+	if (c.doc != doc || c.len >= size)
+		return -1;
+	memcpy (out, c.key, c.len + 1);
+	return c.len;
+}
+
+/*
+   Answers
+*/
+
+static int get_length (const uint8_t *in, size_t len, size_t *i, size_t *n)
+{
+	uint8_t b;
+
+	do
+	{
+		if (*i >= len)
+			return 1;
+		b = in[(*i)++];
+		*n += b;
+	}
+	while (b == 255);
+	return 0;
+}
+
+//Counts the terminators in [p, end) off nuls, returns 1 once that reaches 0
+static int count_nuls (const uint8_t *p, const uint8_t *end, uint32_t *nuls)
+{
+	//A token only adds a few bytes, too few for memchr to pay
+	for (; p < end; p++)
+	{
+		if (*p == '\0' && --*nuls == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+   Decompresses until out holds nuls terminators, or to the end of the
+   block. Returns the size decompressed, or -1 if the input is corrupt or
+   doesn't fit in size.
+
+   Short runs are copied 16 bytes at a time whatever their length, so out
+   must have COPY_SLACK bytes past size.
+*/
+static long unpack (const uint8_t *in, size_t len, const uint8_t *dict, size_t dict_len, uint8_t *out, size_t size, uint32_t nuls)
+{
+	const uint8_t *src;
+	size_t i = 0;
+	size_t o = 0;
+	size_t seen = 0;
+	size_t lit;
+	size_t match;
+	size_t off;
+	size_t k;
+	uint8_t token;
+
+	while (i < len)
+	{
+		token = in[i++];
+		lit = token >> 4;
+		if (lit == 15 && get_length (in, len, &i, &lit))
+			return -1;
+		if (lit > len - i || lit > size - o)
+			return -1;
+		if (lit <= COPY_SLACK && len - i >= COPY_SLACK)
+			memcpy (out + o, in + i, COPY_SLACK);
+		else
+			memcpy (out + o, in + i, lit);
+		i += lit;
+		o += lit;
+		//The last run of literals has no match after it
+		if (i == len)
+			break;
+
+		if (len - i < 2)
+			return -1;
+		off = in[i] | in[i + 1] << 8;
+		i += 2;
+		match = (token & 15) + MIN_MATCH;
+		if ((token & 15) == 15 && get_length (in, len, &i, &match))
+			return -1;
+		if (off == 0 || off > o + dict_len || match > size - o)
+			return -1;
+
+		//Whole copies when the match is all in the dictionary or all in out, and doesn't overlap itself
+		src = NULL;
+		if (off >= o + match)
+			src = dict + dict_len - (off - o);
+		else if (off <= o && off >= match)
+			src = out + o - off;
+		if (src != NULL && match <= COPY_SLACK && (off > o ? off - o : off) >= COPY_SLACK)
+		{
+			memcpy (out + o, src, COPY_SLACK);
+			o += match;
+		}
+		else if (src != NULL)
+		{
+			memcpy (out + o, src, match);
+			o += match;
+		}
+		else
+		{
+			for (k = 0; k < match; k++, o++)
+				out[o] = off > o ? dict[dict_len - (off - o)] : out[o - off];
+		}
+		if (count_nuls (out + seen, out + o, &nuls))
+			return o;
+		seen = o;
+	}
+	return o;
+}
+
+static __thread uint8_t *block_buf;
+static __thread size_t block_size;
+
+int qdb_packed_answer (const struct quizdb *db, uint32_t doc, char *out, size_t size)
+{
+	const struct qdb_pack *pack = &db->pack;
+	const uint8_t *p;
+	const uint8_t *end;
+	uint8_t *buf;
+	uint32_t block;
+	uint32_t i;
+	long n;
+
+	if (doc >= db->count)
+		return -1;
+	block = doc / pack->block;
+	if (pack->answer_blocks[block] > pack->answer_blocks[block + 1] ||
+			pack->answer_blocks[block + 1] > pack->answers_len)
+		return -1;
+
+	if (block_size < pack->block_max)
+	{
+		if ((buf = realloc (block_buf, pack->block_max + COPY_SLACK)) == NULL)
+			return -1;
+		block_buf = buf;
+		block_size = pack->block_max;
+	}
+	n = unpack (pack->answers + pack->answer_blocks[block], pack->answer_blocks[block + 1] - pack->answer_blocks[block],
+			pack->dict, pack->dict_len, block_buf, pack->block_max, doc % pack->block + 1);
+	if (n < 0)
+		return -1;
+
+	//Every answer in the block is terminated, skip to ours
+	p = block_buf;
+	end = block_buf + n;
+	for (i = doc % pack->block; i > 0 && (p = memchr (p, '\0', end - p)) != NULL; i--)
+		p++;
+	if (p == NULL || (end = memchr (p, '\0', end - p)) == NULL || (size_t) (end - p) >= size)
+		return -1;
+	memcpy (out, p, end - p + 1);
+	return end - p;
+}
+
+int qdb_map_packed (struct quizdb *db, const struct qdb_header *hdr)
+{
+	struct qdb_pack *pack = &db->pack;
+	void *map = db->map;
+	size_t len = db->map_len;
+
+	if (hdr->block == 0 || hdr->block_max > (uint64_t) hdr->block * QDB_LINE_MAX)
+		return 1;
+	pack->block = hdr->block;
+	pack->block_max = hdr->block_max;
+	pack->nkey_blocks = db->count / QDB_KEY_BLOCK + (db->count % QDB_KEY_BLOCK != 0);
+	pack->nanswer_blocks = db->count / pack->block + (db->count % pack->block != 0);
+
+	pack->keys = qdb_map_section (map, len, hdr, QDB_SEC_KEYS, 0);
+	pack->keys_len = hdr->sec[QDB_SEC_KEYS].len;
+	pack->key_blocks = qdb_map_section (map, len, hdr, QDB_SEC_KEY_BLOCKS, (uint64_t) pack->nkey_blocks * sizeof(uint32_t));
+	pack->ranks = qdb_map_section (map, len, hdr, QDB_SEC_RANKS, (uint64_t) db->count * sizeof(uint32_t));
+	pack->weights = qdb_map_section (map, len, hdr, QDB_SEC_WEIGHTS, (uint64_t) db->count * sizeof(float));
+	pack->answers = qdb_map_section (map, len, hdr, QDB_SEC_ANSWERS, 0);
+	pack->answers_len = hdr->sec[QDB_SEC_ANSWERS].len;
+	pack->answer_blocks = qdb_map_section (map, len, hdr, QDB_SEC_ANSWER_BLOCKS,
+			((uint64_t) pack->nanswer_blocks + 1) * sizeof(uint32_t));
+	pack->dict = qdb_map_section (map, len, hdr, QDB_SEC_DICT, 0);
+	pack->dict_len = hdr->sec[QDB_SEC_DICT].len;
+
+	return pack->keys == NULL || pack->key_blocks == NULL || pack->ranks == NULL || pack->weights == NULL ||
+			pack->answers == NULL || pack->answer_blocks == NULL || pack->dict == NULL;
+}
+
+/*
+   Packing
+*/
+
+struct segment {
+	uint32_t hash;
+	uint32_t len;
+	uint32_t count;
+	const char *p;
+};
+
+struct segments {
+	struct segment *slots;
+	uint32_t mask;
+	uint32_t count;
+};
+
+static int segment_add (struct segments *t, const char *p, uint32_t len)
+{
+	struct segment *slots;
+	uint32_t hash = qdb_hash (p, len);
+	uint32_t size;
+	uint32_t i;
+	uint32_t j;
+
+	for (i = hash & t->mask; t->slots[i].p != NULL; i = (i + 1) & t->mask)
+	{
+		if (t->slots[i].hash == hash && t->slots[i].len == len && memcmp (t->slots[i].p, p, len) == 0)
+		{
+			t->slots[i].count++;
+			return 0;
+		}
+	}
+	t->slots[i].hash = hash;
+	t->slots[i].len = len;
+	t->slots[i].count = 1;
+	t->slots[i].p = p;
+	if (++t->count * 2 <= t->mask)
+		return 0;
+
+	size = (t->mask + 1) * 2;
+	if ((slots = calloc (size, sizeof(struct segment))) == NULL)
+		return 1;
+	for (i = 0; i <= t->mask; i++)
+	{
+		if (t->slots[i].p == NULL)
+			continue;
+		for (j = t->slots[i].hash & (size - 1); slots[j].p != NULL; j = (j + 1) & (size - 1))
+			;
+		slots[j] = t->slots[i];
+	}
+	free (t->slots);
+	t->slots = slots;
+	t->mask = size - 1;
+	return 0;
+}
+
+//Most bytes saved first
+static int segment_cmp (const void *a, const void *b)
+{
+	const struct segment *x = a;
+	const struct segment *y = b;
+	uint64_t sx = (uint64_t) (x->count - 1) * x->len;
+	uint64_t sy = (uint64_t) (y->count - 1) * y->len;
+
+	return sx < sy ? 1 : sx > sy ? -1 : 0;
+}
+
+/*
+   The dictionary is made of whole answers with their terminator, and the
+   words of longer ones, picked by how many bytes they would save if every
+   repeat of them became a match.
+*/
+static int train_dict (const struct quizdb *db, struct bytes *dict)
+{
+	struct segments t;
+	struct segment *picked;
+	const char *answer;
+	const char *p;
+	const char *word;
+	uint32_t stride = db->count / TRAIN_SAMPLES + 1;
+	uint32_t npicked = 0;
+	uint32_t used = 0;
+	uint32_t d;
+	uint32_t i;
+
+	t.mask = (1 << 12) - 1;
+	t.count = 0;
+	if ((t.slots = calloc (t.mask + 1, sizeof(struct segment))) == NULL)
+		return 1;
+
+	for (d = 0; d < db->count; d += stride)
+	{
+		answer = db->arena + db->docs[d].answer;
+		if (segment_add (&t, answer, db->docs[d].answer_len + 1))
+			goto fail;
+		for (p = answer; *p != '\0'; )
+		{
+			for (word = p; *p != '\0' && *p != ' '; p++)
+				;
+			if (*p == ' ')
+				p++;
+			if (p - word >= MIN_MATCH && (word != answer || *p != '\0') && segment_add (&t, word, p - word))
+				goto fail;
+		}
+	}
+
+	//Only what repeats is worth having
+	picked = t.slots;
+	for (i = 0; i <= t.mask; i++)
+	{
+		if (t.slots[i].p != NULL && t.slots[i].count > 1)
+			picked[npicked++] = t.slots[i];
+	}
+	qsort (picked, npicked, sizeof(struct segment), segment_cmp);
+	for (i = 0; i < npicked && used < DICT_SIZE; i++)
+	{
+		if (picked[i].len <= DICT_SIZE - used)
+		{
+			picked[i].count = 0;
+			used += picked[i].len;
+		}
+	}
+
+	//The best go last, nearest the data
+	while (i-- > 0)
+	{
+		if (picked[i].count == 0 && bytes_add (dict, picked[i].p, picked[i].len))
+			goto fail;
+	}
+	free (t.slots);
+	return 0;
+
+fail:
+	free (t.slots);
+	return 1;
+}
+
+struct packer {
+	const uint8_t *dict;
+	size_t dict_len;
+	uint8_t *win;		//The dictionary followed by the block being packed
+	int32_t *prev;		//Earlier position with the same hash, for every position in win
+	int32_t *dict_head;
+	int32_t *head;		//Latest position in the block with each hash, if stamped with the block
+	uint32_t *stamp;
+	uint32_t block;
+};
+
+static uint32_t hash4 (const uint8_t *p)
+{
+	uint32_t v = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static int put_length (struct bytes *out, size_t n)
+{
+	for (; n >= 255; n -= 255)
+	{
+		if (bytes_byte (out, 255))
+			return 1;
+	}
+	return bytes_byte (out, n);
+}
+
+//A run of literals and the match after it, or the last run if match is 0
+static int emit (struct bytes *out, const uint8_t *lit, size_t nlit, size_t match, size_t off)
+{
+	uint8_t token;
+
+	token = (nlit < 15 ? nlit : 15) << 4;
+	if (match > 0)
+		token |= match - MIN_MATCH < 15 ? match - MIN_MATCH : 15;
+	if (bytes_byte (out, token) || (nlit >= 15 && put_length (out, nlit - 15)) || bytes_add (out, lit, nlit))
+		return 1;
+	if (match == 0)
+		return 0;
+	if (bytes_byte (out, off & 0xff) || bytes_byte (out, off >> 8))
+		return 1;
+	return match - MIN_MATCH >= 15 && put_length (out, match - MIN_MATCH - 15);
+}
+
+static void chain_insert (struct packer *pk, size_t pos)
+{
+	uint32_t h = hash4 (pk->win + pos);
+
+	pk->prev[pos] = pk->stamp[h] == pk->block ? pk->head[h] : pk->dict_head[h];
+	pk->head[h] = pos;
+	pk->stamp[h] = pk->block;
+}
+
+//Greedy, taking the longest match found along a bounded hash chain
+static int pack_block (struct packer *pk, const uint8_t *raw, size_t len, struct bytes *out)
+{
+	uint8_t *win = pk->win;
+	size_t end = pk->dict_len + len;
+	size_t pos = pk->dict_len;
+	size_t anchor = pos;
+	size_t best_len;
+	size_t best_off;
+	size_t l;
+	int32_t cand;
+	uint32_t h;
+	int depth;
+
+	memcpy (win + pk->dict_len, raw, len);
+	pk->block++;
+	while (pos + MIN_MATCH <= end)
+	{
+		h = hash4 (win + pos);
+		cand = pk->stamp[h] == pk->block ? pk->head[h] : pk->dict_head[h];
+		best_len = 0;
+		best_off = 0;
+		for (depth = 0; cand >= 0 && depth < CHAIN_DEPTH && pos - cand <= MAX_OFFSET; depth++, cand = pk->prev[cand])
+		{
+			for (l = 0; pos + l < end && win[cand + l] == win[pos + l]; l++)
+				;
+			if (l > best_len)
+			{
+				best_len = l;
+				best_off = pos - cand;
+			}
+		}
+		if (best_len < MIN_MATCH)
+		{
+			chain_insert (pk, pos++);
+			continue;
+		}
+		if (emit (out, win + anchor, pos - anchor, best_len, best_off))
+			return 1;
+		for (l = 0; l < best_len && pos + MIN_MATCH <= end; l++)
+			chain_insert (pk, pos++);
+		pos += best_len - l;
+		anchor = pos;
+	}
+	if (anchor < end)
+		return emit (out, win + anchor, end - anchor, 0, 0);
+	return 0;
+}
+
+static const struct quizdb *sort_db;
+
+//By question, then by doc so copies in several categories keep their order
+static int rank_cmp (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+	int cmp = strcmp (sort_db->arena + sort_db->docs[x].key, sort_db->arena + sort_db->docs[y].key);
+
+	if (cmp != 0)
+		return cmp;
+	return x < y ? -1 : x > y;
+}
+
+int quizdb_pack (const struct quizdb *db, const char *path, unsigned int block)
+{
+	struct qdb_header hdr;
+	const void *data[QDB_NUM_SECTIONS];
+	struct qdb_category *categories = NULL;
+	struct packer pk;
+	struct bytes arena = { 0 };
+	struct bytes keys = { 0 };
+	struct bytes answers = { 0 };
+	struct bytes raw = { 0 };
+	struct bytes dict = { 0 };
+	uint32_t *order = NULL;
+	uint32_t *ranks = NULL;
+	uint32_t *key_blocks = NULL;
+	uint32_t *answer_blocks = NULL;
+	float *weights = NULL;
+	const char *key;
+	const char *prev = "";
+	uint32_t nkey_blocks;
+	uint32_t nblocks;
+	uint32_t block_max = 0;
+	uint32_t shared;
+	uint32_t len;
+	uint32_t d;
+	uint32_t i;
+	uint64_t off;
+	int ret = 1;
+
+	if (db->packed || block == 0)
+		return 1;
+	memset (&pk, 0, sizeof(pk));
+	nkey_blocks = db->count / QDB_KEY_BLOCK + (db->count % QDB_KEY_BLOCK != 0);
+	nblocks = db->count / block + (db->count % block != 0);
+
+	order = malloc ((db->count + 1) * sizeof(uint32_t));
+	ranks = malloc ((db->count + 1) * sizeof(uint32_t));
+	weights = malloc ((db->count + 1) * sizeof(float));
+	key_blocks = malloc ((nkey_blocks + 1) * sizeof(uint32_t));
+	answer_blocks = malloc ((nblocks + 1) * sizeof(uint32_t));
+	categories = malloc ((db->ncategories + 1) * sizeof(struct qdb_category));
+	if (order == NULL || ranks == NULL || weights == NULL || key_blocks == NULL ||
+			answer_blocks == NULL || categories == NULL)
+		goto out;
+
+	//Front code the questions in sorted order
+	for (d = 0; d < db->count; d++)
+	{
+		order[d] = d;
+		weights[d] = db->docs[d].weight;
+	}
+	sort_db = db;
+	qsort (order, db->count, sizeof(uint32_t), rank_cmp);
+	for (i = 0; i < db->count; i++)
+	{
+		d = order[i];
+		ranks[d] = i;
+		key = db->arena + db->docs[d].key;
+		len = strlen (key);
+		shared = 0;
+		if (i % QDB_KEY_BLOCK == 0)
+		{
+			key_blocks[i / QDB_KEY_BLOCK] = keys.len;
+		}
+		else
+		{
+			while (shared < len && key[shared] == prev[shared])
+				shared++;
+		}
+		if (keys.len > UINT32_MAX || bytes_varint (&keys, shared) || bytes_varint (&keys, len - shared) ||
+				bytes_add (&keys, key + shared, len - shared) || bytes_varint (&keys, d))
+			goto out;
+		prev = key;
+	}
+
+	//Then the answers, a block at a time against the dictionary
+	if (train_dict (db, &dict))
+		goto out;
+	pk.dict = dict.p;
+	pk.dict_len = dict.len;
+	for (d = 0; d < db->count; d += block)
+	{
+		raw.len = 0;
+		for (i = d; i < db->count && i - d < block; i++)
+		{
+			if (bytes_add (&raw, db->arena + db->docs[i].answer, db->docs[i].answer_len + 1))
+				goto out;
+		}
+		if (raw.len > block_max)
+			block_max = raw.len;
+	}
+	pk.win = malloc (dict.len + block_max + 1);
+	pk.prev = malloc ((dict.len + block_max + 1) * sizeof(int32_t));
+	pk.dict_head = malloc ((1 << HASH_BITS) * sizeof(int32_t));
+	pk.head = malloc ((1 << HASH_BITS) * sizeof(int32_t));
+	pk.stamp = calloc (1 << HASH_BITS, sizeof(uint32_t));
+	if (pk.win == NULL || pk.prev == NULL || pk.dict_head == NULL || pk.head == NULL || pk.stamp == NULL)
+		goto out;
+	if (dict.len > 0)
+		memcpy (pk.win, dict.p, dict.len);
+	for (i = 0; i < 1 << HASH_BITS; i++)
+		pk.dict_head[i] = -1;
+	for (i = 0; i + MIN_MATCH <= dict.len; i++)
+	{
+		pk.prev[i] = pk.dict_head[hash4 (pk.win + i)];
+		pk.dict_head[hash4 (pk.win + i)] = i;
+	}
+	for (d = 0; d < db->count; d += block)
+	{
+		raw.len = 0;
+		for (i = d; i < db->count && i - d < block; i++)
+		{
+			if (bytes_add (&raw, db->arena + db->docs[i].answer, db->docs[i].answer_len + 1))
+				goto out;
+		}
+		answer_blocks[d / block] = answers.len;
+		if (pack_block (&pk, raw.p, raw.len, &answers) || answers.len > UINT32_MAX)
+			goto out;
+	}
+	answer_blocks[nblocks] = answers.len;
+
+	//Only the category names are left in the arena
+	if (bytes_byte (&arena, '\0'))
+		goto out;
+	for (i = 0; i < db->ncategories; i++)
+	{
+		categories[i] = db->categories[i];
+		categories[i].name = arena.len;
+		key = db->arena + db->categories[i].name;
+		if (bytes_add (&arena, key, strlen (key) + 1))
+			goto out;
+	}
+
+	memset (&hdr, 0, sizeof(hdr));
+	memset (data, 0, sizeof(data));
+	memcpy (hdr.magic, QDB_MAGIC, sizeof(hdr.magic));
+	hdr.version = QDB_VERSION;
+	hdr.byte_order = QDB_BYTE_ORDER;
+	hdr.count = db->count;
+	hdr.term_size = db->term_mask + 1;
+	hdr.ncategories = db->ncategories;
+	hdr.flags = QDB_PACKED;
+	hdr.block = block;
+	hdr.block_max = block_max;
+
+	data[QDB_SEC_ARENA] = arena.p;
+	hdr.sec[QDB_SEC_ARENA].len = arena.len;
+	data[QDB_SEC_TERMS] = db->terms;
+	hdr.sec[QDB_SEC_TERMS].len = (uint64_t) hdr.term_size * sizeof(struct qdb_term);
+	data[QDB_SEC_POSTINGS] = db->postings;
+	hdr.sec[QDB_SEC_POSTINGS].len = (uint64_t) db->npostings * sizeof(uint32_t);
+	data[QDB_SEC_CATEGORIES] = categories;
+	hdr.sec[QDB_SEC_CATEGORIES].len = (uint64_t) db->ncategories * sizeof(struct qdb_category);
+	data[QDB_SEC_KEYS] = keys.p;
+	hdr.sec[QDB_SEC_KEYS].len = keys.len;
+	data[QDB_SEC_KEY_BLOCKS] = key_blocks;
+	hdr.sec[QDB_SEC_KEY_BLOCKS].len = (uint64_t) nkey_blocks * sizeof(uint32_t);
+	data[QDB_SEC_RANKS] = ranks;
+	hdr.sec[QDB_SEC_RANKS].len = (uint64_t) db->count * sizeof(uint32_t);
+	data[QDB_SEC_WEIGHTS] = weights;
+	hdr.sec[QDB_SEC_WEIGHTS].len = (uint64_t) db->count * sizeof(float);
+	data[QDB_SEC_ANSWERS] = answers.p;
+	hdr.sec[QDB_SEC_ANSWERS].len = answers.len;
+	data[QDB_SEC_ANSWER_BLOCKS] = answer_blocks;
+	hdr.sec[QDB_SEC_ANSWER_BLOCKS].len = ((uint64_t) nblocks + 1) * sizeof(uint32_t);
+	data[QDB_SEC_DICT] = dict.p;
+	hdr.sec[QDB_SEC_DICT].len = dict.len;
+
+	off = sizeof(hdr);
+	for (i = 0; i < QDB_NUM_SECTIONS; i++)
+	{
+		off = (off + 7) & ~(uint64_t) 7;
+		hdr.sec[i].off = off;
+		off += hdr.sec[i].len;
+	}
+	ret = qdb_write (path, &hdr, data);
+
+out:
+	free (order);
+	free (ranks);
+	free (weights);
+	free (key_blocks);
+	free (answer_blocks);
+	free (categories);
+	free (arena.p);
+	free (keys.p);
+	free (answers.p);
+	free (raw.p);
+	free (dict.p);
+	free (pk.win);
+	free (pk.prev);
+	free (pk.dict_head);
+	free (pk.head);
+	free (pk.stamp);
+	return ret;
+}
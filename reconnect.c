@@ -0,0 +1,129 @@
+#include "reconnect.h"
+#include "libircclient/libirc_rfcnumeric.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+static uint64_t seed;
+
+//xorshift64, only has to spread the delays out
+static uint32_t jitter (void)
+{
+	if (seed == 0)
+		seed = ((uint64_t) getpid () << 32 ^ timer_now_us ()) | 1;
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed >> 32;
+}
+
+static unsigned int backoff_ms (unsigned int failures)
+{
+	unsigned int ms = RECONNECT_MIN_MS;
+
+	while (failures-- > 0 && ms < RECONNECT_MAX_MS)
+		ms *= 2;
+	if (ms > RECONNECT_MAX_MS)
+		ms = RECONNECT_MAX_MS;
+	return ms / 2 + jitter () % (ms / 2 + 1);
+}
+
+//The same channel twice is only joined once
+static unsigned int count_channels (const char *channels)
+{
+	const char *name;
+	const char *prev;
+	size_t len;
+	unsigned int n = 0;
+
+	for (name = channels; *name != '\0'; name += len + (name[len] == ','))
+	{
+		len = strcspn (name, ",");
+		for (prev = channels; prev < name; prev += strcspn (prev, ",") + 1)
+		{
+			if (strcspn (prev, ",") == len && strncasecmp (prev, name, len) == 0)
+				break;
+		}
+		if (len > 0 && prev >= name)
+			n++;
+	}
+	return n;
+}
+
+static void attempt (void *arg)
+{
+	struct reconnect *r = arg;
+	const struct cfg *cfg = r->cfg;
+
+	if (r->connected)
+		fprintf (stdout, "IRC: Reconnecting to server %s\n", cfg->server);
+	if (irc_connect (r->session, cfg->server, atoi (cfg->port), 0, cfg->nick, cfg->username, cfg->realname))
+	{
+		fprintf (stderr, "IRC: ERROR %s\n", irc_strerror (irc_errno (r->session)));
+		reconnect_lost (r);
+	}
+}
+
+void reconnect_init (struct reconnect *r, irc_session_t *session, const struct cfg *cfg)
+{
+	memset (r, 0, sizeof(*r));
+	r->session = session;
+	r->cfg = cfg;
+	timer_init (&r->timer, attempt, r);
+}
+
+void reconnect_start (struct reconnect *r)
+{
+	attempt (r);
+}
+
+void reconnect_lost (struct reconnect *r)
+{
+	unsigned int ms;
+
+	if (r->lost == 0 && r->connected)
+		r->lost = timer_now_us ();
+	ms = backoff_ms (r->failures++);
+	fprintf (stdout, "IRC: Connection to %s lost, trying again in %u ms\n", r->cfg->server, ms);
+	timer_add (&r->timer, ms);
+}
+
+int reconnect_connected (struct reconnect *r)
+{
+	int again = r->connected;
+
+	//Registered, so whatever happens to the channels the server itself took us
+	r->connected = 1;
+	r->failures = 0;
+	r->channels = count_channels (r->cfg->channel);
+	return again;
+}
+
+void reconnect_numeric (struct reconnect *r, unsigned int event)
+{
+	switch (event)
+	{
+		case LIBIRC_RFC_RPL_ENDOFNAMES:
+		case LIBIRC_RFC_ERR_NOSUCHCHANNEL:
+		case LIBIRC_RFC_ERR_CHANNELISFULL:
+		case LIBIRC_RFC_ERR_INVITEONLYCHAN:
+		case LIBIRC_RFC_ERR_BANNEDFROMCHAN:
+		case LIBIRC_RFC_ERR_BADCHANNELKEY:
+			break;
+		default:
+			return;
+	}
+	if (r->channels == 0 || --r->channels > 0)
+		return;
+
+	if (r->lost != 0)
+	{
+		metric_time (METRIC_REJOIN_US, timer_now_us () - r->lost);
+		fprintf (stdout, "IRC: Back in %s after %lu ms\n", r->cfg->channel, (timer_now_us () - r->lost) / 1000);
+		r->lost = 0;
+	}
+}
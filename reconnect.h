@@ -0,0 +1,53 @@
+#ifndef RECONNECT_H
+#define RECONNECT_H
+
+#include "libircclient/libircclient.h"
+#include "cfg.h"
+#include "timer.h"
+
+/*
+   Keeping a session connected without restarting the bot.
+
+   When a session's connection goes it is made again after a delay that
+   doubles with every attempt in a row that doesn't get registered,
+   from RECONNECT_MIN_MS up to RECONNECT_MAX_MS. Each delay is picked at
+   random from the upper half of that, so sessions dropped together
+   don't all come back at the same moment.
+
+   Only the connection is redone, so whatever the bot has loaded or
+   learned carries on as it was. The time from the connection going to
+   the server having answered the JOIN of every channel in cfg->channel,
+   with their names or a refusal, is recorded as ircbot_rejoin_seconds.
+
+   Everything here is only to be used from the loop thread.
+*/
+
+#define RECONNECT_MIN_MS	200
+#define RECONNECT_MAX_MS	300000
+
+struct reconnect {
+	irc_session_t *session;
+	const struct cfg *cfg;
+	struct timer timer;
+	unsigned int failures;	//Attempts in a row that didn't get registered
+	unsigned int channels;	//Still to be answered for since the last connect
+	unsigned long lost;	//timer_now_us when the connection went, 0 while in the channels
+	int connected;		//Has been connected at least once
+};
+
+void reconnect_init (struct reconnect *r, irc_session_t *session, const struct cfg *cfg);
+
+//Connects now, and keeps retrying if that fails
+void reconnect_start (struct reconnect *r);
+
+//The connection went, or couldn't be made. Schedules the next attempt
+void reconnect_lost (struct reconnect *r);
+
+//From event_connect. Returns 1 if the session had been connected before
+int reconnect_connected (struct reconnect *r);
+
+//From event_numeric. RPL_ENDOFNAMES, or the server refusing a JOIN,
+//finishes one of the channels
+void reconnect_numeric (struct reconnect *r, unsigned int event);
+
+#endif
@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+
+#include "reload.h"
+#include "epoch.h"
+#include "loop.h"
+#include "timer.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+//Check again for old indexes nobody is reading any more
+#define RELOAD_RECLAIM_MS	100
+#define RELOAD_NICE		19
+
+struct quizdb_live {
+	struct quizdb_live *next;
+	char path[255];
+	const char *name;	//File name within its directory, for matching inotify events
+	int wd;
+	struct quizdb *db;	//Readers load this inside an epoch
+	struct timer settle;
+
+	//Loop thread only
+	int building;
+	int again;		//Changed again while it was being built
+	unsigned long started;
+	pthread_t builder;
+
+	//Set by the builder, then it writes reload_efd
+	struct quizdb *built;
+	int done;
+};
+
+static struct quizdb_live *lives;
+static int inotify_fd = -1;
+static int reload_efd = -1;
+static struct timer reclaim_timer;
+
+static void start_build (struct quizdb_live *live);
+
+static void free_db (void *ptr)
+{
+	quizdb_free (ptr);
+}
+
+static void reclaim (void *arg)
+{
+	if (epoch_reclaim () > 0)
+		timer_add (&reclaim_timer, RELOAD_RECLAIM_MS);
+}
+
+static void *build (void *arg)
+{
+	struct quizdb_live *live = arg;
+	uint64_t one = 1;
+
+	//Niced on its own, so the loop and workers come first. SCHED_IDLE would be
+	//stronger still, but could hold a reload off forever on a busy machine
+	setpriority (PRIO_PROCESS, syscall (SYS_gettid), RELOAD_NICE);
+
+	live->built = quizdb_load (live->path);
+	__atomic_store_n (&live->done, 1, __ATOMIC_RELEASE);
+	if (write (reload_efd, &one, sizeof(one)) < 0)
+		;
+	return NULL;
+}
+
+//Loop thread, a builder has finished
+static void finish_builds (void *arg)
+{
+	struct quizdb_live *live;
+	struct quizdb *old;
+	uint64_t count;
+
+	if (read (reload_efd, &count, sizeof(count)) < 0)
+		;
+
+	for (live = lives; live != NULL; live = live->next)
+	{
+		if (!live->building || !__atomic_load_n (&live->done, __ATOMIC_ACQUIRE))
+			continue;
+		pthread_join (live->builder, NULL);
+		live->building = 0;
+
+		if (live->built == NULL)
+		{
+			metric_inc (METRIC_RELOAD_FAILED);
+			fprintf (stderr, "IRC: Error reloading question database %s, keeping the old one\n", live->path);
+		}
+		else
+		{
+			old = live->db;
+			__atomic_store_n (&live->db, live->built, __ATOMIC_SEQ_CST);
+			if (old != NULL)
+			{
+				epoch_retire (free_db, old);
+				reclaim (NULL);
+			}
+			metric_inc (METRIC_RELOAD);
+			fprintf (stdout, "IRC: Reloaded %u questions from %s in %lums\n",
+					quizdb_count (live->built), live->path, timer_now_ms () - live->started);
+		}
+		live->built = NULL;
+
+		if (live->again)
+		{
+			live->again = 0;
+			start_build (live);
+		}
+	}
+}
+
+static void start_build (struct quizdb_live *live)
+{
+	if (live->building)
+	{
+		live->again = 1;
+		return;
+	}
+	live->done = 0;
+	live->built = NULL;
+	live->started = timer_now_ms ();
+	if (pthread_create (&live->builder, NULL, build, live) != 0)
+	{
+		fprintf (stderr, "IRC: Error starting a reload of %s\n", live->path);
+		return;
+	}
+	live->building = 1;
+}
+
+//The file has been quiet for RELOAD_SETTLE_MS
+static void settled (void *arg)
+{
+	start_build (arg);
+}
+
+//Loop thread, something changed in a watched directory
+static void changed (void *arg)
+{
+	char buff[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+	const struct inotify_event *ev;
+	struct quizdb_live *live;
+	ssize_t len;
+	ssize_t off;
+
+	while ((len = read (inotify_fd, buff, sizeof(buff))) > 0)
+	{
+		for (off = 0; off < len; off += sizeof(*ev) + ev->len)
+		{
+			ev = (const struct inotify_event *) (buff + off);
+			for (live = lives; live != NULL; live = live->next)
+			{
+				//Wait for the writes to stop before loading it
+				if (live->wd == ev->wd && ev->len > 0 && strcmp (ev->name, live->name) == 0)
+					timer_add (&live->settle, RELOAD_SETTLE_MS);
+			}
+		}
+	}
+}
+
+static int watch_setup (void)
+{
+	inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	reload_efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (inotify_fd >= 0 && reload_efd >= 0 &&
+			loop_watch (inotify_fd, changed, NULL) == 0 && loop_watch (reload_efd, finish_builds, NULL) == 0)
+	{
+		timer_init (&reclaim_timer, reclaim, NULL);
+		return 0;
+	}
+
+	if (inotify_fd >= 0)
+		close (inotify_fd);
+	if (reload_efd >= 0)
+		close (reload_efd);
+	inotify_fd = -1;
+	reload_efd = -1;
+	return 1;
+}
+
+struct quizdb_live *reload_open (const char *path)
+{
+	struct quizdb_live *live;
+	char dir[255];
+	char *slash;
+
+	live = calloc (1, sizeof(*live));
+	if (live == NULL)
+		return NULL;
+	snprintf (live->path, sizeof(live->path), "%s", path);
+	timer_init (&live->settle, settled, live);
+	live->db = quizdb_load (live->path);
+	live->wd = -1;
+
+	snprintf (dir, sizeof(dir), "%s", live->path);
+	slash = strrchr (dir, '/');
+	if (slash == NULL)
+	{
+		strcpy (dir, ".");
+		live->name = live->path;
+	}
+	else
+	{
+		live->name = live->path + (slash - dir) + 1;
+		slash[slash == dir ? 1 : 0] = '\0';
+	}
+
+	//Still usable without reloads
+	if (inotify_fd < 0 && watch_setup ())
+		fprintf (stderr, "IRC: Can't watch for changes to %s, it won't be reloaded\n", live->path);
+	else if ((live->wd = inotify_add_watch (inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO)) < 0)
+		fprintf (stderr, "IRC: Can't watch %s for changes, %s won't be reloaded\n", dir, live->path);
+
+	live->next = lives;
+	lives = live;
+	return live;
+}
+
+struct quizdb *reload_get (const struct quizdb_live *live)
+{
+	return __atomic_load_n (&live->db, __ATOMIC_SEQ_CST);
+}
+
+void reload_close (void)
+{
+	struct quizdb_live *live;
+
+	while ((live = lives) != NULL)
+	{
+		lives = live->next;
+		timer_cancel (&live->settle);
+		if (live->building)
+		{
+			pthread_join (live->builder, NULL);
+			quizdb_free (live->built);
+		}
+		quizdb_free (live->db);
+		free (live);
+	}
+	if (inotify_fd >= 0)
+		timer_cancel (&reclaim_timer);
+	epoch_reclaim ();
+}
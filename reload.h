@@ -0,0 +1,36 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "quizdb.h"
+
+/*
+   Question databases that reload themselves when their file changes.
+
+   The directory holding each file is watched with inotify, so both an
+   edited text file and a quizdb-compile run (which renames the new file
+   into place) are noticed. Once the file has been left alone for
+   RELOAD_SETTLE_MS the new index is built on a thread of its own, niced so
+   it doesn't compete with the workers, and handed back to the loop
+   thread. There it replaces the old one with a single pointer store,
+   and the old index is freed through epoch.h once no lookup can still be
+   using it. A file that fails to load leaves the old index in place.
+
+   Readers call reload_get between epoch_enter and epoch_exit and must not
+   keep anything from it past epoch_exit. Everything else is for the loop
+   thread only.
+*/
+
+#define RELOAD_SETTLE_MS	500
+
+struct quizdb_live;
+
+//Loads path straight away and watches it, NULL only if out of memory
+struct quizdb_live *reload_open (const char *path);
+
+//The current index, NULL if the file has never loaded
+struct quizdb *reload_get (const struct quizdb_live *live);
+
+//Waits for any reload still being built and frees every index, once nothing can be reading them
+void reload_close (void);
+
+#endif
@@ -0,0 +1,108 @@
+#include "ring.h"
+#include <stdlib.h>
+
+int spsc_init (struct spsc_ring *r, unsigned long size)
+{
+	r->slots = calloc (size, sizeof(void *));
+	if (r->slots == NULL)
+		return 1;
+	r->mask = size - 1;
+	r->head = 0;
+	r->tail = 0;
+	return 0;
+}
+
+void spsc_free (struct spsc_ring *r)
+{
+	free (r->slots);
+	r->slots = NULL;
+}
+
+int spsc_push (struct spsc_ring *r, void *p)
+{
+	unsigned long tail = r->tail;
+
+	if (tail - __atomic_load_n (&r->head, __ATOMIC_ACQUIRE) > r->mask)
+		return 1;
+	r->slots[tail & r->mask] = p;
+	//Publishes the slot along with the new tail
+	__atomic_store_n (&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void *spsc_pop (struct spsc_ring *r)
+{
+	unsigned long head = r->head;
+	void *p;
+
+	if (head == __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	p = r->slots[head & r->mask];
+	__atomic_store_n (&r->head, head + 1, __ATOMIC_RELEASE);
+	return p;
+}
+
+int mpsc_init (struct mpsc_ring *r, unsigned long size)
+{
+	unsigned long i;
+
+	r->slots = malloc (size * sizeof(struct mpsc_slot));
+	if (r->slots == NULL)
+		return 1;
+	//A slot is free for the push at position seq, and full once seq is one past it
+	for (i = 0; i < size; i++)
+		r->slots[i].seq = i;
+	r->mask = size - 1;
+	r->head = 0;
+	r->tail = 0;
+	return 0;
+}
+
+void mpsc_free (struct mpsc_ring *r)
+{
+	free (r->slots);
+	r->slots = NULL;
+}
+
+int mpsc_push (struct mpsc_ring *r, void *p)
+{
+	struct mpsc_slot *slot;
+	unsigned long pos = __atomic_load_n (&r->tail, __ATOMIC_RELAXED);
+	unsigned long seq;
+	long diff;
+
+	for (;;)
+	{
+		slot = &r->slots[pos & r->mask];
+		seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (long) (seq - pos);
+		if (diff == 0)
+		{
+			//On failure pos is reloaded with whatever another producer left there
+			if (__atomic_compare_exchange_n (&r->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+			return 1;
+		else
+			pos = __atomic_load_n (&r->tail, __ATOMIC_RELAXED);
+	}
+
+	slot->p = p;
+	__atomic_store_n (&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void *mpsc_pop (struct mpsc_ring *r)
+{
+	struct mpsc_slot *slot = &r->slots[r->head & r->mask];
+	void *p;
+
+	if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) != r->head + 1)
+		return NULL;
+	p = slot->p;
+	//Hands the slot back to producers for the next lap round the ring
+	__atomic_store_n (&slot->seq, r->head + r->mask + 1, __ATOMIC_RELEASE);
+	r->head++;
+	return p;
+}
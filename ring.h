@@ -0,0 +1,46 @@
+#ifndef RING_H
+#define RING_H
+
+/*
+   Bounded lock-free rings of pointers, the size has to be a power of two.
+
+   spsc_ring is for exactly one thread pushing and one popping. mpsc_ring
+   takes pushes from any number of threads (each slot carries a sequence
+   number so producers claim slots with a single compare and swap) and
+   pops from one. Neither ever blocks, push returns 1 when the ring is
+   full and pop returns NULL when it's empty.
+*/
+
+#define RING_CACHE_LINE	64
+
+struct spsc_ring {
+	void **slots;
+	unsigned long mask;
+	//Kept on separate cache lines so the two sides don't fight over them
+	unsigned long head __attribute__((aligned(RING_CACHE_LINE)));	//Next to pop
+	unsigned long tail __attribute__((aligned(RING_CACHE_LINE)));	//Next to push
+};
+
+struct mpsc_slot {
+	unsigned long seq;
+	void *p;
+};
+
+struct mpsc_ring {
+	struct mpsc_slot *slots;
+	unsigned long mask;
+	unsigned long head __attribute__((aligned(RING_CACHE_LINE)));
+	unsigned long tail __attribute__((aligned(RING_CACHE_LINE)));
+};
+
+int spsc_init (struct spsc_ring *r, unsigned long size);
+void spsc_free (struct spsc_ring *r);
+int spsc_push (struct spsc_ring *r, void *p);
+void *spsc_pop (struct spsc_ring *r);
+
+int mpsc_init (struct mpsc_ring *r, unsigned long size);
+void mpsc_free (struct mpsc_ring *r);
+int mpsc_push (struct mpsc_ring *r, void *p);
+void *mpsc_pop (struct mpsc_ring *r);
+
+#endif
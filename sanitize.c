@@ -0,0 +1,235 @@
+#include "sanitize.h"
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define SANITIZE_X86 1
+#include <immintrin.h>
+#endif
+
+#define IRC_COLOR	0x03
+#define IRC_HEX_COLOR	0x04
+#define UTF8_SPACE	32
+#define UTF8_TILDE	126
+
+/*
+   Most channel text is plain printable ASCII. The vector versions copy a
+   run of it a block at a time and stop at the first byte that needs a
+   closer look, only that goes through the per-byte state machine. Whole
+   blocks are stored before being checked, len is never more than out has
+   room for and whatever lands past the returned length is overwritten.
+*/
+typedef size_t (*span_func) (const unsigned char *p, char *out, size_t len);
+
+//The smallest block any of them copies
+#define SANITIZE_BLOCK	16
+
+#ifdef SANITIZE_X86
+static size_t span_sse2 (const unsigned char *p, char *out, size_t len)
+{
+	const __m128i below = _mm_set1_epi8 (UTF8_SPACE - 1);
+	const __m128i above = _mm_set1_epi8 (UTF8_TILDE + 1);
+	__m128i v;
+	unsigned int mask;
+	size_t i = 0;
+
+	//Signed compares, so bytes >= 0x80 count as below the range
+	for (; i + 16 <= len; i += 16)
+	{
+		v = _mm_loadu_si128 ((const __m128i *) (p + i));
+		_mm_storeu_si128 ((__m128i *) (out + i), v);
+		mask = _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpgt_epi8 (v, below), _mm_cmplt_epi8 (v, above)));
+		if (mask != 0xFFFF)
+			return i + __builtin_ctz (~mask);
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t span_avx2 (const unsigned char *p, char *out, size_t len)
+{
+	const __m256i below = _mm256_set1_epi8 (UTF8_SPACE - 1);
+	const __m256i above = _mm256_set1_epi8 (UTF8_TILDE + 1);
+	__m256i v;
+	unsigned int mask;
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		v = _mm256_loadu_si256 ((const __m256i *) (p + i));
+		_mm256_storeu_si256 ((__m256i *) (out + i), v);
+		mask = _mm256_movemask_epi8 (_mm256_and_si256 (_mm256_cmpgt_epi8 (v, below), _mm256_cmpgt_epi8 (above, v)));
+		if (mask != 0xFFFFFFFFu)
+			return i + __builtin_ctz (~mask);
+	}
+	return i + span_sse2 (p + i, out + i, len - i);
+}
+#endif
+
+static span_func pick_span (void)
+{
+#ifdef SANITIZE_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2"))
+		return span_avx2;
+	return span_sse2;
+#else
+	return NULL;
+#endif
+}
+
+static int is_digit (unsigned char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static int is_hex (unsigned char c)
+{
+	return is_digit (c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+//Skips the "fg[,bg]" part of a colour code, each up to max chars long
+static size_t skip_color (const unsigned char *p, size_t len, int (*valid) (unsigned char), size_t max)
+{
+	size_t i = 0;
+	size_t n;
+
+	for (n = 0; i < len && n < max && valid (p[i]); n++)
+		i++;
+	if (n > 0 && i + 1 < len && p[i] == ',' && valid (p[i + 1]))
+	{
+		i++;
+		for (n = 0; i < len && n < max && valid (p[i]); n++)
+			i++;
+	}
+	return i;
+}
+
+//Length of the valid UTF-8 sequence at p, or 0 if it isn't one
+static size_t utf8_len (const unsigned char *p, size_t len)
+{
+	unsigned char lo = 0x80;
+	unsigned char hi = 0xBF;
+	size_t need;
+	size_t i;
+
+	if (p[0] >= 0xC2 && p[0] <= 0xDF)
+		need = 1;
+	else if (p[0] >= 0xE0 && p[0] <= 0xEF)
+		need = 2;
+	else if (p[0] >= 0xF0 && p[0] <= 0xF4)
+		need = 3;
+	else
+		return 0;
+
+	//Reject overlong forms, surrogates and anything past U+10FFFF
+	if (p[0] == 0xE0)
+		lo = 0xA0;
+	else if (p[0] == 0xED)
+		hi = 0x9F;
+	else if (p[0] == 0xF0)
+		lo = 0x90;
+	else if (p[0] == 0xF4)
+		hi = 0x8F;
+
+	if (need >= len || p[1] < lo || p[1] > hi)
+		return 0;
+	for (i = 2; i <= need; i++)
+	{
+		if (p[i] < 0x80 || p[i] > 0xBF)
+			return 0;
+	}
+	return need + 1;
+}
+
+static size_t sanitize (span_func span, const char *in, size_t len, char *out, size_t outlen)
+{
+	const unsigned char *p = (const unsigned char *) in;
+	size_t i = 0;
+	size_t j = 0;
+	size_t n;
+
+	if (outlen == 0)
+		return 0;
+	outlen--;
+
+	while (i < len && j < outlen)
+	{
+		if (p[i] >= UTF8_SPACE && p[i] <= UTF8_TILDE)
+		{
+			//Only worth a vector call with a block to go, as it stops at the first byte that isn't plain
+			n = (len - i < outlen - j) ? len - i : outlen - j;
+			if (span != NULL && n >= SANITIZE_BLOCK)
+			{
+				n = span (p + i, out + j, n);
+				i += n;
+				j += n;
+			}
+			//Whatever the blocks left, and runs too short for one
+			while (i < len && j < outlen && p[i] >= UTF8_SPACE && p[i] <= UTF8_TILDE)
+				out[j++] = p[i++];
+			if (i == len || j == outlen)
+				break;
+		}
+
+		if (p[i] == IRC_COLOR)
+		{
+			i++;
+			i += skip_color (p + i, len - i, is_digit, 2);
+		}
+		else if (p[i] == IRC_HEX_COLOR)
+		{
+			i++;
+			i += skip_color (p + i, len - i, is_hex, 6);
+		}
+		else if (p[i] < 0x80)
+		{
+			//Bold, italics, reset and every other control character
+			i++;
+		}
+		else if ((n = utf8_len (p + i, len - i)) > 0)
+		{
+			//U+00A0 no-break space, and the C1 controls which aren't text
+			if (n == 2 && p[i] == 0xC2 && p[i + 1] == 0xA0)
+				out[j++] = UTF8_SPACE;
+			else if (n == 2 && p[i] == 0xC2 && p[i + 1] < 0xA0)
+				;
+			else if (j + n <= outlen)
+			{
+				memcpy (out + j, p + i, n);
+				j += n;
+			}
+			else
+				break;
+			i += n;
+		}
+		else
+		{
+			//Not UTF-8, but a lone 0xA0 is most likely a Latin-1 no-break space
+			if (p[i] == 0xA0)
+				out[j++] = UTF8_SPACE;
+			i++;
+		}
+	}
+
+	out[j] = '\0';
+	return j;
+}
+
+size_t irc_sanitize (const char *in, size_t len, char *out, size_t outlen)
+{
+	static span_func span;
+	static int picked;
+
+	//Racing threads would all pick the same one, so this doesn't need a lock
+	if (!__atomic_load_n (&picked, __ATOMIC_ACQUIRE))
+	{
+		__atomic_store_n (&span, pick_span (), __ATOMIC_RELAXED);
+		__atomic_store_n (&picked, 1, __ATOMIC_RELEASE);
+	}
+	return sanitize (__atomic_load_n (&span, __ATOMIC_RELAXED), in, len, out, outlen);
+}
+
+size_t irc_sanitize_scalar (const char *in, size_t len, char *out, size_t outlen)
+{
+	return sanitize (NULL, in, len, out, outlen);
+}
@@ -0,0 +1,20 @@
+#ifndef SANITIZE_H
+#define SANITIZE_H
+
+#include <stddef.h>
+
+/*
+   Cleans up channel text before we try to make sense of it.
+
+   IRC colour and formatting codes, other control characters and invalid
+   UTF-8 are dropped, a non-breaking space becomes a plain space and valid
+   UTF-8 is passed through untouched. At most outlen - 1 bytes are written
+   to out, which is always NUL terminated, and a multibyte character is
+   never cut in half. Returns the number of bytes written.
+*/
+size_t irc_sanitize (const char *in, size_t len, char *out, size_t outlen);
+
+//The plain per-byte version, for comparing against in the benchmark
+size_t irc_sanitize_scalar (const char *in, size_t len, char *out, size_t outlen);
+
+#endif
@@ -0,0 +1,198 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "timer.h"
+#include <stddef.h>
+#include <time.h>
+
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+//Furthest out a timer can be, in ticks
+#define WHEEL_RANGE	(1UL << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct timer *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static unsigned int wheel_count[WHEEL_LEVELS];
+static unsigned long wheel_now;		//Last tick that has been run
+static int wheel_started;
+
+static unsigned long now_ticks (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * (1000 / TIMER_TICK_MS) + ts.tv_nsec / (TIMER_TICK_MS * 1000000L);
+}
+
+unsigned long timer_now_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000L;
+}
+
+unsigned long timer_now_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000L;
+}
+
+static void wheel_start (void)
+{
+	if (!wheel_started)
+	{
+		wheel_now = now_ticks ();
+		wheel_started = 1;
+	}
+}
+
+static void wheel_insert (struct timer *t)
+{
+	struct timer **slot;
+	unsigned long delta;
+	int level;
+
+	//Anything overdue runs on the next tick
+	if ((long) (t->expires - wheel_now) <= 0)
+		t->expires = wheel_now + 1;
+	delta = t->expires - wheel_now;
+	if (delta >= WHEEL_RANGE)
+	{
+		t->expires = wheel_now + WHEEL_RANGE - 1;
+		delta = WHEEL_RANGE - 1;
+	}
+
+	for (level = 0; delta >= (1UL << (WHEEL_BITS * (level + 1))); level++)
+		;
+	slot = &wheel[level][(t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	wheel_count[level]++;
+	t->level = level;
+
+	t->next = *slot;
+	if (t->next != NULL)
+		t->next->pprev = &t->next;
+	t->pprev = slot;
+	*slot = t;
+}
+
+static void wheel_unlink (struct timer *t)
+{
+	wheel_count[t->level]--;
+	*t->pprev = t->next;
+	if (t->next != NULL)
+		t->next->pprev = t->pprev;
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+void timer_init (struct timer *t, void (*func) (void *arg), void *arg)
+{
+	t->next = NULL;
+	t->pprev = NULL;
+	t->expires = 0;
+	t->func = func;
+	t->arg = arg;
+}
+
+void timer_add (struct timer *t, unsigned int ms)
+{
+	wheel_start ();
+	if (t->pprev != NULL)
+		wheel_unlink (t);
+	//Round up so it never runs early, the current tick is already partly gone
+	t->expires = now_ticks () + ms / TIMER_TICK_MS + 1;
+	wheel_insert (t);
+}
+
+void timer_cancel (struct timer *t)
+{
+	if (t->pprev != NULL)
+		wheel_unlink (t);
+}
+
+int timer_pending (const struct timer *t)
+{
+	return t->pprev != NULL;
+}
+
+//Moves everything in a slot of a higher level down to where it belongs now
+static void cascade (int level, int index)
+{
+	struct timer *t = wheel[level][index];
+	struct timer *next;
+
+	wheel[level][index] = NULL;
+	for (; t != NULL; t = next)
+	{
+		next = t->next;
+		wheel_count[level]--;
+		wheel_insert (t);
+	}
+}
+
+void timer_run (void)
+{
+	unsigned long target;
+	struct timer *t;
+	int level;
+
+	wheel_start ();
+	target = now_ticks ();
+
+	while ((long) (target - wheel_now) > 0)
+	{
+		//Nothing pending, so there's nothing to step through
+		if (wheel_count[0] + wheel_count[1] + wheel_count[2] + wheel_count[3] == 0)
+		{
+			wheel_now = target;
+			break;
+		}
+
+		wheel_now++;
+		for (level = WHEEL_LEVELS - 1; level > 0; level--)
+		{
+			if ((wheel_now & ((1UL << (WHEEL_BITS * level)) - 1)) == 0)
+				cascade (level, (wheel_now >> (WHEEL_BITS * level)) & WHEEL_MASK);
+		}
+
+		//Callbacks may add or cancel timers, including ones in this slot
+		while ((t = wheel[0][wheel_now & WHEEL_MASK]) != NULL)
+		{
+			wheel_unlink (t);
+			t->func (t->arg);
+		}
+	}
+}
+
+int timer_next_ms (void)
+{
+	unsigned long due = 0;
+	unsigned long boundary;
+	unsigned long now;
+	int i;
+
+	if (wheel_count[0] + wheel_count[1] + wheel_count[2] + wheel_count[3] == 0)
+		return -1;
+
+	for (i = 1; i <= WHEEL_SIZE && wheel_count[0] > 0; i++)
+	{
+		if (wheel[0][(wheel_now + i) & WHEEL_MASK] != NULL)
+		{
+			due = wheel_now + i;
+			break;
+		}
+	}
+
+	//Timers further out may come down a level before then
+	boundary = ((wheel_now >> WHEEL_BITS) + 1) << WHEEL_BITS;
+	if (wheel_count[1] + wheel_count[2] + wheel_count[3] > 0 && (due == 0 || (long) (boundary - due) < 0))
+		due = boundary;
+
+	now = now_ticks ();
+	if ((long) (due - now) <= 0)
+		return 0;
+	return (due - now) * TIMER_TICK_MS;
+}
@@ -0,0 +1,44 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+/*
+   Timers run from the event loop, so a delayed action never blocks it.
+
+   Timers live in a hierarchical wheel with a 10ms tick: four levels of 64
+   slots each, the first covering the next 640ms and every level after it
+   64 times more, up to about 46 hours. Adding and cancelling are O(1),
+   timers further out are moved down a level as their time gets close.
+
+   struct timer is owned by the caller and must stay around while it's
+   pending. Everything here is only to be used from the loop thread.
+*/
+
+#define TIMER_TICK_MS	10
+
+struct timer {
+	struct timer *next;
+	struct timer **pprev;	//NULL when the timer isn't pending
+	unsigned long expires;	//In ticks
+	int level;
+	void (*func) (void *arg);
+	void *arg;
+};
+
+void timer_init (struct timer *t, void (*func) (void *arg), void *arg);
+
+//(Re)schedules t to run in ms milliseconds
+void timer_add (struct timer *t, unsigned int ms);
+void timer_cancel (struct timer *t);
+int timer_pending (const struct timer *t);
+
+//Monotonic clock in milliseconds, for anything that needs to measure time between events
+unsigned long timer_now_ms (void);
+unsigned long timer_now_us (void);
+
+//Milliseconds until the loop should call timer_run again, -1 if nothing is pending
+int timer_next_ms (void);
+
+//Runs every timer that is due
+void timer_run (void);
+
+#endif
@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+
+struct trace_event {
+	const char *name;
+	unsigned long start;
+	unsigned long end;
+	unsigned int line;
+};
+
+struct trace_ring {
+	struct trace_ring *next;
+	unsigned int tid;
+	char name[32];
+	unsigned long head;	//Events ever recorded, the newest is at (head - 1) % TRACE_EVENTS
+	struct trace_event events[TRACE_EVENTS];
+};
+
+int trace_enabled;
+
+static char trace_path[1024];
+static int signal_fd = -1;
+
+static struct trace_ring *rings;
+static unsigned int next_tid;
+static unsigned int next_line;
+
+static __thread struct trace_ring *mine;
+static __thread unsigned int current_line;
+static __thread unsigned long mark;
+
+unsigned long trace_clock (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static struct trace_ring *ring (void)
+{
+	struct trace_ring *r = mine;
+
+	if (r != NULL || !trace_enabled)
+		return r;
+	r = calloc (1, sizeof(*r));
+	if (r == NULL)
+		return NULL;
+	r->tid = __atomic_add_fetch (&next_tid, 1, __ATOMIC_RELAXED);
+
+	//Never freed, so trace_dump can walk the list while threads are still adding to it
+	r->next = __atomic_load_n (&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n (&rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	mine = r;
+	return r;
+}
+
+void trace_record (const char *name, unsigned long start, unsigned long end)
+{
+	struct trace_ring *r = ring ();
+	struct trace_event *ev;
+
+	if (r == NULL)
+		return;
+	//Only this thread writes the ring, the stores are atomic so a dump can read it meanwhile
+	ev = &r->events[r->head % TRACE_EVENTS];
+	__atomic_store_n (&ev->name, name, __ATOMIC_RELAXED);
+	__atomic_store_n (&ev->start, start, __ATOMIC_RELAXED);
+	__atomic_store_n (&ev->end, end, __ATOMIC_RELAXED);
+	__atomic_store_n (&ev->line, current_line, __ATOMIC_RELAXED);
+	__atomic_store_n (&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+unsigned int trace_new_line (void)
+{
+	if (!trace_enabled)
+		return 0;
+	current_line = __atomic_add_fetch (&next_line, 1, __ATOMIC_RELAXED);
+	return current_line;
+}
+
+unsigned int trace_line (void)
+{
+	return current_line;
+}
+
+void trace_set_line (unsigned int line)
+{
+	current_line = line;
+}
+
+void trace_set_mark (unsigned long start)
+{
+	mark = start;
+}
+
+unsigned long trace_mark (void)
+{
+	return mark;
+}
+
+void trace_thread (const char *name)
+{
+	struct trace_ring *r = ring ();
+
+	if (r != NULL)
+		snprintf (r->name, sizeof(r->name), "%s", name);
+}
+
+int trace_start (const char *path, int sig)
+{
+	sigset_t mask;
+
+	if (strlen (path) >= sizeof(trace_path))
+		return -1;
+	strcpy (trace_path, path);
+	trace_enabled = 1;
+
+	sigemptyset (&mask);
+	sigaddset (&mask, sig);
+	if (pthread_sigmask (SIG_BLOCK, &mask, NULL) != 0)
+		return -1;
+	signal_fd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	return signal_fd;
+}
+
+void trace_signalled (void *arg)
+{
+	struct signalfd_siginfo info;
+
+	while (read (signal_fd, &info, sizeof(info)) == sizeof(info))
+		;
+	trace_dump ();
+}
+
+static unsigned long dump_ring (FILE *out, struct trace_ring *r, int *first)
+{
+	const struct trace_event *ev;
+	unsigned long head = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+	unsigned long i = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+	unsigned long start;
+	unsigned long end;
+	unsigned long n = 0;
+
+	if (r->name[0] != '\0')
+	{
+		fprintf (out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				*first ? "" : ",\n", (int) getpid (), r->tid, r->name);
+		*first = 0;
+	}
+	//The oldest few may be overwritten while we read them, that only costs a span or two
+	for (; i < head; i++)
+	{
+		ev = &r->events[i % TRACE_EVENTS];
+		start = __atomic_load_n (&ev->start, __ATOMIC_RELAXED);
+		end = __atomic_load_n (&ev->end, __ATOMIC_RELAXED);
+		fprintf (out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lu.%03lu,\"dur\":%lu.%03lu,\"pid\":%d,\"tid\":%u,\"args\":{\"line\":%u}}",
+				*first ? "" : ",\n", __atomic_load_n (&ev->name, __ATOMIC_RELAXED),
+				start / 1000, start % 1000, (end - start) / 1000, (end - start) % 1000,
+				(int) getpid (), r->tid, __atomic_load_n (&ev->line, __ATOMIC_RELAXED));
+		*first = 0;
+		n++;
+	}
+	return n;
+}
+
+int trace_dump (void)
+{
+	struct trace_ring *r;
+	char tmp[1040];
+	unsigned long n = 0;
+	int first = 1;
+	FILE *out;
+
+	if (!trace_enabled)
+		return 0;
+	snprintf (tmp, sizeof(tmp), "%s.tmp", trace_path);
+	out = fopen (tmp, "w");
+	if (out == NULL)
+	{
+		fprintf (stderr, "IRC: Error writing trace to %s\n", tmp);
+		return 1;
+	}
+
+	fprintf (out, "{\"traceEvents\":[\n");
+	for (r = __atomic_load_n (&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+		n += dump_ring (out, r, &first);
+	fprintf (out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	if (fclose (out) != 0 || rename (tmp, trace_path) != 0)
+	{
+		fprintf (stderr, "IRC: Error writing trace to %s\n", trace_path);
+		unlink (tmp);
+		return 1;
+	}
+	fprintf (stdout, "IRC: Wrote %lu trace events to %s\n", n, trace_path);
+	return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+   Optional tracing of where the time goes between reading a line and
+   writing the answer.
+
+   Each thread records spans into its own fixed-size ring, overwriting
+   the oldest once it is full, and trace_dump writes every ring out as
+   Chrome trace-event JSON (load it in chrome://tracing or Perfetto).
+   Every inbound channel line gets an id that is carried along with it,
+   onto the worker and into the outbound queue, so the spans for one
+   answer can be picked out of the rest.
+
+   Until trace_start is called, trace_begin is a load and a branch and
+   nothing else records anything.
+*/
+
+//Per thread, the oldest are overwritten
+#define TRACE_EVENTS	16384
+
+extern int trace_enabled;
+
+//Monotonic nanoseconds, the same clock as timer_now_us
+unsigned long trace_clock (void);
+void trace_record (const char *name, unsigned long start, unsigned long end);
+
+//Start of a span, 0 when tracing is off
+static inline unsigned long trace_begin (void)
+{
+	return __builtin_expect (trace_enabled, 0) ? trace_clock () : 0;
+}
+
+//name has to be a string literal, only the pointer is kept
+static inline void trace_end (const char *name, unsigned long start)
+{
+	if (start != 0)
+		trace_record (name, start, trace_clock ());
+}
+
+//Gives the calling thread a new inbound line id, and returns it
+unsigned int trace_new_line (void);
+//The line the calling thread is working on, for passing to another thread
+unsigned int trace_line (void);
+void trace_set_line (unsigned int line);
+
+//Where the last line stopped being handled, so the next one can see how long parsing took
+void trace_set_mark (unsigned long start);
+unsigned long trace_mark (void);
+
+//Names the calling thread in the trace
+void trace_thread (const char *name);
+
+//Turns tracing on, with trace_dump writing to path. Blocks sig in the calling
+//thread (and any thread it starts afterwards) and returns a signalfd for it, or -1
+int trace_start (const char *path, int sig);
+//For loop_watch on the signalfd, dumps the trace whenever the signal arrives
+void trace_signalled (void *arg);
+int trace_dump (void);
+
+#endif
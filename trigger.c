@@ -0,0 +1,582 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trigger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <regex.h>
+
+#define TRIGGER_LINE_MAX	1024
+//Not a state, only while the trie is being built
+#define TRIGGER_NONE		UINT32_MAX
+//Set in a transition to a state some trigger's text ends on
+#define TRIGGER_HIT		0x80000000u
+
+struct trigger {
+	char *reply;
+	char *text;		//Keyword, or the text a regex can't match without, in lower case
+	size_t len;
+	int regex;
+	regex_t re;
+	int next;		//Next trigger whose text ends on the same state, -1 for none
+};
+
+//One Aho-Corasick automaton, built out into a DFA. Transitions are kept as the offset of the
+//target's row, so a step is one load and an add, with TRIGGER_HIT set if anything ends there
+struct automaton {
+	uint8_t classes[256];
+	unsigned int nclasses;
+	uint32_t *delta;
+	unsigned int nstates;
+	int *first;		//First trigger ending on each state, -1 for none
+	uint32_t *out;		//Nearest state down the suffix chain, this one included, that ends a trigger
+	uint32_t *chain;	//And the next one down from there, 0 at the end
+};
+
+struct triggers {
+	struct trigger *list;
+	unsigned int count;
+	unsigned int size;
+	int compiled;
+
+	//Keywords, which only start where a word can
+	struct automaton words;
+	//The text regexes can't match without, which can turn up anywhere
+	struct automaton texts;
+
+	//Regexes to try after the scan, those whose text turned up and then those without any
+	unsigned int *candidates;
+	unsigned int *always;
+	unsigned int nalways;
+
+	//Marks a trigger already reported for this message, without clearing anything between them
+	unsigned int *stamp;
+	unsigned int generation;
+};
+
+static unsigned char fold (unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+//UTF-8 counts as letters, so only the ASCII around a keyword can end a word
+static int is_word (unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+static void end_run (const char *run, size_t run_len, char *out, size_t *best)
+{
+	if (run_len > *best)
+	{
+		memcpy (out, run, run_len);
+		*best = run_len;
+	}
+}
+
+//The longest run of text every match of an extended regex has to contain, folded to lower case.
+//Errs towards shorter runs, and returns 0 if there's none it can be sure of
+static size_t regex_text (const char *re, char *out)
+{
+	char run[TRIGGER_LINE_MAX];
+	size_t run_len = 0;
+	size_t best = 0;
+	int depth;
+
+	for (; *re != '\0'; re++)
+	{
+		switch (*re)
+		{
+			case '|':
+				//Either side could match on its own
+				return 0;
+			case '(':
+				end_run (run, run_len, out, &best);
+				run_len = 0;
+				for (depth = 1; depth > 0 && re[1] != '\0'; re++)
+				{
+					if (re[1] == '\\' && re[2] != '\0')
+						re++;
+					else if (re[1] == '(')
+						depth++;
+					else if (re[1] == ')')
+						depth--;
+				}
+				break;
+			case '[':
+				end_run (run, run_len, out, &best);
+				run_len = 0;
+				//A ] straight after the [ or [^ is part of the set
+				re += re[1] == '^' ? 2 : 1;
+				if (*re == ']')
+					re++;
+				while (*re != '\0' && *re != ']')
+					re++;
+				if (*re == '\0')
+					return best;
+				break;
+			case '*':
+			case '?':
+				//The character before is optional after all
+				if (run_len > 0)
+					run_len--;
+				end_run (run, run_len, out, &best);
+				run_len = 0;
+				break;
+			case '{':
+				if (re[1] == '0' || re[1] == ',')
+				{
+					if (run_len > 0)
+						run_len--;
+				}
+				end_run (run, run_len, out, &best);
+				run_len = 0;
+				while (*re != '\0' && *re != '}')
+					re++;
+				if (*re == '\0')
+					return best;
+				break;
+			case '+':
+			case '.':
+			case '^':
+			case '$':
+				end_run (run, run_len, out, &best);
+				run_len = 0;
+				break;
+			case '\\':
+				//\w, \b, back references and the like aren't text
+				if (re[1] == '\0' || is_word ((unsigned char) re[1]))
+				{
+					end_run (run, run_len, out, &best);
+					run_len = 0;
+					if (re[1] != '\0')
+						re++;
+					break;
+				}
+				re++;
+				run[run_len++] = fold (*re);
+				break;
+			default:
+				run[run_len++] = fold (*re);
+				break;
+		}
+	}
+	end_run (run, run_len, out, &best);
+	return best;
+}
+
+struct triggers *trigger_new (void)
+{
+	return calloc (1, sizeof(struct triggers));
+}
+
+int trigger_add (struct triggers *t, const char *pattern, int regex, const char *reply)
+{
+	char text[TRIGGER_LINE_MAX];
+	char error[128];
+	struct trigger *tr;
+	size_t len;
+	size_t i;
+	int ret;
+
+	if (t->compiled || strlen (pattern) >= sizeof(text))
+		return 1;
+	if (t->count == t->size)
+	{
+		tr = realloc (t->list, (t->size * 2 + 16) * sizeof(*tr));
+		if (tr == NULL)
+			return 1;
+		t->list = tr;
+		t->size = t->size * 2 + 16;
+	}
+	tr = &t->list[t->count];
+	memset (tr, 0, sizeof(*tr));
+
+	if (regex)
+	{
+		ret = regcomp (&tr->re, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+		if (ret != 0)
+		{
+			regerror (ret, &tr->re, error, sizeof(error));
+			fprintf (stderr, "Bad trigger regex %s: %s\n", pattern, error);
+			return 1;
+		}
+		len = regex_text (pattern, text);
+	}
+	else
+	{
+		len = strlen (pattern);
+		for (i = 0; i < len; i++)
+			text[i] = fold (pattern[i]);
+		if (len == 0)
+			return 1;
+	}
+
+	tr->regex = regex;
+	tr->len = len;
+	tr->text = malloc (len + 1);
+	tr->reply = strdup (reply);
+	if (tr->text == NULL || tr->reply == NULL)
+	{
+		if (regex)
+			regfree (&tr->re);
+		free (tr->text);
+		free (tr->reply);
+		return 1;
+	}
+	memcpy (tr->text, text, len);
+	tr->text[len] = '\0';
+	t->count++;
+	return 0;
+}
+
+/*
+   States 0 and 1 are the two roots: 0 for when the last byte didn't end
+   in a word (and the start of the text), 1 for the middle of a word. In
+   an anchored automaton a trigger starting with a letter can only begin
+   from 0, so the rest of a word that doesn't start a keyword is read
+   sitting in 1 instead of wandering the trie, which keeps the rows in
+   use few enough to stay in cache. Without anchoring, 1 is never reached
+   and this is plain Aho-Corasick.
+*/
+static int build (struct automaton *a, struct triggers *t, int regex, int anchored)
+{
+	uint32_t *fail = NULL;
+	uint32_t *queue = NULL;
+	uint8_t word[256];
+	unsigned int max_states = 2;
+	unsigned int head = 0;
+	unsigned int tail = 0;
+	unsigned int i;
+	uint32_t s;
+	uint32_t u;
+	size_t j;
+	size_t c;
+
+	//Every byte a trigger's text has gets a class of its own, the rest share 0, or 1 for letters
+	a->nclasses = 2;
+	for (i = 0; i < t->count; i++)
+	{
+		if (t->list[i].regex != regex)
+			continue;
+		max_states += t->list[i].len;
+		for (j = 0; j < t->list[i].len; j++)
+		{
+			c = (unsigned char) t->list[i].text[j];
+			if (a->classes[c] == 0)
+				a->classes[c] = a->nclasses++;
+		}
+	}
+	memset (word, 0, sizeof(word));
+	for (c = 0; c < 256; c++)
+	{
+		a->classes[c] = a->classes[fold (c)];
+		if (a->classes[c] == 0 && anchored && is_word (c))
+			a->classes[c] = 1;
+		word[a->classes[c]] = anchored && is_word (c);
+	}
+	if ((uint64_t) max_states * a->nclasses >= TRIGGER_HIT)
+		return 1;
+
+	a->delta = malloc ((size_t) max_states * a->nclasses * sizeof(*a->delta));
+	a->first = malloc (max_states * sizeof(*a->first));
+	a->out = calloc (max_states, sizeof(*a->out));
+	a->chain = calloc (max_states, sizeof(*a->chain));
+	fail = calloc (max_states, sizeof(*fail));
+	queue = malloc (max_states * sizeof(*queue));
+	if (a->delta == NULL || a->first == NULL || a->out == NULL || a->chain == NULL || fail == NULL || queue == NULL)
+		goto fail;
+	for (j = 0; j < (size_t) max_states * a->nclasses; j++)
+		a->delta[j] = TRIGGER_NONE;
+	for (i = 0; i < max_states; i++)
+		a->first[i] = -1;
+
+	//The trie, hanging off root 0
+	a->nstates = 2;
+	for (i = 0; i < t->count; i++)
+	{
+		struct trigger *tr = &t->list[i];
+
+		if (tr->regex != regex || tr->len == 0)
+			continue;
+		s = 0;
+		for (j = 0; j < tr->len; j++)
+		{
+			c = a->classes[(unsigned char) tr->text[j]];
+			if (a->delta[s * a->nclasses + c] == TRIGGER_NONE)
+				a->delta[s * a->nclasses + c] = a->nstates++;
+			s = a->delta[s * a->nclasses + c];
+		}
+		tr->next = a->first[s];
+		a->first[s] = i;
+	}
+
+	//Root 1 can only start triggers that don't start with a letter
+	for (c = 0; c < a->nclasses; c++)
+	{
+		u = a->delta[c];
+		if (u != TRIGGER_NONE)
+		{
+			fail[u] = word[c];
+			queue[tail++] = u;
+		}
+		a->delta[c] = u != TRIGGER_NONE ? u : word[c];
+		a->delta[a->nclasses + c] = u != TRIGGER_NONE && !word[c] ? u : word[c];
+	}
+
+	//Breadth first, so every state's suffix has its row filled in before it's needed
+	while (head < tail)
+	{
+		s = queue[head++];
+		a->out[s] = a->first[s] >= 0 ? s : a->out[fail[s]];
+		a->chain[s] = a->out[fail[s]];
+		for (c = 0; c < a->nclasses; c++)
+		{
+			u = a->delta[s * a->nclasses + c];
+			if (u == TRIGGER_NONE)
+				a->delta[s * a->nclasses + c] = a->delta[fail[s] * a->nclasses + c];
+			else
+			{
+				fail[u] = a->delta[fail[s] * a->nclasses + c];
+				queue[tail++] = u;
+			}
+		}
+	}
+
+	//From states to row offsets, flagging the states something ends on
+	for (j = 0; j < (size_t) a->nstates * a->nclasses; j++)
+	{
+		u = a->delta[j];
+		a->delta[j] = u * a->nclasses | (a->out[u] != 0 ? TRIGGER_HIT : 0);
+	}
+	free (fail);
+	free (queue);
+	return 0;
+
+fail:
+	free (fail);
+	free (queue);
+	return 1;
+}
+
+static void free_automaton (struct automaton *a)
+{
+	free (a->delta);
+	free (a->first);
+	free (a->out);
+	free (a->chain);
+}
+
+int trigger_compile (struct triggers *t)
+{
+	unsigned int i;
+
+	if (t->compiled)
+		return 1;
+	t->compiled = 1;
+
+	t->candidates = malloc ((t->count + 1) * sizeof(*t->candidates));
+	t->always = malloc ((t->count + 1) * sizeof(*t->always));
+	t->stamp = calloc (t->count + 1, sizeof(*t->stamp));
+	if (t->candidates == NULL || t->always == NULL || t->stamp == NULL)
+		return 1;
+	for (i = 0; i < t->count; i++)
+	{
+		if (t->list[i].len == 0)
+			t->always[t->nalways++] = i;
+	}
+	return build (&t->words, t, 0, 1) || build (&t->texts, t, 1, 0);
+}
+
+static int whole_word (const struct trigger *tr, const char *text, size_t len, size_t end)
+{
+	size_t start = end + 1 - tr->len;
+
+	if (start > 0 && is_word (text[start]) && is_word (text[start - 1]))
+		return 0;
+	if (end + 1 < len && is_word (text[end]) && is_word (text[end + 1]))
+		return 0;
+	return 1;
+}
+
+//Everything ending on state, the offset of its row in a. Returns 1 once hits is full
+static int report (struct triggers *t, const struct automaton *a, uint32_t state, const char *text, size_t len,
+		size_t pos, unsigned int *hits, int *n, int max, unsigned int *ncandidates)
+{
+	struct trigger *tr;
+	uint32_t m;
+	int id;
+
+	for (m = a->out[state / a->nclasses]; m != 0; m = a->chain[m])
+	{
+		for (id = a->first[m]; id >= 0; id = tr->next)
+		{
+			tr = &t->list[id];
+			if (t->stamp[id] == t->generation)
+				continue;
+			if (tr->regex)
+			{
+				t->stamp[id] = t->generation;
+				t->candidates[(*ncandidates)++] = id;
+			}
+			//The start is a word boundary already, or the automaton wouldn't have got here
+			else if (whole_word (tr, text, len, pos))
+			{
+				t->stamp[id] = t->generation;
+				hits[(*n)++] = id;
+				if (*n == max)
+					return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+int trigger_match (struct triggers *t, const char *text, size_t len, unsigned int *hits, int max)
+{
+	const uint32_t *words = t->words.delta;
+	const uint32_t *texts = t->texts.delta;
+	const uint8_t *word_classes = t->words.classes;
+	const uint8_t *text_classes = t->texts.classes;
+	unsigned int ncandidates = 0;
+	unsigned int i;
+	uint32_t ws = 0;
+	uint32_t ts = 0;
+	uint32_t v;
+	size_t pos;
+	int regexes = t->texts.nstates > 2;
+	int n = 0;
+
+	if (words == NULL || texts == NULL || max <= 0)
+		return 0;
+	if (++t->generation == 0)
+	{
+		memset (t->stamp, 0, t->count * sizeof(*t->stamp));
+		t->generation = 1;
+	}
+
+	for (pos = 0; pos < len; pos++)
+	{
+		v = words[ws + word_classes[(unsigned char) text[pos]]];
+		ws = v & ~TRIGGER_HIT;
+		if ((v & TRIGGER_HIT) && report (t, &t->words, ws, text, len, pos, hits, &n, max, &ncandidates))
+			return n;
+		if (!regexes)
+			continue;
+		v = texts[ts + text_classes[(unsigned char) text[pos]]];
+		ts = v & ~TRIGGER_HIT;
+		if ((v & TRIGGER_HIT) && report (t, &t->texts, ts, text, len, pos, hits, &n, max, &ncandidates))
+			return n;
+	}
+
+	for (i = 0; i < ncandidates && n < max; i++)
+	{
+		if (regexec (&t->list[t->candidates[i]].re, text, 0, NULL, 0) == 0)
+			hits[n++] = t->candidates[i];
+	}
+	for (i = 0; i < t->nalways && n < max; i++)
+	{
+		if (regexec (&t->list[t->always[i]].re, text, 0, NULL, 0) == 0)
+			hits[n++] = t->always[i];
+	}
+	return n;
+}
+
+struct triggers *trigger_load (const char *path)
+{
+	char line[TRIGGER_LINE_MAX];
+	struct triggers *t;
+	FILE *in;
+	char *reply;
+	char *end;
+	int regex;
+	int n = 0;
+
+	in = fopen (path, "r");
+	if (in == NULL)
+	{
+		fprintf (stderr, "Error opening trigger file %s\n", path);
+		return NULL;
+	}
+	t = trigger_new ();
+	if (t == NULL)
+	{
+		fclose (in);
+		return NULL;
+	}
+
+	while (fgets (line, sizeof(line), in) != NULL)
+	{
+		n++;
+		line[strcspn (line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		regex = line[0] == '/';
+		end = regex ? strstr (line + 1, "/=") : strchr (line, '=');
+		if (end == NULL || end == line + regex || end[regex + 1] == '\0')
+		{
+			fprintf (stderr, "Bad trigger on line %d of %s\n", n, path);
+			goto fail;
+		}
+		reply = end + regex + 1;
+		*end = '\0';
+		if (trigger_add (t, line + regex, regex, reply))
+		{
+			fprintf (stderr, "Bad trigger on line %d of %s\n", n, path);
+			goto fail;
+		}
+	}
+	fclose (in);
+
+	if (trigger_compile (t))
+	{
+		fprintf (stderr, "Error building the triggers from %s\n", path);
+		trigger_free (t);
+		return NULL;
+	}
+	return t;
+
+fail:
+	fclose (in);
+	trigger_free (t);
+	return NULL;
+}
+
+void trigger_free (struct triggers *t)
+{
+	unsigned int i;
+
+	if (t == NULL)
+		return;
+	for (i = 0; i < t->count; i++)
+	{
+		if (t->list[i].regex)
+			regfree (&t->list[i].re);
+		free (t->list[i].text);
+		free (t->list[i].reply);
+	}
+	free (t->list);
+	free_automaton (&t->words);
+	free_automaton (&t->texts);
+	free (t->candidates);
+	free (t->always);
+	free (t->stamp);
+	free (t);
+}
+
+const char *trigger_reply (const struct triggers *t, unsigned int hit)
+{
+	return t->list[hit].reply;
+}
+
+unsigned int trigger_count (const struct triggers *t)
+{
+	return t->count;
+}
+
+unsigned int trigger_states (const struct triggers *t)
+{
+	return t->words.nstates + t->texts.nstates;
+}
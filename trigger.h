@@ -0,0 +1,58 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stddef.h>
+
+/*
+   Triggers ircbot answers channel messages with.
+
+   A trigger file has one "pattern=reply" per line, and # comments:
+
+	hello there=Hi!
+	/^!rules( |$)/=Be nice, and no spoilers
+
+   A plain pattern is a keyword or phrase, matched as whole words without
+   case. One between slashes is a POSIX extended regex, also matched
+   without case, and its reply starts after the first "/=".
+
+   Every keyword goes into one Aho-Corasick automaton, built out into a
+   full DFA over the classes of bytes the patterns use, so a message is
+   scanned once with a single table lookup per byte however many
+   triggers there are. As keywords start at the start of a word, the
+   automaton only looks for them there, and skips over the rest of any
+   word that doesn't begin one. Each regex puts the longest run of text
+   it can't match without into a second automaton run in the same pass,
+   and regexec only runs for the regexes whose text turned up. One
+   without any such text (an alternation at the top, or nothing but
+   classes) is tried on every message, so it costs as much as all the
+   rest.
+
+   Matching keeps per-trigger state to not report a trigger twice, so a
+   set of triggers is only to be used from one thread at a time.
+*/
+
+//Most triggers one message can fire
+#define TRIGGER_MAX_HITS	4
+
+struct triggers;
+
+//NULL if the file can't be read or has a bad line, which is reported
+struct triggers *trigger_load (const char *path);
+void trigger_free (struct triggers *t);
+
+//Adds one trigger, for building a set without a file. Returns 0 on success
+struct triggers *trigger_new (void);
+int trigger_add (struct triggers *t, const char *pattern, int regex, const char *reply);
+//Builds the automaton, after which nothing more can be added
+int trigger_compile (struct triggers *t);
+
+//Fills hits with up to max triggers text fires, keywords in the order they end in it and then
+//regexes, and returns how many. text has to be NUL terminated at len, for regexec
+int trigger_match (struct triggers *t, const char *text, size_t len, unsigned int *hits, int max);
+
+const char *trigger_reply (const struct triggers *t, unsigned int hit);
+unsigned int trigger_count (const struct triggers *t);
+//Automaton states, for the curious
+unsigned int trigger_states (const struct triggers *t);
+
+#endif